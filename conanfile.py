@@ -8,8 +8,10 @@ class Small3dConan(ConanFile):
                   "(C++, OpenGL, GLFW) - runs on Win/MacOS/Linux"
     generators = "cmake"
     settings = "os", "arch", "build_type", "compiler"
-    options = {"development": [True, False]}
-    default_options = "gtest:shared=False", "development=False"
+    options = {"development": [True, False], "headless": [True, False],
+               "trace": [True, False]}
+    default_options = "gtest:shared=False", "development=False", \
+                      "headless=False", "trace=False"
     url="http://github.com/dimi309/conan-packages"
     requires = "glfw/3.2.1@bincrafters/stable", \
                "freetype/2.8.1@bincrafters/stable", "glm/0.9.8.5@g-truc/stable",\
@@ -43,6 +45,8 @@ class Small3dConan(ConanFile):
         
         cmake = CMake(self)
         cmake.definitions['BUILD_TESTS'] = self.options.development
+        cmake.definitions['SMALL3D_HEADLESS'] = self.options.headless
+        cmake.definitions['SMALL3D_TRACE'] = self.options.trace
         cmake.configure()
         cmake.build()
 
@@ -69,6 +73,11 @@ class Small3dConan(ConanFile):
             
     def package_info(self):
         self.cpp_info.libs = ['small3d']
+        if self.options.headless:
+            self.cpp_info.defines.append("SMALL3D_HEADLESS")
+            self.cpp_info.libs.append("EGL")
+        if self.options.trace:
+            self.cpp_info.defines.append("SMALL3D_TRACE")
         if self.settings.os == "Windows":
             if self.settings.compiler == "Visual Studio":
                 self.cpp_info.cppflags.append("/EHsc")
@@ -13,6 +13,7 @@
 #include <memory>
 #include "Logger.hpp"
 #include <vector>
+#include <cstdint>
 #include <glm/glm.hpp>
 
 namespace small3d {
@@ -26,7 +27,41 @@ namespace small3d {
   class BoundingBoxSet {
   private:
     int numBoxes;
+    glm::vec3 setMinCoords, setMaxCoords;
+
+    // Box extents in box set space (one element per box), precalculated
+    // when loading, in separate arrays so that all the boxes can be checked
+    // in a single vectorisable loop.
+    std::vector<float> boxMinX, boxMaxX, boxMinY, boxMaxY, boxMinZ, boxMaxZ;
+
+    // Bounding spheres, for early outs, of each box and of the whole set
+    std::vector<float> boxRadius;
+    glm::vec3 setCentre;
+    float setRadius;
+
+    // The vertices, as a contiguous array
+    std::vector<glm::vec3> flatVertices;
+
     void loadFromFile(std::string fileLocation);
+    bool collidesInBoxSpace(const glm::vec3 &point) const;
+
+    // Find the first box hit by a line moving from start to
+    // start + maxTime * direction, in box set space. axis is the axis of the
+    // side that is hit, or -1 if the line starts inside the box.
+    bool findFirstBoxHit(const glm::vec3 &start, const glm::vec3 &direction,
+			 const float maxTime, float &time, int &axis) const;
+
+    size_t findCollidingPoints(const float *x, const float *y,
+			       const float *z, const size_t stride,
+			       const size_t numPoints,
+			       const glm::vec3 &thisOffset,
+			       const glm::vec3 &thisRotation,
+			       uint64_t *collisionMask) const;
+
+    bool castRay(const glm::vec3 &origin, const glm::vec3 &direction,
+		 const glm::vec3 &thisOffset, const glm::vec3 &thisRotation,
+		 const float maxDistance, float &distance,
+		 glm::vec3 &normal) const;
     
   public:
 
@@ -51,7 +86,9 @@ namespace small3d {
     ~BoundingBoxSet() = default;
 
     /**
-     * @brief Vertex coordinates read from Wavefront .obj file
+     * @brief Vertex coordinates read from Wavefront .obj file. Collision
+     *        detection uses data precalculated from these when the file is
+     *        loaded, so modifying them afterwards has no effect.
      */
 
     std::vector<std::vector<float> > vertices;
@@ -75,6 +112,65 @@ namespace small3d {
     bool collidesWith(const glm::vec3 point, const glm::vec3 thisOffset,
       const glm::vec3 thisRotation) const;
 
+    /**
+     * @brief Check if any of a number of points collides with (or is inside)
+     *        any of the boxes of the box set, assuming that they are in a
+     *        given offset and have a certain rotation. The rotation is only
+     *        calculated once for all the points and no memory is allocated.
+     * @param points       Pointer to the first point
+     * @param numPoints    The number of points
+     * @param thisOffset   The offset (location) of the box set
+     * @param thisRotation The rotation of the box set
+     * @return True if there is a collision, False if not.
+     */
+
+    bool collidesWith(const glm::vec3 *points, const size_t numPoints,
+		      const glm::vec3 thisOffset,
+		      const glm::vec3 thisRotation) const;
+
+    /**
+     * @brief Find which ones of a number of points collide with (or are
+     *        inside) any of the boxes of the box set, assuming that they are
+     *        in a given offset and have a certain rotation. The points are
+     *        transformed to the space of the box set once and checked in
+     *        batches, which is much faster than checking them one by one.
+     * @param points              Pointer to the first point
+     * @param numPoints           The number of points
+     * @param thisOffset          The offset (location) of the box set
+     * @param thisRotation        The rotation of the box set
+     * @param [out] collisionMask Array of at least (numPoints + 63) / 64
+     *                            elements. Bit i % 64 of element i / 64 is
+     *                            set if point i collides and cleared if not.
+     * @return The number of points that collide
+     */
+
+    size_t findCollidingPoints(const glm::vec3 *points,
+			       const size_t numPoints,
+			       const glm::vec3 thisOffset,
+			       const glm::vec3 thisRotation,
+			       uint64_t *collisionMask) const;
+
+    /**
+     * @brief Same as the previous function, but for points stored as separate
+     *        arrays of x, y and z coordinates.
+     * @param x                   The x coordinates of the points
+     * @param y                   The y coordinates of the points
+     * @param z                   The z coordinates of the points
+     * @param numPoints           The number of points
+     * @param thisOffset          The offset (location) of the box set
+     * @param thisRotation        The rotation of the box set
+     * @param [out] collisionMask Array of at least (numPoints + 63) / 64
+     *                            elements. Bit i % 64 of element i / 64 is
+     *                            set if point i collides and cleared if not.
+     * @return The number of points that collide
+     */
+
+    size_t findCollidingPoints(const float *x, const float *y,
+			       const float *z, const size_t numPoints,
+			       const glm::vec3 thisOffset,
+			       const glm::vec3 thisRotation,
+			       uint64_t *collisionMask) const;
+
     /**
      * @brief Check if another set of bounding boxes is located with this set
      *        (even partially), thus colliding with it.
@@ -86,11 +182,127 @@ namespace small3d {
      * @return True if there is a collision, False if not.
      */
 
-    bool collidesWith(const BoundingBoxSet otherBoxSet,
+    bool collidesWith(const BoundingBoxSet &otherBoxSet,
 		      const glm::vec3 thisOffset,
 		      const glm::vec3 thisRotation,
 		      const glm::vec3 otherOffset,
 		      const glm::vec3 otherRotation) const;
 
+    /**
+     * @brief Check if another set of bounding boxes overlaps with this set,
+     *        treating each box as an oriented box and using the separating
+     *        axis test. Contrary to the collidesWith function, which checks
+     *        if any corners of the boxes of one set are inside the boxes of
+     *        the other, this also detects boxes crossing each other without
+     *        any corners inside (for example two thin boxes forming a cross).
+     *        Both sets are checked in a single pass.
+     * @param otherBoxSet   The other box set
+     * @param thisOffset    The offset (location) of this box set
+     * @param thisRotation  The rotation of this box set
+     * @param otherOffset   The offset (location) of the other box set
+     * @param otherRotation The rotation of the other box set
+     * @return True if there is an overlap, False if not.
+     */
+
+    bool intersects(const BoundingBoxSet &otherBoxSet,
+		    const glm::vec3 thisOffset,
+		    const glm::vec3 thisRotation,
+		    const glm::vec3 otherOffset,
+		    const glm::vec3 otherRotation) const;
+
+    /**
+     * @brief Check if a line segment (for example the path of a fast moving
+     *        projectile during a frame) crosses any of the boxes of the set,
+     *        assuming that they are in a given offset and have a certain
+     *        rotation.
+     * @param start              The start of the segment
+     * @param end                The end of the segment
+     * @param thisOffset         The offset (location) of the box set
+     * @param thisRotation       The rotation of the box set
+     * @param [out] timeOfImpact Where the segment first touches a box, from
+     *                           0 (start) to 1 (end)
+     * @param [out] normal       The normal (in world space) of the side of the
+     *                           box that is touched. If the segment starts
+     *                           inside a box, this points back along the
+     *                           segment.
+     * @return True if the segment touches a box, False if not.
+     */
+
+    bool intersectsSegment(const glm::vec3 start, const glm::vec3 end,
+			   const glm::vec3 thisOffset,
+			   const glm::vec3 thisRotation,
+			   float &timeOfImpact, glm::vec3 &normal) const;
+
+    /**
+     * @brief Cast a ray against the boxes of the set, assuming that they are
+     *        in a given offset and have a certain rotation (for example for
+     *        line of sight checks).
+     * @param origin         The origin of the ray
+     * @param direction      The direction of the ray
+     * @param thisOffset     The offset (location) of the box set
+     * @param thisRotation   The rotation of the box set
+     * @param [out] distance The distance from the origin to the first box
+     *                       hit, in multiples of the length of direction
+     * @param [out] normal   The normal (in world space) of the side of the
+     *                       box that is hit. If the ray starts inside a box,
+     *                       this points back along the ray.
+     * @return True if the ray hits a box, False if not.
+     */
+
+    bool intersectsRay(const glm::vec3 origin, const glm::vec3 direction,
+		       const glm::vec3 thisOffset,
+		       const glm::vec3 thisRotation,
+		       float &distance, glm::vec3 &normal) const;
+
+    /**
+     * @brief Swept (continuous) version of intersects. Both box sets move
+     *        linearly from a start to an end offset and rotation (for
+     *        example their positions in the previous and in the current
+     *        frame) and the time at which they first touch is found, so that
+     *        fast moving sets cannot pass through each other unnoticed.
+     *        Rotation is handled in steps of at most 0.05 radians, during
+     *        which it is considered constant.
+     * @param otherBoxSet        The other box set
+     * @param thisStartOffset    The start offset of this box set
+     * @param thisStartRotation  The start rotation of this box set
+     * @param thisEndOffset      The end offset of this box set
+     * @param thisEndRotation    The end rotation of this box set
+     * @param otherStartOffset   The start offset of the other box set
+     * @param otherStartRotation The start rotation of the other box set
+     * @param otherEndOffset     The end offset of the other box set
+     * @param otherEndRotation   The end rotation of the other box set
+     * @param [out] timeOfImpact When the sets first touch, from 0 (start) to
+     *                           1 (end)
+     * @param [out] normal       The contact normal, in world space, pointing
+     *                           from this set towards the other one
+     * @return True if the sets touch during the movement, False if not.
+     */
+
+    bool intersectsDuring(const BoundingBoxSet &otherBoxSet,
+			  const glm::vec3 thisStartOffset,
+			  const glm::vec3 thisStartRotation,
+			  const glm::vec3 thisEndOffset,
+			  const glm::vec3 thisEndRotation,
+			  const glm::vec3 otherStartOffset,
+			  const glm::vec3 otherStartRotation,
+			  const glm::vec3 otherEndOffset,
+			  const glm::vec3 otherEndRotation,
+			  float &timeOfImpact, glm::vec3 &normal) const;
+
+    /**
+     * @brief Get the axis-aligned box, in world space, that encloses all the
+     *        boxes of the set, assuming that they are in a given offset and
+     *        have a certain rotation. This is conservative (the enclosing box
+     *        of the rotated set extents) and is meant for broad-phase checks.
+     * @param thisOffset        The offset (location) of the box set
+     * @param thisRotation      The rotation of the box set
+     * @param [out] minCoords   The minimum x, y and z world coordinates
+     * @param [out] maxCoords   The maximum x, y and z world coordinates
+     */
+
+    void getWorldExtents(const glm::vec3 thisOffset,
+			 const glm::vec3 thisRotation,
+			 glm::vec3 &minCoords, glm::vec3 &maxCoords) const;
+
   };
 }
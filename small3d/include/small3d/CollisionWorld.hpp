@@ -0,0 +1,130 @@
+/**
+ * @file  CollisionWorld.hpp
+ * @brief Header of the CollisionWorld class
+ *
+ *  Created on: 2026/10/19
+ *      Author: Dimitri Kourkoulis
+ *     License: BSD 3-Clause License (see LICENSE file)
+ */
+
+#pragma once
+
+#include <vector>
+#include <utility>
+#include "SceneObject.hpp"
+#include "JobSystem.hpp"
+#include <glm/glm.hpp>
+
+namespace small3d {
+
+  /**
+   * @class CollisionWorld
+   *
+   * @brief Broad-phase collision detection over many SceneObjects. The world
+   *        keeps a world-space axis-aligned box for the bounding box set of
+   *        each registered object and, on every update, finds the pairs of
+   *        objects whose boxes overlap. Only these candidate pairs need to be
+   *        checked by the (more expensive) SceneObject::collidesWith function.
+   *
+   *        The objects are kept sorted along a Morton (Z-order) curve, which
+   *        is close to sorted from one update to the next, so it is sorted
+   *        incrementally. A balanced box tree is refitted over the sorted
+   *        objects on each update and every object is checked against it.
+   */
+
+  class CollisionWorld {
+  private:
+
+    struct Proxy {
+      SceneObject *sceneObject;
+      glm::vec3 minCoords;
+      glm::vec3 maxCoords;
+      unsigned int mortonCode;
+    };
+
+    std::vector<Proxy> proxies;
+
+    // Proxy indexes, sorted on their Morton code. The order is kept between
+    // updates.
+    std::vector<size_t> sortedProxies;
+
+    // Implicit tree (node n has children 2n and 2n + 1) over the sorted
+    // proxies. Leaves start at numLeafSlots.
+    size_t numLeafSlots;
+    std::vector<glm::vec3> nodeMinCoords;
+    std::vector<glm::vec3> nodeMaxCoords;
+
+    std::vector<std::pair<SceneObject*, SceneObject*> > candidatePairs;
+
+    void sortProxies();
+    void buildTree();
+
+  public:
+
+    /**
+     * @brief Constructor
+     */
+    CollisionWorld();
+
+    /**
+     * @brief Destructor
+     */
+    ~CollisionWorld() = default;
+
+    /**
+     * @brief Register a SceneObject with the world. The object is referenced,
+     *        not copied, so it has to remain alive (and at the same memory
+     *        location) until it is removed from the world.
+     * @param sceneObject The object. It must have a bounding box set.
+     */
+    void add(SceneObject &sceneObject);
+
+    /**
+     * @brief Remove a SceneObject from the world.
+     * @param sceneObject The object
+     */
+    void remove(const SceneObject &sceneObject);
+
+    /**
+     * @brief Get the number of objects registered with the world.
+     * @return The number of objects
+     */
+    size_t getNumObjects() const;
+
+    /**
+     * @brief Recalculate the world-space boxes of all objects from their
+     *        current offset and rotation and find the candidate pairs. This
+     *        is to be called once per tick, after the objects have moved.
+     */
+    void update();
+
+    /**
+     * @brief Get the pairs of objects whose world-space boxes overlapped
+     *        during the last update.
+     * @return The candidate pairs
+     */
+    const std::vector<std::pair<SceneObject*, SceneObject*> >&
+    getCandidatePairs() const;
+
+    /**
+     * @brief Run the narrow phase (SceneObject::collidesWith) on the candidate
+     *        pairs found during the last update.
+     * @param [out] collisions The pairs of objects that collide
+     */
+    void getCollisions(std::vector<std::pair<SceneObject*, SceneObject*> >
+		       &collisions) const;
+
+    /**
+     * @brief Run the narrow phase (SceneObject::collidesWith) on the candidate
+     *        pairs found during the last update, splitting them between the
+     *        threads of a job system. The result is the same, and in the same
+     *        order, as when running on a single thread.
+     * @param [out] collisions The pairs of objects that collide
+     * @param jobSystem        The job system
+     */
+    void getCollisions(std::vector<std::pair<SceneObject*, SceneObject*> >
+		       &collisions, JobSystem &jobSystem) const;
+
+  };
+
+}
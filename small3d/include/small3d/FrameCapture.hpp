@@ -0,0 +1,151 @@
+/**
+ * @file  FrameCapture.hpp
+ * @brief Header of the FrameCapture class
+ *
+ *  Created on: 2026/10/19
+ *      Author: Dimitri Kourkoulis
+ *     License: BSD 3-Clause License (see LICENSE file)
+ */
+
+#pragma once
+
+#include <GL/glew.h>
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <cstdio>
+
+namespace small3d {
+
+  /**
+   * @brief Possible formats for captured frames.
+   */
+
+  enum CaptureFormat {
+    capturepng, capturey4m
+  };
+
+  /**
+   * @class FrameCapture
+   *
+   * @brief Captures the rendered frames without stalling the rendering. Each
+   *        frame is read back into one of a ring of pixel buffer objects and
+   *        only copied out of it a few frames later, when the GPU has (almost
+   *        certainly) finished with it. The copied frames are then written to
+   *        disk by a background thread, either as a sequence of png files or
+   *        as a single raw (YUV 4:2:0) Y4M video file.
+   *
+   *        The object has to be created, used and destroyed on the thread on
+   *        which the OpenGL context is current. It is normally managed by
+   *        the Renderer (see Renderer::startCapture).
+   */
+
+  class FrameCapture {
+  private:
+
+    struct Slot {
+      GLuint buffer;
+      GLsync fence;
+      unsigned long number;
+      bool pending;
+    };
+
+    struct Frame {
+      std::vector<unsigned char> pixels;
+      unsigned long number;
+    };
+
+    int width;
+    int height;
+    size_t frameSize;
+    std::string path;
+    CaptureFormat format;
+    unsigned int framesPerSecond;
+    bool useFences;
+
+    std::vector<Slot> slots;
+    size_t nextSlot;
+    unsigned long numFramesCaptured;
+
+    // Shared with the encoder thread
+    std::mutex mutex;
+    std::condition_variable frameQueued;
+    std::condition_variable frameWritten;
+    std::deque<Frame> queuedFrames;
+    std::vector<std::vector<unsigned char> > freeBuffers;
+    bool stopping;
+    std::exception_ptr exception;
+
+    // Used by the encoder thread only
+    FILE *y4mFile;
+    std::vector<unsigned char> yuvFrame;
+
+    std::thread encoder;
+    bool finished;
+
+    void retrieve(Slot &slot);
+    void encoderLoop();
+    void writePng(const Frame &frame) const;
+    void writeY4m(const Frame &frame);
+    void rethrow();
+
+  public:
+
+    /**
+     * @brief Constructor. Starts the encoder thread.
+     * @param width           The width of the frames
+     * @param height          The height of the frames
+     * @param path            For png, the beginning of the path of the files,
+     *                        to which the frame number and ".png" are
+     *                        appended. For Y4M, the path of the video file.
+     * @param format          The format
+     * @param framesPerSecond The frame rate, written in the Y4M header
+     * @param numBuffers      The number of pixel buffer objects, i.e. how
+     *                        many frames behind the rendering the frames are
+     *                        copied out of the GPU (at least 2)
+     */
+    FrameCapture(const int width, const int height, const std::string path,
+		 const CaptureFormat format,
+		 const unsigned int framesPerSecond = 30,
+		 const unsigned int numBuffers = 3);
+
+    /**
+     * @brief Destructor. Writes out the frames that are still pending. Errors
+     *        are logged. Call finish first in order to have them thrown.
+     */
+    ~FrameCapture();
+
+    FrameCapture(const FrameCapture&) = delete;
+    FrameCapture& operator=(const FrameCapture&) = delete;
+
+    /**
+     * @brief Start reading back the frame that has just been rendered (to be
+     *        called before swapping the buffers) and hand the oldest pending
+     *        frame to the encoder thread. If the encoder thread falls too far
+     *        behind, this waits for it, so that no frames are dropped. Errors
+     *        of the encoder thread are thrown here.
+     */
+    void captureFrame();
+
+    /**
+     * @brief Write out all pending frames and stop the encoder thread. Errors
+     *        of the encoder thread are thrown here. No frames can be captured
+     *        afterwards.
+     */
+    void finish();
+
+    /**
+     * @brief Get the number of frames captured so far (some of which may
+     *        still be pending).
+     * @return The number of frames
+     */
+    unsigned long getNumFramesCaptured() const;
+
+  };
+
+}
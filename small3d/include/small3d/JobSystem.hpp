@@ -0,0 +1,129 @@
+/**
+ * @file  JobSystem.hpp
+ * @brief Header of the JobSystem class
+ *
+ *  Created on: 2026/10/19
+ *      Author: Dimitri Kourkoulis
+ *     License: BSD 3-Clause License (see LICENSE file)
+ */
+
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+
+namespace small3d {
+
+  /**
+   * @class JobSystem
+   *
+   * @brief A small work-stealing job system. Each thread has its own queue of
+   *        jobs. Threads take jobs from the back of their own queue and, when
+   *        it is empty, steal jobs from the front of the queues of the other
+   *        threads. The thread that waits for jobs to complete also runs
+   *        jobs while waiting, so a JobSystem with a single thread runs
+   *        everything on the calling thread. The job system does not depend
+   *        on the Renderer, so it can also be used by headless applications.
+   */
+
+  class JobSystem {
+  private:
+
+    // Jobs that are waited for together
+    struct JobGroup {
+      std::atomic<size_t> numRemaining;
+      std::mutex exceptionMutex;
+      std::exception_ptr exception;
+      JobGroup();
+    };
+
+    struct Job {
+      std::function<void()> function;
+      JobGroup *group;
+    };
+
+    struct JobQueue {
+      std::mutex mutex;
+      std::deque<Job> jobs;
+    };
+
+    // One queue per thread. The first one belongs to the threads which are
+    // not workers of the job system (e.g. the main thread).
+    std::vector<std::unique_ptr<JobQueue> > queues;
+    std::vector<std::thread> workers;
+
+    std::atomic<size_t> numQueuedJobs;
+    std::atomic<size_t> nextQueue;
+    std::mutex sleepMutex;
+    std::condition_variable wakeUp;
+    bool stopping;
+
+    JobGroup runGroup;
+
+    void push(const std::function<void()> &function, JobGroup *group);
+    bool runJob(const size_t queueIdx);
+    void workerLoop(const size_t queueIdx);
+    void waitFor(JobGroup &group);
+    size_t getQueueIdx() const;
+
+  public:
+
+    /**
+     * @brief Constructor
+     * @param numThreads The number of threads that will be running jobs,
+     *                   including the one that waits for them. 0 means one
+     *                   per hardware thread.
+     */
+    JobSystem(const unsigned int numThreads = 0);
+
+    /**
+     * @brief Destructor. Queued jobs that have not started are discarded.
+     */
+    ~JobSystem();
+
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+
+    /**
+     * @brief Get the number of threads that run jobs, including the one
+     *        that waits for them.
+     * @return The number of threads
+     */
+    unsigned int getNumThreads() const;
+
+    /**
+     * @brief Queue a job. Jobs can also queue other jobs.
+     * @param job The job
+     */
+    void run(const std::function<void()> &job);
+
+    /**
+     * @brief Wait until all the jobs queued with run have completed, running
+     *        jobs on the calling thread in the meantime. If any of the jobs
+     *        has thrown an exception, the first one is rethrown here.
+     */
+    void wait();
+
+    /**
+     * @brief Call a function for all the items of a range, splitting the
+     *        range into batches that run in parallel, and wait until all of
+     *        them have completed. If the function throws an exception, the
+     *        first one is rethrown here.
+     * @param numItems  The number of items
+     * @param batchSize The maximum number of items in each batch
+     * @param function  The function, called with the first item of a batch
+     *                  and the item after its last one
+     */
+    void parallelFor(const size_t numItems, const size_t batchSize,
+		     const std::function<void(size_t, size_t)> &function);
+
+  };
+
+}
@@ -11,26 +11,155 @@
 
 /**
  * Logging is accessed through macros so that it can be completely
- * omitted if deactivated.
+ * omitted if deactivated. Levels below SMALL3D_MIN_LOG_LEVEL (0: debug,
+ * 1: info, 2: error) are not compiled at all. For the rest, the message is
+ * only built if its level is enabled at runtime (see setMinLogLevel).
+ *
+ * The macros ending in F receive a format, in which each {} is replaced by
+ * the next argument, e.g. LOGINFOF("Loaded {} bounding boxes.", numBoxes).
  */
 
-#define LOGERROR(MESSAGE) logger->append(loggererror, MESSAGE)
+#ifndef SMALL3D_MIN_LOG_LEVEL
+#if defined(DEBUG) || defined(_DEBUG) || !defined (NDEBUG)
+#define SMALL3D_MIN_LOG_LEVEL 0
+#else
+#define SMALL3D_MIN_LOG_LEVEL 1
+#endif
+#endif
+
+#define SMALL3D_LOG(LEVEL, MESSAGE) \
+  do { \
+    if (small3d::isLogLevelEnabled(LEVEL)) logger->append(LEVEL, MESSAGE); \
+  } while (0)
 
-#define LOGINFO(MESSAGE) logger->append(loggerinfo, MESSAGE)
+#define SMALL3D_LOGF(LEVEL, ...) \
+  do { \
+    if (small3d::isLogLevelEnabled(LEVEL)) \
+      logger->append(LEVEL, small3d::formatLogMessage(__VA_ARGS__)); \
+  } while (0)
 
-#if defined(DEBUG) || defined(_DEBUG) || !defined (NDEBUG)
-#define LOGDEBUG(MESSAGE) logger->append(loggerdebug, MESSAGE)
+#define LOGERROR(MESSAGE) SMALL3D_LOG(small3d::loggererror, MESSAGE)
+#define LOGERRORF(...) SMALL3D_LOGF(small3d::loggererror, __VA_ARGS__)
+
+#if SMALL3D_MIN_LOG_LEVEL <= 1
+#define LOGINFO(MESSAGE) SMALL3D_LOG(small3d::loggerinfo, MESSAGE)
+#define LOGINFOF(...) SMALL3D_LOGF(small3d::loggerinfo, __VA_ARGS__)
 #else
-#define LOGDEBUG(MESSAGE)
+#define LOGINFO(MESSAGE) do {} while (0)
+#define LOGINFOF(...) do {} while (0)
+#endif
+
+#if SMALL3D_MIN_LOG_LEVEL <= 0
+#define LOGDEBUG(MESSAGE) SMALL3D_LOG(small3d::loggerdebug, MESSAGE)
+#define LOGDEBUGF(...) SMALL3D_LOGF(small3d::loggerdebug, __VA_ARGS__)
+#else
+#define LOGDEBUG(MESSAGE) do {} while (0)
+#define LOGDEBUGF(...) do {} while (0)
 #endif
 
 #include <ostream>
 #include <memory>
+#include <string>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
 
 namespace small3d {
 
   std::string intToStr(const int number);
 
+  /**
+   * @brief Append a value to a log message. Overloaded for the types that
+   *        can be used as arguments of formatted log messages.
+   * @param [in,out] message The message
+   * @param          value   The value
+   */
+  void appendLogValue(std::string &message, const long long value);
+  void appendLogValue(std::string &message, const unsigned long long value);
+  void appendLogValue(std::string &message, const double value);
+
+  inline void appendLogValue(std::string &message, const int value) {
+    appendLogValue(message, static_cast<long long>(value));
+  }
+
+  inline void appendLogValue(std::string &message, const unsigned int value) {
+    appendLogValue(message, static_cast<unsigned long long>(value));
+  }
+
+  inline void appendLogValue(std::string &message, const long value) {
+    appendLogValue(message, static_cast<long long>(value));
+  }
+
+  inline void appendLogValue(std::string &message,
+			     const unsigned long value) {
+    appendLogValue(message, static_cast<unsigned long long>(value));
+  }
+
+  inline void appendLogValue(std::string &message, const float value) {
+    appendLogValue(message, static_cast<double>(value));
+  }
+
+  inline void appendLogValue(std::string &message, const bool value) {
+    message += value ? "true" : "false";
+  }
+
+  inline void appendLogValue(std::string &message, const char value) {
+    message += value;
+  }
+
+  inline void appendLogValue(std::string &message, const char *value) {
+    message += value;
+  }
+
+  inline void appendLogValue(std::string &message, const std::string &value) {
+    message += value;
+  }
+
+  inline void appendFormatted(std::string &message, const char *format) {
+    message += format;
+  }
+
+  template<typename T, typename... Args>
+  void appendFormatted(std::string &message, const char *format,
+		       const T &value, const Args&... args) {
+    const char *placeholder = format;
+    while (*placeholder != '\0' &&
+	   (placeholder[0] != '{' || placeholder[1] != '}')) {
+      ++placeholder;
+    }
+    message.append(format, static_cast<size_t>(placeholder - format));
+    if (*placeholder == '\0') return;
+    appendLogValue(message, value);
+    appendFormatted(message, placeholder + 2, args...);
+  }
+
+  /**
+   * @brief Get the (per thread) buffer in which log messages are formatted.
+   * @return The buffer
+   */
+  std::string& getLogFormatBuffer();
+
+  /**
+   * @brief Format a log message, replacing each {} in the format with the
+   *        next argument. Arguments without a {} are ignored. The message
+   *        is built in a buffer that is reused by the calling thread, so
+   *        it does not usually allocate memory.
+   * @param format The format
+   * @param args   The arguments
+   * @return The message, valid until the next message is formatted on the
+   *         same thread
+   */
+  template<typename... Args>
+  const std::string& formatLogMessage(const char *format,
+				      const Args&... args) {
+    std::string &message = getLogFormatBuffer();
+    message.clear();
+    appendFormatted(message, format, args...);
+    return message;
+  }
+
   /**
    * @brief Possible logging levels.
    */
@@ -39,6 +168,16 @@ namespace small3d {
     loggerinfo, loggerdebug, loggererror
   };
 
+  /**
+   * @brief What an asynchronous logger does when its queue is full.
+   *        logdrop discards the message (the number of discarded messages
+   *        is logged later), logblock waits until there is space.
+   */
+
+  enum LogOverflowPolicy {
+    logdrop, logblock
+  };
+
   /**
    * @class Logger
    * @brief The standard logging class for small3d.
@@ -46,7 +185,35 @@ namespace small3d {
 
   class Logger {
   private:
+
+    struct LogRecord {
+      std::atomic<size_t> sequence;
+      LogLevel level;
+      std::chrono::system_clock::time_point time;
+      std::string message;
+    };
+
     std::ostream *logStream;
+
+    // Asynchronous mode: a bounded multiple producer queue of records
+    // (Vyukov), emptied by the writer thread.
+    bool asynchronous;
+    LogOverflowPolicy overflowPolicy;
+    std::unique_ptr<LogRecord[]> records;
+    size_t queueMask;
+    mutable std::atomic<size_t> enqueuePos;
+    mutable std::atomic<size_t> writtenPos;
+    mutable std::atomic<size_t> numDropped;
+    mutable std::mutex writerMutex;
+    mutable std::condition_variable writerWakeUp;
+    mutable std::condition_variable flushed;
+    mutable unsigned int numFlushRequests;
+    bool stopping;
+    std::thread writer;
+
+    bool push(const LogLevel level, const std::string &message) const;
+    void writerLoop();
+
   public:
 
     /**
@@ -57,6 +224,22 @@ namespace small3d {
 
     Logger(std::ostream &stream);
 
+    /**
+     * @brief Constructor for an asynchronous logger. Messages are queued and
+     *        written to the stream by a background thread, in batches, so
+     *        that appending them does not have to wait for the stream. Errors
+     *        are written immediately (with everything queued before them).
+     *
+     * @param [in,out] stream         The stream to which events will be
+     *                                logged. Only the writer thread uses it.
+     * @param          queueSize      The maximum number of queued messages
+     *                                (rounded up to a power of 2)
+     * @param          overflowPolicy What to do when the queue is full
+     */
+
+    Logger(std::ostream &stream, const size_t queueSize,
+	   const LogOverflowPolicy overflowPolicy);
+
     /**
      * @brief Destructor.
      */
@@ -70,14 +253,51 @@ namespace small3d {
      * @param	message	The message.
      */
 
-    void append(const LogLevel level, const std::string message) const;
+    void append(const LogLevel level, const std::string &message) const;
+
+    /**
+     * @brief Wait until all the messages appended so far have been written
+     *        and flushed (only needed for an asynchronous logger).
+     */
+
+    void flush() const;
   };
 
   void initLogger();
 
   void initLogger(std::ostream &stream);
 
+  void initLogger(std::ostream &stream, const size_t queueSize,
+		  const LogOverflowPolicy overflowPolicy);
+
   void deleteLogger();
+
+  /**
+   * @brief Set the minimum level of the messages that are logged at
+   *        runtime. From lowest to highest: loggerdebug, loggerinfo,
+   *        loggererror. Errors are always logged.
+   * @param level The level
+   */
+  void setMinLogLevel(const LogLevel level);
+
+  extern std::atomic<int> minLogSeverity;
+
+  inline int getLogSeverity(const LogLevel level) {
+    return level == loggerdebug ? 0 : (level == loggerinfo ? 1 : 2);
+  }
 }
 
 extern std::shared_ptr<small3d::Logger> logger;
+
+namespace small3d {
+
+  /**
+   * @brief Check if messages of a level will be logged.
+   * @param level The level
+   * @return True if there is a logger and the level is enabled
+   */
+  inline bool isLogLevelEnabled(const LogLevel level) {
+    return getLogSeverity(level) >=
+      minLogSeverity.load(std::memory_order_relaxed) && logger;
+  }
+}
@@ -10,6 +10,7 @@
 
 #include <string>
 #include <vector>
+#include <glm/glm.hpp>
 
 #ifndef WITH_VULKAN
 #include <GL/glew.h>
@@ -46,6 +47,34 @@ namespace small3d {
 
     void clear();
 
+    // Bounding volume hierarchy over the triangles, for ray casting. Nodes
+    // are stored depth first, so the left child of a node follows it. For
+    // leaves, index is the position of their triangle packet, otherwise it
+    // is the position of the right child.
+    struct BvhNode {
+      glm::vec3 minCoords;
+      glm::vec3 maxCoords;
+      unsigned int index;
+      unsigned int numTriangles;
+    };
+
+    // Up to four triangles, stored so that they can be checked together
+    // (one lane per triangle). Unused lanes hold degenerate triangles.
+    struct TrianglePacket {
+      float v0[3][4];
+      float edge1[3][4];
+      float edge2[3][4];
+      unsigned int triangles[4];
+    };
+
+    mutable std::vector<BvhNode> bvhNodes;
+    mutable std::vector<TrianglePacket> trianglePackets;
+
+    void buildBvh() const;
+    unsigned int buildBvhNode(std::vector<unsigned int> &triangles,
+			      const size_t begin, const size_t end,
+			      const std::vector<glm::vec3> &centroids) const;
+
   public:
     
     /**
@@ -71,6 +100,31 @@ namespace small3d {
      *        directly.
      */
     GLuint uvBufferObjectId = 0;
+
+    /**
+     * @brief OpenGL bone index buffer object id. It is suggested not to
+     *        manipulate this directly.
+     */
+    GLuint boneIndexBufferObjectId = 0;
+
+    /**
+     * @brief OpenGL bone weight buffer object id. It is suggested not to
+     *        manipulate this directly.
+     */
+    GLuint boneWeightBufferObjectId = 0;
+
+    /**
+     * @brief OpenGL index buffer object ids of the levels of detail. It is
+     *        suggested not to manipulate these directly.
+     */
+    std::vector<GLuint> lodIndexBufferObjectIds;
+
+    /**
+     * @brief Set when the levels of detail have been generated again, so
+     *        that the Renderer uploads them again. It is suggested not to
+     *        manipulate this directly.
+     */
+    bool lodIndexBuffersStale = false;
     
     /**
      * @brief The vertex data. This is an array, which is to be treated as a 4
@@ -122,6 +176,51 @@ namespace small3d {
      */
     int textureCoordsDataByteSize;
 
+    /**
+     * @brief Vertices that are used with more than one set of texture
+     *        coordinates are copied while loading the model, and the copies
+     *        are added to the end of the vertex data. This holds the position
+     *        of the original vertex in the Wavefront file (counting from 0)
+     *        for each copy, in the order the copies have been added.
+     */
+    std::vector<unsigned int> copiedVertexIndices;
+
+    /**
+     * @brief 4 column table of the bones moving each vertex, if the model is
+     *        skinned (see Skeleton). The position of the "row" in the array
+     *        is the same as the position of the corresponding vertex "row" in
+     *        the vertexData array.
+     */
+    std::vector<unsigned char> boneIndexData;
+
+    /**
+     * @brief 4 column table of the weights of the bones in boneIndexData. The
+     *        weights of each vertex add up to 1.
+     */
+    std::vector<float> boneWeightData;
+
+    /**
+     * @brief The smallest x, y and z coordinates of the vertices, as loaded.
+     */
+    glm::vec3 minCoords;
+
+    /**
+     * @brief The largest x, y and z coordinates of the vertices, as loaded.
+     */
+    glm::vec3 maxCoords;
+
+    /**
+     * @brief Index data of simplified versions of the model (levels of
+     *        detail, see generateLods), from the most to the least detailed.
+     *        They use the same vertex data as the model.
+     */
+    std::vector<std::vector<unsigned int> > lodIndexData;
+
+    /**
+     * @brief The error of each level of detail (see simplify).
+     */
+    std::vector<float> lodErrors;
+
     /**
      * @brief constructor
      * @param fileLocation Location of the Wavefront file from which to load the
@@ -129,5 +228,67 @@ namespace small3d {
      */
     Model(const std::string fileLocation);
 
+    /**
+     * @brief Simplify the model, by collapsing edges, removing one vertex at
+     *        a time. The edge collapsed each time is the one that moves the
+     *        surface the least, as measured by quadric error metrics: every
+     *        vertex keeps the planes of the original triangles that have been
+     *        merged into it, and the error of a collapse is the square root
+     *        of the sum of the squared distances of the remaining vertex
+     *        from them. Since the remaining vertices do not move, the
+     *        simplified model uses the same vertex data, and vertices that
+     *        have been copied for their texture coordinates are kept. Edges
+     *        on the border of open surfaces also count as planes, so that
+     *        borders keep their shape. Collapses that would flip triangles
+     *        are not made.
+     * @param targetNumTriangles        Stop when the number of triangles
+     *                                  has been reduced to this
+     * @param maxError                  Do not make collapses with a larger
+     *                                  error than this
+     * @param [out] simplifiedIndexData The index data of the simplified model
+     * @return The largest error of the collapses made (0 if none)
+     */
+    float simplify(const size_t targetNumTriangles, const float maxError,
+		   std::vector<unsigned int> &simplifiedIndexData) const;
+
+    /**
+     * @brief Generate levels of detail (lodIndexData and lodErrors), each
+     *        one with a fraction of the triangles of the previous one (see
+     *        simplify). Fewer levels are generated if the model cannot be
+     *        simplified any more.
+     * @param numLevels The number of levels, besides the model itself
+     * @param reduction The fraction of the triangles of the previous level
+     *                  that each level is to have
+     */
+    void generateLods(const int numLevels, const float reduction = 0.5f);
+
+    /**
+     * @brief Cast a ray against the triangles of the model, for example for
+     *        picking. The model is considered to be placed the way
+     *        Renderer::render places it, for a given offset and rotation. A
+     *        bounding volume hierarchy is built over the triangles the first
+     *        time this is called (so the first call should not be made from
+     *        many threads at once) and it is not updated if the vertex or
+     *        index data change afterwards.
+     * @param origin            The origin of the ray
+     * @param direction         The direction of the ray
+     * @param offset            The offset (location) of the model
+     * @param rotation          The rotation of the model
+     * @param [out] distance    The distance from the origin to the nearest
+     *                          triangle hit, in multiples of the length of
+     *                          direction
+     * @param [out] triangle    The triangle hit (the position of its first
+     *                          index in indexData, divided by 3)
+     * @param [out] barycentric The barycentric coordinates of the hit on the
+     *                          triangle, being the weights of its second and
+     *                          third vertices. The weight of the first vertex
+     *                          is 1 - barycentric.x - barycentric.y.
+     * @return True if a triangle is hit, False if not.
+     */
+    bool intersectsRay(const glm::vec3 origin, const glm::vec3 direction,
+		       const glm::vec3 offset, const glm::vec3 rotation,
+		       float &distance, unsigned int &triangle,
+		       glm::vec2 &barycentric) const;
+
   };
 }
@@ -0,0 +1,173 @@
+/**
+ * @file  OcclusionBuffer.hpp
+ * @brief Header of the OcclusionBuffer class
+ *
+ *  Created on: 2026/10/19
+ *      Author: Dimitri Kourkoulis
+ *     License: BSD 3-Clause License (see LICENSE file)
+ */
+
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "SceneObject.hpp"
+#include "JobSystem.hpp"
+
+namespace small3d {
+
+  /**
+   * @class OcclusionBuffer
+   *
+   * @brief A low resolution depth buffer, rendered on the CPU, for finding
+   *        the objects that are hidden behind others (occluders, e.g. the
+   *        walls of a building) before rendering them. It uses the same
+   *        projection as the Renderer, so it can be drawn and checked without
+   *        a GPU, and the Renderer uses one to skip the objects that do not
+   *        need to be drawn (see Renderer::renderOccluders).
+   *
+   *        The triangles of the occluders are rasterised 4 pixels at a time
+   *        (with SSE2) and the rows of the buffer can be split among the
+   *        threads of a JobSystem. Triangles crossing the near plane are left
+   *        out and objects are checked on one more pixel around their
+   *        axis-aligned bounding boxes (in model space), so that they are
+   *        never hidden by mistake, even when they only show past the edge
+   *        of an occluder by part of a pixel.
+   */
+
+  class OcclusionBuffer {
+  private:
+
+    // A triangle on the buffer. Each edge function (a * x + b * y + c) is
+    // positive on the inside of the triangle and the inverse of the depth
+    // changes linearly on the screen.
+    struct Triangle {
+      float edgeA[3];
+      float edgeB[3];
+      float edgeC[3];
+      float depthA;
+      float depthB;
+      float depthC;
+      int minX;
+      int maxX;
+      int minY;
+      int maxY;
+    };
+
+    int width;
+    int height;
+    float frustumScale;
+    float aspectRatio;
+    float zNear;
+    float zOffsetFromCamera;
+
+    glm::vec3 cameraPosition;
+    glm::mat3 cameraRotationMatrix;
+
+    // The inverse of the depth of the nearest occluder at each pixel, 0
+    // where there is none. Rows start from the bottom, like OpenGL.
+    std::vector<float> inverseDepths;
+
+    // Per occluder
+    std::vector<std::vector<glm::vec4> > occluderVertices;
+    std::vector<std::vector<Triangle> > occluderTriangles;
+
+    void project(const glm::vec3 &viewPosition, glm::vec4 &screenVertex) const;
+    void setUpOccluder(SceneObject &occluder,
+		       std::vector<glm::vec4> &vertices,
+		       std::vector<Triangle> &triangles) const;
+    void rasteriseRows(const int beginRow, const int endRow);
+
+  public:
+
+    /**
+     * @brief Constructor
+     * @param width             The width of the buffer, in pixels. It is
+     *                          rounded up to a multiple of 4.
+     * @param height            The height of the buffer, in pixels
+     * @param frustumScale      How much the frustum scales the items rendered
+     *                          (as given to the Renderer)
+     * @param aspectRatio       The width of the screen divided by its height
+     * @param zNear             Projection plane z coordinate (as given to the
+     *                          Renderer)
+     * @param zOffsetFromCamera The position of the projection plane with
+     *                          regard to the camera (as given to the
+     *                          Renderer)
+     */
+    OcclusionBuffer(const int width, const int height,
+		    const float frustumScale = 1.0f,
+		    const float aspectRatio = 1.0f, const float zNear = 1.0f,
+		    const float zOffsetFromCamera = -1.0f);
+
+    /**
+     * @brief Get the width of the buffer.
+     * @return The width, in pixels
+     */
+    int getWidth() const;
+
+    /**
+     * @brief Get the height of the buffer.
+     * @return The height, in pixels
+     */
+    int getHeight() const;
+
+    /**
+     * @brief Set the camera from which the buffer is drawn and checked.
+     * @param position The position of the camera (Renderer::cameraPosition)
+     * @param rotation The rotation of the camera (Renderer::cameraRotation)
+     */
+    void setCamera(const glm::vec3 position, const glm::vec3 rotation);
+
+    /**
+     * @brief Clear the buffer and draw the models of some objects into it,
+     *        as currently placed and animated (blended with the next frame
+     *        or skinned, like the Renderer draws them).
+     * @param occluders The objects
+     */
+    void draw(const std::vector<SceneObject*> &occluders);
+
+    /**
+     * @brief Clear the buffer and draw the models of some objects into it,
+     *        on the threads of a JobSystem. The result is the same as when
+     *        drawing on a single thread.
+     * @param occluders The objects
+     * @param jobSystem The job system
+     */
+    void draw(const std::vector<SceneObject*> &occluders,
+	      JobSystem &jobSystem);
+
+    /**
+     * @brief Check if a box could be visible, that is if it is in front of
+     *        the camera and not entirely behind the occluders drawn.
+     * @param minCoords The smallest coordinates of the box, in model space
+     * @param maxCoords The largest coordinates of the box, in model space
+     * @param offset    The offset of the model
+     * @param rotation  The rotation of the model
+     * @return False if the box is hidden behind the occluders or outside the
+     *         view, True otherwise
+     */
+    bool isVisible(const glm::vec3 minCoords, const glm::vec3 maxCoords,
+		   const glm::vec3 offset, const glm::vec3 rotation) const;
+
+    /**
+     * @brief Check if an object could be visible, by the box containing its
+     *        vertices as currently drawn (see
+     *        SceneObject::getBoundingCoords).
+     * @param sceneObject The object
+     * @return False if the object is hidden behind the occluders or outside
+     *         the view, True otherwise
+     */
+    bool isVisible(SceneObject &sceneObject) const;
+
+    /**
+     * @brief Get the depth of the nearest occluder at a pixel.
+     * @param x The horizontal position of the pixel, from the left
+     * @param y The vertical position of the pixel, from the bottom
+     * @return The depth (distance from the camera along its direction) or
+     *         FLT_MAX if there is no occluder at the pixel.
+     */
+    float getDepth(const int x, const int y) const;
+
+  };
+
+}
@@ -12,13 +12,22 @@
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 
+#ifdef SMALL3D_HEADLESS
+#include <EGL/egl.h>
+#endif
+
 #include "Logger.hpp"
 #include "Image.hpp"
 #include "Model.hpp"
 #include "SceneObject.hpp"
+#include "FrameCapture.hpp"
+#include "OcclusionBuffer.hpp"
+#include "JobSystem.hpp"
 
 #include <unordered_map>
 #include <vector>
+#include <memory>
+#include <chrono>
 
 #define GLM_FORCE_RADIANS
 #include <glm/glm.hpp>
@@ -28,6 +37,103 @@
 namespace small3d
 {
 
+  /**
+   * @struct FrameStats
+   * @brief Statistics of a rendered frame. The CPU times are those spent in
+   *        the Renderer calls of each category (a rectangle rendered as
+   *        part of writing text counts as text).
+   */
+  struct FrameStats {
+
+    /**
+     * @brief The number of the frame (counting from 0)
+     */
+    unsigned long frameNumber;
+
+    /**
+     * @brief Time from the previous swap of the buffers to the one that
+     *        ended the frame
+     */
+    double frameMilliseconds;
+
+    /**
+     * @brief CPU time spent rendering models
+     */
+    double modelMilliseconds;
+
+    /**
+     * @brief CPU time spent rendering rectangles
+     */
+    double rectangleMilliseconds;
+
+    /**
+     * @brief CPU time spent writing text
+     */
+    double textMilliseconds;
+
+    /**
+     * @brief CPU time spent drawing occluders and checking if objects are
+     *        hidden behind them (see Renderer::renderOccluders)
+     */
+    double occlusionMilliseconds;
+
+    /**
+     * @brief The number of draw calls
+     */
+    unsigned int numDrawCalls;
+
+    /**
+     * @brief The number of triangles drawn
+     */
+    unsigned long numTriangles;
+
+    /**
+     * @brief The number of triangles not drawn because models were drawn at
+     *        a lower level of detail (see SceneObject::generateLods)
+     */
+    unsigned long numTrianglesSavedByLod;
+
+    /**
+     * @brief The number of objects not drawn because they were hidden
+     *        behind occluders or outside the view (see
+     *        Renderer::renderOccluders)
+     */
+    unsigned int numObjectsCulled;
+
+    /**
+     * @brief The number of program and texture changes
+     */
+    unsigned int numStateChanges;
+
+    /**
+     * @brief Bytes uploaded to textures
+     */
+    unsigned long textureUploadBytes;
+
+    /**
+     * @brief Bytes uploaded to vertex and index buffers
+     */
+    unsigned long bufferUploadBytes;
+
+    /**
+     * @brief GPU time of frame gpuFrameNumber (the previous frame, since
+     *        timer queries are read one frame late so as not to stall the
+     *        pipeline), or -1 if it is not available (before OpenGL 3.3, or
+     *        if the GPU had not finished that frame yet).
+     */
+    double gpuMilliseconds;
+
+    /**
+     * @brief The frame to which gpuMilliseconds refers
+     */
+    unsigned long gpuFrameNumber;
+
+    /**
+     * @brief Constructor, zeroing all the statistics
+     */
+    FrameStats();
+  };
+
   /**
    * @class Renderer
    * @brief Renderer class, which can render using either OpenGL v3.3 or v2.1
@@ -39,6 +145,16 @@ namespace small3d
 
     GLFWwindow* window;
 
+    bool headless;
+    int screenWidth;
+    int screenHeight;
+
+#ifdef SMALL3D_HEADLESS
+    EGLDisplay eglDisplay;
+    EGLContext eglContext;
+    EGLSurface eglSurface;
+#endif
+
     GLuint perspectiveProgram;
     GLuint orthographicProgram;
     GLuint vao;
@@ -53,10 +169,40 @@ namespace small3d
 
     std::unordered_map<std::string, GLuint> textures;
 
+    std::unique_ptr<FrameCapture> frameCapture;
+
+    // Statistics of the frame being rendered and of the last one. Two GPU
+    // timer queries are used, alternating between frames.
+    mutable FrameStats currentFrameStats;
+    mutable FrameStats lastFrameStats;
+    mutable std::chrono::steady_clock::time_point frameStartTime;
+    mutable bool timingCall;
+    GLuint timerQueries[2];
+    mutable bool timerQueryPending[2];
+    mutable bool timerQueryRunning;
+
+    void startFrameStats() const;
+    void endFrameStats() const;
+
     FT_Library library;
     std::vector<float> textMemory;
     std::unordered_map<std::string, FT_Face> fontFaces;
 
+    // Frames of animations blended on the CPU (OpenGL 2.1 only). These,
+    // and skinned vertices, are streamed to the GPU every time they are
+    // rendered.
+    mutable std::vector<float> blendedVertexData;
+    mutable std::vector<float> blendedNormalsData;
+    mutable GLuint streamedPositionBufferObjectId;
+    mutable GLuint streamedNormalsBufferObjectId;
+
+    // Occluders drawn on the CPU for the current frame. Objects are only
+    // checked against them until the buffers are swapped.
+    mutable std::unique_ptr<OcclusionBuffer> occlusionBuffer;
+    mutable bool occlusionCulling;
+
+    OcclusionBuffer &getOcclusionBufferForFrame() const;
+
     std::string loadShaderFromFile(const std::string fileLocation) const;
     GLuint compileShader(const std::string shaderSourceFile,
 			 const GLenum shaderType) const;
@@ -68,6 +214,15 @@ namespace small3d
     void positionNextObject(const glm::vec3 offset,
 			    const glm::vec3 rotation) const;
     void positionCamera() const;
+    void uploadModel(Model &model) const;
+    void uploadBones(Model &model) const;
+    void uploadLods(Model &model) const;
+    float getScreenSize(const Model &model, const glm::vec3 offset,
+			const glm::vec3 rotation) const;
+    void renderModel(Model &model, SceneObject *sceneObject,
+		     const glm::vec3 offset, const glm::vec3 rotation,
+		     const glm::vec4 colour,
+		     const std::string textureName) const;
     GLuint getTextureHandle(const std::string name) const;
     GLuint generateTexture(const std::string name, const float *data,
 			   const unsigned long width,
@@ -79,10 +234,12 @@ namespace small3d
               const std::string shadersPath);
     void initWindow(int &width, int &height,
 		    const std::string windowTitle = "");
+    void initHeadless(const int width, const int height);
 
     Renderer(const std::string windowTitle, const int width, const int height,
 	     const float frustumScale, const float zNear, const float zFar,
-	     const float zOffsetFromCamera, const std::string shadersPath);
+	     const float zOffsetFromCamera, const std::string shadersPath,
+	     const bool headless);
     
     Renderer() {};
     
@@ -132,6 +289,13 @@ namespace small3d
      *                          provided. The shader code can be changed,
      *                          provided that their inputs and outputs are
      *                          maintained the same.
+     * @param headless          If set to true, no window is created. An
+     *                          offscreen EGL surface of the given width and
+     *                          height (which cannot be 0) is rendered to
+     *                          instead, so that no display is needed (e.g.
+     *                          for rendering on servers or running tests).
+     *                          The engine has to have been built with the
+     *                          SMALL3D_HEADLESS option for this to work.
      * @return                  The Renderer object. It can only be assigned to 
      *                          a pointer by its address (Renderer *r =
      *                          &Renderer::getInstance(...), since declaring
@@ -147,7 +311,8 @@ namespace small3d
 				 const float zFar = 24.0f,
 				 const float zOffsetFromCamera = -1.0f,
 				 const std::string shadersPath =
-				 "resources/shaders/");
+				 "resources/shaders/",
+				 const bool headless = false);
 
     /**
      * @brief Destructor
@@ -156,9 +321,71 @@ namespace small3d
 
     /**
      * @brief Get the GLFW window object, associated with the Renderer.
+     *        This is null when running headless.
      */
     GLFWwindow* getWindow() const;
 
+    /**
+     * @brief Is the Renderer running headless (without a window)?
+     * @return True if running headless, False otherwise
+     */
+    bool isHeadless() const;
+
+    /**
+     * @brief Get the width of the screen (or of the window, or of the
+     *        offscreen surface when running headless), in pixels.
+     * @return The width
+     */
+    int getScreenWidth() const;
+
+    /**
+     * @brief Get the height of the screen (or of the window, or of the
+     *        offscreen surface when running headless), in pixels.
+     * @return The height
+     */
+    int getScreenHeight() const;
+
+    /**
+     * @brief Read back what has been rendered so far (before swapping the
+     *        buffers), as 8 bit RGBA values. The vector is resized to
+     *        4 * width * height bytes if needed, so passing the same vector
+     *        on every frame avoids reallocating it.
+     * @param [out] pixels   The pixels
+     * @param topRowFirst    If set to true, the rows are returned from top
+     *                       to bottom, like in most image formats. Otherwise
+     *                       they are returned from bottom to top, like
+     *                       OpenGL stores them, which is a bit faster.
+     */
+    void readPixels(std::vector<unsigned char> &pixels,
+		    const bool topRowFirst = true) const;
+
+    /**
+     * @brief Start capturing every rendered frame, when the buffers are
+     *        swapped. The frames are read back asynchronously, a few frames
+     *        later, and written to disk by a background thread, so that the
+     *        rendering is not stalled.
+     * @param path            For png, the beginning of the path of the files,
+     *                        to which the frame number and ".png" are
+     *                        appended. For Y4M, the path of the video file.
+     * @param format          The format (capturepng or capturey4m)
+     * @param framesPerSecond The frame rate, written in the Y4M header
+     */
+    void startCapture(const std::string path, const CaptureFormat format,
+		      const unsigned int framesPerSecond = 30);
+
+    /**
+     * @brief Stop capturing frames, waiting until all the captured frames
+     *        have been written. Errors that occurred while writing frames
+     *        are thrown here (or when swapping the buffers).
+     */
+    void stopCapture();
+
+    /**
+     * @brief Check if frames are being captured.
+     * @return True if frames are being captured, False otherwise.
+     */
+    bool isCapturing() const;
+
     /**
      * @brief Generate a texture on the GPU from the given image
      * @param name The name by which the texture will be known
@@ -230,7 +457,12 @@ namespace small3d
 		const std::string textureName) const;
 
     /**
-     * @brief Render a SceneObject
+     * @brief Render a SceneObject. If it is being animated, the frame being
+     *        displayed is blended with the next one (see
+     *        SceneObject::getFrameBlend), on the GPU with OpenGL 3.3 and on
+     *        the CPU with OpenGL 2.1. Likewise, if it has a skeleton, it is
+     *        skinned on the GPU with OpenGL 3.3 and on the CPU (see
+     *        SceneObject::skin) with OpenGL 2.1.
      * @param sceneObject The object
      * @param colour The colour the object. 
      */
@@ -244,6 +476,28 @@ namespace small3d
      */
     void render(SceneObject &sceneObject, const std::string textureName) const;
 
+    /**
+     * @brief Draw objects that hide others (e.g. walls) into a low
+     *        resolution depth buffer, on the CPU (see OcclusionBuffer). Until
+     *        the buffers are swapped, SceneObjects rendered afterwards are
+     *        only drawn if their bounding box (see
+     *        SceneObject::getBoundingCoords) is not entirely hidden behind
+     *        these objects (or outside the view). The occluders themselves
+     *        still have to be rendered.
+     * @param occluders The objects
+     */
+    void renderOccluders(const std::vector<SceneObject*> &occluders) const;
+
+    /**
+     * @brief Draw objects that hide others into a low resolution depth
+     *        buffer, on the threads of a JobSystem (see renderOccluders
+     *        above).
+     * @param occluders The objects
+     * @param jobSystem The job system
+     */
+    void renderOccluders(const std::vector<SceneObject*> &occluders,
+			 JobSystem &jobSystem) const;
+
     /**
      * @brief Render some text on the screen.
      * @param text The text to be rendered
@@ -261,6 +515,27 @@ namespace small3d
 	       const std::string fontPath =
 	       "resources/fonts/CrusoeText/CrusoeText-Regular.ttf");
 
+    /**
+     * @brief Get the statistics of the last frame, i.e. of the Renderer calls
+     *        made up to the last swap of the buffers.
+     * @return The statistics
+     */
+    const FrameStats& getFrameStats() const;
+
+    /**
+     * @brief Write the statistics of the last frame on the screen, as an
+     *        overlay. The overlay itself counts as text in the statistics of
+     *        the current frame.
+     * @param colour      The colour of the text (r, g, b)
+     * @param topLeft     Where to place the top left corner of the overlay
+     * @param bottomRight Where to place the bottom right corner of the
+     *                    overlay
+     */
+    void renderFrameStats(const glm::vec3 colour = glm::vec3(1.0f, 1.0f, 0.0f),
+			  const glm::vec2 topLeft = glm::vec2(-1.0f, 1.0f),
+			  const glm::vec2 bottomRight =
+			  glm::vec2(-0.2f, 0.8f));
+
     /**
      * @brief Clear a Model from the GPU buffers (the object itself remains
      *        intact).
@@ -281,7 +556,8 @@ namespace small3d
 
     /**
      * @brief This is a double buffered system and this command swaps
-     * the buffers.
+     * the buffers. If frames are being captured, the frame is captured
+     * just before that.
      */
     void swapBuffers() const;
 
@@ -14,11 +14,14 @@
 #include <iomanip>
 #include <stdexcept>
 #include <memory>
+#include <unordered_map>
 
 #include "Model.hpp"
 #include "Logger.hpp"
 #include "Image.hpp"
 #include "BoundingBoxSet.hpp"
+#include "Skeleton.hpp"
+#include "JobSystem.hpp"
 #include <glm/glm.hpp>
 
 namespace small3d
@@ -30,19 +33,59 @@ namespace small3d
    *        models (the latter for animation), together with information about
    *        positioning and rotation and collision detection functionality.
    *
+   *        The frames of an animated object can be split into named
+   *        animations, each played at its own number of frames per second.
+   *        Animations are driven by the time that has passed (see
+   *        animate(double)), so they play at the same speed whatever the
+   *        frame rate, and do not need a Renderer, e.g. on a server.
+   *        Between two frames, the Renderer blends them, so animations look
+   *        smooth even with few frames per second.
+   *
+   *        Alternatively, an object made up of a single model can be
+   *        animated by a Skeleton (see setSkeleton), which only needs the
+   *        memory of the model once, however long its animations are.
    */
 
   class SceneObject
   {
   private:
+
+    struct Animation {
+      int firstFrame;
+      int numFrames;
+      double framesPerSecond;
+      bool repeat;
+    };
+
     std::vector<Model> model;
     bool animating;
     int frameDelay;
     int currentFrame;
     int framesWaited;
     int numFrames;
+    int nextFrame;
+    float frameBlend;
+    bool frameBlending;
+    bool blendableFrames;
     std::string name;
 
+    std::unordered_map<std::string, Animation> animations;
+    std::string animationName;
+    Animation animation;
+    double animationTime;
+
+    std::shared_ptr<const Skeleton> skeleton;
+    int skeletalAnimation;
+    std::vector<glm::mat4> boneMatrices;
+    std::vector<float> skinnedVertexData;
+    std::vector<float> skinnedNormalsData;
+    bool skinned;
+
+    int lod;
+    std::vector<float> lodScreenSizes;
+
+    void poseSkeleton();
+
   public:
 
     /**
@@ -74,9 +117,144 @@ namespace small3d
      */
     Model& getModel() ;
 
+    /**
+     * @brief Get the model of the frame after the one being displayed, i.e.
+     *        the one the animation is moving towards.
+     * @return The model of the next frame
+     */
+    Model& getNextModel();
+
+    /**
+     * @brief Get how far the animation has moved from the frame being
+     *        displayed towards the next one (only with animate(double)).
+     * @return From 0 (the frame being displayed) to 1 (the next frame).
+     *         Always 0 if frame blending is disabled or the frames do not
+     *         have the same vertices.
+     */
+    float getFrameBlend() const;
+
+    /**
+     * @brief Enable or disable blending between frames (enabled by default).
+     *        When disabled, the animation jumps from frame to frame.
+     * @param frameBlending Blend between frames?
+     */
+    void setFrameBlending(const bool frameBlending);
+
+    /**
+     * @brief Blend the vertex positions and normals of the frame being
+     *        displayed with those of the next frame, on the CPU (the
+     *        Renderer does this on the GPU when OpenGL 3.3 is available).
+     *        The normals are not normalised.
+     * @param [out] vertexData  The blended vertex positions
+     * @param [out] normalsData The blended normals
+     */
+    void getBlendedFrame(std::vector<float> &vertexData,
+			 std::vector<float> &normalsData) const;
+
+    /**
+     * @brief Animate the object with a skeleton. The skeleton's animations
+     *        can then be played like the ones made up of frames (see
+     *        playAnimation). The same skeleton can be set on many objects.
+     * @param skeleton The skeleton, accompanying the object's model
+     */
+    void setSkeleton(const std::shared_ptr<const Skeleton> skeleton);
+
+    /**
+     * @brief Get the object's skeleton.
+     * @return The skeleton, or nullptr if the object does not have one
+     */
+    const std::shared_ptr<const Skeleton>& getSkeleton() const;
+
+    /**
+     * @brief Get the matrices of the bones of the object's skeleton, for the
+     *        current moment of the animation being played (see
+     *        Skeleton::getPose).
+     * @return The matrices
+     */
+    const std::vector<glm::mat4>& getBoneMatrices() const;
+
+    /**
+     * @brief Get a box containing the vertices of the object as they are
+     *        currently drawn, in model space. It covers the frame being
+     *        displayed and, while blending, the next one. For objects with a
+     *        skeleton, it covers the box of the model moved by each bone of
+     *        the current pose, since each vertex is a weighted average of
+     *        those.
+     * @param [out] minCoords The smallest coordinates of the box
+     * @param [out] maxCoords The largest coordinates of the box
+     */
+    void getBoundingCoords(glm::vec3 &minCoords, glm::vec3 &maxCoords);
+
+    /**
+     * @brief Move the vertices and normals of the model with the bones of
+     *        the skeleton, on the CPU, if they have not been moved since the
+     *        animation last advanced. The Renderer skins on the GPU when
+     *        OpenGL 3.3 is available and calls this otherwise.
+     */
+    void skin();
+
+    /**
+     * @brief Skin many objects (see skin()), in parallel.
+     * @param objects   The objects
+     * @param jobSystem The job system that will be skinning them
+     */
+    static void skinAll(const std::vector<SceneObject*> &objects,
+			JobSystem &jobSystem);
+
+    /**
+     * @brief Get the vertices of the model, as moved by skin().
+     * @return The vertex data (same layout as Model::vertexData)
+     */
+    const std::vector<float>& getSkinnedVertexData() const;
+
+    /**
+     * @brief Get the normals of the model, as moved by skin().
+     * @return The normals data (same layout as Model::normalsData)
+     */
+    const std::vector<float>& getSkinnedNormalsData() const;
+
+    /**
+     * @brief Generate levels of detail for the models of the object (see
+     *        Model::generateLods). The Renderer chooses one every time it
+     *        renders the object, based on how large it appears on the
+     *        screen.
+     * @param numLevels The number of levels, besides the models themselves
+     * @param reduction The fraction of the triangles of the previous level
+     *                  that each level is to have
+     */
+    void generateLods(const int numLevels, const float reduction = 0.5f);
+
+    /**
+     * @brief Set the sizes on the screen at which the levels of detail are
+     *        used. By default, level 1 is used below 0.5, level 2 below
+     *        0.25 and so on.
+     * @param screenSizes For each level of detail after the model itself,
+     *                    the size (the fraction of the height of the screen
+     *                    covered by the object's bounding sphere) below
+     *                    which it is used. The sizes must be decreasing.
+     */
+    void setLodScreenSizes(const std::vector<float> &screenSizes);
+
+    /**
+     * @brief Choose the level of detail for a size of the object on the
+     *        screen. In order not to switch back and forth when the size
+     *        stays near one of the sizes at which levels change, the size
+     *        has to move a little past it before switching (hysteresis).
+     * @param screenSize The fraction of the height of the screen covered by
+     *                   the object's bounding sphere
+     * @return The level of detail (0 for the model itself)
+     */
+    int selectLod(const float screenSize);
+
+    /**
+     * @brief Get the level of detail chosen the last time (see selectLod).
+     * @return The level of detail (0 for the model itself)
+     */
+    int getLod() const;
+
     /**
      * @brief Is this an animated or a static object (is it associated with more than
-     *        one frames/models)?
+     *        one frames/models, or with a skeleton)?
      * @return True if animated, False otherwise.
      */
     bool isAnimated() const;
@@ -113,17 +291,97 @@ namespace small3d
     void resetAnimation();
 
     /**
-     * @brief Set the animation speed
+     * @brief Set the animation speed, for animate()
      * @param delay The delay between each animation frame, expressed in number
      *              of game frames
      */
     void setFrameDelay(const int delay);
 
     /**
-     * @brief Process animation (progress current frame if necessary)
+     * @brief Process animation (progress current frame if necessary). The
+     *        animation advances by one frame every frameDelay calls, so its
+     *        speed depends on the frame rate. animate(double) is preferable
+     *        and the only one that animates skeletons.
      */
     void animate();
 
+    /**
+     * @brief Process animation, based on the time that has passed since the
+     *        last call. The current frame only depends on the total time
+     *        the animation has been playing for, however it is split
+     *        between calls, so the animation looks the same at any frame
+     *        rate.
+     * @param seconds The time that has passed, in seconds
+     */
+    void animate(const double seconds);
+
+    /**
+     * @brief Process the animation of many objects (see animate(double)).
+     * @param objects    Pointer to the first object
+     * @param numObjects The number of objects
+     * @param seconds    The time that has passed, in seconds
+     */
+    static void animateAll(SceneObject *objects, const size_t numObjects,
+			   const double seconds);
+
+    /**
+     * @brief Process the animation of many objects (see animate(double)).
+     * @param objects The objects
+     * @param seconds The time that has passed, in seconds
+     */
+    static void animateAll(const std::vector<SceneObject*> &objects,
+			   const double seconds);
+
+    /**
+     * @brief Set the speed of the animation being played, for
+     *        animate(double). By default, the whole sequence of frames is
+     *        played at 24 frames per second. Skeletal animations are timed
+     *        in seconds, so this cannot be called while one is played.
+     * @param framesPerSecond The number of animation frames per second
+     */
+    void setFramesPerSecond(const double framesPerSecond);
+
+    /**
+     * @brief Add a named animation, made up of some of the frames.
+     * @param name            The name of the animation
+     * @param firstFrame      The first frame (counting from 0)
+     * @param numFrames       The number of frames
+     * @param framesPerSecond The number of frames per second
+     * @param repeat          Start again after the last frame? If not, the
+     *                        animation stops on its last frame.
+     */
+    void addAnimation(const std::string name, const int firstFrame,
+		      const int numFrames, const double framesPerSecond,
+		      const bool repeat = true);
+
+    /**
+     * @brief Start playing a named animation from its first frame.
+     * @param name The name of the animation ("" for the whole sequence of
+     *             frames). If the object has a skeleton, its animations are
+     *             looked up first and "" is the pose in which the model has
+     *             been exported.
+     */
+    void playAnimation(const std::string name);
+
+    /**
+     * @brief Get the name of the animation being played.
+     * @return The name of the animation ("" for the whole sequence of frames)
+     */
+    const std::string& getAnimationName() const;
+
+    /**
+     * @brief Is the object being animated?
+     * @return True if animating, False otherwise (also after the last frame
+     *         of an animation that does not repeat)
+     */
+    bool isAnimating() const;
+
+    /**
+     * @brief Get the frame being displayed.
+     * @return The frame (counting from 0)
+     */
+    int getCurrentFrame() const;
+
     /**
      * @brief The bounding boxes for the object, used for collision detection.
      */
@@ -145,7 +403,90 @@ namespace small3d
      * @return	True if there is a collision, False if not.
      */
 
-    bool collidesWith(SceneObject otherObject) const;
+    bool collidesWith(const SceneObject &otherObject) const;
+
+    /**
+     * @brief Check if the object collides with any of a number of points. No
+     *        memory is allocated, so this can be called for many points every
+     *        frame.
+     * @param points    Pointer to the first point
+     * @param numPoints The number of points
+     * @return True if a collision is detected, False otherwise.
+     */
+
+    bool collidesWith(const glm::vec3 *points, const size_t numPoints) const;
+
+    /**
+     * @brief Find which ones of a number of points collide with the object.
+     *        This is much faster than checking the points one by one.
+     * @param points              Pointer to the first point
+     * @param numPoints           The number of points
+     * @param [out] collisionMask Array of at least (numPoints + 63) / 64
+     *                            elements. Bit i % 64 of element i / 64 is
+     *                            set if point i collides and cleared if not.
+     * @return The number of points that collide
+     */
+
+    size_t findCollidingPoints(const glm::vec3 *points,
+			       const size_t numPoints,
+			       uint64_t *collisionMask) const;
+
+    /**
+     * @brief Find which ones of a number of points, stored as separate arrays
+     *        of x, y and z coordinates, collide with the object.
+     * @param x                   The x coordinates of the points
+     * @param y                   The y coordinates of the points
+     * @param z                   The z coordinates of the points
+     * @param numPoints           The number of points
+     * @param [out] collisionMask Array of at least (numPoints + 63) / 64
+     *                            elements. Bit i % 64 of element i / 64 is
+     *                            set if point i collides and cleared if not.
+     * @return The number of points that collide
+     */
+
+    size_t findCollidingPoints(const float *x, const float *y, const float *z,
+			       const size_t numPoints,
+			       uint64_t *collisionMask) const;
+
+    /**
+     * @brief Check if a line segment (for example the path of a projectile
+     *        during a frame) crosses the object.
+     * @param start              The start of the segment
+     * @param end                The end of the segment
+     * @param [out] timeOfImpact Where the segment first touches the object,
+     *                           from 0 (start) to 1 (end)
+     * @param [out] normal       The normal of the touched surface of the
+     *                           bounding box, in world space
+     * @return True if a collision is detected, False otherwise.
+     */
+
+    bool collidesWith(const glm::vec3 start, const glm::vec3 end,
+		      float &timeOfImpact, glm::vec3 &normal) const;
+
+    /**
+     * @brief Check if the object collides with another object at any moment
+     *        while both move from their previous to their current offset and
+     *        rotation, so that fast moving objects cannot pass through each
+     *        other between frames.
+     * @param otherObject           The other object
+     * @param previousOffset        The previous offset of this object
+     * @param previousRotation      The previous rotation of this object
+     * @param otherPreviousOffset   The previous offset of the other object
+     * @param otherPreviousRotation The previous rotation of the other object
+     * @param [out] timeOfImpact    When the objects first touch, from 0
+     *                              (previous) to 1 (current)
+     * @param [out] normal          The contact normal, in world space,
+     *                              pointing from this object towards the
+     *                              other one
+     * @return True if there is a collision, False if not.
+     */
+
+    bool collidesWith(const SceneObject &otherObject,
+		      const glm::vec3 previousOffset,
+		      const glm::vec3 previousRotation,
+		      const glm::vec3 otherPreviousOffset,
+		      const glm::vec3 otherPreviousRotation,
+		      float &timeOfImpact, glm::vec3 &normal) const;
 
   };
   
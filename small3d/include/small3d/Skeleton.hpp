@@ -0,0 +1,172 @@
+/**
+ * @file  Skeleton.hpp
+ * @brief Header of the Skeleton class
+ *
+ *  Created on: 2026/10/19
+ *      Author: Dimitri Kourkoulis
+ *     License: BSD 3-Clause License (see LICENSE file)
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include "Model.hpp"
+
+namespace small3d {
+
+  /**
+   * @class Skeleton
+   *
+   * @brief The bones of a model, the weights with which they move its
+   *        vertices and keyframed animations of the bones, loaded from a
+   *        text file that accompanies the Wavefront file of the model.
+   *        Each line of the file starts with its type:
+   *
+   *        b name parent x y z qw qx qy qz
+   *
+   *        A bone. The parent is the position of the parent bone among the
+   *        bones of the file (counting from 0), or -1 for none, and it has
+   *        to come before the bone. x y z is the position and qw qx qy qz
+   *        the rotation (a quaternion) of the bone, relative to its parent,
+   *        in the pose in which the model has been exported. There can be
+   *        up to 48 bones.
+   *
+   *        w vertex bone weight [bone weight ...]
+   *
+   *        The bones moving a vertex (as numbered in the Wavefront file,
+   *        counting from 1) and their weights, for up to 4 bones. The
+   *        weights are scaled so that they add up to 1. Vertices without
+   *        weights move with the first bone.
+   *
+   *        a name duration repeat
+   *
+   *        An animation, lasting duration seconds, starting again after the
+   *        end if repeat is 1 or stopping if it is 0.
+   *
+   *        k time bone x y z qw qx qy qz
+   *
+   *        A keyframe of the last animation: the position and rotation of a
+   *        bone, relative to its parent, time seconds into the animation.
+   *        Between keyframes, positions and rotations are interpolated.
+   *        Bones without keyframes stay as they have been exported.
+   *
+   *        Lines starting with # are comments. A Skeleton is not modified
+   *        once loaded, so it can be shared by any number of SceneObjects
+   *        (see SceneObject::setSkeleton), which only need to keep the
+   *        matrices of their own pose.
+   */
+
+  class Skeleton {
+  private:
+
+    struct Transform {
+      glm::vec3 position;
+      // Quaternion (x, y, z, w)
+      glm::vec4 rotation;
+    };
+
+    struct Keyframe {
+      double time;
+      Transform transform;
+    };
+
+    struct Animation {
+      std::string name;
+      double duration;
+      bool repeat;
+      // Per bone
+      std::vector<std::vector<Keyframe> > keyframes;
+    };
+
+    std::vector<std::string> boneNames;
+    std::vector<int> boneParents;
+    std::vector<Transform> restPose;
+    std::vector<glm::mat4> inverseRestMatrices;
+
+    // 4 per vertex of the Wavefront file
+    std::vector<unsigned char> vertexBones;
+    std::vector<float> vertexWeights;
+
+    std::vector<Animation> animations;
+
+    glm::mat4 getMatrix(const Transform &transform) const;
+    Transform getTransform(const std::vector<Keyframe> &keyframes,
+			   const double time) const;
+
+  public:
+
+    /**
+     * @brief Constructor
+     * @param fileLocation The location of the skeleton file
+     */
+    Skeleton(const std::string fileLocation);
+
+    /**
+     * @brief Get the number of bones.
+     * @return The number of bones
+     */
+    size_t getNumBones() const;
+
+    /**
+     * @brief Find a bone by name.
+     * @param name The name of the bone
+     * @return The position of the bone (counting from 0) or -1 if there is
+     *         no bone with this name.
+     */
+    int getBoneIndex(const std::string name) const;
+
+    /**
+     * @brief Find an animation by name.
+     * @param name The name of the animation
+     * @return The position of the animation in the file (counting from 0)
+     *         or -1 if there is no animation with this name.
+     */
+    int getAnimationIndex(const std::string name) const;
+
+    /**
+     * @brief Get the duration of an animation.
+     * @param animation The position of the animation (see getAnimationIndex)
+     * @return The duration, in seconds
+     */
+    double getAnimationDuration(const int animation) const;
+
+    /**
+     * @brief Does an animation start again after its end?
+     * @param animation The position of the animation (see getAnimationIndex)
+     * @return True if the animation repeats, False if not.
+     */
+    bool isAnimationRepeated(const int animation) const;
+
+    /**
+     * @brief Work out the matrices that move the vertices of the model
+     *        from the pose in which it has been exported to their place at
+     *        some moment of an animation, one for each bone.
+     * @param animation          The position of the animation (see
+     *                           getAnimationIndex), or -1 for the pose in
+     *                           which the model has been exported (all the
+     *                           matrices are the identity).
+     * @param time               The time into the animation, in seconds
+     * @param [out] boneMatrices The matrices
+     */
+    void getPose(const int animation, const double time,
+		 std::vector<glm::mat4> &boneMatrices) const;
+
+    /**
+     * @brief Fill in the bone indices and weights of the vertices of a model
+     *        (Model::boneIndexData and Model::boneWeightData).
+     * @param model The model, loaded from the Wavefront file that the
+     *              skeleton accompanies
+     */
+    void loadWeights(Model &model) const;
+
+    /**
+     * @brief Get the size of the data of the skeleton.
+     * @return The size, in bytes
+     */
+    size_t getDataByteSize() const;
+
+  };
+
+}
@@ -9,47 +9,46 @@
 
 #pragma once
 
-#include <unordered_map>
-#include <portaudio.h>
-#include <vector>
+#include <memory>
 #include <string>
+#include "SoundMixer.hpp"
+#include "SoundStream.hpp"
 
 namespace small3d {
 
   /**
    * @class Sound
    *
-   * @brief Class that loads and plays a sound from an ogg file.
+   * @brief Class that loads a sound from an ogg file and plays it on a
+   *        SoundMixer. The decoded clip is kept in the SoundBank and shared
+   *        by all the Sounds loaded from the same file, as well as by copies
+   *        of a Sound, which can be played at the same time. A Sound itself
+   *        is small and cheap to copy.
+   *
+   *        Long sounds, like music, can be streamed instead, in which case
+   *        they are decoded while they are being played (see SoundStream).
+   *        Each copy of a streaming Sound opens its own stream.
+   *
+   *        A Sound can be given a position in the world (e.g. the offset of
+   *        the SceneObject making it), in which case it is heard from the
+   *        listener of the mixer (see SoundMixer::setListener).
    */
   class Sound {
   private:
 
-    struct SoundData {
-      int channels;
-      int rate;
-      long samples;
-      long size;
-      double duration;
-      double startTime;
-      bool repeat;
-      unsigned long currentFrame;
-      std::vector<char> data;
-    };
-
-    SoundData soundData;
-    PaStream *stream;
-
-    static bool noOutputDevice;
-    static PaDeviceIndex defaultOutput;
-    static unsigned int numInstances;
-
-    static int audioCallback(const void *inputBuffer, void *outputBuffer,
-			     unsigned long framesPerBuffer,
-			     const PaStreamCallbackTimeInfo *timeInfo,
-			     PaStreamCallbackFlags statusFlags,
-			     void *userData);
-    void load(const std::string soundFilePath);
-    void openStream();
+    std::shared_ptr<const SoundClip> clip;
+    std::shared_ptr<SoundStream> stream;
+    bool streamStarted;
+    SoundMixer *mixer;
+    unsigned int voice;
+    float volume;
+    float pan;
+    float pitch;
+    bool positional;
+    glm::vec3 position;
+    glm::vec3 velocity;
+
+    void load(const std::string soundFilePath, const bool stream);
 
   public:
     /**
@@ -63,41 +62,104 @@ namespace small3d {
      */
     Sound(const std::string soundFilePath);
 
+    /**
+     * @brief Ogg file loading constructor, with the option to stream
+     * @param soundFilePath The path to the ogg file from which to load the sound.
+     * @param stream        Stream the file, decoding it while it is played,
+     *                      instead of decoding it all in advance?
+     */
+    Sound(const std::string soundFilePath, const bool stream);
+
+    /**
+     * @brief Ogg file loading constructor, for a specific mixer
+     * @param soundFilePath The path to the ogg file from which to load the sound.
+     * @param mixer         The mixer on which the sound is played. It has to
+     *                      outlive the Sound.
+     * @param stream        Stream the file, decoding it while it is played?
+     */
+    Sound(const std::string soundFilePath, SoundMixer &mixer,
+	  const bool stream = false);
+
     /**
      * @brief Destructor
      */
     ~Sound();
 
     /**
-     * @brief Play the sound.
-     * @brief repeat Repeat the sound after it ends?
+     * @brief Play the sound. If it is already playing, it restarts.
+     * @param repeat     Repeat the sound after it ends?
+     * @param startFrame The frame of the mix at which to start playing (see
+     *                   SoundMixer::getNumFramesMixed). By default, as soon
+     *                   as possible.
      */
-    void play(const bool repeat=false);
+    void play(const bool repeat=false, const uint64_t startFrame = 0);
 
     /**
      * @brief Stop playing the sound.
      */
     void stop();
 
+    /**
+     * @brief Check if the sound is playing.
+     * @return True if it is playing, false otherwise
+     */
+    bool isPlaying() const;
+
+    /**
+     * @brief Set the volume, which also applies if the sound is playing.
+     * @param volume The volume (1 plays the sound as it is)
+     */
+    void setVolume(const float volume);
+
+    /**
+     * @brief Set the pan, which also applies if the sound is playing.
+     * @param pan The pan, from -1 (left only) to 1 (right only)
+     */
+    void setPan(const float pan);
+
+    /**
+     * @brief Set the pitch, which also applies if the sound is playing.
+     * @param pitch The pitch (2 plays the sound twice as fast)
+     */
+    void setPitch(const float pitch);
+
+    /**
+     * @brief Position the sound in the world, which also applies if it is
+     *        playing. Its pan is worked out from the position from then on.
+     * @param position The position (e.g. the offset of a SceneObject)
+     * @param velocity The velocity, in world units per second, for the
+     *                 Doppler effect
+     */
+    void setPosition(const glm::vec3 position,
+		     const glm::vec3 velocity = glm::vec3(0.0f));
+
+    /**
+     * @brief Stop positioning the sound in the world, so that it is played
+     *        with its own pan again.
+     */
+    void clearPosition();
+
     /**
      * @brief Copy constructor
      */
     Sound(const Sound& other);
 
     /**
-     * @brief Move constructor
+     * @brief Move constructor. If the other Sound is playing, this one takes
+     *        over its voice.
      */
-    Sound(const Sound&& other);
+    Sound(Sound&& other) noexcept;
 
     /**
      * @brief Copy assignment
      */
     Sound& operator=(const Sound& other);
 
-    /** 
-     * @brief Move assignment
+    /**
+     * @brief Move assignment. This Sound stops playing and, if the other
+     *        Sound is playing, takes over its voice.
      */
-    Sound& operator=(const Sound&& other);
+    Sound& operator=(Sound&& other) noexcept;
     
   };
 
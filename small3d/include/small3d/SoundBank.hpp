@@ -0,0 +1,133 @@
+/**
+ * @file  SoundBank.hpp
+ * @brief Header of the SoundBank class
+ *
+ *  Created on: 2026/10/19
+ *      Author: Dimitri Kourkoulis
+ *     License: BSD 3-Clause License (see LICENSE file)
+ */
+
+#pragma once
+
+#include <string>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "SoundMixer.hpp"
+#include "JobSystem.hpp"
+
+namespace small3d {
+
+  /**
+   * @class SoundBank
+   *
+   * @brief Keeps the decoded sound clips, by the path of the file they have
+   *        been loaded from, so that each file is only decoded once and all
+   *        the Sounds loaded from it share the same (immutable) samples. The
+   *        bank does not own the clips. A clip is released when the last
+   *        Sound (or mixer voice) using it is gone and decoded again if it is
+   *        needed after that.
+   *
+   *        Many files can be decoded at once, in parallel, on a JobSystem,
+   *        e.g. while loading a level. The decoded samples can also be
+   *        cached in files (one per clip, checked against the modification
+   *        time and size of the ogg file), which are much faster to load
+   *        than decoding the ogg files again the next time the game runs.
+   */
+
+  class SoundBank {
+  private:
+
+    std::mutex mutex;
+    std::unordered_map<std::string, std::weak_ptr<const SoundClip> > clips;
+    std::string cacheDirectory;
+
+    static std::shared_ptr<const SoundClip> decode(const std::string
+						   soundFilePath);
+    static std::shared_ptr<const SoundClip> readCache(const std::string
+						      soundFilePath,
+						      const std::string
+						      cacheFilePath);
+    static void writeCache(const std::string soundFilePath,
+			   const std::string cacheFilePath,
+			   const SoundClip &clip);
+
+    void removeExpired();
+
+  public:
+
+    /**
+     * @brief Get the bank used by Sound objects.
+     * @return The bank
+     */
+    static SoundBank& getInstance();
+
+    /**
+     * @brief Constructor
+     */
+    SoundBank() = default;
+
+    /**
+     * @brief Destructor
+     */
+    ~SoundBank() = default;
+
+    SoundBank(const SoundBank&) = delete;
+    SoundBank& operator=(const SoundBank&) = delete;
+
+    /**
+     * @brief Get the clip decoded from an ogg file, decoding it if it is not
+     *        in the bank.
+     * @param soundFilePath The path of the file
+     * @return The clip
+     */
+    std::shared_ptr<const SoundClip> get(const std::string soundFilePath);
+
+    /**
+     * @brief Get the clips decoded from many ogg files, decoding the ones
+     *        that are not in the bank in parallel. The bank only keeps the
+     *        clips while they are used, so hold on to them until the Sounds
+     *        using them have been created.
+     * @param soundFilePaths The paths of the files
+     * @param jobSystem      The job system on which to decode the files
+     * @param [out] clips    The clips, in the order of the paths
+     */
+    void get(const std::vector<std::string> &soundFilePaths,
+	     JobSystem &jobSystem,
+	     std::vector<std::shared_ptr<const SoundClip> > &clips);
+
+    /**
+     * @brief Cache the decoded samples of the clips in files, in the given
+     *        directory, which is created if it does not exist. A cache file
+     *        is used instead of the ogg file from then on, as long as the
+     *        ogg file has not been modified.
+     * @param directory The directory. If empty, caching is disabled (the
+     *                  default).
+     */
+    void setCacheDirectory(const std::string directory);
+
+    /**
+     * @brief Get the path of the file in which the samples decoded from an
+     *        ogg file are cached.
+     * @param soundFilePath The path of the ogg file
+     * @return The path of the cache file, or an empty string if caching is
+     *         disabled
+     */
+    std::string getCacheFilePath(const std::string soundFilePath);
+
+    /**
+     * @brief Get the number of clips in the bank (that are in use).
+     * @return The number of clips
+     */
+    size_t getNumClips();
+
+    /**
+     * @brief Get the memory taken up by the samples of the clips in the bank.
+     * @return The size of the samples, in bytes
+     */
+    size_t getMemoryUsage();
+
+  };
+
+}
@@ -0,0 +1,408 @@
+/**
+ * @file  SoundMixer.hpp
+ * @brief Header of the SoundMixer class
+ *
+ *  Created on: 2026/10/19
+ *      Author: Dimitri Kourkoulis
+ *     License: BSD 3-Clause License (see LICENSE file)
+ */
+
+#pragma once
+
+#include <portaudio.h>
+#include <vector>
+#include <string>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+namespace small3d {
+
+  class SoundStream;
+
+  /**
+   * @brief Possible outputs of a SoundMixer.
+   */
+
+  enum MixerOutput {
+    mixerdevice, mixernull
+  };
+
+  /**
+   * @brief A decoded sound clip (16-bit PCM, with the channels interleaved).
+   *        It is not modified once it has been handed to a mixer.
+   */
+
+  struct SoundClip {
+
+    /**
+     * @brief Number of channels (1 or 2)
+     */
+    int channels;
+
+    /**
+     * @brief Sample rate (frames per second)
+     */
+    int rate;
+
+    /**
+     * @brief Number of frames (samples per channel)
+     */
+    unsigned long numFrames;
+
+    /**
+     * @brief The samples
+     */
+    std::vector<short> samples;
+
+    /**
+     * @brief Constructor
+     */
+    SoundClip();
+  };
+
+  /**
+   * @class SoundMixer
+   *
+   * @brief Plays many voices (instances of sound clips being played) through
+   *        a single stereo PortAudio stream, mixing them in its callback.
+   *        Each voice has its own volume, pan and pitch (playback speed,
+   *        which also converts between the sample rate of the clip and that
+   *        of the mixer).
+   *
+   *        Voices are controlled from any thread through a queue of commands
+   *        that the audio callback picks up without locking, so that the
+   *        callback never waits for the game code. The clips being played
+   *        (or streams) are kept alive by the mixer until their voices have
+   *        finished.
+   *
+   *        Voices can also be positioned in the world, in which case their
+   *        gains and pitch are worked out from their position relative to
+   *        the listener (see setListener) once per block of samples:
+   *        attenuation with distance, panning and the Doppler effect. If
+   *        more voices are requested than can be mixed, the quietest ones
+   *        are stopped to make room for louder ones.
+   *
+   *        A mixer created with the null output has no stream. The mix is
+   *        rendered offline instead, by calling render or renderToFile.
+   */
+
+  class SoundMixer {
+  private:
+
+    struct Command;
+    struct QueueSlot;
+    struct Voice;
+
+    MixerOutput output;
+    int rate;
+    PaStream *stream;
+    bool paInitialised;
+
+    // Commands, from any thread to the audio thread: a bounded multiple
+    // producer queue (Vyukov).
+    std::unique_ptr<QueueSlot[]> commands;
+    size_t commandMask;
+    std::atomic<size_t> enqueuePos;
+    size_t dequeuePos;
+
+    // Handles of finished voices, from the audio thread back to the game
+    // code: a single producer, single consumer ring.
+    std::unique_ptr<std::atomic<unsigned int>[]> finished;
+    size_t finishedSize;
+    std::atomic<size_t> finishedHead;
+    std::atomic<size_t> finishedTail;
+
+    // Used by the audio thread only
+    std::unique_ptr<Voice[]> voices;
+    std::vector<float> mixBuffer;
+    uint64_t frameCount;
+
+    std::atomic<uint64_t> numFramesMixed;
+
+    // The listener, used by the audio thread only (set through the command
+    // queue). The distance model can be changed from any thread.
+    glm::vec3 listenerPosition;
+    glm::vec3 listenerVelocity;
+    glm::mat3 listenerRotation;
+    std::atomic<float> referenceDistance;
+    std::atomic<float> maxDistance;
+    std::atomic<float> rolloffFactor;
+    std::atomic<float> speedOfSound;
+
+    // Used by the game code only. The clips or streams of voices that have
+    // been requested and have not finished yet.
+    std::mutex sourcesMutex;
+    std::unordered_map<unsigned int,
+		       std::shared_ptr<const void> > voiceSources;
+    unsigned int lastHandle;
+
+    static int audioCallback(const void *inputBuffer, void *outputBuffer,
+			     unsigned long framesPerBuffer,
+			     const PaStreamCallbackTimeInfo *timeInfo,
+			     PaStreamCallbackFlags statusFlags,
+			     void *userData);
+
+    void openStream();
+    bool push(const Command &command);
+    unsigned int start(Command &command,
+		       const std::shared_ptr<const void> source);
+    void collectFinished();
+    void reportFinished(const unsigned int handle);
+    void finishVoice(Voice &voice);
+    float getAttenuation(const glm::vec3 &position) const;
+    Voice* getFreeVoice(const float audibility);
+    void updateGains(Voice &voice);
+    void processCommands();
+    void mixVoice(Voice &voice, float *buffer, const unsigned long numFrames);
+    void mixStream(Voice &voice, float *buffer,
+		   const unsigned long numFrames);
+    void mix(short *output, const unsigned long numFrames);
+
+  public:
+
+    /**
+     * @brief Get the mixer playing on the default output device, which is
+     *        used by Sound objects unless they are given another one. If
+     *        there is no output device, the voices played on it are
+     *        discarded.
+     * @return The mixer
+     */
+    static SoundMixer& getInstance();
+
+    /**
+     * @brief Constructor
+     * @param output With mixerdevice, a stream is opened on the default
+     *               output device and started. With mixernull, there is no
+     *               stream and the mix is rendered offline.
+     * @param rate   The sample rate of the mix
+     */
+    SoundMixer(const MixerOutput output = mixerdevice,
+	       const int rate = 44100);
+
+    /**
+     * @brief Destructor. Stops the stream.
+     */
+    ~SoundMixer();
+
+    SoundMixer(const SoundMixer&) = delete;
+    SoundMixer& operator=(const SoundMixer&) = delete;
+
+    /**
+     * @brief Start playing a clip on a new voice.
+     * @param clip   The clip. It is kept alive until the voice has finished.
+     * @param repeat Repeat the clip (without gaps) until the voice is stopped?
+     * @param volume The volume (1 plays the clip as it is)
+     * @param pan    The pan, from -1 (left only) through 0 (centre) to 1
+     *               (right only)
+     * @param pitch  The pitch (2 plays the clip twice as fast, one octave
+     *               higher)
+     * @param startFrame The frame of the mix (see getNumFramesMixed) at
+     *               which to start playing, exactly. If it has already been
+     *               mixed (e.g. 0), the clip starts as soon as possible.
+     * @return       The handle of the voice, or 0 if the clip will not be
+     *               played (no output device, or the command queue is full)
+     */
+    unsigned int play(const std::shared_ptr<const SoundClip> clip,
+		      const bool repeat = false, const float volume = 1.0f,
+		      const float pan = 0.0f, const float pitch = 1.0f,
+		      const uint64_t startFrame = 0);
+
+    /**
+     * @brief Start playing a stream on a new voice. The stream is read from
+     *        where it is (see SoundStream::seek) and repeats if it has been
+     *        set to. If it is already playing on another voice, the new
+     *        voice finishes immediately.
+     * @param stream The stream. It is kept alive until the voice has
+     *               finished.
+     * @param volume The volume
+     * @param pan    The pan, from -1 (left only) to 1 (right only)
+     * @param pitch  The pitch
+     * @param startFrame The frame of the mix at which to start playing
+     * @return       The handle of the voice, or 0 if the stream will not be
+     *               played (no output device, or the command queue is full)
+     */
+    unsigned int play(const std::shared_ptr<SoundStream> stream,
+		      const float volume = 1.0f, const float pan = 0.0f,
+		      const float pitch = 1.0f, const uint64_t startFrame = 0);
+
+    /**
+     * @brief Start playing a clip on a new voice, at a position in the world.
+     * @param clip     The clip
+     * @param position The position of the voice (e.g. the offset of the
+     *                 SceneObject making the sound)
+     * @param velocity The velocity of the voice, in world units per second,
+     *                 for the Doppler effect
+     * @param repeat   Repeat the clip until the voice is stopped?
+     * @param volume   The volume, before attenuation with distance
+     * @param pitch    The pitch, before the Doppler effect
+     * @param startFrame The frame of the mix at which to start playing
+     * @return         The handle of the voice, or 0 if the clip will not be
+     *                 played
+     */
+    unsigned int play(const std::shared_ptr<const SoundClip> clip,
+		      const glm::vec3 position, const glm::vec3 velocity,
+		      const bool repeat = false, const float volume = 1.0f,
+		      const float pitch = 1.0f, const uint64_t startFrame = 0);
+
+    /**
+     * @brief Start playing a stream on a new voice, at a position in the
+     *        world.
+     * @param stream   The stream
+     * @param position The position of the voice
+     * @param velocity The velocity of the voice, in world units per second
+     * @param volume   The volume, before attenuation with distance
+     * @param pitch    The pitch, before the Doppler effect
+     * @param startFrame The frame of the mix at which to start playing
+     * @return         The handle of the voice, or 0 if the stream will not
+     *                 be played
+     */
+    unsigned int play(const std::shared_ptr<SoundStream> stream,
+		      const glm::vec3 position, const glm::vec3 velocity,
+		      const float volume = 1.0f, const float pitch = 1.0f,
+		      const uint64_t startFrame = 0);
+
+    /**
+     * @brief Stop a voice. Nothing happens if it has already finished.
+     * @param voice The handle of the voice
+     */
+    void stop(const unsigned int voice);
+
+    /**
+     * @brief Set the volume of a voice. To avoid clicks, the change is
+     *        spread over the next block of samples that are mixed.
+     * @param voice  The handle of the voice
+     * @param volume The volume
+     */
+    void setVolume(const unsigned int voice, const float volume);
+
+    /**
+     * @brief Set the pan of a voice
+     * @param voice The handle of the voice
+     * @param pan   The pan, from -1 (left) to 1 (right)
+     */
+    void setPan(const unsigned int voice, const float pan);
+
+    /**
+     * @brief Set the pitch of a voice
+     * @param voice The handle of the voice
+     * @param pitch The pitch
+     */
+    void setPitch(const unsigned int voice, const float pitch);
+
+    /**
+     * @brief Position a voice in the world. From then on, its pan is worked
+     *        out from its position relative to the listener.
+     * @param voice    The handle of the voice
+     * @param position The position of the voice
+     * @param velocity The velocity of the voice, in world units per second
+     */
+    void setPosition(const unsigned int voice, const glm::vec3 position,
+		     const glm::vec3 velocity);
+
+    /**
+     * @brief Stop positioning a voice in the world. It is played with its
+     *        own volume and pan again.
+     * @param voice The handle of the voice
+     */
+    void clearPosition(const unsigned int voice);
+
+    /**
+     * @brief Set the listener, against which positioned voices are heard.
+     *        It is normally the camera, and this is called every frame with
+     *        the Renderer's cameraPosition and cameraRotation.
+     * @param position The position of the listener
+     * @param rotation The rotation of the listener (around the x, y and z
+     *                 axes), as in Renderer::cameraRotation
+     * @param velocity The velocity of the listener, in world units per
+     *                 second, for the Doppler effect
+     */
+    void setListener(const glm::vec3 position, const glm::vec3 rotation,
+		     const glm::vec3 velocity = glm::vec3(0.0f));
+
+    /**
+     * @brief Set how positioned voices are attenuated with distance. The
+     *        gain is referenceDistance / (referenceDistance + rolloffFactor
+     *        * (distance - referenceDistance)), with the distance clamped
+     *        between referenceDistance and maxDistance.
+     * @param referenceDistance The distance up to which voices are not
+     *                          attenuated (default 1)
+     * @param maxDistance       The distance after which voices are not
+     *                          attenuated any further (default 1000)
+     * @param rolloffFactor     How fast voices are attenuated (default 1)
+     */
+    void setDistanceModel(const float referenceDistance,
+			  const float maxDistance,
+			  const float rolloffFactor);
+
+    /**
+     * @brief Set the speed of sound, for the Doppler effect.
+     * @param speedOfSound The speed of sound, in world units per second
+     *                     (default 343). 0 disables the Doppler effect.
+     */
+    void setSpeedOfSound(const float speedOfSound);
+
+    /**
+     * @brief Check if a voice has been requested and has not finished yet.
+     * @param voice The handle of the voice
+     * @return True if it is playing (or about to start), false otherwise
+     */
+    bool isPlaying(const unsigned int voice);
+
+    /**
+     * @brief Get the number of voices that are playing (or about to start).
+     * @return The number of voices
+     */
+    size_t getNumVoices();
+
+    /**
+     * @brief Get the number of frames that have been mixed so far, which is
+     *        the clock of the mixer. Timing is best based on it, rather than
+     *        on the time of the system, in order to start voices exactly
+     *        when intended, e.g. on the beat of music that is playing.
+     * @return The number of frames
+     */
+    uint64_t getNumFramesMixed() const;
+
+    /**
+     * @brief Get the sample rate of the mix.
+     * @return The sample rate
+     */
+    int getRate() const;
+
+    /**
+     * @brief Get the output of the mixer.
+     * @return The output
+     */
+    MixerOutput getOutput() const;
+
+    /**
+     * @brief Check if the mixer can be heard, i.e. it has the device output
+     *        and an output device has been found.
+     * @return True if the mixer has an output device, false otherwise
+     */
+    bool hasOutputDevice() const;
+
+    /**
+     * @brief Render the next frames of the mix (for the null output only),
+     *        just as the audio callback would.
+     * @param [out] samples   The stereo samples, interleaved
+     * @param       numFrames The number of frames to render
+     */
+    void render(std::vector<short> &samples, const unsigned long numFrames);
+
+    /**
+     * @brief Render the next frames of the mix to a (16-bit, stereo) wav
+     *        file (for the null output only).
+     * @param filePath  The path of the file
+     * @param numFrames The number of frames to render
+     */
+    void renderToFile(const std::string filePath,
+		      const unsigned long numFrames);
+
+  };
+
+}
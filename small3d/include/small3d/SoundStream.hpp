@@ -0,0 +1,180 @@
+/**
+ * @file  SoundStream.hpp
+ * @brief Header of the SoundStream class
+ *
+ *  Created on: 2026/10/19
+ *      Author: Dimitri Kourkoulis
+ *     License: BSD 3-Clause License (see LICENSE file)
+ */
+
+#pragma once
+
+#include <vorbis/vorbisfile.h>
+#include <string>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdio>
+
+namespace small3d {
+
+  class SoundMixer;
+
+  /**
+   * @class SoundStream
+   *
+   * @brief Plays an ogg file without decoding all of it in advance, for long
+   *        sounds like music. A background thread decodes the file into a
+   *        ring buffer, keeping it a little ahead of the audio callback,
+   *        which reads from it without locking. Only the ring buffer is kept
+   *        in memory, however long the file is.
+   *
+   *        Looping and seeking are done by the decoding thread, so they also
+   *        do not need the whole file to be decoded. A stream can only be
+   *        played on one voice at a time. It is normally used through a
+   *        streaming Sound (see the Sound constructors).
+   */
+
+  class SoundStream {
+  private:
+
+    std::string filePath;
+    FILE *fp;
+    OggVorbis_File vorbisFile;
+    int channels;
+    int rate;
+    unsigned long numFrames;
+
+    // Single producer (decoder thread), single consumer (audio thread)
+    // ring of frames. The indexes count frames since the stream was opened.
+    std::unique_ptr<short[]> ring;
+    size_t ringMask;
+    std::atomic<size_t> writeIndex;
+    std::atomic<size_t> readIndex;
+
+    // Seeking: the game code requests, the decoder thread seeks and tells
+    // the audio thread from which index the data is valid again.
+    std::atomic<unsigned long> seekFrame;
+    std::atomic<unsigned int> requestedGeneration;
+    std::atomic<unsigned int> handledGeneration;
+    std::atomic<size_t> flushIndex;
+    std::atomic<unsigned long> flushFrame;
+    std::atomic<unsigned int> acknowledgedGeneration;
+
+    // Set by the audio thread while a voice is playing the stream
+    std::atomic<bool> attached;
+
+    std::atomic<bool> repeat;
+    std::atomic<bool> ended;
+    std::atomic<unsigned long> position;
+    std::atomic<unsigned long> numUnderruns;
+
+    // Used by the audio thread only
+    size_t localReadIndex;
+    size_t cachedWriteIndex;
+    unsigned long localPosition;
+    unsigned int seenGeneration;
+    bool seekPending;
+
+    std::mutex decoderMutex;
+    std::condition_variable decoderWakeUp;
+    bool stopping;
+    std::thread decoder;
+
+    void decoderLoop();
+
+    // Used by the audio thread (SoundMixer), around each block
+    void beginRead();
+    bool readFrame(short &left, short &right);
+    bool hasEnded() const;
+    void countUnderrun();
+    void endRead(const bool frameAhead);
+
+    friend class SoundMixer;
+
+  public:
+
+    /**
+     * @brief Constructor. Opens the file and starts decoding it.
+     * @param soundFilePath The path to the ogg file
+     * @param bufferSeconds How far ahead of the playback to decode
+     */
+    SoundStream(const std::string soundFilePath,
+		const double bufferSeconds = 0.5);
+
+    /**
+     * @brief Destructor. Stops the decoding thread and closes the file.
+     */
+    ~SoundStream();
+
+    SoundStream(const SoundStream&) = delete;
+    SoundStream& operator=(const SoundStream&) = delete;
+
+    /**
+     * @brief Get the path of the file being streamed.
+     * @return The path
+     */
+    const std::string& getFilePath() const;
+
+    /**
+     * @brief Get the number of channels.
+     * @return The number of channels
+     */
+    int getChannels() const;
+
+    /**
+     * @brief Get the sample rate.
+     * @return The sample rate
+     */
+    int getRate() const;
+
+    /**
+     * @brief Get the length of the stream.
+     * @return The number of frames
+     */
+    unsigned long getNumFrames() const;
+
+    /**
+     * @brief Set whether the stream starts again (without a gap) when it
+     *        reaches the end.
+     * @param repeat Repeat the stream?
+     */
+    void setRepeat(const bool repeat);
+
+    /**
+     * @brief Move to another position. Until the decoding thread has
+     *        decoded the new position, nothing is played.
+     * @param seconds The position, in seconds from the start
+     */
+    void seek(const double seconds);
+
+    /**
+     * @brief Get the position of the playback, as of the last audio callback.
+     * @return The position, in frames from the start
+     */
+    unsigned long getPosition() const;
+
+    /**
+     * @brief Get the number of frames that have been decoded but not played.
+     * @return The number of frames
+     */
+    size_t getNumBufferedFrames() const;
+
+    /**
+     * @brief Get the size of the ring buffer.
+     * @return The size of the ring buffer, in bytes
+     */
+    size_t getBufferSize() const;
+
+    /**
+     * @brief Get the number of blocks during which the audio callback ran out
+     *        of decoded frames and played silence.
+     * @return The number of underruns
+     */
+    unsigned long getNumUnderruns() const;
+
+  };
+
+}
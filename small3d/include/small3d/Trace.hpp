@@ -0,0 +1,95 @@
+/**
+ * @file  Trace.hpp
+ * @brief Tracing of the time spent in scoped zones
+ *
+ *  Created on: 2026/10/19
+ *      Author: Dimitri Kourkoulis
+ *     License: BSD 3-Clause License (see LICENSE file)
+ */
+
+#pragma once
+
+#include <string>
+#include <ostream>
+#include <cstdint>
+
+/**
+ * Zones are declared through a macro so that they can be completely omitted
+ * if tracing is deactivated (build with SMALL3D_TRACE defined to activate
+ * it). The name has to be a string literal.
+ */
+
+#define SMALL3D_TRACE_CONCAT2(A, B) A##B
+#define SMALL3D_TRACE_CONCAT(A, B) SMALL3D_TRACE_CONCAT2(A, B)
+
+#ifdef SMALL3D_TRACE
+#define TRACEZONE(NAME) \
+  small3d::TraceZone SMALL3D_TRACE_CONCAT(traceZone, __LINE__)(NAME)
+#else
+#define TRACEZONE(NAME)
+#endif
+
+namespace small3d {
+
+  /**
+   * @class TraceZone
+   *
+   * @brief Records the time from its construction to its destruction, i.e.
+   *        the time spent in the scope in which it is declared, as a trace
+   *        event. Each thread records its events in its own ring buffer,
+   *        without locking, so only the most recent events of each thread
+   *        are kept. Normally used through the TRACEZONE macro.
+   */
+
+  class TraceZone {
+  private:
+    const char *name;
+    int64_t startTime;
+
+  public:
+
+    /**
+     * @brief Constructor, starting the zone
+     * @param name The name of the zone. It is referenced, not copied, so it
+     *             has to remain valid (e.g. be a string literal).
+     */
+    TraceZone(const char *name);
+
+    /**
+     * @brief Destructor, ending the zone and recording it
+     */
+    ~TraceZone();
+
+    TraceZone(const TraceZone&) = delete;
+    TraceZone& operator=(const TraceZone&) = delete;
+  };
+
+  /**
+   * @brief Write the recorded trace events of all threads in the Chrome
+   *        trace event (JSON) format, which can be opened in chrome://tracing
+   *        or Perfetto. Zones that are still open are not included.
+   * @param stream The stream to write to
+   */
+  void writeTrace(std::ostream &stream);
+
+  /**
+   * @brief Write the recorded trace events of all threads to a file, in the
+   *        Chrome trace event (JSON) format.
+   * @param filePath The path of the file
+   */
+  void writeTrace(const std::string filePath);
+
+  /**
+   * @brief Discard the trace events recorded so far.
+   */
+  void clearTrace();
+
+  /**
+   * @brief Get the memory used for recording trace events. The buffer of a
+   *        thread is reused by other threads after it exits, so this only
+   *        grows with the number of threads recording at the same time.
+   * @return The size, in bytes
+   */
+  size_t getTraceByteSize();
+
+}
@@ -4,11 +4,23 @@ layout(location = 0) in vec4 position;
 layout(location = 1) in vec3 normal;
 layout(location = 2) in vec2 uvCoords;
 
+// The next frame of an animation, blended with the current one
+layout(location = 3) in vec4 nextPosition;
+layout(location = 4) in vec3 nextNormal;
+
+// The bones moving the vertex and their weights, if there is a skeleton
+layout(location = 5) in vec4 boneIndices;
+layout(location = 6) in vec4 boneWeights;
+
 smooth out float cosAngIncidence;
 out vec2 textureCoords;
 
 uniform vec3 offset;
 uniform mat4 perspectiveMatrix;
+uniform float frameBlend;
+
+uniform bool skinned;
+uniform mat4 boneMatrices[48];
 
 uniform mat4 xRotationMatrix;
 uniform mat4 yRotationMatrix;
@@ -24,7 +36,19 @@ uniform vec3 lightDirection;
 
 void main()
 {
-  vec4 worldPos = position * zRotationMatrix * xRotationMatrix 
+  vec4 blendedPosition = mix(position, nextPosition, frameBlend);
+  vec3 blendedNormal = mix(normal, nextNormal, frameBlend);
+
+  if (skinned) {
+    mat4 skin = boneWeights.x * boneMatrices[int(boneIndices.x)]
+      + boneWeights.y * boneMatrices[int(boneIndices.y)]
+      + boneWeights.z * boneMatrices[int(boneIndices.z)]
+      + boneWeights.w * boneMatrices[int(boneIndices.w)];
+    blendedPosition = skin * blendedPosition;
+    blendedNormal = mat3(skin) * blendedNormal;
+  }
+
+  vec4 worldPos = blendedPosition * zRotationMatrix * xRotationMatrix 
     * yRotationMatrix
     + vec4(offset.x, offset.y, offset.z, 0.0);
 
@@ -33,7 +57,7 @@ void main()
 
   gl_Position = perspectiveMatrix * cameraPos;
 
-  vec4 normalInWorld = normalize(perspectiveMatrix * (vec4(normal, 1) * zRotationMatrix * xRotationMatrix 
+  vec4 normalInWorld = normalize(perspectiveMatrix * (vec4(blendedNormal, 1) * zRotationMatrix * xRotationMatrix 
 						      * yRotationMatrix));   
     
   vec4 lightDirectionWorld = normalize(perspectiveMatrix * vec4(lightDirection, 1));
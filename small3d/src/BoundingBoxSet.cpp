@@ -7,13 +7,212 @@
  */
 
 #include "BoundingBoxSet.hpp"
+#include "Trace.hpp"
 #include <fstream>
 #include <stdexcept>
+#include <cmath>
+#include <algorithm>
 #include "GetTokens.hpp"
 #include <glm/gtc/matrix_transform.hpp>
+#include <cfloat>
+
+// Maximum rotation (in radians) of a box set during each step of a swept
+// collision check, and maximum number of steps
+#define MAX_SWEEP_STEP_ROTATION 0.05f
+#define MAX_SWEEP_STEPS 64
 
 namespace small3d {
   
+  // Rotation from box set space to world space
+  static glm::mat4 getRotationMatrix(const glm::vec3 &rotation) {
+    return glm::rotate(
+      glm::rotate(
+        glm::rotate(glm::mat4x4(1.0f), rotation.z,
+		    glm::vec3(0.0f, 0.0f, -1.0f)),
+	rotation.x,
+	glm::vec3(-1.0f, 0.0f, 0.0f)),
+      rotation.y, glm::vec3(0.0f, -1.0f, 0.0f));
+  }
+  
+  // Rotation from world space to box set space
+  static glm::mat4 getInverseRotationMatrix(const glm::vec3 &rotation) {
+    return glm::rotate(
+      glm::rotate(
+        glm::rotate(glm::mat4x4(1.0f), -rotation.y,
+		    glm::vec3(0.0f, -1.0f, 0.0f)),
+	-rotation.x,
+	glm::vec3(-1.0f, 0.0f, 0.0f)), -rotation.z,
+      glm::vec3(0.0f, 0.0f, -1.0f));
+  }
+  
+  // Separating axis test between two oriented boxes. t is the position of
+  // the centre of box b in the space of box a, r is the rotation of b in the
+  // space of a (r[i][j] being the dot product of axis i of a with axis j of b)
+  // and absR its absolute values (slightly increased, for the cross products
+  // of almost parallel axes). Based on "Real-Time Collision Detection" by
+  // Christer Ericson.
+  static bool orientedBoxesOverlap(const glm::vec3 &t, const glm::vec3 &a,
+				   const glm::vec3 &b, const float r[3][3],
+				   const float absR[3][3]) {
+    float ra, rb;
+
+    // Axes of box a
+    for (int i = 0; i < 3; ++i) {
+      ra = a[i];
+      rb = b[0] * absR[i][0] + b[1] * absR[i][1] + b[2] * absR[i][2];
+      if (std::abs(t[i]) > ra + rb) return false;
+    }
+
+    // Axes of box b
+    for (int i = 0; i < 3; ++i) {
+      ra = a[0] * absR[0][i] + a[1] * absR[1][i] + a[2] * absR[2][i];
+      rb = b[i];
+      if (std::abs(t[0] * r[0][i] + t[1] * r[1][i] + t[2] * r[2][i]) >
+	  ra + rb) return false;
+    }
+
+    // Cross products of the axes of a and b
+    ra = a[1] * absR[2][0] + a[2] * absR[1][0];
+    rb = b[1] * absR[0][2] + b[2] * absR[0][1];
+    if (std::abs(t[2] * r[1][0] - t[1] * r[2][0]) > ra + rb) return false;
+
+    ra = a[1] * absR[2][1] + a[2] * absR[1][1];
+    rb = b[0] * absR[0][2] + b[2] * absR[0][0];
+    if (std::abs(t[2] * r[1][1] - t[1] * r[2][1]) > ra + rb) return false;
+
+    ra = a[1] * absR[2][2] + a[2] * absR[1][2];
+    rb = b[0] * absR[0][1] + b[1] * absR[0][0];
+    if (std::abs(t[2] * r[1][2] - t[1] * r[2][2]) > ra + rb) return false;
+
+    ra = a[0] * absR[2][0] + a[2] * absR[0][0];
+    rb = b[1] * absR[1][2] + b[2] * absR[1][1];
+    if (std::abs(t[0] * r[2][0] - t[2] * r[0][0]) > ra + rb) return false;
+
+    ra = a[0] * absR[2][1] + a[2] * absR[0][1];
+    rb = b[0] * absR[1][2] + b[2] * absR[1][0];
+    if (std::abs(t[0] * r[2][1] - t[2] * r[0][1]) > ra + rb) return false;
+
+    ra = a[0] * absR[2][2] + a[2] * absR[0][2];
+    rb = b[0] * absR[1][1] + b[1] * absR[1][0];
+    if (std::abs(t[0] * r[2][2] - t[2] * r[0][2]) > ra + rb) return false;
+
+    ra = a[0] * absR[1][0] + a[1] * absR[0][0];
+    rb = b[1] * absR[2][2] + b[2] * absR[2][1];
+    if (std::abs(t[1] * r[0][0] - t[0] * r[1][0]) > ra + rb) return false;
+
+    ra = a[0] * absR[1][1] + a[1] * absR[0][1];
+    rb = b[0] * absR[2][2] + b[2] * absR[2][0];
+    if (std::abs(t[1] * r[0][1] - t[0] * r[1][1]) > ra + rb) return false;
+
+    ra = a[0] * absR[1][2] + a[1] * absR[0][2];
+    rb = b[0] * absR[2][1] + b[1] * absR[2][0];
+    if (std::abs(t[1] * r[0][2] - t[0] * r[1][2]) > ra + rb) return false;
+
+    return true;
+  }
+  
+  // Minimum squared distance from the origin of a point moving from p to
+  // p + velocity.
+  static float minDistanceSquared(const glm::vec3 &p,
+				  const glm::vec3 &velocity) {
+    float speedSquared = glm::dot(velocity, velocity);
+    float s = speedSquared > 0.0f ?
+      std::min(1.0f, std::max(0.0f, -glm::dot(p, velocity) / speedSquared)) :
+      0.0f;
+    glm::vec3 closest = p + s * velocity;
+    return glm::dot(closest, closest);
+  }
+
+  // Swept separating axis test between two oriented boxes. Box b moves from
+  // t to t + velocity (in the space of box a) without rotating. otherAxes
+  // are the axes of b in the space of a. If the boxes overlap at some point
+  // during the movement, the time at which they start overlapping (from 0
+  // to 1) and the axis along which they touch (pointing from a to b) are
+  // returned. If they already overlap at the start, the time is 0 and the
+  // axis is the one along which they overlap the least.
+  static bool orientedBoxesOverlapDuring(const glm::vec3 &t,
+					 const glm::vec3 &velocity,
+					 const glm::vec3 &a,
+					 const glm::vec3 &b,
+					 const glm::vec3 otherAxes[3],
+					 float &timeOfImpact,
+					 glm::vec3 &contactAxis) {
+    glm::vec3 axes[15];
+    int numAxes = 0;
+    for (int i = 0; i < 3; ++i) {
+      glm::vec3 axis(0.0f, 0.0f, 0.0f);
+      axis[i] = 1.0f;
+      axes[numAxes++] = axis;
+      axes[numAxes++] = otherAxes[i];
+    }
+    for (int i = 0; i < 3; ++i) {
+      glm::vec3 axis(0.0f, 0.0f, 0.0f);
+      axis[i] = 1.0f;
+      for (int j = 0; j < 3; ++j) {
+        glm::vec3 crossProduct = glm::cross(axis, otherAxes[j]);
+        float lengthSquared = glm::dot(crossProduct, crossProduct);
+        // Almost parallel axes are covered by the axes of the boxes.
+        if (lengthSquared > 1e-10f) {
+          axes[numAxes++] = crossProduct / std::sqrt(lengthSquared);
+        }
+      }
+    }
+
+    float enterTime = 0.0f, exitTime = 1.0f;
+    bool overlapsAtStart = true;
+    float minPenetration = FLT_MAX;
+    glm::vec3 enterAxis(0.0f, 0.0f, 0.0f), penetrationAxis(0.0f, 0.0f, 0.0f);
+
+    for (int idx = 0; idx < numAxes; ++idx) {
+      const glm::vec3 &axis = axes[idx];
+      float distance = glm::dot(t, axis);
+      float speed = glm::dot(velocity, axis);
+      float radius = a.x * std::abs(axis.x) + a.y * std::abs(axis.y) +
+	a.z * std::abs(axis.z) +
+	b.x * std::abs(glm::dot(axis, otherAxes[0])) +
+	b.y * std::abs(glm::dot(axis, otherAxes[1])) +
+	b.z * std::abs(glm::dot(axis, otherAxes[2]));
+      glm::vec3 towardsB = distance >= 0.0f ? axis : -axis;
+
+      if (std::abs(distance) <= radius) {
+        float penetration = radius - std::abs(distance);
+        if (penetration < minPenetration) {
+          minPenetration = penetration;
+          penetrationAxis = towardsB;
+        }
+        if (speed != 0.0f) {
+          exitTime = std::min(exitTime,
+			      ((speed > 0.0f ? radius : -radius) - distance) /
+			      speed);
+        }
+      }
+      else {
+        overlapsAtStart = false;
+        if (speed == 0.0f) return false;
+        float time1 = (-radius - distance) / speed;
+        float time2 = (radius - distance) / speed;
+        if (time1 > time2) std::swap(time1, time2);
+        if (time1 > enterTime) {
+          enterTime = time1;
+          enterAxis = towardsB;
+        }
+        exitTime = std::min(exitTime, time2);
+      }
+
+      if (enterTime > exitTime) return false;
+    }
+
+    if (overlapsAtStart) {
+      timeOfImpact = 0.0f;
+      contactAxis = penetrationAxis;
+    }
+    else {
+      timeOfImpact = enterTime;
+      contactAxis = enterAxis;
+    }
+    return true;
+  }
+  
   /**
    * Constructor
    */
@@ -23,6 +222,10 @@ namespace small3d {
     vertices.clear();
     facesVertexIndexes.clear();
     numBoxes = 0;
+    setMinCoords = glm::vec3(0.0f, 0.0f, 0.0f);
+    setMaxCoords = glm::vec3(0.0f, 0.0f, 0.0f);
+    setCentre = glm::vec3(0.0f, 0.0f, 0.0f);
+    setRadius = 0.0f;
     
     if (fileLocation != "") this->loadFromFile(fileLocation);
     
@@ -91,7 +294,57 @@ namespace small3d {
         }
       }
       
-      LOGINFO("Loaded " + intToStr(numBoxes) + " bounding boxes.");
+      // Precalculate the extents of each box (and of the whole set), in box
+      // set space, so that they do not have to be worked out from the
+      // vertices on every collision check.
+      flatVertices.clear();
+      for (auto vertex = vertices.begin(); vertex != vertices.end();
+	   ++vertex) {
+        flatVertices.push_back(glm::vec3((*vertex)[0], (*vertex)[1],
+					 (*vertex)[2]));
+      }
+
+      boxMinX.resize(static_cast<size_t>(numBoxes));
+      boxMaxX.resize(static_cast<size_t>(numBoxes));
+      boxMinY.resize(static_cast<size_t>(numBoxes));
+      boxMaxY.resize(static_cast<size_t>(numBoxes));
+      boxMinZ.resize(static_cast<size_t>(numBoxes));
+      boxMaxZ.resize(static_cast<size_t>(numBoxes));
+      boxRadius.resize(static_cast<size_t>(numBoxes));
+
+      for (size_t idx = 0; idx < static_cast<size_t>(numBoxes); ++idx) {
+        glm::vec3 minCoords = flatVertices[idx * 8];
+        glm::vec3 maxCoords = flatVertices[idx * 8];
+        for (size_t checkIdx = idx * 8; checkIdx < (idx + 1) * 8; ++checkIdx) {
+          minCoords = glm::min(minCoords, flatVertices[checkIdx]);
+          maxCoords = glm::max(maxCoords, flatVertices[checkIdx]);
+        }
+        boxMinX[idx] = minCoords.x;
+        boxMaxX[idx] = maxCoords.x;
+        boxMinY[idx] = minCoords.y;
+        boxMaxY[idx] = maxCoords.y;
+        boxMinZ[idx] = minCoords.z;
+        boxMaxZ[idx] = maxCoords.z;
+        boxRadius[idx] = glm::length(0.5f * (maxCoords - minCoords));
+
+        if (idx == 0) {
+          setMinCoords = minCoords;
+          setMaxCoords = maxCoords;
+        }
+        else {
+          setMinCoords = glm::min(setMinCoords, minCoords);
+          setMaxCoords = glm::max(setMaxCoords, maxCoords);
+        }
+      }
+
+      setCentre = 0.5f * (setMinCoords + setMaxCoords);
+      setRadius = 0.0f;
+      for (auto vertex = flatVertices.begin(); vertex != flatVertices.end();
+	   ++vertex) {
+        setRadius = std::max(setRadius, glm::length(*vertex - setCentre));
+      }
+      
+      LOGINFOF("Loaded {} bounding boxes.", numBoxes);
     }
     else
       throw std::runtime_error(
@@ -102,102 +355,141 @@ namespace small3d {
   bool BoundingBoxSet::collidesWith(const glm::vec3 point,
 				    const glm::vec3 thisOffset,
 				    const glm::vec3 thisRotation) const {
-    bool collides = false;
-    glm::mat4 rotationMatrix = 
-      glm::rotate(
-        glm::rotate(
-          glm::rotate(glm::mat4x4(1.0f), -thisRotation.y,
-		      glm::vec3(0.0f, -1.0f, 0.0f)),
-	  -thisRotation.x,
-	  glm::vec3(-1.0f, 0.0f, 0.0f)), -thisRotation.z,
-	glm::vec3(0.0f, 0.0f, -1.0f)
-      );
-    
-    glm::vec4 pointInBoxSpace = glm::vec4(point, 1.0f) -
-      glm::vec4(thisOffset, 0.0f);
-    
-    pointInBoxSpace = rotationMatrix * pointInBoxSpace;
-    
-    for (int idx = 0; idx < numBoxes; ++idx) {
-      float minZ, maxZ, minX, maxX, minY, maxY;
-      
-      glm::vec4 coords(vertices[static_cast<unsigned int>(idx * 8)][0],
-		       vertices[static_cast<unsigned int>(idx * 8)][1],
-                       vertices[static_cast<unsigned int>(idx * 8)][2], 1);
-      
-      glm::vec4 rotatedCoords;
-      rotatedCoords = coords;
-      
-      minX = rotatedCoords.x;
-      maxX = rotatedCoords.x;
-      minY = rotatedCoords.y;
-      maxY = rotatedCoords.y;
-      minZ = rotatedCoords.z;
-      maxZ = rotatedCoords.z;
-      
-      for (int checkidx = idx * 8; checkidx < (idx + 1) * 8; ++checkidx) {
-        coords = glm::vec4(vertices[static_cast<unsigned int>(checkidx)][0],
-			   vertices[static_cast<unsigned int>(checkidx)][1],
-                           vertices[static_cast<unsigned int>(checkidx)][2], 1);
-        rotatedCoords = coords;
-        
-        if (rotatedCoords.x < minX)
-          minX = rotatedCoords.x;
-        if (rotatedCoords.x > maxX)
-          maxX = rotatedCoords.x;
-        if (rotatedCoords.y < minY)
-          minY = rotatedCoords.y;
-        if (rotatedCoords.y > maxY)
-          maxY = rotatedCoords.y;
-        if (rotatedCoords.z < minZ)
-          minZ = rotatedCoords.z;
-        if (rotatedCoords.z > maxZ)
-          maxZ = rotatedCoords.z;
-      }
-      
-      if (pointInBoxSpace.x > minX && pointInBoxSpace.x < maxX &&
-          pointInBoxSpace.y > minY && pointInBoxSpace.y < maxY &&
-          pointInBoxSpace.z > minZ && pointInBoxSpace.z < maxZ) {
-        
-        collides = true;
-        break;
+    return collidesWith(&point, 1, thisOffset, thisRotation);
+  }
+  
+  bool BoundingBoxSet::collidesWith(const glm::vec3 *points,
+				    const size_t numPoints,
+				    const glm::vec3 thisOffset,
+				    const glm::vec3 thisRotation) const {
+    TRACEZONE("BoundingBoxSet::collidesWith(points)");
+    glm::mat4 rotationMatrix = getInverseRotationMatrix(thisRotation);
+
+    for (size_t idx = 0; idx < numPoints; ++idx) {
+      glm::vec4 pointInBoxSpace = rotationMatrix *
+	(glm::vec4(points[idx], 1.0f) - glm::vec4(thisOffset, 0.0f));
+
+      if (collidesInBoxSpace(glm::vec3(pointInBoxSpace.x, pointInBoxSpace.y,
+				       pointInBoxSpace.z))) {
+        return true;
       }
     }
-    return collides;
+
+    return false;
   }
   
-  bool BoundingBoxSet::collidesWith(const BoundingBoxSet otherBoxSet,
+  size_t BoundingBoxSet::findCollidingPoints(const glm::vec3 *points,
+					     const size_t numPoints,
+					     const glm::vec3 thisOffset,
+					     const glm::vec3 thisRotation,
+					     uint64_t *collisionMask) const {
+    if (numPoints == 0) return 0;
+    return findCollidingPoints(&points[0].x, &points[0].y, &points[0].z, 3,
+			       numPoints, thisOffset, thisRotation,
+			       collisionMask);
+  }
+
+  size_t BoundingBoxSet::findCollidingPoints(const float *x, const float *y,
+					     const float *z,
+					     const size_t numPoints,
+					     const glm::vec3 thisOffset,
+					     const glm::vec3 thisRotation,
+					     uint64_t *collisionMask) const {
+    return findCollidingPoints(x, y, z, 1, numPoints, thisOffset,
+			       thisRotation, collisionMask);
+  }
+
+  size_t BoundingBoxSet::findCollidingPoints(const float *x, const float *y,
+					     const float *z,
+					     const size_t stride,
+					     const size_t numPoints,
+					     const glm::vec3 &thisOffset,
+					     const glm::vec3 &thisRotation,
+					     uint64_t *collisionMask) const {
+    glm::mat4 rotationMatrix = getInverseRotationMatrix(thisRotation);
+    glm::vec3 column0(rotationMatrix[0].x, rotationMatrix[0].y,
+		      rotationMatrix[0].z);
+    glm::vec3 column1(rotationMatrix[1].x, rotationMatrix[1].y,
+		      rotationMatrix[1].z);
+    glm::vec3 column2(rotationMatrix[2].x, rotationMatrix[2].y,
+		      rotationMatrix[2].z);
+
+    // The points are processed in chunks, one for each word of the mask.
+    // They are transformed to box set space and then checked against each
+    // box, with all the points of the chunk checked in the same loop and
+    // without branching, so that the compiler can vectorise the loops.
+    float chunkX[64], chunkY[64], chunkZ[64];
+    int inside[64];
+    size_t numColliding = 0;
+
+    for (size_t chunkStart = 0; chunkStart < numPoints; chunkStart += 64) {
+      size_t chunkSize = std::min(static_cast<size_t>(64),
+				  numPoints - chunkStart);
+      const float *chunkStartX = x + chunkStart * stride;
+      const float *chunkStartY = y + chunkStart * stride;
+      const float *chunkStartZ = z + chunkStart * stride;
+
+      for (size_t idx = 0; idx < chunkSize; ++idx) {
+        float pointX = chunkStartX[idx * stride] - thisOffset.x;
+        float pointY = chunkStartY[idx * stride] - thisOffset.y;
+        float pointZ = chunkStartZ[idx * stride] - thisOffset.z;
+        chunkX[idx] = column0.x * pointX + column1.x * pointY +
+	  column2.x * pointZ;
+        chunkY[idx] = column0.y * pointX + column1.y * pointY +
+	  column2.y * pointZ;
+        chunkZ[idx] = column0.z * pointX + column1.z * pointY +
+	  column2.z * pointZ;
+        inside[idx] = 0;
+      }
+
+      for (int boxIdx = 0; boxIdx < numBoxes; ++boxIdx) {
+        float minX = boxMinX[boxIdx], maxX = boxMaxX[boxIdx];
+        float minY = boxMinY[boxIdx], maxY = boxMaxY[boxIdx];
+        float minZ = boxMinZ[boxIdx], maxZ = boxMaxZ[boxIdx];
+        for (size_t idx = 0; idx < chunkSize; ++idx) {
+          inside[idx] |= (chunkX[idx] > minX) & (chunkX[idx] < maxX) &
+	    (chunkY[idx] > minY) & (chunkY[idx] < maxY) &
+	    (chunkZ[idx] > minZ) & (chunkZ[idx] < maxZ);
+        }
+      }
+
+      uint64_t mask = 0;
+      for (size_t idx = 0; idx < chunkSize; ++idx) {
+        mask |= static_cast<uint64_t>(inside[idx]) << idx;
+        numColliding += static_cast<size_t>(inside[idx]);
+      }
+      collisionMask[chunkStart / 64] = mask;
+    }
+
+    return numColliding;
+  }
+
+  bool BoundingBoxSet::collidesWith(const BoundingBoxSet &otherBoxSet,
 				    const glm::vec3 thisOffset,
 				    const glm::vec3 thisRotation,
 				    const glm::vec3 otherOffset,
 				    const glm::vec3 otherRotation) const {
+    TRACEZONE("BoundingBoxSet::collidesWith");
     bool collides = false;
     
-    glm::mat4 rotationMatrix =
-      glm::rotate(
-        glm::rotate(
-          glm::rotate(glm::mat4x4(1.0f), otherRotation.z,
-		      glm::vec3(0.0f, 0.0f, -1.0f)),
-	  otherRotation.x,
-	  glm::vec3(-1.0f, 0.0f, 0.0f)),
-	otherRotation.y, glm::vec3(0.0f, -1.0f, 0.0f));
+    glm::mat4 rotationMatrix = getRotationMatrix(otherRotation);
+    glm::mat4 inverseRotationMatrix = getInverseRotationMatrix(thisRotation);
     
-    for (auto vertex = otherBoxSet.vertices.begin();
-         vertex != otherBoxSet.vertices.end(); ++vertex) {
-      
-      glm::vec4 otherCoords(vertex->at(0), vertex->at(1), vertex->at(2), 1.0f);
-      glm::vec4 rotatedOtherCoords;
+    for (auto vertex = otherBoxSet.flatVertices.begin();
+         vertex != otherBoxSet.flatVertices.end(); ++vertex) {
       
-      rotatedOtherCoords =  rotationMatrix * otherCoords;
+      glm::vec4 rotatedOtherCoords = rotationMatrix * glm::vec4(*vertex, 1.0f);
       
       rotatedOtherCoords.x += otherOffset.x;
       rotatedOtherCoords.y += otherOffset.y;
       rotatedOtherCoords.z += otherOffset.z;
       
-      if (collidesWith(glm::vec3(rotatedOtherCoords.x, rotatedOtherCoords.y,
-				 rotatedOtherCoords.z),
-		       thisOffset, thisRotation)) {
-        
+      glm::vec4 pointInBoxSpace = inverseRotationMatrix *
+	(glm::vec4(rotatedOtherCoords.x, rotatedOtherCoords.y,
+		   rotatedOtherCoords.z, 1.0f) - glm::vec4(thisOffset, 0.0f));
+      
+      if (collidesInBoxSpace(glm::vec3(pointInBoxSpace.x, pointInBoxSpace.y,
+				       pointInBoxSpace.z))) {
         collides = true;
         break;
       }
@@ -206,6 +498,351 @@ namespace small3d {
     return collides;
   }
   
+  bool BoundingBoxSet::collidesInBoxSpace(const glm::vec3 &point) const {
+    // No branching in the loop, so that the compiler can vectorise it.
+    int collides = 0;
+    const float *minX = boxMinX.data(), *maxX = boxMaxX.data();
+    const float *minY = boxMinY.data(), *maxY = boxMaxY.data();
+    const float *minZ = boxMinZ.data(), *maxZ = boxMaxZ.data();
+    for (int idx = 0; idx < numBoxes; ++idx) {
+      collides |= (point.x > minX[idx]) & (point.x < maxX[idx]) &
+	(point.y > minY[idx]) & (point.y < maxY[idx]) &
+	(point.z > minZ[idx]) & (point.z < maxZ[idx]);
+    }
+    return collides != 0;
+  }
+  
+  bool BoundingBoxSet::intersects(const BoundingBoxSet &otherBoxSet,
+				  const glm::vec3 thisOffset,
+				  const glm::vec3 thisRotation,
+				  const glm::vec3 otherOffset,
+				  const glm::vec3 otherRotation) const {
+    glm::mat3 thisRotationMatrix = glm::mat3(getRotationMatrix(thisRotation));
+    glm::mat3 otherRotationMatrix =
+      glm::mat3(getRotationMatrix(otherRotation));
+
+    // Early out if the bounding spheres of the two sets do not overlap
+    glm::vec3 centreDistance =
+      (otherRotationMatrix * otherBoxSet.setCentre + otherOffset) -
+      (thisRotationMatrix * setCentre + thisOffset);
+    float radiusSum = setRadius + otherBoxSet.setRadius;
+    if (glm::dot(centreDistance, centreDistance) > radiusSum * radiusSum) {
+      return false;
+    }
+
+    // All the boxes of a set share its rotation, so the rotation of the other
+    // set's boxes in the space of this set's boxes is the same for all pairs.
+    float r[3][3], absR[3][3];
+    for (int i = 0; i < 3; ++i) {
+      for (int j = 0; j < 3; ++j) {
+        r[i][j] = glm::dot(thisRotationMatrix[i], otherRotationMatrix[j]);
+        absR[i][j] = std::abs(r[i][j]) + 1e-6f;
+      }
+    }
+
+    glm::vec3 worldOffset = otherOffset - thisOffset;
+    glm::vec3 otherOffsetInThisSpace(glm::dot(thisRotationMatrix[0],
+					      worldOffset),
+				     glm::dot(thisRotationMatrix[1],
+					      worldOffset),
+				     glm::dot(thisRotationMatrix[2],
+					      worldOffset));
+
+    for (size_t otherIdx = 0;
+	 otherIdx < static_cast<size_t>(otherBoxSet.numBoxes); ++otherIdx) {
+      glm::vec3 otherMinCoords(otherBoxSet.boxMinX[otherIdx],
+			       otherBoxSet.boxMinY[otherIdx],
+			       otherBoxSet.boxMinZ[otherIdx]);
+      glm::vec3 otherMaxCoords(otherBoxSet.boxMaxX[otherIdx],
+			       otherBoxSet.boxMaxY[otherIdx],
+			       otherBoxSet.boxMaxZ[otherIdx]);
+      glm::vec3 otherCentre = 0.5f * (otherMinCoords + otherMaxCoords);
+      glm::vec3 otherHalfSize = 0.5f * (otherMaxCoords - otherMinCoords);
+
+      glm::vec3 otherCentreInThisSpace = otherOffsetInThisSpace;
+      for (int i = 0; i < 3; ++i) {
+        otherCentreInThisSpace[i] += r[i][0] * otherCentre.x +
+	  r[i][1] * otherCentre.y + r[i][2] * otherCentre.z;
+      }
+
+      for (size_t idx = 0; idx < static_cast<size_t>(numBoxes); ++idx) {
+        glm::vec3 minCoords(boxMinX[idx], boxMinY[idx], boxMinZ[idx]);
+        glm::vec3 maxCoords(boxMaxX[idx], boxMaxY[idx], boxMaxZ[idx]);
+
+        glm::vec3 t = otherCentreInThisSpace - 0.5f * (minCoords + maxCoords);
+
+        float boxRadiusSum = boxRadius[idx] + otherBoxSet.boxRadius[otherIdx];
+        if (glm::dot(t, t) > boxRadiusSum * boxRadiusSum) continue;
+
+        if (orientedBoxesOverlap(t, 0.5f * (maxCoords - minCoords),
+				 otherHalfSize, r, absR)) {
+          return true;
+        }
+      }
+    }
+
+    return false;
+  }
+  
+  bool BoundingBoxSet::findFirstBoxHit(const glm::vec3 &start,
+				       const glm::vec3 &direction,
+				       const float maxTime, float &time,
+				       int &axis) const {
+    float closestTime = maxTime;
+    int closestAxis = -1;
+    bool found = false;
+
+    for (int idx = 0; idx < numBoxes; ++idx) {
+      float minCoords[3] = {boxMinX[idx], boxMinY[idx], boxMinZ[idx]};
+      float maxCoords[3] = {boxMaxX[idx], boxMaxY[idx], boxMaxZ[idx]};
+
+      // Slab test. The time at which the line enters the box is the latest
+      // of the times at which it enters the slab of each axis.
+      float enterTime = 0.0f, exitTime = maxTime;
+      int enterAxis = -1;
+      bool misses = false;
+      for (int checkAxis = 0; checkAxis < 3 && !misses; ++checkAxis) {
+        if (direction[checkAxis] == 0.0f) {
+          misses = start[checkAxis] < minCoords[checkAxis] ||
+	    start[checkAxis] > maxCoords[checkAxis];
+        }
+        else {
+          float time1 = (minCoords[checkAxis] - start[checkAxis]) /
+	    direction[checkAxis];
+          float time2 = (maxCoords[checkAxis] - start[checkAxis]) /
+	    direction[checkAxis];
+          if (time1 > time2) std::swap(time1, time2);
+          if (time1 > enterTime) {
+            enterTime = time1;
+            enterAxis = checkAxis;
+          }
+          exitTime = std::min(exitTime, time2);
+          misses = enterTime > exitTime;
+        }
+      }
+
+      if (!misses && (!found || enterTime < closestTime)) {
+        closestTime = enterTime;
+        closestAxis = enterAxis;
+        found = true;
+      }
+    }
+
+    if (found) {
+      time = closestTime;
+      axis = closestAxis;
+    }
+    return found;
+  }
+
+  bool BoundingBoxSet::intersectsSegment(const glm::vec3 start,
+					 const glm::vec3 end,
+					 const glm::vec3 thisOffset,
+					 const glm::vec3 thisRotation,
+					 float &timeOfImpact,
+					 glm::vec3 &normal) const {
+    return castRay(start, end - start, thisOffset, thisRotation, 1.0f,
+		   timeOfImpact, normal);
+  }
+
+  bool BoundingBoxSet::intersectsRay(const glm::vec3 origin,
+				     const glm::vec3 direction,
+				     const glm::vec3 thisOffset,
+				     const glm::vec3 thisRotation,
+				     float &distance,
+				     glm::vec3 &normal) const {
+    return castRay(origin, direction, thisOffset, thisRotation, FLT_MAX,
+		   distance, normal);
+  }
+
+  bool BoundingBoxSet::castRay(const glm::vec3 &origin,
+			       const glm::vec3 &direction,
+			       const glm::vec3 &thisOffset,
+			       const glm::vec3 &thisRotation,
+			       const float maxDistance, float &distance,
+			       glm::vec3 &normal) const {
+    glm::mat4 inverseRotationMatrix = getInverseRotationMatrix(thisRotation);
+    glm::vec4 originInBoxSpace = inverseRotationMatrix *
+      (glm::vec4(origin, 1.0f) - glm::vec4(thisOffset, 0.0f));
+    glm::vec4 directionInBoxSpace = inverseRotationMatrix *
+      glm::vec4(direction, 0.0f);
+    glm::vec3 direction3(directionInBoxSpace.x, directionInBoxSpace.y,
+			 directionInBoxSpace.z);
+
+    float time;
+    int axis;
+    if (!findFirstBoxHit(glm::vec3(originInBoxSpace.x, originInBoxSpace.y,
+				   originInBoxSpace.z), direction3,
+			 maxDistance, time, axis)) {
+      return false;
+    }
+
+    distance = time;
+
+    glm::vec3 normalInBoxSpace(0.0f, 0.0f, 0.0f);
+    if (axis != -1) {
+      normalInBoxSpace[axis] = direction3[axis] > 0.0f ? -1.0f : 1.0f;
+    }
+    else {
+      // The line starts inside a box.
+      float length = std::sqrt(glm::dot(direction3, direction3));
+      if (length > 0.0f) normalInBoxSpace = -direction3 / length;
+    }
+    normal = glm::mat3(getRotationMatrix(thisRotation)) * normalInBoxSpace;
+
+    return true;
+  }
+
+  bool BoundingBoxSet::intersectsDuring(const BoundingBoxSet &otherBoxSet,
+					const glm::vec3 thisStartOffset,
+					const glm::vec3 thisStartRotation,
+					const glm::vec3 thisEndOffset,
+					const glm::vec3 thisEndRotation,
+					const glm::vec3 otherStartOffset,
+					const glm::vec3 otherStartRotation,
+					const glm::vec3 otherEndOffset,
+					const glm::vec3 otherEndRotation,
+					float &timeOfImpact,
+					glm::vec3 &normal) const {
+    // The sets move linearly, and the rotation is considered constant during
+    // each step, so rotating sets are checked in several steps.
+    float maxRotation = 0.0f;
+    for (int axis = 0; axis < 3; ++axis) {
+      maxRotation = std::max(maxRotation,
+			     std::abs(thisEndRotation[axis] -
+				      thisStartRotation[axis]));
+      maxRotation = std::max(maxRotation,
+			     std::abs(otherEndRotation[axis] -
+				      otherStartRotation[axis]));
+    }
+    int numSteps = std::min(MAX_SWEEP_STEPS,
+			    1 + static_cast<int>(maxRotation /
+						 MAX_SWEEP_STEP_ROTATION));
+
+    // Spheres around the offsets, enclosing the sets whatever their rotation
+    float thisRadius = std::sqrt(glm::dot(setCentre, setCentre)) + setRadius;
+    float otherRadius = std::sqrt(glm::dot(otherBoxSet.setCentre,
+					   otherBoxSet.setCentre)) +
+      otherBoxSet.setRadius;
+    float radiusSum = thisRadius + otherRadius;
+    glm::vec3 relativeStart = otherStartOffset - thisStartOffset;
+    if (minDistanceSquared(relativeStart,
+			   otherEndOffset - otherStartOffset -
+			   (thisEndOffset - thisStartOffset)) >
+	radiusSum * radiusSum) {
+      return false;
+    }
+
+    for (int step = 0; step < numSteps; ++step) {
+      float stepStart = static_cast<float>(step) / numSteps;
+      float stepEnd = static_cast<float>(step + 1) / numSteps;
+      float stepMiddle = 0.5f * (stepStart + stepEnd);
+
+      glm::mat3 thisRotationMatrix =
+	glm::mat3(getRotationMatrix(thisStartRotation + stepMiddle *
+				    (thisEndRotation - thisStartRotation)));
+      glm::mat3 otherRotationMatrix =
+	glm::mat3(getRotationMatrix(otherStartRotation + stepMiddle *
+				    (otherEndRotation - otherStartRotation)));
+
+      glm::vec3 worldOffset = relativeStart + stepStart *
+	(otherEndOffset - otherStartOffset -
+	 (thisEndOffset - thisStartOffset));
+      glm::vec3 worldVelocity = (stepEnd - stepStart) *
+	(otherEndOffset - otherStartOffset -
+	 (thisEndOffset - thisStartOffset));
+
+      glm::vec3 otherOffsetInThisSpace, velocity;
+      float r[3][3];
+      glm::vec3 otherAxes[3];
+      for (int i = 0; i < 3; ++i) {
+        otherOffsetInThisSpace[i] = glm::dot(thisRotationMatrix[i],
+					     worldOffset);
+        velocity[i] = glm::dot(thisRotationMatrix[i], worldVelocity);
+        for (int j = 0; j < 3; ++j) {
+          r[i][j] = glm::dot(thisRotationMatrix[i], otherRotationMatrix[j]);
+        }
+      }
+      for (int j = 0; j < 3; ++j) {
+        otherAxes[j] = glm::vec3(r[0][j], r[1][j], r[2][j]);
+      }
+
+      float closestTime = 2.0f;
+      glm::vec3 closestAxis(0.0f, 0.0f, 0.0f);
+
+      for (size_t otherIdx = 0;
+	   otherIdx < static_cast<size_t>(otherBoxSet.numBoxes); ++otherIdx) {
+        glm::vec3 otherMinCoords(otherBoxSet.boxMinX[otherIdx],
+				 otherBoxSet.boxMinY[otherIdx],
+				 otherBoxSet.boxMinZ[otherIdx]);
+        glm::vec3 otherMaxCoords(otherBoxSet.boxMaxX[otherIdx],
+				 otherBoxSet.boxMaxY[otherIdx],
+				 otherBoxSet.boxMaxZ[otherIdx]);
+        glm::vec3 otherCentre = 0.5f * (otherMinCoords + otherMaxCoords);
+        glm::vec3 otherHalfSize = 0.5f * (otherMaxCoords - otherMinCoords);
+
+        glm::vec3 otherCentreInThisSpace = otherOffsetInThisSpace;
+        for (int i = 0; i < 3; ++i) {
+          otherCentreInThisSpace[i] += r[i][0] * otherCentre.x +
+	    r[i][1] * otherCentre.y + r[i][2] * otherCentre.z;
+        }
+
+        for (size_t idx = 0; idx < static_cast<size_t>(numBoxes); ++idx) {
+          glm::vec3 minCoords(boxMinX[idx], boxMinY[idx], boxMinZ[idx]);
+          glm::vec3 maxCoords(boxMaxX[idx], boxMaxY[idx], boxMaxZ[idx]);
+
+          glm::vec3 t = otherCentreInThisSpace - 0.5f *
+	    (minCoords + maxCoords);
+
+          float boxRadiusSum = boxRadius[idx] +
+	    otherBoxSet.boxRadius[otherIdx];
+          if (minDistanceSquared(t, velocity) > boxRadiusSum * boxRadiusSum) {
+            continue;
+          }
+
+          float time;
+          glm::vec3 axis;
+          if (orientedBoxesOverlapDuring(t, velocity,
+					 0.5f * (maxCoords - minCoords),
+					 otherHalfSize, otherAxes, time, axis) &&
+	      time < closestTime) {
+            closestTime = time;
+            closestAxis = axis;
+          }
+        }
+      }
+
+      if (closestTime <= 1.0f) {
+        timeOfImpact = stepStart + closestTime * (stepEnd - stepStart);
+        normal = thisRotationMatrix * closestAxis;
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  void BoundingBoxSet::getWorldExtents(const glm::vec3 thisOffset,
+				       const glm::vec3 thisRotation,
+				       glm::vec3 &minCoords,
+				       glm::vec3 &maxCoords) const {
+    glm::mat3 rotationMatrix = glm::mat3(getRotationMatrix(thisRotation));
+
+    // Rotate the centre of the set extents and project their half size on
+    // the world axes, instead of rotating all the corners.
+    glm::vec3 centre = 0.5f * (setMinCoords + setMaxCoords);
+    glm::vec3 halfSize = 0.5f * (setMaxCoords - setMinCoords);
+
+    glm::vec3 worldCentre = rotationMatrix * centre + thisOffset;
+    glm::vec3 worldHalfSize(0.0f, 0.0f, 0.0f);
+    for (int axis = 0; axis < 3; ++axis) {
+      worldHalfSize += glm::abs(rotationMatrix[axis]) * halfSize[axis];
+    }
+
+    minCoords = worldCentre - worldHalfSize;
+    maxCoords = worldCentre + worldHalfSize;
+  }
+  
   int BoundingBoxSet::getNumBoxes() const {
     return numBoxes;
   }
@@ -0,0 +1,290 @@
+/*
+ *  CollisionWorld.cpp
+ *
+ *  Created on: 2026/10/19
+ *      Author: Dimitri Kourkoulis
+ *     License: BSD 3-Clause License (see LICENSE file)
+ */
+
+#include "CollisionWorld.hpp"
+#include <stdexcept>
+#include <algorithm>
+#include <cfloat>
+
+namespace small3d {
+
+  // Spread the lower 10 bits of a number, so that there are two zero bits
+  // between each of them, for interleaving into a Morton code.
+  static unsigned int expandBits(unsigned int v) {
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+  }
+
+  CollisionWorld::CollisionWorld() {
+    numLeafSlots = 0;
+  }
+
+  void CollisionWorld::add(SceneObject &sceneObject) {
+    if (sceneObject.boundingBoxSet.vertices.size() == 0) {
+      throw std::runtime_error("No bounding boxes have been provided for " +
+			       sceneObject.getName() +
+			       ", so it cannot be added to a collision world.");
+    }
+
+    for (auto proxy = proxies.begin(); proxy != proxies.end(); ++proxy) {
+      if (proxy->sceneObject == &sceneObject) {
+        throw std::runtime_error("Object " + sceneObject.getName() +
+				 " has already been added to the collision "
+				 "world.");
+      }
+    }
+
+    Proxy proxy;
+    proxy.sceneObject = &sceneObject;
+    sceneObject.boundingBoxSet.getWorldExtents(sceneObject.offset,
+					       sceneObject.rotation,
+					       proxy.minCoords,
+					       proxy.maxCoords);
+    proxy.mortonCode = 0;
+    proxies.push_back(proxy);
+    sortedProxies.push_back(proxies.size() - 1);
+  }
+
+  void CollisionWorld::remove(const SceneObject &sceneObject) {
+    size_t removedIdx = proxies.size();
+    for (size_t idx = 0; idx < proxies.size(); ++idx) {
+      if (proxies[idx].sceneObject == &sceneObject) {
+        removedIdx = idx;
+        break;
+      }
+    }
+
+    if (removedIdx == proxies.size()) return;
+
+    // Move the last proxy into the place of the removed one and fix the
+    // sorted indexes accordingly.
+    size_t lastIdx = proxies.size() - 1;
+    proxies[removedIdx] = proxies[lastIdx];
+    proxies.pop_back();
+
+    size_t sortedPos = 0;
+    for (size_t idx = 0; idx < sortedProxies.size(); ++idx) {
+      if (sortedProxies[idx] == removedIdx) {
+        sortedPos = idx;
+      }
+      else {
+        if (sortedProxies[idx] == lastIdx) {
+          sortedProxies[idx] = removedIdx;
+        }
+      }
+    }
+    sortedProxies.erase(sortedProxies.begin() +
+			static_cast<std::ptrdiff_t>(sortedPos));
+
+    for (auto pair = candidatePairs.begin(); pair != candidatePairs.end();) {
+      if (pair->first == &sceneObject || pair->second == &sceneObject) {
+        pair = candidatePairs.erase(pair);
+      }
+      else {
+        ++pair;
+      }
+    }
+  }
+
+  size_t CollisionWorld::getNumObjects() const {
+    return proxies.size();
+  }
+
+  void CollisionWorld::update() {
+    if (proxies.size() == 0) {
+      candidatePairs.clear();
+      return;
+    }
+
+    glm::vec3 sceneMinCoords(FLT_MAX, FLT_MAX, FLT_MAX);
+    glm::vec3 sceneMaxCoords(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+    for (auto proxy = proxies.begin(); proxy != proxies.end(); ++proxy) {
+      proxy->sceneObject->boundingBoxSet.
+	getWorldExtents(proxy->sceneObject->offset,
+			proxy->sceneObject->rotation,
+			proxy->minCoords, proxy->maxCoords);
+      glm::vec3 centre = 0.5f * (proxy->minCoords + proxy->maxCoords);
+      sceneMinCoords = glm::min(sceneMinCoords, centre);
+      sceneMaxCoords = glm::max(sceneMaxCoords, centre);
+    }
+
+    glm::vec3 sceneSize = sceneMaxCoords - sceneMinCoords;
+    for (auto proxy = proxies.begin(); proxy != proxies.end(); ++proxy) {
+      glm::vec3 centre = 0.5f * (proxy->minCoords + proxy->maxCoords);
+      unsigned int code = 0;
+      for (int axis = 0; axis < 3; ++axis) {
+        unsigned int cell = sceneSize[axis] > 0.0f ?
+	  static_cast<unsigned int>(1023.0f * (centre[axis] -
+					       sceneMinCoords[axis]) /
+				    sceneSize[axis]) : 0;
+        code |= expandBits(cell) << (2 - axis);
+      }
+      proxy->mortonCode = code;
+    }
+
+    sortProxies();
+    buildTree();
+
+    candidatePairs.clear();
+
+    // Traverse the tree against itself, starting from the root. Both nodes of
+    // a pair are always on the same level, since all leaves are.
+    std::pair<size_t, size_t> stack[256];
+    int stackSize = 0;
+    stack[stackSize++] = std::make_pair(static_cast<size_t>(1),
+					static_cast<size_t>(1));
+
+    while (stackSize > 0) {
+      size_t node = stack[stackSize - 1].first;
+      size_t otherNode = stack[--stackSize].second;
+      bool isLeaf = node >= numLeafSlots;
+
+      const glm::vec3 &minCoords = nodeMinCoords[node];
+      const glm::vec3 &maxCoords = nodeMaxCoords[node];
+
+      if (node == otherNode) {
+        // Pairs within the same subtree (empty subtrees are skipped)
+        if (!isLeaf && minCoords.x <= maxCoords.x) {
+          stack[stackSize++] = std::make_pair(2 * node, 2 * node + 1);
+          stack[stackSize++] = std::make_pair(2 * node + 1, 2 * node + 1);
+          stack[stackSize++] = std::make_pair(2 * node, 2 * node);
+        }
+        continue;
+      }
+
+      const glm::vec3 &otherMinCoords = nodeMinCoords[otherNode];
+      const glm::vec3 &otherMaxCoords = nodeMaxCoords[otherNode];
+
+      if (otherMinCoords.x <= maxCoords.x &&
+	  minCoords.x <= otherMaxCoords.x &&
+	  otherMinCoords.y <= maxCoords.y &&
+	  minCoords.y <= otherMaxCoords.y &&
+	  otherMinCoords.z <= maxCoords.z &&
+	  minCoords.z <= otherMaxCoords.z) {
+        if (isLeaf) {
+          candidatePairs.push_back(
+	    std::make_pair(proxies[sortedProxies[node - numLeafSlots]].
+			   sceneObject,
+			   proxies[sortedProxies[otherNode - numLeafSlots]].
+			   sceneObject));
+        }
+        else {
+          stack[stackSize++] = std::make_pair(2 * node + 1, 2 * otherNode + 1);
+          stack[stackSize++] = std::make_pair(2 * node + 1, 2 * otherNode);
+          stack[stackSize++] = std::make_pair(2 * node, 2 * otherNode + 1);
+          stack[stackSize++] = std::make_pair(2 * node, 2 * otherNode);
+        }
+      }
+    }
+  }
+
+  void CollisionWorld::sortProxies() {
+    // Insertion sort, because the order from the previous update is almost
+    // correct. If too many elements have to move (for example on the first
+    // update), fall back to a full sort.
+    size_t numProxies = sortedProxies.size();
+    size_t maxMoves = 8 * numProxies;
+    size_t numMoves = 0;
+    for (size_t idx = 1; idx < numProxies; ++idx) {
+      size_t proxyIdx = sortedProxies[idx];
+      unsigned int code = proxies[proxyIdx].mortonCode;
+      size_t pos = idx;
+      while (pos > 0 && proxies[sortedProxies[pos - 1]].mortonCode > code) {
+        sortedProxies[pos] = sortedProxies[pos - 1];
+        --pos;
+        ++numMoves;
+      }
+      sortedProxies[pos] = proxyIdx;
+      if (numMoves > maxMoves) {
+        std::sort(sortedProxies.begin(), sortedProxies.end(),
+		  [this](const size_t a, const size_t b) {
+		    return proxies[a].mortonCode < proxies[b].mortonCode;
+		  });
+        break;
+      }
+    }
+  }
+
+  void CollisionWorld::buildTree() {
+    size_t numProxies = sortedProxies.size();
+    numLeafSlots = 1;
+    while (numLeafSlots < numProxies) numLeafSlots *= 2;
+
+    nodeMinCoords.resize(2 * numLeafSlots);
+    nodeMaxCoords.resize(2 * numLeafSlots);
+
+    for (size_t leaf = 0; leaf < numLeafSlots; ++leaf) {
+      if (leaf < numProxies) {
+        nodeMinCoords[numLeafSlots + leaf] =
+	  proxies[sortedProxies[leaf]].minCoords;
+        nodeMaxCoords[numLeafSlots + leaf] =
+	  proxies[sortedProxies[leaf]].maxCoords;
+      }
+      else {
+        // Empty slots never overlap with anything.
+        nodeMinCoords[numLeafSlots + leaf] = glm::vec3(FLT_MAX, FLT_MAX,
+						       FLT_MAX);
+        nodeMaxCoords[numLeafSlots + leaf] = glm::vec3(-FLT_MAX, -FLT_MAX,
+						       -FLT_MAX);
+      }
+    }
+
+    for (size_t node = numLeafSlots - 1; node > 0; --node) {
+      nodeMinCoords[node] = glm::min(nodeMinCoords[2 * node],
+				     nodeMinCoords[2 * node + 1]);
+      nodeMaxCoords[node] = glm::max(nodeMaxCoords[2 * node],
+				     nodeMaxCoords[2 * node + 1]);
+    }
+  }
+
+  const std::vector<std::pair<SceneObject*, SceneObject*> >&
+  CollisionWorld::getCandidatePairs() const {
+    return candidatePairs;
+  }
+
+  void CollisionWorld::getCollisions(
+    std::vector<std::pair<SceneObject*, SceneObject*> > &collisions) const {
+    collisions.clear();
+    for (auto pair = candidatePairs.begin(); pair != candidatePairs.end();
+	 ++pair) {
+      if (pair->first->collidesWith(*pair->second)) {
+        collisions.push_back(*pair);
+      }
+    }
+  }
+
+  void CollisionWorld::getCollisions(
+    std::vector<std::pair<SceneObject*, SceneObject*> > &collisions,
+    JobSystem &jobSystem) const {
+    collisions.clear();
+
+    // Each pair has its own result, so the workers never write to the same
+    // element and the results can be merged in the original order.
+    std::vector<unsigned char> collides(candidatePairs.size(), 0);
+
+    jobSystem.parallelFor(candidatePairs.size(), 64,
+			  [this, &collides](size_t begin, size_t end) {
+			    for (size_t idx = begin; idx < end; ++idx) {
+			      collides[idx] = candidatePairs[idx].first->
+				collidesWith(*candidatePairs[idx].second) ?
+				1 : 0;
+			    }
+			  });
+
+    for (size_t idx = 0; idx < candidatePairs.size(); ++idx) {
+      if (collides[idx]) {
+        collisions.push_back(candidatePairs[idx]);
+      }
+    }
+  }
+
+}
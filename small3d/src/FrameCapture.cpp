@@ -0,0 +1,385 @@
+/*
+ *  FrameCapture.cpp
+ *
+ *  Created on: 2026/10/19
+ *      Author: Dimitri Kourkoulis
+ *     License: BSD 3-Clause License (see LICENSE file)
+ */
+
+#include "FrameCapture.hpp"
+#include "Logger.hpp"
+#include <png.h>
+#include <stdexcept>
+#include <cstring>
+#include <algorithm>
+
+// Frames copied out of the GPU and waiting for the encoder thread. When there
+// are this many, the rendering thread waits.
+#define MAX_QUEUED_FRAMES 8
+
+// Digits of the frame number in the names of png files
+#define PNG_FRAME_NUMBER_DIGITS 6
+
+namespace small3d {
+
+  // Full range BT.601 (JPEG) conversion from the sum of four RGB pixels
+  static unsigned char chromaBlue(const int r, const int g, const int b) {
+    return static_cast<unsigned char>
+      (std::min(255, (-43 * r - 85 * g + 128 * b + 4 * 32896) >> 10));
+  }
+
+  static unsigned char chromaRed(const int r, const int g, const int b) {
+    return static_cast<unsigned char>
+      (std::min(255, (128 * r - 107 * g - 21 * b + 4 * 32896) >> 10));
+  }
+
+  FrameCapture::FrameCapture(const int width, const int height,
+			     const std::string path,
+			     const CaptureFormat format,
+			     const unsigned int framesPerSecond,
+			     const unsigned int numBuffers) {
+    initLogger();
+
+    if (width <= 0 || height <= 0) {
+      throw std::runtime_error("Invalid frame capture dimensions.");
+    }
+    if (numBuffers < 2) {
+      throw std::runtime_error("At least two buffers are needed for frame "
+			       "capture.");
+    }
+    if (!glewIsSupported("GL_VERSION_2_1")) {
+      throw std::runtime_error("Frame capture requires pixel buffer objects "
+			       "(OpenGL 2.1).");
+    }
+
+    this->width = width;
+    this->height = height;
+    this->path = path;
+    this->format = format;
+    this->framesPerSecond = framesPerSecond;
+    frameSize = 4 * static_cast<size_t>(width) * static_cast<size_t>(height);
+
+    // Without fences, mapping a buffer simply waits for its read to complete.
+    useFences = glewIsSupported("GL_VERSION_3_2") ||
+      glewIsSupported("GL_ARB_sync");
+
+    nextSlot = 0;
+    numFramesCaptured = 0;
+    stopping = false;
+    finished = false;
+    y4mFile = nullptr;
+
+    if (format == capturey4m) {
+      y4mFile = fopen(path.c_str(), "wb");
+      if (y4mFile == nullptr) {
+        throw std::runtime_error("Could not open " + path +
+				 " for writing.");
+      }
+      std::string header = "YUV4MPEG2 W" + intToStr(width) + " H" +
+	intToStr(height) + " F" +
+	intToStr(static_cast<int>(framesPerSecond)) +
+	":1 Ip A1:1 C420jpeg\n";
+      if (fwrite(header.c_str(), 1, header.size(), y4mFile) !=
+	  header.size()) {
+        fclose(y4mFile);
+        throw std::runtime_error("Could not write to " + path + ".");
+      }
+    }
+
+    slots.resize(numBuffers);
+    for (auto slot = slots.begin(); slot != slots.end(); ++slot) {
+      glGenBuffers(1, &slot->buffer);
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->buffer);
+      glBufferData(GL_PIXEL_PACK_BUFFER, static_cast<GLsizeiptr>(frameSize),
+		   nullptr, GL_STREAM_READ);
+      slot->fence = 0;
+      slot->number = 0;
+      slot->pending = false;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    encoder = std::thread(&FrameCapture::encoderLoop, this);
+  }
+
+  FrameCapture::~FrameCapture() {
+    try {
+      finish();
+    }
+    catch (std::exception &e) {
+      LOGERROR(std::string("Frame capture failed: ") + e.what());
+    }
+  }
+
+  void FrameCapture::rethrow() {
+    std::exception_ptr encoderException;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      encoderException = exception;
+    }
+    if (encoderException) std::rethrow_exception(encoderException);
+  }
+
+  void FrameCapture::captureFrame() {
+    if (finished) {
+      throw std::runtime_error("Frame capture has already finished.");
+    }
+    rethrow();
+
+    Slot &slot = slots[nextSlot];
+    if (slot.pending) {
+      retrieve(slot);
+    }
+
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    if (useFences) {
+      slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+    slot.number = numFramesCaptured++;
+    slot.pending = true;
+
+    nextSlot = (nextSlot + 1) % slots.size();
+  }
+
+  void FrameCapture::retrieve(Slot &slot) {
+    if (slot.fence != 0) {
+      GLenum result;
+      do {
+        result = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+				  1000000000);
+      } while (result == GL_TIMEOUT_EXPIRED);
+      glDeleteSync(slot.fence);
+      slot.fence = 0;
+      if (result == GL_WAIT_FAILED) {
+        throw std::runtime_error("Failed to wait for captured frame.");
+      }
+    }
+
+    // Reuse the memory of frames that have already been written.
+    Frame frame;
+    frame.number = slot.number;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      frameWritten.wait(lock, [this] {
+	  return queuedFrames.size() < MAX_QUEUED_FRAMES || exception;
+	});
+      if (!freeBuffers.empty()) {
+        frame.pixels.swap(freeBuffers.back());
+        freeBuffers.pop_back();
+      }
+    }
+    frame.pixels.resize(frameSize);
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+    const void *data = glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+    if (data == nullptr) {
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+      throw std::runtime_error("Failed to map captured frame.");
+    }
+    memcpy(&frame.pixels[0], data, frameSize);
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    slot.pending = false;
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      queuedFrames.push_back(Frame());
+      queuedFrames.back().pixels.swap(frame.pixels);
+      queuedFrames.back().number = frame.number;
+    }
+    frameQueued.notify_one();
+  }
+
+  void FrameCapture::encoderLoop() {
+    while (true) {
+      Frame frame;
+      bool failed;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        frameQueued.wait(lock, [this] {
+	    return stopping || !queuedFrames.empty();
+	  });
+        if (queuedFrames.empty()) break;
+        frame.pixels.swap(queuedFrames.front().pixels);
+        frame.number = queuedFrames.front().number;
+        queuedFrames.pop_front();
+        failed = exception != nullptr;
+      }
+
+      // After an error, frames are only discarded.
+      if (!failed) {
+        try {
+          if (format == capturepng) {
+            writePng(frame);
+          }
+          else {
+            writeY4m(frame);
+          }
+        }
+        catch (...) {
+          std::lock_guard<std::mutex> lock(mutex);
+          exception = std::current_exception();
+        }
+      }
+
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        freeBuffers.push_back(std::vector<unsigned char>());
+        freeBuffers.back().swap(frame.pixels);
+      }
+      frameWritten.notify_one();
+    }
+  }
+
+  void FrameCapture::writePng(const Frame &frame) const {
+    std::string number = intToStr(static_cast<int>(frame.number));
+    if (number.size() < PNG_FRAME_NUMBER_DIGITS) {
+      number.insert(0, PNG_FRAME_NUMBER_DIGITS - number.size(), '0');
+    }
+    std::string fileName = path + number + ".png";
+
+    FILE *file = fopen(fileName.c_str(), "wb");
+    if (file == nullptr) {
+      throw std::runtime_error("Could not open " + fileName +
+			       " for writing.");
+    }
+
+    png_structp pngStructure = png_create_write_struct(PNG_LIBPNG_VER_STRING,
+						       nullptr, nullptr,
+						       nullptr);
+    png_infop pngInformation = pngStructure != nullptr ?
+      png_create_info_struct(pngStructure) : nullptr;
+
+    if (pngInformation == nullptr || setjmp(png_jmpbuf(pngStructure))) {
+      png_destroy_write_struct(&pngStructure, &pngInformation);
+      fclose(file);
+      throw std::runtime_error("Error writing " + fileName + ".");
+    }
+
+    png_init_io(pngStructure, file);
+    png_set_IHDR(pngStructure, pngInformation,
+		 static_cast<png_uint_32>(width),
+		 static_cast<png_uint_32>(height), 8, PNG_COLOR_TYPE_RGBA,
+		 PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
+		 PNG_FILTER_TYPE_DEFAULT);
+
+    // The frames have to keep up with the rendering, so speed is preferred
+    // to size.
+    png_set_compression_level(pngStructure, 1);
+    png_write_info(pngStructure, pngInformation);
+
+    // OpenGL rows start from the bottom.
+    size_t rowSize = 4 * static_cast<size_t>(width);
+    for (int row = height - 1; row >= 0; --row) {
+      png_write_row(pngStructure, const_cast<png_bytep>
+		    (&frame.pixels[static_cast<size_t>(row) * rowSize]));
+    }
+    png_write_end(pngStructure, nullptr);
+    png_destroy_write_struct(&pngStructure, &pngInformation);
+
+    if (fclose(file) != 0) {
+      throw std::runtime_error("Error writing " + fileName + ".");
+    }
+  }
+
+  void FrameCapture::writeY4m(const Frame &frame) {
+    size_t chromaWidth = (static_cast<size_t>(width) + 1) / 2;
+    size_t chromaHeight = (static_cast<size_t>(height) + 1) / 2;
+    size_t lumaSize = static_cast<size_t>(width) * static_cast<size_t>(height);
+    size_t chromaSize = chromaWidth * chromaHeight;
+    yuvFrame.resize(lumaSize + 2 * chromaSize);
+
+    unsigned char *luma = &yuvFrame[0];
+    unsigned char *blue = luma + lumaSize;
+    unsigned char *red = blue + chromaSize;
+    size_t rowSize = 4 * static_cast<size_t>(width);
+
+    // Y4M rows start from the top, OpenGL rows from the bottom.
+    for (int y = 0; y < height; ++y) {
+      const unsigned char *pixel =
+	&frame.pixels[static_cast<size_t>(height - 1 - y) * rowSize];
+      unsigned char *out = luma + static_cast<size_t>(y) * width;
+      for (int x = 0; x < width; ++x, pixel += 4) {
+        out[x] = static_cast<unsigned char>
+	  ((77 * pixel[0] + 150 * pixel[1] + 29 * pixel[2] + 128) >> 8);
+      }
+    }
+
+    // Each chroma sample covers 2x2 pixels (repeating the last row and
+    // column if the dimensions are odd).
+    for (size_t cy = 0; cy < chromaHeight; ++cy) {
+      size_t y0 = 2 * cy;
+      size_t y1 = std::min(y0 + 1, static_cast<size_t>(height) - 1);
+      const unsigned char *row0 =
+	&frame.pixels[(static_cast<size_t>(height) - 1 - y0) * rowSize];
+      const unsigned char *row1 =
+	&frame.pixels[(static_cast<size_t>(height) - 1 - y1) * rowSize];
+      for (size_t cx = 0; cx < chromaWidth; ++cx) {
+        size_t x0 = 8 * cx;
+        size_t x1 = std::min(x0 + 4, rowSize - 4);
+        int r = row0[x0] + row0[x1] + row1[x0] + row1[x1];
+        int g = row0[x0 + 1] + row0[x1 + 1] + row1[x0 + 1] + row1[x1 + 1];
+        int b = row0[x0 + 2] + row0[x1 + 2] + row1[x0 + 2] + row1[x1 + 2];
+        blue[cy * chromaWidth + cx] = chromaBlue(r, g, b);
+        red[cy * chromaWidth + cx] = chromaRed(r, g, b);
+      }
+    }
+
+    if (fwrite("FRAME\n", 1, 6, y4mFile) != 6 ||
+	fwrite(&yuvFrame[0], 1, yuvFrame.size(), y4mFile) != yuvFrame.size()) {
+      throw std::runtime_error("Could not write to " + path + ".");
+    }
+  }
+
+  void FrameCapture::finish() {
+    if (finished) return;
+    finished = true;
+
+    // Hand over the pending frames, oldest first.
+    std::exception_ptr retrieveException;
+    try {
+      for (size_t idx = 0; idx < slots.size(); ++idx) {
+        Slot &slot = slots[(nextSlot + idx) % slots.size()];
+        if (slot.pending) {
+          retrieve(slot);
+        }
+      }
+    }
+    catch (...) {
+      retrieveException = std::current_exception();
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    frameQueued.notify_one();
+    encoder.join();
+
+    for (auto slot = slots.begin(); slot != slots.end(); ++slot) {
+      if (slot->fence != 0) {
+        glDeleteSync(slot->fence);
+      }
+      glDeleteBuffers(1, &slot->buffer);
+    }
+    slots.clear();
+
+    if (y4mFile != nullptr) {
+      bool closed = fclose(y4mFile) == 0;
+      y4mFile = nullptr;
+      if (!closed && !retrieveException) {
+        throw std::runtime_error("Could not write to " + path + ".");
+      }
+    }
+
+    if (retrieveException) std::rethrow_exception(retrieveException);
+    rethrow();
+  }
+
+  unsigned long FrameCapture::getNumFramesCaptured() const {
+    return numFramesCaptured;
+  }
+
+}
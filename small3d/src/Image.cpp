@@ -7,6 +7,7 @@
  */
 
 #include "Image.hpp"
+#include "Trace.hpp"
 #include <stdexcept>
 
 namespace small3d {
@@ -22,6 +23,7 @@ namespace small3d {
   }
 
   void Image::loadFromFile(const std::string fileLocation) {
+    TRACEZONE("Image::loadFromFile");
     // function developed based on example at
     // http://zarb.org/~gc/html/libpng.html
 #if defined(_WIN32) && !defined(__MINGW32__)
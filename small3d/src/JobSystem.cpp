@@ -0,0 +1,180 @@
+/*
+ *  JobSystem.cpp
+ *
+ *  Created on: 2026/10/19
+ *      Author: Dimitri Kourkoulis
+ *     License: BSD 3-Clause License (see LICENSE file)
+ */
+
+#include "JobSystem.hpp"
+#include <algorithm>
+
+namespace small3d {
+
+  // The job system and queue of the current thread, if it is a worker
+  static thread_local const JobSystem *currentJobSystem = nullptr;
+  static thread_local size_t currentQueueIdx = 0;
+
+  JobSystem::JobGroup::JobGroup() : numRemaining(0) {
+  }
+
+  JobSystem::JobSystem(const unsigned int numThreads) :
+    numQueuedJobs(0), nextQueue(0), stopping(false) {
+    unsigned int totalThreads = numThreads;
+    if (totalThreads == 0) {
+      totalThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    for (unsigned int idx = 0; idx < totalThreads; ++idx) {
+      queues.push_back(std::unique_ptr<JobQueue>(new JobQueue()));
+    }
+
+    for (unsigned int idx = 1; idx < totalThreads; ++idx) {
+      workers.push_back(std::thread(&JobSystem::workerLoop, this,
+				    static_cast<size_t>(idx)));
+    }
+  }
+
+  JobSystem::~JobSystem() {
+    {
+      std::lock_guard<std::mutex> lock(sleepMutex);
+      stopping = true;
+    }
+    wakeUp.notify_all();
+    for (auto worker = workers.begin(); worker != workers.end(); ++worker) {
+      worker->join();
+    }
+  }
+
+  unsigned int JobSystem::getNumThreads() const {
+    return static_cast<unsigned int>(queues.size());
+  }
+
+  size_t JobSystem::getQueueIdx() const {
+    return currentJobSystem == this ? currentQueueIdx : 0;
+  }
+
+  void JobSystem::push(const std::function<void()> &function,
+		       JobGroup *group) {
+    ++group->numRemaining;
+
+    // Workers queue jobs on their own queue. Other threads spread them over
+    // all the queues.
+    size_t queueIdx = currentJobSystem == this ? currentQueueIdx :
+      nextQueue++ % queues.size();
+
+    Job job;
+    job.function = function;
+    job.group = group;
+
+    // Counted before it is queued, so that a thread taking it cannot
+    // decrement the count first.
+    {
+      std::lock_guard<std::mutex> lock(sleepMutex);
+      ++numQueuedJobs;
+    }
+    {
+      std::lock_guard<std::mutex> lock(queues[queueIdx]->mutex);
+      queues[queueIdx]->jobs.push_back(job);
+    }
+    wakeUp.notify_one();
+  }
+
+  bool JobSystem::runJob(const size_t queueIdx) {
+    Job job;
+    bool found = false;
+
+    // Own queue first, from the back (most recently queued, so most likely
+    // to have its data in the cache), then the other queues, from the front.
+    for (size_t offset = 0; offset < queues.size() && !found; ++offset) {
+      JobQueue &queue = *queues[(queueIdx + offset) % queues.size()];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      if (!queue.jobs.empty()) {
+        if (offset == 0) {
+          job = queue.jobs.back();
+          queue.jobs.pop_back();
+        }
+        else {
+          job = queue.jobs.front();
+          queue.jobs.pop_front();
+        }
+        found = true;
+      }
+    }
+
+    if (!found) return false;
+
+    --numQueuedJobs;
+
+    try {
+      job.function();
+    }
+    catch (...) {
+      std::lock_guard<std::mutex> lock(job.group->exceptionMutex);
+      if (!job.group->exception) {
+        job.group->exception = std::current_exception();
+      }
+    }
+
+    --job.group->numRemaining;
+    return true;
+  }
+
+  void JobSystem::workerLoop(const size_t queueIdx) {
+    currentJobSystem = this;
+    currentQueueIdx = queueIdx;
+
+    while (true) {
+      if (!runJob(queueIdx)) {
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wakeUp.wait(lock, [this] {
+	    return stopping || numQueuedJobs > 0;
+	  });
+        if (stopping) break;
+      }
+    }
+  }
+
+  void JobSystem::waitFor(JobGroup &group) {
+    size_t queueIdx = getQueueIdx();
+    while (group.numRemaining > 0) {
+      if (!runJob(queueIdx)) {
+        // The remaining jobs are running on other threads.
+        std::this_thread::yield();
+      }
+    }
+
+    std::exception_ptr exception;
+    {
+      std::lock_guard<std::mutex> lock(group.exceptionMutex);
+      exception = group.exception;
+      group.exception = nullptr;
+    }
+    if (exception) std::rethrow_exception(exception);
+  }
+
+  void JobSystem::run(const std::function<void()> &job) {
+    push(job, &runGroup);
+  }
+
+  void JobSystem::wait() {
+    waitFor(runGroup);
+  }
+
+  void JobSystem::parallelFor(const size_t numItems, const size_t batchSize,
+			      const std::function<void(size_t, size_t)>
+			      &function) {
+    if (numItems == 0) return;
+    size_t size = std::max(static_cast<size_t>(1), batchSize);
+
+    JobGroup group;
+    for (size_t begin = 0; begin < numItems; begin += size) {
+      size_t end = std::min(numItems, begin + size);
+      push([&function, begin, end]() {
+	  function(begin, end);
+	}, &group);
+    }
+    waitFor(group);
+  }
+
+}
@@ -10,50 +10,126 @@
 #include <sstream>
 #include <ctime>
 #include <iostream>
+#include <cstdio>
+#include <algorithm>
+
+// How often the writer thread of an asynchronous logger checks for messages
+// if it is not woken up earlier
+#define LOG_WRITE_INTERVAL_MS 20
+
+// Characters reserved for the message of each queued record, so that
+// appending most messages does not allocate memory
+#define LOG_RECORD_RESERVE 128
 
 std::shared_ptr<small3d::Logger> logger;
 
 namespace small3d {
 
+  std::atomic<int> minLogSeverity(0);
+
   std::string intToStr(const int number)
   {
-    char buffer[100];
-#if defined(_WIN32) && !defined(__MINGW32__)
-    sprintf_s(buffer, "%d", number);
-#else
-    sprintf(buffer, "%d", number);
-#endif
-    return std::string(buffer);
+    std::string result;
+    appendLogValue(result, number);
+    return result;
+  }
+
+  void appendLogValue(std::string &message, const unsigned long long value) {
+    char digits[20];
+    int numDigits = 0;
+    unsigned long long remaining = value;
+    do {
+      digits[numDigits++] = static_cast<char>('0' + remaining % 10);
+      remaining /= 10;
+    } while (remaining > 0);
+    while (numDigits > 0) {
+      message += digits[--numDigits];
+    }
+  }
+
+  void appendLogValue(std::string &message, const long long value) {
+    if (value < 0) {
+      message += '-';
+      // Negating in unsigned arithmetic also works for the minimum value.
+      appendLogValue(message, 0ULL - static_cast<unsigned long long>(value));
+    }
+    else {
+      appendLogValue(message, static_cast<unsigned long long>(value));
+    }
+  }
+
+  void appendLogValue(std::string &message, const double value) {
+    char buffer[32];
+    int length = snprintf(buffer, sizeof(buffer), "%g", value);
+    if (length > 0) {
+      message.append(buffer, std::min(static_cast<size_t>(length),
+				      sizeof(buffer) - 1));
+    }
+  }
+
+  std::string& getLogFormatBuffer() {
+    static thread_local std::string buffer;
+    return buffer;
+  }
+
+  void setMinLogLevel(const LogLevel level) {
+    // Errors have the highest severity, so they are never filtered out.
+    minLogSeverity.store(getLogSeverity(level));
   }
 
   Logger::Logger(std::ostream &stream) {
     logStream = &stream;
+    asynchronous = false;
+    overflowPolicy = logblock;
+    queueMask = 0;
+    enqueuePos = 0;
+    writtenPos = 0;
+    numDropped = 0;
+    numFlushRequests = 0;
+    stopping = false;
+  }
+
+  Logger::Logger(std::ostream &stream, const size_t queueSize,
+		 const LogOverflowPolicy overflowPolicy) : Logger(stream) {
+    asynchronous = true;
+    this->overflowPolicy = overflowPolicy;
+
+    size_t size = 2;
+    while (size < queueSize) size *= 2;
+    queueMask = size - 1;
+    records.reset(new LogRecord[size]);
+    for (size_t idx = 0; idx < size; ++idx) {
+      records[idx].sequence.store(idx, std::memory_order_relaxed);
+      records[idx].message.reserve(LOG_RECORD_RESERVE);
+    }
+
+    writer = std::thread(&Logger::writerLoop, this);
   }
 
   Logger::~Logger() {
     this->append(loggerinfo, "Logger getting destroyed");
+    if (asynchronous) {
+      {
+        std::lock_guard<std::mutex> lock(writerMutex);
+        stopping = true;
+      }
+      writerWakeUp.notify_one();
+      writer.join();
+    }
     logStream = NULL;
 
   }
 
-  void Logger::append(const LogLevel level, const std::string message) const {
-    if (!logger) return;
-    std::ostringstream dateTimeOstringstream;
-
-    time_t now;
-
-    time(&now);
-
+  static void formatTime(const time_t time, char *buf) {
     tm *t;
 
 #if defined(_WIN32) && !defined(__MINGW32__)
     t = new tm();
-    localtime_s(t, &now);
+    localtime_s(t, &time);
 
 #else
-    t = localtime(&now);
+    t = localtime(&time);
 #endif
-    char buf[20];
 
     strftime(buf, 20,"%Y-%m-%d %H:%M:%S", t);
 
@@ -63,27 +139,166 @@ namespace small3d {
 #if defined(_WIN32) && !defined(__MINGW32__)
     delete t;
 #endif
+  }
 
-    dateTimeOstringstream << buf;
-
-    std::string indicator;
+  static const char* getIndicator(const LogLevel level) {
     switch (level) {
     case loggerinfo:
-      indicator = "INFO";
-      break;
+      return "INFO";
     case loggerdebug:
-      indicator = "DEBUG";
-      break;
+      return "DEBUG";
     case loggererror:
-      indicator = "ERROR";
-      break;
+      return "ERROR";
     default:
-      indicator = "";
-      break;
+      return "";
+    }
+  }
+
+  void Logger::append(const LogLevel level, const std::string &message) const {
+    if (asynchronous) {
+      // Errors are never dropped and are written before returning, in case
+      // the program is about to crash.
+      push(level, message);
+      if (level == loggererror) flush();
+      return;
+    }
+
+    if (!logger) return;
+    std::ostringstream dateTimeOstringstream;
+
+    time_t now;
+
+    time(&now);
+
+    char buf[20];
+    formatTime(now, buf);
+
+    dateTimeOstringstream << buf;
+
+    *logStream << dateTimeOstringstream.str().c_str() << " - "
+	       << getIndicator(level) << ": " << message.c_str() << std::endl;
+  }
+
+  bool Logger::push(const LogLevel level, const std::string &message) const {
+    bool block = overflowPolicy == logblock || level == loggererror;
+    size_t pos = enqueuePos.load(std::memory_order_relaxed);
+    LogRecord *record;
+    while (true) {
+      record = &records[pos & queueMask];
+      size_t sequence = record->sequence.load(std::memory_order_acquire);
+      std::ptrdiff_t difference = static_cast<std::ptrdiff_t>(sequence - pos);
+      if (difference == 0) {
+        // The record is free. Claim it, unless another thread has already.
+        if (enqueuePos.compare_exchange_weak(pos, pos + 1,
+					     std::memory_order_relaxed)) {
+          break;
+        }
+      }
+      else if (difference < 0) {
+        // The queue is full.
+        if (!block) {
+          ++numDropped;
+          return false;
+        }
+        writerWakeUp.notify_one();
+        std::this_thread::yield();
+        pos = enqueuePos.load(std::memory_order_relaxed);
+      }
+      else {
+        pos = enqueuePos.load(std::memory_order_relaxed);
+      }
+    }
+
+    record->level = level;
+    record->time = std::chrono::system_clock::now();
+    record->message.assign(message);
+    record->sequence.store(pos + 1, std::memory_order_release);
+
+    // The writer checks the queue periodically, but is woken up earlier
+    // if the queue is getting full.
+    if (pos - writtenPos.load(std::memory_order_relaxed) ==
+	(queueMask + 1) / 2) {
+      writerWakeUp.notify_one();
+    }
+    return true;
+  }
+
+  void Logger::writerLoop() {
+    std::string batch;
+    char timeText[20];
+    time_t lastTime = static_cast<time_t>(-1);
+    size_t pos = 0;
+
+    while (true) {
+      while (true) {
+        LogRecord &record = records[pos & queueMask];
+        if (record.sequence.load(std::memory_order_acquire) != pos + 1) break;
+
+        // Consecutive messages are usually logged within the same second.
+        time_t recordTime = std::chrono::system_clock::to_time_t(record.time);
+        if (recordTime != lastTime) {
+          formatTime(recordTime, timeText);
+          lastTime = recordTime;
+        }
+        batch += timeText;
+        batch += " - ";
+        batch += getIndicator(record.level);
+        batch += ": ";
+        batch += record.message;
+        batch += '\n';
+
+        record.sequence.store(pos + queueMask + 1, std::memory_order_release);
+        ++pos;
+      }
+
+      size_t dropped = numDropped.exchange(0);
+      if (dropped > 0) {
+        formatTime(time(nullptr), timeText);
+        batch += timeText;
+        batch += " - ";
+        batch += getIndicator(loggererror);
+        batch += ": ";
+        batch += intToStr(static_cast<int>(dropped)) +
+	  " log messages dropped (queue full)\n";
+        lastTime = static_cast<time_t>(-1);
+      }
+
+      if (!batch.empty()) {
+        *logStream << batch;
+        logStream->flush();
+        batch.clear();
+      }
+
+      std::unique_lock<std::mutex> lock(writerMutex);
+      writtenPos.store(pos, std::memory_order_relaxed);
+      flushed.notify_all();
+      if (stopping && enqueuePos.load() == pos) break;
+      writerWakeUp.wait_for(lock,
+			    std::chrono::milliseconds(LOG_WRITE_INTERVAL_MS),
+			    [this, pos] {
+			      size_t numQueued = enqueuePos.load() - pos;
+			      return stopping ||
+				(numQueued > 0 && (numFlushRequests > 0 ||
+						   numQueued >= (queueMask + 1) /
+						   2));
+			    });
     }
+  }
 
-    *logStream << dateTimeOstringstream.str().c_str() << " - " << indicator
-	       << ": " << message.c_str() << std::endl;
+  void Logger::flush() const {
+    if (!asynchronous) {
+      logStream->flush();
+      return;
+    }
+
+    size_t target = enqueuePos.load();
+    std::unique_lock<std::mutex> lock(writerMutex);
+    ++numFlushRequests;
+    writerWakeUp.notify_one();
+    flushed.wait(lock, [this, target] {
+	return writtenPos.load(std::memory_order_relaxed) >= target;
+      });
+    --numFlushRequests;
   }
 
   void initLogger() {
@@ -94,6 +309,12 @@ namespace small3d {
     if (!logger) logger = std::shared_ptr<Logger>(new Logger(stream));
   }
 
+  void initLogger(std::ostream &stream, const size_t queueSize,
+		  const LogOverflowPolicy overflowPolicy) {
+    if (!logger) logger = std::shared_ptr<Logger>(new Logger(stream, queueSize,
+							     overflowPolicy));
+  }
+
   void deleteLogger() {
     logger = NULL;
   }
@@ -10,8 +10,23 @@
 #include <fstream>
 #include <unordered_map>
 #include <memory>
+#include <utility>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <climits>
+#include <queue>
 #include "GetTokens.hpp"
 #include "Model.hpp"
+#include "Trace.hpp"
+#include <glm/gtc/matrix_transform.hpp>
+
+// Maximum depth of the bounding volume hierarchy used for ray casting
+#define MAX_BVH_DEPTH 64
+
+// Levels of detail with more than this fraction of the triangles of the
+// previous level are not worth keeping.
+#define MIN_LOD_REDUCTION 0.95
 
 namespace small3d {
 
@@ -158,6 +173,9 @@ namespace small3d {
             v.push_back(vertices[facesVertexIndices[idx][vertexIndex] - 1][1]);
             v.push_back(vertices[facesVertexIndices[idx][vertexIndex] - 1][2]);
             vertices.push_back(v);
+            copiedVertexIndices.push_back(static_cast<unsigned int>
+					  (facesVertexIndices[idx][vertexIndex]
+					   - 1));
 
             facesVertexIndices[idx][vertexIndex] = static_cast<int>
 	      (vertices.size());
@@ -192,10 +210,12 @@ namespace small3d {
 
 
   Model::Model(const std::string fileLocation) {
+    TRACEZONE("Model::Model");
     std::ifstream file(fileLocation.c_str());
     std::string line;
     if (file.is_open()) {
       clear();
+      copiedVertexIndices.clear();
 
       while (getline(file, line)) {
         if (line[0] == 'v' || line[0] == 'f') {
@@ -334,9 +354,526 @@ namespace small3d {
       this->loadTextureCoordsData();
       this->clear();
 
+      minCoords = glm::vec3(0.0f, 0.0f, 0.0f);
+      maxCoords = glm::vec3(0.0f, 0.0f, 0.0f);
+      for (size_t idx = 0; idx < vertexData.size(); idx += 4) {
+        glm::vec3 vertex(vertexData[idx], vertexData[idx + 1],
+			 vertexData[idx + 2]);
+        minCoords = idx == 0 ? vertex : glm::min(minCoords, vertex);
+        maxCoords = idx == 0 ? vertex : glm::max(maxCoords, vertex);
+      }
+
     }
     else
       throw std::runtime_error("Could not open file " + fileLocation);
   }
 
+  void Model::buildBvh() const {
+    bvhNodes.clear();
+    trianglePackets.clear();
+
+    size_t numTriangles = indexData.size() / 3;
+    if (numTriangles == 0) return;
+
+    std::vector<unsigned int> triangles(numTriangles);
+    std::vector<glm::vec3> centroids(numTriangles);
+    for (size_t idx = 0; idx < numTriangles; ++idx) {
+      triangles[idx] = static_cast<unsigned int>(idx);
+      glm::vec3 centroid(0.0f, 0.0f, 0.0f);
+      for (size_t vertexIdx = 0; vertexIdx < 3; ++vertexIdx) {
+        const float *vertex = &vertexData[4 * indexData[3 * idx + vertexIdx]];
+        centroid += glm::vec3(vertex[0], vertex[1], vertex[2]);
+      }
+      centroids[idx] = centroid / 3.0f;
+    }
+
+    bvhNodes.reserve(2 * (numTriangles / 4 + 1));
+    trianglePackets.reserve(numTriangles / 2 + 1);
+    buildBvhNode(triangles, 0, numTriangles, centroids);
+  }
+
+  unsigned int Model::buildBvhNode(std::vector<unsigned int> &triangles,
+				   const size_t begin, const size_t end,
+				   const std::vector<glm::vec3> &centroids)
+    const {
+    unsigned int nodeIdx = static_cast<unsigned int>(bvhNodes.size());
+    bvhNodes.push_back(BvhNode());
+
+    glm::vec3 minCoords(FLT_MAX, FLT_MAX, FLT_MAX);
+    glm::vec3 maxCoords(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    glm::vec3 minCentroid = minCoords, maxCentroid = maxCoords;
+    for (size_t idx = begin; idx < end; ++idx) {
+      for (size_t vertexIdx = 0; vertexIdx < 3; ++vertexIdx) {
+        const float *vertex =
+	  &vertexData[4 * indexData[3 * triangles[idx] + vertexIdx]];
+        glm::vec3 coords(vertex[0], vertex[1], vertex[2]);
+        minCoords = glm::min(minCoords, coords);
+        maxCoords = glm::max(maxCoords, coords);
+      }
+      minCentroid = glm::min(minCentroid, centroids[triangles[idx]]);
+      maxCentroid = glm::max(maxCentroid, centroids[triangles[idx]]);
+    }
+    bvhNodes[nodeIdx].minCoords = minCoords;
+    bvhNodes[nodeIdx].maxCoords = maxCoords;
+
+    if (end - begin <= 4) {
+      TrianglePacket packet;
+      for (size_t lane = 0; lane < 4; ++lane) {
+        bool used = begin + lane < end;
+        unsigned int triangle = used ? triangles[begin + lane] : UINT_MAX;
+        glm::vec3 v[3];
+        for (size_t vertexIdx = 0; vertexIdx < 3; ++vertexIdx) {
+          if (used) {
+            const float *vertex =
+	      &vertexData[4 * indexData[3 * triangle + vertexIdx]];
+            v[vertexIdx] = glm::vec3(vertex[0], vertex[1], vertex[2]);
+          }
+          else {
+            v[vertexIdx] = glm::vec3(0.0f, 0.0f, 0.0f);
+          }
+        }
+        for (int axis = 0; axis < 3; ++axis) {
+          packet.v0[axis][lane] = v[0][axis];
+          packet.edge1[axis][lane] = v[1][axis] - v[0][axis];
+          packet.edge2[axis][lane] = v[2][axis] - v[0][axis];
+        }
+        packet.triangles[lane] = triangle;
+      }
+      bvhNodes[nodeIdx].index =
+	static_cast<unsigned int>(trianglePackets.size());
+      bvhNodes[nodeIdx].numTriangles = static_cast<unsigned int>(end - begin);
+      trianglePackets.push_back(packet);
+      return nodeIdx;
+    }
+
+    // Split in the middle of the longest axis of the centroids, placing half
+    // of the triangles on each side. This keeps the tree balanced, so its
+    // depth never exceeds MAX_BVH_DEPTH.
+    glm::vec3 extent = maxCentroid - minCentroid;
+    int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) :
+      (extent.y > extent.z ? 1 : 2);
+    size_t middle = begin + (end - begin) / 2;
+    std::nth_element(triangles.begin() + static_cast<std::ptrdiff_t>(begin),
+		     triangles.begin() + static_cast<std::ptrdiff_t>(middle),
+		     triangles.begin() + static_cast<std::ptrdiff_t>(end),
+		     [&centroids, axis](const unsigned int a,
+					const unsigned int b) {
+		       return centroids[a][axis] < centroids[b][axis];
+		     });
+
+    buildBvhNode(triangles, begin, middle, centroids);
+    unsigned int rightIdx = buildBvhNode(triangles, middle, end, centroids);
+    bvhNodes[nodeIdx].index = rightIdx;
+    bvhNodes[nodeIdx].numTriangles = 0;
+    return nodeIdx;
+  }
+
+  // Distance at which a ray enters a box, or FLT_MAX if it misses it or
+  // enters it further than maxDistance.
+  static float rayEntersBox(const glm::vec3 &origin,
+			    const glm::vec3 &inverseDirection,
+			    const glm::vec3 &minCoords,
+			    const glm::vec3 &maxCoords,
+			    const float maxDistance) {
+    glm::vec3 time1 = (minCoords - origin) * inverseDirection;
+    glm::vec3 time2 = (maxCoords - origin) * inverseDirection;
+    glm::vec3 nearTime = glm::min(time1, time2);
+    glm::vec3 farTime = glm::max(time1, time2);
+    float enter = std::max(std::max(nearTime.x, nearTime.y),
+			   std::max(nearTime.z, 0.0f));
+    float exit = std::min(std::min(farTime.x, farTime.y),
+			  std::min(farTime.z, maxDistance));
+    return enter <= exit ? enter : FLT_MAX;
+  }
+
+  bool Model::intersectsRay(const glm::vec3 origin, const glm::vec3 direction,
+			    const glm::vec3 offset, const glm::vec3 rotation,
+			    float &distance, unsigned int &triangle,
+			    glm::vec2 &barycentric) const {
+    if (bvhNodes.empty()) buildBvh();
+    if (bvhNodes.empty()) return false;
+
+    // The same rotation as the one applied by the shaders
+    glm::mat3 rotationMatrix =
+      glm::mat3(glm::rotate(glm::mat4x4(1.0f), rotation.y,
+			    glm::vec3(0.0f, -1.0f, 0.0f)) *
+		glm::rotate(glm::mat4x4(1.0f), rotation.x,
+			    glm::vec3(-1.0f, 0.0f, 0.0f)) *
+		glm::rotate(glm::mat4x4(1.0f), rotation.z,
+			    glm::vec3(0.0f, 0.0f, -1.0f)));
+
+    glm::vec3 worldOrigin = origin - offset;
+    glm::vec3 rayOrigin, rayDirection;
+    for (int axis = 0; axis < 3; ++axis) {
+      rayOrigin[axis] = glm::dot(rotationMatrix[axis], worldOrigin);
+      rayDirection[axis] = glm::dot(rotationMatrix[axis], direction);
+    }
+
+    // Division by zero results in infinity, which the box check handles.
+    glm::vec3 inverseDirection(1.0f / rayDirection.x, 1.0f / rayDirection.y,
+			       1.0f / rayDirection.z);
+
+    float closestDistance = FLT_MAX;
+    unsigned int closestTriangle = UINT_MAX;
+    float closestU = 0.0f, closestV = 0.0f;
+
+    // Nodes to visit, with the distance at which the ray enters them
+    std::pair<unsigned int, float> stack[MAX_BVH_DEPTH];
+    int stackSize = 0;
+    stack[stackSize++] = std::make_pair(0u,
+					rayEntersBox(rayOrigin,
+						     inverseDirection,
+						     bvhNodes[0].minCoords,
+						     bvhNodes[0].maxCoords,
+						     closestDistance));
+
+    while (stackSize > 0) {
+      --stackSize;
+      // Skip nodes further than the closest triangle found so far
+      if (stack[stackSize].second >= closestDistance) continue;
+      unsigned int nodeIdx = stack[stackSize].first;
+      const BvhNode &node = bvhNodes[nodeIdx];
+
+      if (node.numTriangles > 0) {
+        // Moller - Trumbore intersection with the four triangles of the
+        // packet at once. There is no branching in the loop, so that the
+        // compiler can vectorise it.
+        const TrianglePacket &packet = trianglePackets[node.index];
+        float hitDistance[4], hitU[4], hitV[4];
+        int hit[4];
+        for (int lane = 0; lane < 4; ++lane) {
+          float e1x = packet.edge1[0][lane], e1y = packet.edge1[1][lane],
+	    e1z = packet.edge1[2][lane];
+          float e2x = packet.edge2[0][lane], e2y = packet.edge2[1][lane],
+	    e2z = packet.edge2[2][lane];
+          float px = rayDirection.y * e2z - rayDirection.z * e2y;
+          float py = rayDirection.z * e2x - rayDirection.x * e2z;
+          float pz = rayDirection.x * e2y - rayDirection.y * e2x;
+          float det = e1x * px + e1y * py + e1z * pz;
+          float inverseDet = 1.0f / (std::abs(det) > 1e-12f ? det : 1e-12f);
+          float tx = rayOrigin.x - packet.v0[0][lane];
+          float ty = rayOrigin.y - packet.v0[1][lane];
+          float tz = rayOrigin.z - packet.v0[2][lane];
+          float u = (tx * px + ty * py + tz * pz) * inverseDet;
+          float qx = ty * e1z - tz * e1y;
+          float qy = tz * e1x - tx * e1z;
+          float qz = tx * e1y - ty * e1x;
+          float v = (rayDirection.x * qx + rayDirection.y * qy +
+		     rayDirection.z * qz) * inverseDet;
+          float t = (e2x * qx + e2y * qy + e2z * qz) * inverseDet;
+          hit[lane] = (std::abs(det) > 1e-12f) & (u >= 0.0f) & (v >= 0.0f) &
+	    (u + v <= 1.0f) & (t >= 0.0f) & (t < closestDistance);
+          hitDistance[lane] = t;
+          hitU[lane] = u;
+          hitV[lane] = v;
+        }
+        for (int lane = 0; lane < 4; ++lane) {
+          if (hit[lane] && hitDistance[lane] < closestDistance) {
+            closestDistance = hitDistance[lane];
+            closestTriangle = packet.triangles[lane];
+            closestU = hitU[lane];
+            closestV = hitV[lane];
+          }
+        }
+      }
+      else {
+        // Visit the nearest child first, so that the furthest one can be
+        // skipped if a closer triangle is found.
+        unsigned int leftIdx = nodeIdx + 1;
+        unsigned int rightIdx = node.index;
+        float leftDistance = rayEntersBox(rayOrigin, inverseDirection,
+					  bvhNodes[leftIdx].minCoords,
+					  bvhNodes[leftIdx].maxCoords,
+					  closestDistance);
+        float rightDistance = rayEntersBox(rayOrigin, inverseDirection,
+					   bvhNodes[rightIdx].minCoords,
+					   bvhNodes[rightIdx].maxCoords,
+					   closestDistance);
+        if (leftDistance > rightDistance) {
+          std::swap(leftIdx, rightIdx);
+          std::swap(leftDistance, rightDistance);
+        }
+        if (rightDistance != FLT_MAX) {
+          stack[stackSize++] = std::make_pair(rightIdx, rightDistance);
+        }
+        if (leftDistance != FLT_MAX) {
+          stack[stackSize++] = std::make_pair(leftIdx, leftDistance);
+        }
+      }
+    }
+
+    if (closestTriangle == UINT_MAX) return false;
+
+    distance = closestDistance;
+    triangle = closestTriangle;
+    barycentric = glm::vec2(closestU, closestV);
+    return true;
+  }
+
+  // The sum of the squared distances of a point p from a number of planes,
+  // p'Ap + 2b'p + c, with A symmetric.
+  struct Quadric {
+    double a[6]; // xx, xy, xz, yy, yz, zz
+    double b[3];
+    double c;
+
+    Quadric() : a{0.0, 0.0, 0.0, 0.0, 0.0, 0.0}, b{0.0, 0.0, 0.0}, c(0.0) {}
+
+    // The plane n.p + d = 0, n being of unit length
+    void addPlane(const glm::vec3 &n, const float d) {
+      a[0] += n.x * n.x; a[1] += n.x * n.y; a[2] += n.x * n.z;
+      a[3] += n.y * n.y; a[4] += n.y * n.z; a[5] += n.z * n.z;
+      b[0] += n.x * d; b[1] += n.y * d; b[2] += n.z * d;
+      c += static_cast<double>(d) * d;
+    }
+
+    void add(const Quadric &other) {
+      for (int idx = 0; idx < 6; ++idx) a[idx] += other.a[idx];
+      for (int idx = 0; idx < 3; ++idx) b[idx] += other.b[idx];
+      c += other.c;
+    }
+
+    double evaluate(const glm::vec3 &p) const {
+      double x = p.x, y = p.y, z = p.z;
+      double value = a[0] * x * x + 2.0 * a[1] * x * y + 2.0 * a[2] * x * z +
+	a[3] * y * y + 2.0 * a[4] * y * z + a[5] * z * z +
+	2.0 * (b[0] * x + b[1] * y + b[2] * z) + c;
+      return std::max(0.0, value);
+    }
+  };
+
+  struct Collapse {
+    double cost;
+    unsigned int from;
+    unsigned int to;
+    unsigned int fromVersion;
+    unsigned int toVersion;
+
+    bool operator>(const Collapse &other) const {
+      return cost > other.cost;
+    }
+  };
+
+  float Model::simplify(const size_t targetNumTriangles, const float maxError,
+			std::vector<unsigned int> &simplifiedIndexData) const {
+    TRACEZONE("Model::simplify");
+    const size_t numVertices = vertexData.size() / 4;
+    const size_t numTriangles = indexData.size() / 3;
+
+    std::vector<glm::vec3> positions(numVertices);
+    for (size_t vertex = 0; vertex < numVertices; ++vertex) {
+      positions[vertex] = glm::vec3(vertexData[4 * vertex],
+				    vertexData[4 * vertex + 1],
+				    vertexData[4 * vertex + 2]);
+    }
+
+    std::vector<unsigned int> triangles(indexData);
+    std::vector<bool> removedTriangles(numTriangles, false);
+    std::vector<std::vector<unsigned int> > vertexTriangles(numVertices);
+    std::vector<Quadric> quadrics(numVertices);
+    std::unordered_map<uint64_t, int> edgeUses;
+
+    auto edgeKey = [](const unsigned int v0, const unsigned int v1) {
+      return (static_cast<uint64_t>(std::min(v0, v1)) << 32) |
+	std::max(v0, v1);
+    };
+
+    for (unsigned int triangle = 0; triangle < numTriangles; ++triangle) {
+      const unsigned int *vertices = &triangles[3 * triangle];
+      glm::vec3 normal = glm::cross(positions[vertices[1]] -
+				    positions[vertices[0]],
+				    positions[vertices[2]] -
+				    positions[vertices[0]]);
+      float length = glm::length(normal);
+      for (int idx = 0; idx < 3; ++idx) {
+        vertexTriangles[vertices[idx]].push_back(triangle);
+        ++edgeUses[edgeKey(vertices[idx], vertices[(idx + 1) % 3])];
+      }
+      if (length == 0.0f) continue;
+      normal /= length;
+      float d = -glm::dot(normal, positions[vertices[0]]);
+      for (int idx = 0; idx < 3; ++idx) {
+        quadrics[vertices[idx]].addPlane(normal, d);
+      }
+    }
+
+    // Borders keep their shape through planes perpendicular to the
+    // triangles, along the edges that belong to a single triangle.
+    for (unsigned int triangle = 0; triangle < numTriangles; ++triangle) {
+      const unsigned int *vertices = &triangles[3 * triangle];
+      glm::vec3 normal = glm::cross(positions[vertices[1]] -
+				    positions[vertices[0]],
+				    positions[vertices[2]] -
+				    positions[vertices[0]]);
+      for (int idx = 0; idx < 3; ++idx) {
+        unsigned int v0 = vertices[idx], v1 = vertices[(idx + 1) % 3];
+        if (edgeUses[edgeKey(v0, v1)] != 1) continue;
+        glm::vec3 borderNormal = glm::cross(positions[v1] - positions[v0],
+					    normal);
+        float length = glm::length(borderNormal);
+        if (length == 0.0f) continue;
+        borderNormal /= length;
+        float d = -glm::dot(borderNormal, positions[v0]);
+        quadrics[v0].addPlane(borderNormal, d);
+        quadrics[v1].addPlane(borderNormal, d);
+      }
+    }
+
+    // Vertices that have been copied for their texture coordinates would
+    // open cracks if they were removed without their copies.
+    std::vector<bool> locked(numVertices, false);
+    size_t numOriginalVertices = numVertices - copiedVertexIndices.size();
+    for (size_t idx = 0; idx < copiedVertexIndices.size(); ++idx) {
+      locked[copiedVertexIndices[idx]] = true;
+      locked[numOriginalVertices + idx] = true;
+    }
+
+    std::vector<unsigned int> versions(numVertices, 0);
+    std::vector<bool> removedVertices(numVertices, false);
+    std::priority_queue<Collapse, std::vector<Collapse>,
+			std::greater<Collapse> > collapses;
+
+    auto addCollapse = [&](const unsigned int from, const unsigned int to) {
+      if (locked[from] || from == to) return;
+      Quadric quadric = quadrics[from];
+      quadric.add(quadrics[to]);
+      Collapse collapse;
+      collapse.cost = quadric.evaluate(positions[to]);
+      collapse.from = from;
+      collapse.to = to;
+      collapse.fromVersion = versions[from];
+      collapse.toVersion = versions[to];
+      collapses.push(collapse);
+    };
+
+    for (size_t idx = 0; idx < triangles.size(); idx += 3) {
+      for (size_t corner = 0; corner < 3; ++corner) {
+        unsigned int v0 = triangles[idx + corner];
+        unsigned int v1 = triangles[idx + (corner + 1) % 3];
+        addCollapse(v0, v1);
+        addCollapse(v1, v0);
+      }
+    }
+
+    const double maxCost = static_cast<double>(maxError) * maxError;
+    double largestCost = 0.0;
+    size_t numRemaining = numTriangles;
+
+    while (numRemaining > targetNumTriangles && !collapses.empty()) {
+      Collapse collapse = collapses.top();
+      collapses.pop();
+      const unsigned int from = collapse.from, to = collapse.to;
+      if (removedVertices[from] || removedVertices[to] ||
+	  versions[from] != collapse.fromVersion ||
+	  versions[to] != collapse.toVersion) {
+        continue;
+      }
+      // All the remaining collapses cost at least as much.
+      if (collapse.cost > maxCost) break;
+
+      std::vector<unsigned int> &fromTriangles = vertexTriangles[from];
+      fromTriangles.erase(std::remove_if(fromTriangles.begin(),
+					 fromTriangles.end(),
+					 [&](const unsigned int triangle) {
+					   return removedTriangles[triangle];
+					 }), fromTriangles.end());
+
+      // Make sure that no triangle is flipped.
+      bool flips = false;
+      for (auto triangle = fromTriangles.begin();
+	   triangle != fromTriangles.end() && !flips; ++triangle) {
+        const unsigned int *vertices = &triangles[3 * *triangle];
+        if (vertices[0] == to || vertices[1] == to || vertices[2] == to) {
+          continue;
+        }
+        glm::vec3 corners[3], movedCorners[3];
+        for (int idx = 0; idx < 3; ++idx) {
+          corners[idx] = positions[vertices[idx]];
+          movedCorners[idx] = vertices[idx] == from ? positions[to] :
+	    corners[idx];
+        }
+        glm::vec3 normal = glm::cross(corners[1] - corners[0],
+				      corners[2] - corners[0]);
+        glm::vec3 movedNormal = glm::cross(movedCorners[1] - movedCorners[0],
+					   movedCorners[2] - movedCorners[0]);
+        // Triangles that have no area to begin with cannot flip.
+        flips = glm::dot(normal, normal) > 0.0f &&
+	  glm::dot(normal, movedNormal) <= 0.0f;
+      }
+      if (flips) continue;
+
+      for (auto triangle = fromTriangles.begin();
+	   triangle != fromTriangles.end(); ++triangle) {
+        unsigned int *vertices = &triangles[3 * *triangle];
+        if (vertices[0] == to || vertices[1] == to || vertices[2] == to) {
+          removedTriangles[*triangle] = true;
+          --numRemaining;
+        }
+        else {
+          for (int idx = 0; idx < 3; ++idx) {
+            if (vertices[idx] == from) vertices[idx] = to;
+          }
+          vertexTriangles[to].push_back(*triangle);
+        }
+      }
+      fromTriangles.clear();
+      removedVertices[from] = true;
+      quadrics[to].add(quadrics[from]);
+      ++versions[to];
+      largestCost = std::max(largestCost, collapse.cost);
+
+      // The collapses of the edges of the remaining vertex cost differently
+      // now.
+      std::vector<unsigned int> &toTriangles = vertexTriangles[to];
+      toTriangles.erase(std::remove_if(toTriangles.begin(),
+				       toTriangles.end(),
+				       [&](const unsigned int triangle) {
+					 return removedTriangles[triangle];
+				       }), toTriangles.end());
+      for (auto triangle = toTriangles.begin(); triangle != toTriangles.end();
+	   ++triangle) {
+        for (int idx = 0; idx < 3; ++idx) {
+          unsigned int neighbour = triangles[3 * *triangle + idx];
+          if (neighbour == to) continue;
+          addCollapse(to, neighbour);
+          addCollapse(neighbour, to);
+        }
+      }
+    }
+
+    simplifiedIndexData.clear();
+    simplifiedIndexData.reserve(3 * numRemaining);
+    for (size_t triangle = 0; triangle < numTriangles; ++triangle) {
+      if (removedTriangles[triangle]) continue;
+      simplifiedIndexData.insert(simplifiedIndexData.end(),
+				 triangles.begin() + 3 * triangle,
+				 triangles.begin() + 3 * triangle + 3);
+    }
+    return static_cast<float>(std::sqrt(largestCost));
+  }
+
+  void Model::generateLods(const int numLevels, const float reduction) {
+    if (numLevels < 0 || reduction <= 0.0f || reduction >= 1.0f) {
+      throw std::runtime_error("Levels of detail need a positive number of "
+			       "levels and a reduction between 0 and 1.");
+    }
+    lodIndexData.clear();
+    lodErrors.clear();
+    lodIndexBuffersStale = true;
+    size_t numTriangles = indexData.size() / 3;
+    for (int level = 0; level < numLevels; ++level) {
+      size_t target = static_cast<size_t>(numTriangles * reduction);
+      std::vector<unsigned int> simplifiedIndexData;
+      float error = simplify(target, FLT_MAX, simplifiedIndexData);
+      size_t numSimplified = simplifiedIndexData.size() / 3;
+      if (numSimplified == 0 ||
+	  numSimplified > MIN_LOD_REDUCTION * numTriangles) {
+        break;
+      }
+      lodIndexData.push_back(simplifiedIndexData);
+      lodErrors.push_back(error);
+      numTriangles = numSimplified;
+    }
+  }
+
 }
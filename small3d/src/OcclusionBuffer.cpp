@@ -0,0 +1,401 @@
+/**
+ * @file  OcclusionBuffer.cpp
+ * @brief Implementation of the OcclusionBuffer class
+ *
+ *  Created on: 2026/10/19
+ *      Author: Dimitri Kourkoulis
+ *     License: BSD 3-Clause License (see LICENSE file)
+ */
+
+#include "OcclusionBuffer.hpp"
+#include "Trace.hpp"
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+#include <stdexcept>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "Simd.hpp"
+
+// Rows of the buffer rasterised by each job
+#define OCCLUSION_ROWS_PER_JOB 8
+
+// Occluders set up by each job
+#define OCCLUSION_OCCLUDERS_PER_JOB 4
+
+// Triangles smaller than this (in pixels) cannot cover a pixel centre
+// reliably, so they are left out.
+#define MIN_OCCLUDER_TRIANGLE_AREA 1e-4f
+
+namespace small3d {
+
+  static glm::mat3 getModelRotationMatrix(const glm::vec3 &rotation) {
+    return glm::mat3(glm::rotate(glm::mat4(1.0f), -rotation.y,
+				 glm::vec3(0.0f, 1.0f, 0.0f)) *
+		     glm::rotate(glm::mat4(1.0f), -rotation.x,
+				 glm::vec3(1.0f, 0.0f, 0.0f)) *
+		     glm::rotate(glm::mat4(1.0f), -rotation.z,
+				 glm::vec3(0.0f, 0.0f, 1.0f)));
+  }
+
+  // The pixel containing a position, from -1 (before the first one) to size
+  // (after the last one)
+  static int toPixel(const float position, const int size) {
+    return static_cast<int>(std::floor(std::max(-1.0f,
+						std::min(position,
+							 static_cast<float>
+							 (size)))));
+  }
+
+  OcclusionBuffer::OcclusionBuffer(const int width, const int height,
+				   const float frustumScale,
+				   const float aspectRatio, const float zNear,
+				   const float zOffsetFromCamera) {
+    if (width <= 0 || height <= 0) {
+      throw std::runtime_error("The occlusion buffer needs a positive width "
+			       "and height.");
+    }
+    this->width = (width + 3) & ~3;
+    this->height = height;
+    this->frustumScale = frustumScale;
+    this->aspectRatio = aspectRatio;
+    this->zNear = zNear;
+    this->zOffsetFromCamera = zOffsetFromCamera;
+    inverseDepths.resize(static_cast<size_t>(this->width) *
+			 static_cast<size_t>(height), 0.0f);
+    setCamera(glm::vec3(0.0f), glm::vec3(0.0f));
+  }
+
+  int OcclusionBuffer::getWidth() const {
+    return width;
+  }
+
+  int OcclusionBuffer::getHeight() const {
+    return height;
+  }
+
+  void OcclusionBuffer::setCamera(const glm::vec3 position,
+				  const glm::vec3 rotation) {
+    cameraPosition = position;
+    // As in the vertex shaders
+    cameraRotationMatrix =
+      glm::mat3(glm::rotate(glm::mat4(1.0f), rotation.z,
+			    glm::vec3(0.0f, 0.0f, 1.0f)) *
+		glm::rotate(glm::mat4(1.0f), rotation.x,
+			    glm::vec3(1.0f, 0.0f, 0.0f)) *
+		glm::rotate(glm::mat4(1.0f), rotation.y,
+			    glm::vec3(0.0f, 1.0f, 0.0f)));
+  }
+
+  // The result holds the position on the buffer (x, y), the inverse of the
+  // depth and the depth itself.
+  void OcclusionBuffer::project(const glm::vec3 &viewPosition,
+				glm::vec4 &screenVertex) const {
+    float depth = -viewPosition.z;
+    float w = zOffsetFromCamera * viewPosition.z;
+    screenVertex.x = (frustumScale * viewPosition.x / w + 1.0f) * 0.5f *
+      static_cast<float>(width);
+    screenVertex.y = (frustumScale * aspectRatio * viewPosition.y / w + 1.0f) *
+      0.5f * static_cast<float>(height);
+    screenVertex.z = 1.0f / depth;
+    screenVertex.w = depth;
+  }
+
+  void OcclusionBuffer::setUpOccluder(SceneObject &occluder,
+				      std::vector<glm::vec4> &vertices,
+				      std::vector<Triangle> &triangles) const {
+    const Model &model = occluder.getModel();
+    glm::mat3 rotationMatrix = getModelRotationMatrix(occluder.rotation);
+
+    // The vertices as drawn: skinned, or blended with the next frame
+    const float *vertexData = model.vertexData.data();
+    const float *nextVertexData = nullptr;
+    float frameBlend = occluder.getFrameBlend();
+    if (occluder.getSkeleton() && !model.boneIndexData.empty()) {
+      occluder.skin();
+      vertexData = occluder.getSkinnedVertexData().data();
+    }
+    else if (frameBlend > 0.0f) {
+      nextVertexData = occluder.getNextModel().vertexData.data();
+    }
+
+    size_t numVertices = model.vertexData.size() / 4;
+    vertices.resize(numVertices);
+    for (size_t vertex = 0; vertex < numVertices; ++vertex) {
+      glm::vec3 position(vertexData[4 * vertex], vertexData[4 * vertex + 1],
+			 vertexData[4 * vertex + 2]);
+      if (nextVertexData != nullptr) {
+        position = glm::mix(position,
+			    glm::vec3(nextVertexData[4 * vertex],
+				      nextVertexData[4 * vertex + 1],
+				      nextVertexData[4 * vertex + 2]),
+			    frameBlend);
+      }
+      glm::vec3 viewPosition = cameraRotationMatrix *
+	(occluder.offset + rotationMatrix * position - cameraPosition);
+      if (-viewPosition.z < zNear) {
+        // Marked as behind the near plane
+        vertices[vertex] = glm::vec4(0.0f, 0.0f, 0.0f, -1.0f);
+      }
+      else {
+        project(viewPosition, vertices[vertex]);
+      }
+    }
+
+    triangles.clear();
+    for (size_t idx = 0; idx + 2 < model.indexData.size(); idx += 3) {
+      glm::vec4 corners[3] = {vertices[model.indexData[idx]],
+			      vertices[model.indexData[idx + 1]],
+			      vertices[model.indexData[idx + 2]]};
+      if (corners[0].w < 0.0f || corners[1].w < 0.0f ||
+	  corners[2].w < 0.0f) {
+        continue;
+      }
+
+      // Both sides of the occluders hide what is behind them, so the
+      // triangles are turned counterclockwise.
+      float area = (corners[1].x - corners[0].x) *
+	(corners[2].y - corners[0].y) -
+	(corners[2].x - corners[0].x) * (corners[1].y - corners[0].y);
+      if (std::abs(area) < MIN_OCCLUDER_TRIANGLE_AREA) continue;
+      if (area < 0.0f) {
+        std::swap(corners[1], corners[2]);
+        area = -area;
+      }
+
+      Triangle triangle;
+      triangle.minX = toPixel(std::min(std::min(corners[0].x, corners[1].x),
+				       corners[2].x), width);
+      triangle.maxX = toPixel(std::max(std::max(corners[0].x, corners[1].x),
+				       corners[2].x), width);
+      triangle.minY = toPixel(std::min(std::min(corners[0].y, corners[1].y),
+				       corners[2].y), height);
+      triangle.maxY = toPixel(std::max(std::max(corners[0].y, corners[1].y),
+				       corners[2].y), height);
+      if (triangle.maxX < 0 || triangle.maxY < 0 ||
+	  triangle.minX >= width || triangle.minY >= height) {
+        continue;
+      }
+      triangle.minX = std::max(triangle.minX, 0);
+      triangle.maxX = std::min(triangle.maxX, width - 1);
+      triangle.minY = std::max(triangle.minY, 0);
+      triangle.maxY = std::min(triangle.maxY, height - 1);
+
+      // Edge n goes from corner n to the next one, so it is opposite the
+      // corner after that.
+      float depthA = 0.0f, depthB = 0.0f, depthC = 0.0f;
+      for (int edge = 0; edge < 3; ++edge) {
+        const glm::vec4 &from = corners[edge];
+        const glm::vec4 &to = corners[(edge + 1) % 3];
+        triangle.edgeA[edge] = from.y - to.y;
+        triangle.edgeB[edge] = to.x - from.x;
+        triangle.edgeC[edge] = from.x * to.y - from.y * to.x;
+        float opposite = corners[(edge + 2) % 3].z;
+        depthA += triangle.edgeA[edge] * opposite;
+        depthB += triangle.edgeB[edge] * opposite;
+        depthC += triangle.edgeC[edge] * opposite;
+      }
+      triangle.depthA = depthA / area;
+      triangle.depthB = depthB / area;
+      triangle.depthC = depthC / area;
+      triangles.push_back(triangle);
+    }
+  }
+
+  void OcclusionBuffer::rasteriseRows(const int beginRow, const int endRow) {
+    for (size_t occluder = 0; occluder < occluderTriangles.size();
+	 ++occluder) {
+      const std::vector<Triangle> &triangles = occluderTriangles[occluder];
+      for (auto triangle = triangles.begin(); triangle != triangles.end();
+	   ++triangle) {
+        int minY = std::max(triangle->minY, beginRow);
+        int maxY = std::min(triangle->maxY, endRow - 1);
+        // Pixels are rasterised in aligned groups of 4.
+        int minX = triangle->minX & ~3;
+        for (int y = minY; y <= maxY; ++y) {
+          float centreY = static_cast<float>(y) + 0.5f;
+          float centreX = static_cast<float>(minX) + 0.5f;
+          float *row = &inverseDepths[static_cast<size_t>(y) *
+				      static_cast<size_t>(width)];
+          float edges[3];
+          for (int edge = 0; edge < 3; ++edge) {
+            edges[edge] = triangle->edgeA[edge] * centreX +
+	      triangle->edgeB[edge] * centreY + triangle->edgeC[edge];
+          }
+          float depth = triangle->depthA * centreX +
+	    triangle->depthB * centreY + triangle->depthC;
+#ifdef SMALL3D_SSE2
+          const __m128 steps = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+          const __m128 zero = _mm_setzero_ps();
+          __m128 edge0 = _mm_add_ps(_mm_set1_ps(edges[0]),
+				    _mm_mul_ps(_mm_set1_ps(triangle->edgeA[0]),
+					       steps));
+          __m128 edge1 = _mm_add_ps(_mm_set1_ps(edges[1]),
+				    _mm_mul_ps(_mm_set1_ps(triangle->edgeA[1]),
+					       steps));
+          __m128 edge2 = _mm_add_ps(_mm_set1_ps(edges[2]),
+				    _mm_mul_ps(_mm_set1_ps(triangle->edgeA[2]),
+					       steps));
+          __m128 depths = _mm_add_ps(_mm_set1_ps(depth),
+				     _mm_mul_ps(_mm_set1_ps(triangle->depthA),
+						steps));
+          const __m128 edge0Step = _mm_set1_ps(4.0f * triangle->edgeA[0]);
+          const __m128 edge1Step = _mm_set1_ps(4.0f * triangle->edgeA[1]);
+          const __m128 edge2Step = _mm_set1_ps(4.0f * triangle->edgeA[2]);
+          const __m128 depthStep = _mm_set1_ps(4.0f * triangle->depthA);
+          for (int x = minX; x <= triangle->maxX; x += 4) {
+            __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(edge0, zero),
+						  _mm_cmpge_ps(edge1, zero)),
+				       _mm_cmpge_ps(edge2, zero));
+            if (_mm_movemask_ps(inside) != 0) {
+              __m128 current = _mm_loadu_ps(row + x);
+              __m128 nearest = _mm_max_ps(current, depths);
+              _mm_storeu_ps(row + x,
+			    _mm_or_ps(_mm_and_ps(inside, nearest),
+				      _mm_andnot_ps(inside, current)));
+            }
+            edge0 = _mm_add_ps(edge0, edge0Step);
+            edge1 = _mm_add_ps(edge1, edge1Step);
+            edge2 = _mm_add_ps(edge2, edge2Step);
+            depths = _mm_add_ps(depths, depthStep);
+          }
+#else
+          for (int x = minX; x <= triangle->maxX; ++x) {
+            if (edges[0] >= 0.0f && edges[1] >= 0.0f && edges[2] >= 0.0f) {
+              row[x] = std::max(row[x], depth);
+            }
+            for (int edge = 0; edge < 3; ++edge) {
+              edges[edge] += triangle->edgeA[edge];
+            }
+            depth += triangle->depthA;
+          }
+#endif
+        }
+      }
+    }
+  }
+
+  void OcclusionBuffer::draw(const std::vector<SceneObject*> &occluders) {
+    TRACEZONE("OcclusionBuffer::draw");
+    occluderVertices.resize(occluders.size());
+    occluderTriangles.resize(occluders.size());
+    for (size_t idx = 0; idx < occluders.size(); ++idx) {
+      setUpOccluder(*occluders[idx], occluderVertices[idx],
+		    occluderTriangles[idx]);
+    }
+    std::fill(inverseDepths.begin(), inverseDepths.end(), 0.0f);
+    rasteriseRows(0, height);
+  }
+
+  void OcclusionBuffer::draw(const std::vector<SceneObject*> &occluders,
+			     JobSystem &jobSystem) {
+    TRACEZONE("OcclusionBuffer::draw");
+    occluderVertices.resize(occluders.size());
+    occluderTriangles.resize(occluders.size());
+    jobSystem.parallelFor(occluders.size(), OCCLUSION_OCCLUDERS_PER_JOB,
+			  [this, &occluders](size_t begin, size_t end) {
+			    for (size_t idx = begin; idx < end; ++idx) {
+			      setUpOccluder(*occluders[idx],
+					    occluderVertices[idx],
+					    occluderTriangles[idx]);
+			    }
+			  });
+
+    // Each job clears and draws its own rows.
+    jobSystem.parallelFor(static_cast<size_t>(height), OCCLUSION_ROWS_PER_JOB,
+			  [this](size_t begin, size_t end) {
+			    size_t rowSize = static_cast<size_t>(width);
+			    std::fill(&inverseDepths[begin * rowSize],
+				      &inverseDepths[0] + end * rowSize, 0.0f);
+			    rasteriseRows(static_cast<int>(begin),
+					  static_cast<int>(end));
+			  });
+  }
+
+  bool OcclusionBuffer::isVisible(const glm::vec3 minCoords,
+				  const glm::vec3 maxCoords,
+				  const glm::vec3 offset,
+				  const glm::vec3 rotation) const {
+    glm::mat3 rotationMatrix = getModelRotationMatrix(rotation);
+
+    float minX = FLT_MAX, maxX = -FLT_MAX, minY = FLT_MAX, maxY = -FLT_MAX;
+    float nearest = 0.0f;
+    int numCornersBehind = 0;
+    for (int corner = 0; corner < 8; ++corner) {
+      glm::vec3 position((corner & 1) ? maxCoords.x : minCoords.x,
+			 (corner & 2) ? maxCoords.y : minCoords.y,
+			 (corner & 4) ? maxCoords.z : minCoords.z);
+      glm::vec3 viewPosition = cameraRotationMatrix *
+	(offset + rotationMatrix * position - cameraPosition);
+      if (-viewPosition.z < zNear) {
+        ++numCornersBehind;
+        continue;
+      }
+      glm::vec4 screenVertex;
+      project(viewPosition, screenVertex);
+      minX = std::min(minX, screenVertex.x);
+      maxX = std::max(maxX, screenVertex.x);
+      minY = std::min(minY, screenVertex.y);
+      maxY = std::max(maxY, screenVertex.y);
+      nearest = std::max(nearest, screenVertex.z);
+    }
+
+    // Boxes entirely behind the near plane cannot be seen and boxes
+    // crossing it are too close to tell.
+    if (numCornersBehind == 8) return false;
+    if (numCornersBehind > 0) return true;
+
+    if (maxX < 0.0f || maxY < 0.0f || minX >= static_cast<float>(width) ||
+	minY >= static_cast<float>(height)) {
+      return false;
+    }
+
+    // Occluders are drawn on the pixels whose centres they cover, so a
+    // pixel on the edge of one may be partly uncovered. The box is checked
+    // on one more pixel on each side, so that it is not hidden if it shows
+    // past the edge.
+    int beginX = std::max(0, toPixel(minX, width) - 1);
+    int endX = std::min(width - 1, toPixel(maxX, width) + 1);
+    int beginY = std::max(0, toPixel(minY, height) - 1);
+    int endY = std::min(height - 1, toPixel(maxY, height) + 1);
+
+    // The box is hidden if the occluders are nearer than its nearest
+    // corner everywhere it covers.
+    for (int y = beginY; y <= endY; ++y) {
+      const float *row = &inverseDepths[static_cast<size_t>(y) *
+					static_cast<size_t>(width)];
+      int x = beginX;
+#ifdef SMALL3D_SSE2
+      const __m128 boxDepth = _mm_set1_ps(nearest);
+      for (; x + 3 <= endX; x += 4) {
+        if (_mm_movemask_ps(_mm_cmple_ps(_mm_loadu_ps(row + x),
+					 boxDepth)) != 0) {
+          return true;
+        }
+      }
+#endif
+      for (; x <= endX; ++x) {
+        if (row[x] <= nearest) return true;
+      }
+    }
+    return false;
+  }
+
+  bool OcclusionBuffer::isVisible(SceneObject &sceneObject) const {
+    glm::vec3 minCoords, maxCoords;
+    sceneObject.getBoundingCoords(minCoords, maxCoords);
+    return isVisible(minCoords, maxCoords, sceneObject.offset,
+		     sceneObject.rotation);
+  }
+
+  float OcclusionBuffer::getDepth(const int x, const int y) const {
+    if (x < 0 || y < 0 || x >= width || y >= height) {
+      throw std::runtime_error("Pixel outside the occlusion buffer.");
+    }
+    float inverseDepth = inverseDepths[static_cast<size_t>(y) *
+				       static_cast<size_t>(width) +
+				       static_cast<size_t>(x)];
+    return inverseDepth > 0.0f ? 1.0f / inverseDepth : FLT_MAX;
+  }
+
+}
@@ -10,10 +10,26 @@
 
 #include <stdexcept>
 #include <fstream>
+#include <cstring>
+#include <algorithm>
+#include <sstream>
+#include <iomanip>
+#include <cfloat>
+#include <cmath>
+
+#include "Trace.hpp"
+
+#ifdef SMALL3D_HEADLESS
+#include <EGL/eglext.h>
+#endif
 
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+// The width of the occlusion buffer, in pixels. Its height follows the
+// aspect ratio of the screen.
+#define OCCLUSION_BUFFER_WIDTH 256
+
 namespace small3d {
 
   static void error_callback(int error, const char* description)
@@ -23,6 +39,55 @@ namespace small3d {
   
   static std::string openglErrorToString(GLenum error);
 
+  // Adds the CPU time of a Renderer call to a statistic. Calls made from
+  // within another timed call (e.g. the rectangle rendered when writing text)
+  // count towards the statistic of the outer call.
+  class CallTimer {
+  private:
+    double *milliseconds;
+    bool *timingCall;
+    std::chrono::steady_clock::time_point startTime;
+  public:
+    CallTimer(double &milliseconds, bool &timingCall) {
+      if (timingCall) {
+        this->milliseconds = nullptr;
+        this->timingCall = nullptr;
+      }
+      else {
+        this->milliseconds = &milliseconds;
+        this->timingCall = &timingCall;
+        timingCall = true;
+        startTime = std::chrono::steady_clock::now();
+      }
+    }
+
+    ~CallTimer() {
+      if (milliseconds != nullptr) {
+        *milliseconds += std::chrono::duration<double, std::milli>
+	  (std::chrono::steady_clock::now() - startTime).count();
+        *timingCall = false;
+      }
+    }
+  };
+
+  FrameStats::FrameStats() {
+    frameNumber = 0;
+    frameMilliseconds = 0.0;
+    modelMilliseconds = 0.0;
+    rectangleMilliseconds = 0.0;
+    textMilliseconds = 0.0;
+    occlusionMilliseconds = 0.0;
+    numDrawCalls = 0;
+    numTriangles = 0;
+    numTrianglesSavedByLod = 0;
+    numObjectsCulled = 0;
+    numStateChanges = 0;
+    textureUploadBytes = 0;
+    bufferUploadBytes = 0;
+    gpuMilliseconds = -1.0;
+    gpuFrameNumber = 0;
+  }
+
   std::string Renderer::loadShaderFromFile(const std::string fileLocation)
     const {
     initLogger();
@@ -58,7 +123,7 @@ namespace small3d {
         + this->getShaderInfoLog(shader));
     }
     else {
-      LOGDEBUG("Shader " + shaderSourceFile + " compiled successfully.");
+      LOGDEBUGF("Shader {} compiled successfully.", shaderSourceFile);
     }
     return shader;
   }
@@ -104,7 +169,9 @@ namespace small3d {
 #ifdef __APPLE__
     glewExperimental = GL_TRUE;
 #endif
-    GLenum initResult = glewInit();
+    // When running headless, there is no window system for glewInit to
+    // query, so only the OpenGL entry points are loaded.
+    GLenum initResult = headless ? glewContextInit() : glewInit();
 
     if (initResult != GLEW_OK) {
       throw std::runtime_error("Error initialising GLEW");
@@ -217,6 +284,7 @@ namespace small3d {
   GLuint Renderer::generateTexture(const std::string name, const float* data,
 				   const unsigned long width,
 				   const unsigned long height) {
+    TRACEZONE("Renderer::generateTexture");
 
     GLuint textureHandle;
     glGenTextures(1, &textureHandle);
@@ -228,6 +296,7 @@ namespace small3d {
 
     glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, GL_RGBA,
       GL_FLOAT, data);
+    currentFrameStats.textureUploadBytes += 4 * sizeof(float) * width * height;
 
     textures.insert(make_pair(name, textureHandle));
 
@@ -240,10 +309,15 @@ namespace small3d {
 		      const float zFar, const float zOffsetFromCamera,
 		      const std::string shadersPath) {
 
-    int screenWidth = width;
-    int screenHeight = height;
+    screenWidth = width;
+    screenHeight = height;
 
-    this->initWindow(screenWidth, screenHeight, windowTitle);
+    if (headless) {
+      this->initHeadless(screenWidth, screenHeight);
+    }
+    else {
+      this->initWindow(screenWidth, screenHeight, windowTitle);
+    }
 
     this->frustumScale = frustumScale;
     this->zNear = zNear;
@@ -252,6 +326,10 @@ namespace small3d {
 
     this->initOpenGL();
 
+    if (isOpenGL33Supported) {
+      glGenQueries(2, timerQueries);
+    }
+
     std::string vertexShaderPath;
     std::string fragmentShaderPath;
     std::string simpleVertexShaderPath;
@@ -398,8 +476,7 @@ namespace small3d {
       width = mode->width;
       height = mode->height;
 
-      LOGINFO("Detected screen width " + intToStr(width) + " and height " +
-	      intToStr(height));
+      LOGINFOF("Detected screen width {} and height {}", width, height);
     }
 
     window = glfwCreateWindow(width, height, windowTitle.c_str(), monitor,
@@ -411,15 +488,103 @@ namespace small3d {
     glfwMakeContextCurrent(window);
 
   }
+
+  void Renderer::initHeadless(const int width, const int height) {
+#ifdef SMALL3D_HEADLESS
+    if (width <= 0 || height <= 0) {
+      throw std::runtime_error("The width and height have to be set when "
+			       "running headless.");
+    }
+
+    // Prefer the surfaceless platform, which does not need a display server
+    // or a GPU (e.g. Mesa llvmpipe), falling back to the default display.
+    eglDisplay = EGL_NO_DISPLAY;
+#ifdef EGL_PLATFORM_SURFACELESS_MESA
+    const char *clientExtensions = eglQueryString(EGL_NO_DISPLAY,
+						  EGL_EXTENSIONS);
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+      reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>
+      (eglGetProcAddress("eglGetPlatformDisplayEXT"));
+    if (clientExtensions != nullptr && getPlatformDisplay != nullptr &&
+	strstr(clientExtensions, "EGL_MESA_platform_surfaceless") != nullptr) {
+      eglDisplay = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA,
+				      EGL_DEFAULT_DISPLAY, nullptr);
+    }
+#endif
+    if (eglDisplay == EGL_NO_DISPLAY) {
+      eglDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    }
+
+    EGLint major = 0, minor = 0;
+    if (eglDisplay == EGL_NO_DISPLAY ||
+	!eglInitialize(eglDisplay, &major, &minor)) {
+      throw std::runtime_error("Unable to initialise EGL");
+    }
+    LOGINFOF("Using EGL version {}.{}", major, minor);
+
+    if (!eglBindAPI(EGL_OPENGL_API)) {
+      throw std::runtime_error("OpenGL is not supported by EGL");
+    }
+
+    const EGLint configAttributes[] = {
+      EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+      EGL_RED_SIZE, 8,
+      EGL_GREEN_SIZE, 8,
+      EGL_BLUE_SIZE, 8,
+      EGL_ALPHA_SIZE, 8,
+      EGL_DEPTH_SIZE, 24,
+      EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+      EGL_NONE
+    };
+    EGLConfig config;
+    EGLint numConfigs = 0;
+    if (!eglChooseConfig(eglDisplay, configAttributes, &config, 1,
+			 &numConfigs) || numConfigs == 0) {
+      throw std::runtime_error("No suitable EGL configuration found");
+    }
+
+    const EGLint surfaceAttributes[] = {
+      EGL_WIDTH, width,
+      EGL_HEIGHT, height,
+      EGL_NONE
+    };
+    eglSurface = eglCreatePbufferSurface(eglDisplay, config,
+					 surfaceAttributes);
+    if (eglSurface == EGL_NO_SURFACE) {
+      throw std::runtime_error("Unable to create EGL surface");
+    }
+
+    eglContext = eglCreateContext(eglDisplay, config, EGL_NO_CONTEXT,
+				  nullptr);
+    if (eglContext == EGL_NO_CONTEXT) {
+      throw std::runtime_error("Unable to create EGL context");
+    }
+
+    if (!eglMakeCurrent(eglDisplay, eglSurface, eglSurface, eglContext)) {
+      throw std::runtime_error("Unable to make the EGL context current");
+    }
+#else
+    throw std::runtime_error("small3d has not been built with headless "
+			     "rendering support (SMALL3D_HEADLESS).");
+#endif
+  }
   
   Renderer::Renderer(const std::string windowTitle, const int width,
 		     const int height, const float frustumScale,
 		     const float zNear, const float zFar,
 		     const float zOffsetFromCamera,
-                     const std::string shadersPath) {
+                     const std::string shadersPath, const bool headless) {
     
     isOpenGL33Supported = false;
     window = 0;
+    this->headless = headless;
+    screenWidth = 0;
+    screenHeight = 0;
+#ifdef SMALL3D_HEADLESS
+    eglDisplay = EGL_NO_DISPLAY;
+    eglContext = EGL_NO_CONTEXT;
+    eglSurface = EGL_NO_SURFACE;
+#endif
     perspectiveProgram = 0;
     orthographicProgram = 0;
     noShaders = false;
@@ -427,9 +592,20 @@ namespace small3d {
     cameraPosition = glm::vec3(0, 0, 0);
     cameraRotation = glm::vec3(0, 0, 0);
     lightIntensity = 1.0f;
+    timingCall = false;
+    timerQueries[0] = 0;
+    timerQueries[1] = 0;
+    timerQueryPending[0] = false;
+    timerQueryPending[1] = false;
+    timerQueryRunning = false;
+    streamedPositionBufferObjectId = 0;
+    streamedNormalsBufferObjectId = 0;
+    occlusionCulling = false;
     
     init(width, height, windowTitle, frustumScale, zNear, zFar,
 	 zOffsetFromCamera, shadersPath);
+
+    startFrameStats();
     
     FT_Error ftError = FT_Init_FreeType( &library );
     
@@ -451,15 +627,30 @@ namespace small3d {
 				  const int height, const float frustumScale,
 				  const float zNear, const float zFar,
 				  const float zOffsetFromCamera, 
-				  const std::string shadersPath) {
+				  const std::string shadersPath,
+				  const bool headless) {
     
     static Renderer instance(windowTitle, width, height, frustumScale, zNear,
-			     zFar, zOffsetFromCamera, shadersPath);
+			     zFar, zOffsetFromCamera, shadersPath, headless);
     return instance;
   }
   
   Renderer::~Renderer() {
     LOGDEBUG("Renderer destructor running");
+    frameCapture.reset();
+
+    if (timerQueries[0] != 0) {
+      if (timerQueryRunning) {
+        glEndQuery(GL_TIME_ELAPSED);
+      }
+      glDeleteQueries(2, timerQueries);
+    }
+
+    if (streamedPositionBufferObjectId != 0) {
+      glDeleteBuffers(1, &streamedPositionBufferObjectId);
+      glDeleteBuffers(1, &streamedNormalsBufferObjectId);
+    }
+
     for (auto it = textures.begin();
          it != textures.end(); ++it) {
       LOGDEBUG("Deleting texture " + it->first);
@@ -490,13 +681,81 @@ namespace small3d {
       glDeleteProgram(perspectiveProgram);
     }
     
-    glfwTerminate();
+#ifdef SMALL3D_HEADLESS
+    if (eglDisplay != EGL_NO_DISPLAY) {
+      eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE,
+		     EGL_NO_CONTEXT);
+      if (eglContext != EGL_NO_CONTEXT) {
+        eglDestroyContext(eglDisplay, eglContext);
+      }
+      if (eglSurface != EGL_NO_SURFACE) {
+        eglDestroySurface(eglDisplay, eglSurface);
+      }
+      eglTerminate(eglDisplay);
+    }
+#endif
+
+    if (!headless) {
+      glfwTerminate();
+    }
   }
   
   GLFWwindow* Renderer::getWindow() const{
     return window;
   }
+
+  bool Renderer::isHeadless() const {
+    return headless;
+  }
+
+  int Renderer::getScreenWidth() const {
+    return screenWidth;
+  }
+
+  int Renderer::getScreenHeight() const {
+    return screenHeight;
+  }
+
+  void Renderer::readPixels(std::vector<unsigned char> &pixels,
+			    const bool topRowFirst) const {
+    size_t rowSize = 4 * static_cast<size_t>(screenWidth);
+    pixels.resize(rowSize * static_cast<size_t>(screenHeight));
+
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, screenWidth, screenHeight, GL_RGBA, GL_UNSIGNED_BYTE,
+		 &pixels[0]);
+    checkForOpenGLErrors("reading pixels", true);
+
+    if (topRowFirst) {
+      for (int rowIdx = 0; rowIdx < screenHeight / 2; ++rowIdx) {
+        unsigned char *top = &pixels[static_cast<size_t>(rowIdx) * rowSize];
+        unsigned char *bottom =
+	  &pixels[static_cast<size_t>(screenHeight - 1 - rowIdx) * rowSize];
+        std::swap_ranges(top, top + rowSize, bottom);
+      }
+    }
+  }
  
+  void Renderer::startCapture(const std::string path,
+			      const CaptureFormat format,
+			      const unsigned int framesPerSecond) {
+    if (frameCapture) {
+      throw std::runtime_error("Frames are already being captured.");
+    }
+    frameCapture.reset(new FrameCapture(screenWidth, screenHeight, path,
+					format, framesPerSecond));
+  }
+
+  void Renderer::stopCapture() {
+    if (!frameCapture) return;
+    std::unique_ptr<FrameCapture> capture(std::move(frameCapture));
+    capture->finish();
+  }
+
+  bool Renderer::isCapturing() const {
+    return frameCapture != nullptr;
+  }
+
   void Renderer::generateTexture(const std::string name, const Image image) {
     this->generateTexture(name, image.getData(), image.getWidth(),
 			  image.getHeight());
@@ -516,6 +775,9 @@ namespace small3d {
 				 const glm::vec3 bottomRight,
 				 const bool perspective,
 				 const glm::vec4 colour) const {
+
+    TRACEZONE("Renderer::renderRectangle");
+    CallTimer callTimer(currentFrameStats.rectangleMilliseconds, timingCall);
     
     float vertices[16] = {
       bottomRight.x, bottomRight.y, bottomRight.z, 1.0f,
@@ -525,6 +787,7 @@ namespace small3d {
     };
     
     glUseProgram(perspective ? perspectiveProgram : orthographicProgram);
+    ++currentFrameStats.numStateChanges;
     
     GLuint boxBuffer = 0;
     glGenBuffers(1, &boxBuffer);
@@ -534,6 +797,7 @@ namespace small3d {
                  sizeof(float) * 16,
                  &vertices[0],
                  GL_STATIC_DRAW);
+    currentFrameStats.bufferUploadBytes += sizeof(float) * 16;
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, 0);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
@@ -549,6 +813,7 @@ namespace small3d {
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferObject);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * 6,
 		 vertexIndexes, GL_STATIC_DRAW);
+    currentFrameStats.bufferUploadBytes += sizeof(unsigned int) * 6;
     
     GLuint coordBuffer = 0;
 
@@ -562,6 +827,7 @@ namespace small3d {
       }
 
       glBindTexture(GL_TEXTURE_2D, textureHandle);
+      ++currentFrameStats.numStateChanges;
 
       float textureCoords[8] = {
         1.0f, 1.0f,
@@ -576,6 +842,7 @@ namespace small3d {
 		   sizeof(float) * 8,
 		   textureCoords,
 		   GL_STATIC_DRAW);
+      currentFrameStats.bufferUploadBytes += sizeof(float) * 8;
       glEnableVertexAttribArray(1);
       glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, 0);
     
@@ -605,6 +872,8 @@ namespace small3d {
     
     glDrawElements(GL_TRIANGLES,
                    6, GL_UNSIGNED_INT, 0);
+    ++currentFrameStats.numDrawCalls;
+    currentFrameStats.numTriangles += 2;
     
     glDeleteBuffers(1, &indexBufferObject);
     glDeleteBuffers(1, &boxBuffer);
@@ -629,54 +898,273 @@ namespace small3d {
     this->renderRectangle("", topLeft, bottomRight, perspective, colour);
   }
   
-  void Renderer::render(Model &model, const glm::vec3 offset,
-			const glm::vec3 rotation, 
-			const glm::vec4 colour,
-			const std::string textureName) const {
-    
-    glUseProgram(perspectiveProgram);
-    
-    bool alreadyInGPU = model.positionBufferObjectId != 0;
-    
-    if (!alreadyInGPU) {
-      glGenBuffers(1, &model.indexBufferObjectId);
-      glGenBuffers(1, &model.positionBufferObjectId);
-      glGenBuffers(1, &model.normalsBufferObjectId);
-      glGenBuffers(1, &model.uvBufferObjectId);
-    }     
+  void Renderer::uploadModel(Model &model) const {
+    glGenBuffers(1, &model.indexBufferObjectId);
+    glGenBuffers(1, &model.positionBufferObjectId);
+    glGenBuffers(1, &model.normalsBufferObjectId);
+    glGenBuffers(1, &model.uvBufferObjectId);
 
     // Vertex
     glBindBuffer(GL_ARRAY_BUFFER, model.positionBufferObjectId);
-    if (!alreadyInGPU) {
+    glBufferData(GL_ARRAY_BUFFER,
+		 model.vertexDataByteSize,
+		 model.vertexData.data(),
+		 GL_STATIC_DRAW);
+    currentFrameStats.bufferUploadBytes +=
+      static_cast<unsigned long>(model.vertexDataByteSize);
+
+    // Vertex indices
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, model.indexBufferObjectId);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+		 model.indexDataByteSize,
+		 model.indexData.data(),
+		 GL_STATIC_DRAW);
+    currentFrameStats.bufferUploadBytes +=
+      static_cast<unsigned long>(model.indexDataByteSize);
+
+    // Normals
+    glBindBuffer(GL_ARRAY_BUFFER, model.normalsBufferObjectId);
+    glBufferData(GL_ARRAY_BUFFER,
+		 model.normalsDataByteSize,
+		 model.normalsData.data(),
+		 GL_STATIC_DRAW);
+    currentFrameStats.bufferUploadBytes +=
+      static_cast<unsigned long>(model.normalsDataByteSize);
+
+    // UV Coordinates (not all models have them)
+    if (!model.textureCoordsData.empty()) {
+      glBindBuffer(GL_ARRAY_BUFFER, model.uvBufferObjectId);
       glBufferData(GL_ARRAY_BUFFER,
-		   model.vertexDataByteSize,
-		   model.vertexData.data(),
+		   model.textureCoordsDataByteSize,
+		   model.textureCoordsData.data(),
 		   GL_STATIC_DRAW);
+      currentFrameStats.bufferUploadBytes +=
+	static_cast<unsigned long>(model.textureCoordsDataByteSize);
     }
+  }
 
-    // Vertex indices
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, model.indexBufferObjectId);
-    if (!alreadyInGPU) {
+  void Renderer::uploadBones(Model &model) const {
+    glGenBuffers(1, &model.boneIndexBufferObjectId);
+    glGenBuffers(1, &model.boneWeightBufferObjectId);
+
+    glBindBuffer(GL_ARRAY_BUFFER, model.boneIndexBufferObjectId);
+    glBufferData(GL_ARRAY_BUFFER,
+		 static_cast<GLsizeiptr>(model.boneIndexData.size()),
+		 model.boneIndexData.data(),
+		 GL_STATIC_DRAW);
+    currentFrameStats.bufferUploadBytes +=
+      static_cast<unsigned long>(model.boneIndexData.size());
+
+    glBindBuffer(GL_ARRAY_BUFFER, model.boneWeightBufferObjectId);
+    glBufferData(GL_ARRAY_BUFFER,
+		 static_cast<GLsizeiptr>(model.boneWeightData.size() *
+					 sizeof(float)),
+		 model.boneWeightData.data(),
+		 GL_STATIC_DRAW);
+    currentFrameStats.bufferUploadBytes +=
+      static_cast<unsigned long>(model.boneWeightData.size() * sizeof(float));
+  }
+
+  void Renderer::uploadLods(Model &model) const {
+    if (!model.lodIndexBufferObjectIds.empty()) {
+      glDeleteBuffers(static_cast<GLsizei>(model.lodIndexBufferObjectIds.
+					   size()),
+		      model.lodIndexBufferObjectIds.data());
+    }
+    model.lodIndexBufferObjectIds.resize(model.lodIndexData.size());
+    glGenBuffers(static_cast<GLsizei>(model.lodIndexBufferObjectIds.size()),
+		 model.lodIndexBufferObjectIds.data());
+
+    for (size_t level = 0; level < model.lodIndexData.size(); ++level) {
+      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,
+		   model.lodIndexBufferObjectIds[level]);
       glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-		   model.indexDataByteSize,
-		   model.indexData.data(),
+		   static_cast<GLsizeiptr>(model.lodIndexData[level].size() *
+					   sizeof(unsigned int)),
+		   model.lodIndexData[level].data(),
 		   GL_STATIC_DRAW);
+      currentFrameStats.bufferUploadBytes +=
+	static_cast<unsigned long>(model.lodIndexData[level].size() *
+				   sizeof(unsigned int));
     }
+    model.lodIndexBuffersStale = false;
+  }
 
+  float Renderer::getScreenSize(const Model &model, const glm::vec3 offset,
+				const glm::vec3 rotation) const {
+    // The bounding sphere of the model, placed in the world
+    glm::mat3 rotationMatrix =
+      glm::mat3(glm::rotate(glm::mat4(1.0f), -rotation.y,
+			    glm::vec3(0.0f, 1.0f, 0.0f)) *
+		glm::rotate(glm::mat4(1.0f), -rotation.x,
+			    glm::vec3(1.0f, 0.0f, 0.0f)) *
+		glm::rotate(glm::mat4(1.0f), -rotation.z,
+			    glm::vec3(0.0f, 0.0f, 1.0f)));
+    glm::vec3 centre = offset + rotationMatrix *
+      ((model.minCoords + model.maxCoords) / 2.0f);
+    float radius = glm::length(model.maxCoords - model.minCoords) / 2.0f;
+    float distance = glm::length(centre - cameraPosition);
+
+    if (distance <= radius) return FLT_MAX;
+
+    // Fraction of the height of the screen covered by the sphere's diameter
+    return frustumScale * screenWidth / screenHeight * radius /
+      (distance * std::abs(zOffsetFromCamera));
+  }
+
+  void Renderer::renderModel(Model &model, SceneObject *sceneObject,
+			     const glm::vec3 offset,
+			     const glm::vec3 rotation,
+			     const glm::vec4 colour,
+			     const std::string textureName) const {
+
+    TRACEZONE("Renderer::render");
+
+    if (sceneObject != nullptr && occlusionCulling) {
+      CallTimer occlusionTimer(currentFrameStats.occlusionMilliseconds,
+			       timingCall);
+      glm::vec3 minCoords, maxCoords;
+      sceneObject->getBoundingCoords(minCoords, maxCoords);
+      if (!occlusionBuffer->isVisible(minCoords, maxCoords, offset,
+				      rotation)) {
+        ++currentFrameStats.numObjectsCulled;
+        return;
+      }
+    }
+
+    CallTimer callTimer(currentFrameStats.modelMilliseconds, timingCall);
+    
+    glUseProgram(perspectiveProgram);
+    ++currentFrameStats.numStateChanges;
+
+    if (model.positionBufferObjectId == 0) {
+      uploadModel(model);
+    }
+
+    // The next frame of an animation, to be blended with this one
+    float frameBlend = sceneObject != nullptr ?
+      sceneObject->getFrameBlend() : 0.0f;
+    Model *nextModel = frameBlend > 0.0f ? &sceneObject->getNextModel() :
+      nullptr;
+    bool blendOnGPU = nextModel != nullptr && isOpenGL33Supported;
+    bool blendOnCPU = nextModel != nullptr && !isOpenGL33Supported;
+    if (blendOnGPU && nextModel->positionBufferObjectId == 0) {
+      uploadModel(*nextModel);
+    }
+
+    // The bones of a skeleton, moving the vertices
+    bool skinned = sceneObject != nullptr && sceneObject->getSkeleton() &&
+      !model.boneIndexData.empty();
+    bool skinOnGPU = skinned && isOpenGL33Supported;
+    bool skinOnCPU = skinned && !isOpenGL33Supported;
+    if (skinOnGPU && model.boneIndexBufferObjectId == 0) {
+      uploadBones(model);
+    }
+
+    // Vertices and normals worked out on the CPU
+    const std::vector<float> *streamedVertexData = nullptr;
+    const std::vector<float> *streamedNormalsData = nullptr;
+    if (blendOnCPU) {
+      TRACEZONE("Renderer::blendFrames");
+      sceneObject->getBlendedFrame(blendedVertexData, blendedNormalsData);
+      streamedVertexData = &blendedVertexData;
+      streamedNormalsData = &blendedNormalsData;
+    }
+    else if (skinOnCPU) {
+      sceneObject->skin();
+      streamedVertexData = &sceneObject->getSkinnedVertexData();
+      streamedNormalsData = &sceneObject->getSkinnedNormalsData();
+    }
+    if (streamedVertexData != nullptr && streamedPositionBufferObjectId == 0) {
+      glGenBuffers(1, &streamedPositionBufferObjectId);
+      glGenBuffers(1, &streamedNormalsBufferObjectId);
+    }
+
+    // Vertex
+    if (streamedVertexData != nullptr) {
+      glBindBuffer(GL_ARRAY_BUFFER, streamedPositionBufferObjectId);
+      glBufferData(GL_ARRAY_BUFFER,
+		   static_cast<GLsizeiptr>(streamedVertexData->size() *
+					   sizeof(float)),
+		   streamedVertexData->data(), GL_STREAM_DRAW);
+      currentFrameStats.bufferUploadBytes +=
+	static_cast<unsigned long>(streamedVertexData->size() *
+				   sizeof(float));
+    }
+    else {
+      glBindBuffer(GL_ARRAY_BUFFER, model.positionBufferObjectId);
+    }
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, 0);
-    
+
+    // Vertex indices, of the level of detail for the size of the object
+    // on the screen
+    int lod = 0;
+    if (sceneObject != nullptr && !model.lodIndexData.empty()) {
+      lod = sceneObject->selectLod(getScreenSize(model, offset, rotation));
+      if (model.lodIndexBuffersStale ||
+	  model.lodIndexBufferObjectIds.size() != model.lodIndexData.size()) {
+        uploadLods(model);
+      }
+    }
+    const std::vector<unsigned int> &indexData = lod > 0 ?
+      model.lodIndexData[static_cast<size_t>(lod - 1)] : model.indexData;
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, lod > 0 ?
+		 model.lodIndexBufferObjectIds[static_cast<size_t>(lod - 1)] :
+		 model.indexBufferObjectId);
+
     // Normals
-    glBindBuffer(GL_ARRAY_BUFFER, model.normalsBufferObjectId);
-    if (!alreadyInGPU) {
+    if (streamedNormalsData != nullptr) {
+      glBindBuffer(GL_ARRAY_BUFFER, streamedNormalsBufferObjectId);
       glBufferData(GL_ARRAY_BUFFER,
-		   model.normalsDataByteSize,
-		   model.normalsData.data(),
-		   GL_STATIC_DRAW);
+		   static_cast<GLsizeiptr>(streamedNormalsData->size() *
+					   sizeof(float)),
+		   streamedNormalsData->data(), GL_STREAM_DRAW);
+      currentFrameStats.bufferUploadBytes +=
+	static_cast<unsigned long>(streamedNormalsData->size() *
+				   sizeof(float));
+    }
+    else {
+      glBindBuffer(GL_ARRAY_BUFFER, model.normalsBufferObjectId);
     }
     glEnableVertexAttribArray(1);
     glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (void *) 0);
-    
+
+    // The next frame. When it is not bound, the shader blends with
+    // nothing, by 0.
+    if (isOpenGL33Supported) {
+      if (blendOnGPU) {
+        glBindBuffer(GL_ARRAY_BUFFER, nextModel->positionBufferObjectId);
+        glEnableVertexAttribArray(3);
+        glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, 0, 0);
+        glBindBuffer(GL_ARRAY_BUFFER, nextModel->normalsBufferObjectId);
+        glEnableVertexAttribArray(4);
+        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, 0, (void *) 0);
+      }
+      GLint frameBlendUniform = glGetUniformLocation(perspectiveProgram,
+						     "frameBlend");
+      glUniform1f(frameBlendUniform, blendOnGPU ? frameBlend : 0.0f);
+
+      if (skinOnGPU) {
+        glBindBuffer(GL_ARRAY_BUFFER, model.boneIndexBufferObjectId);
+        glEnableVertexAttribArray(5);
+        glVertexAttribPointer(5, 4, GL_UNSIGNED_BYTE, GL_FALSE, 0, 0);
+        glBindBuffer(GL_ARRAY_BUFFER, model.boneWeightBufferObjectId);
+        glEnableVertexAttribArray(6);
+        glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, 0, 0);
+
+        const std::vector<glm::mat4> &boneMatrices =
+	  sceneObject->getBoneMatrices();
+        GLint boneMatricesUniform = glGetUniformLocation(perspectiveProgram,
+							 "boneMatrices");
+        glUniformMatrix4fv(boneMatricesUniform,
+			   static_cast<GLsizei>(boneMatrices.size()), GL_FALSE,
+			   glm::value_ptr(boneMatrices[0]));
+      }
+      GLint skinnedUniform = glGetUniformLocation(perspectiveProgram,
+						  "skinned");
+      glUniform1i(skinnedUniform, skinOnGPU ? 1 : 0);
+    }
     
     // Find the colour uniform
     GLint colourUniform = glGetUniformLocation(perspectiveProgram, "colour");
@@ -690,18 +1178,12 @@ namespace small3d {
       GLuint textureId = this->getTextureHandle(textureName);
       
       glBindTexture(GL_TEXTURE_2D, textureId);
+      ++currentFrameStats.numStateChanges;
       
       // UV Coordinates
       
       glBindBuffer(GL_ARRAY_BUFFER, model.uvBufferObjectId);
       
-      if (!alreadyInGPU) {
-        glBufferData(GL_ARRAY_BUFFER,
-                     model.textureCoordsDataByteSize,
-                     model.textureCoordsData.data(),
-                     GL_STATIC_DRAW);
-      }
-      
       glEnableVertexAttribArray(2);
       glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, 0);
       
@@ -731,10 +1213,24 @@ namespace small3d {
     
     // Draw
     glDrawElements(GL_TRIANGLES,
-                   static_cast<GLsizei>(model.indexData.size()),
+                   static_cast<GLsizei>(indexData.size()),
                    GL_UNSIGNED_INT, 0);
+    ++currentFrameStats.numDrawCalls;
+    currentFrameStats.numTriangles += indexData.size() / 3;
+    currentFrameStats.numTrianglesSavedByLod +=
+      (model.indexData.size() - indexData.size()) / 3;
     
     // Clear stuff
+    if (skinOnGPU) {
+      glDisableVertexAttribArray(6);
+      glDisableVertexAttribArray(5);
+    }
+
+    if (blendOnGPU) {
+      glDisableVertexAttribArray(4);
+      glDisableVertexAttribArray(3);
+    }
+
     if (textureName != "") {
       glDisableVertexAttribArray(2);
     }
@@ -749,6 +1245,13 @@ namespace small3d {
     
   }
 
+  void Renderer::render(Model &model, const glm::vec3 offset,
+			const glm::vec3 rotation, 
+			const glm::vec4 colour,
+			const std::string textureName) const {
+    this->renderModel(model, nullptr, offset, rotation, colour, textureName);
+  }
+
   void Renderer::render(Model &model, const glm::vec3 offset,
 			const glm::vec3 rotation,
 			const std::string textureName) const {
@@ -757,15 +1260,15 @@ namespace small3d {
   }
 
   void Renderer::render(SceneObject &sceneObject, const glm::vec4 colour) const {
-    this->render(sceneObject.getModel(), sceneObject.offset,
-		 sceneObject.rotation, colour, "");
+    this->renderModel(sceneObject.getModel(), &sceneObject,
+		      sceneObject.offset, sceneObject.rotation, colour, "");
   }
 
   void Renderer::render(SceneObject &sceneObject,
 			const std::string textureName) const {
-    this->render(sceneObject.getModel(), sceneObject.offset,
-		 sceneObject.rotation, glm::vec4(0.0f, 0.0f, 0.0f, 0.0f),
-		 textureName);
+    this->renderModel(sceneObject.getModel(), &sceneObject,
+		      sceneObject.offset, sceneObject.rotation,
+		      glm::vec4(0.0f, 0.0f, 0.0f, 0.0f), textureName);
   }
   
   void Renderer::write(const std::string text, const glm::vec3 colour,
@@ -773,6 +1276,9 @@ namespace small3d {
 		       const glm::vec2 bottomRight,
 		       const int fontSize,
 		       std::string fontPath) {
+
+    TRACEZONE("Renderer::write");
+    CallTimer callTimer(currentFrameStats.textMilliseconds, timingCall);
     
     std::string faceId = intToStr(fontSize) + fontPath;
     
@@ -865,6 +1371,36 @@ namespace small3d {
     deleteTexture(textureName);
   }
   
+  OcclusionBuffer &Renderer::getOcclusionBufferForFrame() const {
+    if (!occlusionBuffer) {
+      occlusionBuffer.reset(new OcclusionBuffer(OCCLUSION_BUFFER_WIDTH,
+						std::max(1, OCCLUSION_BUFFER_WIDTH *
+							 screenHeight /
+							 screenWidth),
+						frustumScale,
+						static_cast<float>(screenWidth) /
+						screenHeight,
+						zNear, zOffsetFromCamera));
+    }
+    occlusionBuffer->setCamera(cameraPosition, cameraRotation);
+    occlusionCulling = true;
+    return *occlusionBuffer;
+  }
+
+  void Renderer::renderOccluders(const std::vector<SceneObject*> &occluders)
+    const {
+    TRACEZONE("Renderer::renderOccluders");
+    CallTimer callTimer(currentFrameStats.occlusionMilliseconds, timingCall);
+    getOcclusionBufferForFrame().draw(occluders);
+  }
+
+  void Renderer::renderOccluders(const std::vector<SceneObject*> &occluders,
+				 JobSystem &jobSystem) const {
+    TRACEZONE("Renderer::renderOccluders");
+    CallTimer callTimer(currentFrameStats.occlusionMilliseconds, timingCall);
+    getOcclusionBufferForFrame().draw(occluders, jobSystem);
+  }
+
   void Renderer::clearBuffers(Model &model) const {
     if (model.positionBufferObjectId != 0) {
       glDeleteBuffers(1, &model.positionBufferObjectId);
@@ -884,6 +1420,23 @@ namespace small3d {
       glDeleteBuffers(1, &model.uvBufferObjectId);
       model.uvBufferObjectId = 0;
     }
+
+    if (model.boneIndexBufferObjectId != 0) {
+      glDeleteBuffers(1, &model.boneIndexBufferObjectId);
+      model.boneIndexBufferObjectId = 0;
+    }
+
+    if (model.boneWeightBufferObjectId != 0) {
+      glDeleteBuffers(1, &model.boneWeightBufferObjectId);
+      model.boneWeightBufferObjectId = 0;
+    }
+
+    if (!model.lodIndexBufferObjectIds.empty()) {
+      glDeleteBuffers(static_cast<GLsizei>(model.lodIndexBufferObjectIds.
+					   size()),
+		      model.lodIndexBufferObjectIds.data());
+      model.lodIndexBufferObjectIds.clear();
+    }
   }
   
   void Renderer::clearScreen() const {
@@ -896,7 +1449,128 @@ namespace small3d {
   }
   
   void Renderer::swapBuffers() const {
-    glfwSwapBuffers(window);
+    TRACEZONE("Renderer::swapBuffers");
+    if (frameCapture) {
+      frameCapture->captureFrame();
+    }
+
+    endFrameStats();
+    occlusionCulling = false;
+
+    if (headless) {
+      // Offscreen surfaces have a single buffer.
+      glFlush();
+    }
+    else {
+      glfwSwapBuffers(window);
+    }
+
+    startFrameStats();
+  }
+
+  void Renderer::startFrameStats() const {
+    frameStartTime = std::chrono::steady_clock::now();
+    if (timerQueries[0] != 0) {
+      glBeginQuery(GL_TIME_ELAPSED,
+		   timerQueries[currentFrameStats.frameNumber % 2]);
+      timerQueryRunning = true;
+    }
+  }
+
+  void Renderer::endFrameStats() const {
+    unsigned long frameNumber = currentFrameStats.frameNumber;
+    currentFrameStats.frameMilliseconds =
+      std::chrono::duration<double, std::milli>
+      (std::chrono::steady_clock::now() - frameStartTime).count();
+
+    if (timerQueryRunning) {
+      glEndQuery(GL_TIME_ELAPSED);
+      timerQueryRunning = false;
+      timerQueryPending[frameNumber % 2] = true;
+    }
+
+    // Read the query of the previous frame, but only if the GPU is done
+    // with it. Either way, it will be reused on the next frame.
+    size_t previous = (frameNumber + 1) % 2;
+    if (timerQueryPending[previous]) {
+      GLint available = 0;
+      glGetQueryObjectiv(timerQueries[previous], GL_QUERY_RESULT_AVAILABLE,
+			 &available);
+      if (available) {
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(timerQueries[previous], GL_QUERY_RESULT,
+			      &elapsed);
+        currentFrameStats.gpuMilliseconds = static_cast<double>(elapsed) /
+	  1000000.0;
+      }
+      timerQueryPending[previous] = false;
+    }
+    currentFrameStats.gpuFrameNumber = frameNumber > 0 ? frameNumber - 1 : 0;
+
+    lastFrameStats = currentFrameStats;
+    currentFrameStats = FrameStats();
+    currentFrameStats.frameNumber = frameNumber + 1;
+  }
+
+  const FrameStats& Renderer::getFrameStats() const {
+    return lastFrameStats;
+  }
+
+  void Renderer::renderFrameStats(const glm::vec3 colour,
+				  const glm::vec2 topLeft,
+				  const glm::vec2 bottomRight) {
+    std::string lines[4];
+    std::ostringstream line;
+    line << std::fixed << std::setprecision(2);
+
+    line << "Frame " << lastFrameStats.frameNumber << ": "
+	 << lastFrameStats.frameMilliseconds << " ms, GPU ";
+    if (lastFrameStats.gpuMilliseconds >= 0.0) {
+      line << lastFrameStats.gpuMilliseconds << " ms";
+    }
+    else {
+      line << "n/a";
+    }
+    lines[0] = line.str();
+
+    line.str("");
+    line << "Models " << lastFrameStats.modelMilliseconds
+	 << " ms, occlusion " << lastFrameStats.occlusionMilliseconds
+	 << " ms, rectangles " << lastFrameStats.rectangleMilliseconds
+	 << " ms, text " << lastFrameStats.textMilliseconds << " ms";
+    lines[1] = line.str();
+
+    line.str("");
+    line << "Draw calls " << lastFrameStats.numDrawCalls << ", triangles "
+	 << lastFrameStats.numTriangles << " ("
+	 << lastFrameStats.numTrianglesSavedByLod << " saved by LOD), culled "
+	 << lastFrameStats.numObjectsCulled << ", state changes "
+	 << lastFrameStats.numStateChanges;
+    lines[2] = line.str();
+
+    line.str("");
+    line << "Uploaded " << lastFrameStats.bufferUploadBytes
+	 << " buffer bytes, " << lastFrameStats.textureUploadBytes
+	 << " texture bytes";
+    lines[3] = line.str();
+
+    // Text is stretched to its rectangle, so the width of each line is
+    // proportional to its length.
+    size_t maxLength = 0;
+    for (int idx = 0; idx < 4; ++idx) {
+      maxLength = std::max(maxLength, lines[idx].size());
+    }
+    float charWidth = (bottomRight.x - topLeft.x) /
+      static_cast<float>(maxLength);
+    float lineHeight = (topLeft.y - bottomRight.y) / 4.0f;
+
+    for (int idx = 0; idx < 4; ++idx) {
+      float top = topLeft.y - lineHeight * static_cast<float>(idx);
+      write(lines[idx], colour, glm::vec2(topLeft.x, top),
+	    glm::vec2(topLeft.x + charWidth *
+		      static_cast<float>(lines[idx].size()),
+		      top - lineHeight), 24);
+    }
   }
   
   /**
@@ -7,9 +7,120 @@
  */
 
 #include "SceneObject.hpp"
+#include "Trace.hpp"
+#include <cmath>
+#include <algorithm>
+#include <cfloat>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "Simd.hpp"
+
+#define DEFAULT_FRAMES_PER_SECOND 24.0
+
+// Added to the (fractional) number of frames played, so that the frame
+// changes at the same time, however the time has been added up.
+#define ANIMATION_FRAME_EPSILON 1e-6
+
+// Objects skinned by each job of skinAll
+#define SKIN_BATCH_SIZE 4
+
+// Screen size below which the first level of detail is used, by default.
+// Each next level is used below half the size of the previous one.
+#define DEFAULT_LOD_SCREEN_SIZE 0.5f
+
+// How far past the size at which levels of detail change the size on the
+// screen has to move before switching, as a fraction of that size
+#define LOD_HYSTERESIS 0.1f
 
 namespace small3d {
 
+  // result = from + (to - from) * t, four floats at a time
+  static void lerp(const float *from, const float *to, const float t,
+		   float *result, const size_t count) {
+    size_t idx = 0;
+#ifdef SMALL3D_SSE2
+    const __m128 weight = _mm_set1_ps(t);
+    for (; idx + 4 <= count; idx += 4) {
+      __m128 a = _mm_loadu_ps(from + idx);
+      __m128 b = _mm_loadu_ps(to + idx);
+      _mm_storeu_ps(result + idx,
+		    _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), weight)));
+    }
+#endif
+    for (; idx < count; ++idx) {
+      result[idx] = from[idx] + (to[idx] - from[idx]) * t;
+    }
+  }
+
+  // Move each vertex and normal by the sum of the matrices of its bones,
+  // multiplied by their weights.
+  static void skinVertices(const Model &model, const glm::mat4 *boneMatrices,
+			   float *vertexData, float *normalsData) {
+    const size_t numVertices = model.vertexData.size() / 4;
+    const float *positions = model.vertexData.data();
+    const float *normals = model.normalsData.data();
+    const unsigned char *bones = model.boneIndexData.data();
+    const float *weights = model.boneWeightData.data();
+
+    for (size_t vertex = 0; vertex < numVertices; ++vertex) {
+      const float *position = positions + 4 * vertex;
+      const float *normal = normals + 3 * vertex;
+#ifdef SMALL3D_SSE2
+      // The columns of the weighted sum of the matrices
+      __m128 column0 = _mm_setzero_ps();
+      __m128 column1 = _mm_setzero_ps();
+      __m128 column2 = _mm_setzero_ps();
+      __m128 column3 = _mm_setzero_ps();
+      for (size_t idx = 4 * vertex; idx < 4 * vertex + 4; ++idx) {
+        if (weights[idx] == 0.0f) continue;
+        const float *matrix = glm::value_ptr(boneMatrices[bones[idx]]);
+        const __m128 weight = _mm_set1_ps(weights[idx]);
+        column0 = _mm_add_ps(column0,
+			     _mm_mul_ps(weight, _mm_loadu_ps(matrix)));
+        column1 = _mm_add_ps(column1,
+			     _mm_mul_ps(weight, _mm_loadu_ps(matrix + 4)));
+        column2 = _mm_add_ps(column2,
+			     _mm_mul_ps(weight, _mm_loadu_ps(matrix + 8)));
+        column3 = _mm_add_ps(column3,
+			     _mm_mul_ps(weight, _mm_loadu_ps(matrix + 12)));
+      }
+      // The weights add up to 1, so the w coordinate stays 1.
+      __m128 skinnedPosition =
+	_mm_add_ps(_mm_add_ps(_mm_mul_ps(column0, _mm_set1_ps(position[0])),
+			      _mm_mul_ps(column1, _mm_set1_ps(position[1]))),
+		   _mm_add_ps(_mm_mul_ps(column2, _mm_set1_ps(position[2])),
+			      column3));
+      _mm_storeu_ps(vertexData + 4 * vertex, skinnedPosition);
+      __m128 skinnedNormal =
+	_mm_add_ps(_mm_add_ps(_mm_mul_ps(column0, _mm_set1_ps(normal[0])),
+			      _mm_mul_ps(column1, _mm_set1_ps(normal[1]))),
+		   _mm_mul_ps(column2, _mm_set1_ps(normal[2])));
+      float normalComponents[4];
+      _mm_storeu_ps(normalComponents, skinnedNormal);
+      std::copy(normalComponents, normalComponents + 3,
+		normalsData + 3 * vertex);
+#else
+      float skin[16] = {0.0f};
+      for (size_t idx = 4 * vertex; idx < 4 * vertex + 4; ++idx) {
+        if (weights[idx] == 0.0f) continue;
+        const float *matrix = glm::value_ptr(boneMatrices[bones[idx]]);
+        for (size_t element = 0; element < 16; ++element) {
+          skin[element] += weights[idx] * matrix[element];
+        }
+      }
+      for (size_t row = 0; row < 4; ++row) {
+        vertexData[4 * vertex + row] = skin[row] * position[0] +
+	  skin[4 + row] * position[1] + skin[8 + row] * position[2] +
+	  skin[12 + row];
+      }
+      for (size_t row = 0; row < 3; ++row) {
+        normalsData[3 * vertex + row] = skin[row] * normal[0] +
+	  skin[4 + row] * normal[1] + skin[8 + row] * normal[2];
+      }
+#endif
+    }
+  }
+
   SceneObject::SceneObject(const std::string name, const std::string modelPath,
 			   const int numFrames,
 			   const std::string boundingBoxSetPath) :
@@ -21,14 +132,26 @@ namespace small3d {
     framesWaited = 0;
     frameDelay = 1;
     currentFrame = 0;
+    nextFrame = 0;
+    frameBlend = 0.0f;
+    frameBlending = true;
     this->numFrames = numFrames;
 
+    animation.firstFrame = 0;
+    animation.numFrames = std::max(numFrames, 1);
+    animation.framesPerSecond = DEFAULT_FRAMES_PER_SECOND;
+    animation.repeat = true;
+    animations[""] = animation;
+    animationName = "";
+    animationTime = 0.0;
+    skeletalAnimation = -1;
+    skinned = false;
+    lod = 0;
+
     if (numFrames > 1) {
-      LOGINFO("Loading " + name + " animated model (this may take a while):");
+      LOGINFOF("Loading {} animated model (this may take a while):", name);
       for (int idx = 0; idx < numFrames; ++idx) {
-        std::stringstream lss;
-        lss << "Frame " << idx + 1 << " of " << numFrames << "...";
-        LOGINFO(lss.str());
+        LOGINFOF("Frame {} of {}...", idx + 1, numFrames);
         std::stringstream ss;
         ss << std::setfill('0') << std::setw(6) << idx + 1;
         std::string frameNum = ss.str();
@@ -40,12 +163,199 @@ namespace small3d {
       Model model1(modelPath);
       model.push_back(model1);
     }
+
+    // Frames can only be blended if their vertices correspond to each other.
+    blendableFrames = true;
+    for (auto frame = model.begin(); frame != model.end(); ++frame) {
+      if (frame->vertexData.size() != model[0].vertexData.size() ||
+	  frame->normalsData.size() != model[0].normalsData.size() ||
+	  frame->indexData != model[0].indexData) {
+        LOGINFOF("The frames of {} do not have the same vertices, so they "
+		 "will not be blended.", name);
+        blendableFrames = false;
+        break;
+      }
+    }
   }
 
   Model& SceneObject::getModel() {
     return model[currentFrame];
   }
 
+  Model& SceneObject::getNextModel() {
+    return model[nextFrame];
+  }
+
+  float SceneObject::getFrameBlend() const {
+    return frameBlending && blendableFrames ? frameBlend : 0.0f;
+  }
+
+  void SceneObject::setFrameBlending(const bool frameBlending) {
+    this->frameBlending = frameBlending;
+  }
+
+  void SceneObject::getBlendedFrame(std::vector<float> &vertexData,
+				    std::vector<float> &normalsData) const {
+    const Model &current = model[currentFrame];
+    const Model &next = model[nextFrame];
+    float blend = getFrameBlend();
+    vertexData.resize(current.vertexData.size());
+    normalsData.resize(current.normalsData.size());
+    if (blend == 0.0f) {
+      std::copy(current.vertexData.begin(), current.vertexData.end(),
+		vertexData.begin());
+      std::copy(current.normalsData.begin(), current.normalsData.end(),
+		normalsData.begin());
+      return;
+    }
+    lerp(current.vertexData.data(), next.vertexData.data(), blend,
+	 vertexData.data(), vertexData.size());
+    lerp(current.normalsData.data(), next.normalsData.data(), blend,
+	 normalsData.data(), normalsData.size());
+  }
+
+  void SceneObject::setSkeleton(const std::shared_ptr<const Skeleton>
+				 skeleton) {
+    if (model.size() != 1) {
+      throw std::runtime_error("Only objects made up of a single model can "
+			       "have a skeleton (" + name + ").");
+    }
+    skeleton->loadWeights(model[0]);
+    this->skeleton = skeleton;
+    skeletalAnimation = -1;
+    animationName = "";
+    animation = animations[""];
+    resetAnimation();
+  }
+
+  const std::shared_ptr<const Skeleton>& SceneObject::getSkeleton() const {
+    return skeleton;
+  }
+
+  const std::vector<glm::mat4>& SceneObject::getBoneMatrices() const {
+    return boneMatrices;
+  }
+
+  void SceneObject::getBoundingCoords(glm::vec3 &minCoords,
+				       glm::vec3 &maxCoords) {
+    const Model &current = getModel();
+    minCoords = current.minCoords;
+    maxCoords = current.maxCoords;
+    if (getFrameBlend() > 0.0f) {
+      const Model &next = getNextModel();
+      minCoords = glm::min(minCoords, next.minCoords);
+      maxCoords = glm::max(maxCoords, next.maxCoords);
+    }
+    if (skeleton && !boneMatrices.empty()) {
+      glm::vec3 poseMinCoords(FLT_MAX), poseMaxCoords(-FLT_MAX);
+      for (auto bone = boneMatrices.begin(); bone != boneMatrices.end();
+	   ++bone) {
+        for (int corner = 0; corner < 8; ++corner) {
+          glm::vec4 position((corner & 1) ? maxCoords.x : minCoords.x,
+			     (corner & 2) ? maxCoords.y : minCoords.y,
+			     (corner & 4) ? maxCoords.z : minCoords.z, 1.0f);
+          glm::vec3 moved = glm::vec3(*bone * position);
+          poseMinCoords = glm::min(poseMinCoords, moved);
+          poseMaxCoords = glm::max(poseMaxCoords, moved);
+        }
+      }
+      minCoords = poseMinCoords;
+      maxCoords = poseMaxCoords;
+    }
+  }
+
+  void SceneObject::poseSkeleton() {
+    double time = animationTime;
+    if (skeletalAnimation >= 0) {
+      double duration = skeleton->getAnimationDuration(skeletalAnimation);
+      if (skeleton->isAnimationRepeated(skeletalAnimation)) {
+        time = duration > 0.0 ? std::fmod(time, duration) : 0.0;
+      }
+      else if (time >= duration) {
+        time = duration;
+        animating = false;
+      }
+    }
+    skeleton->getPose(skeletalAnimation, time, boneMatrices);
+    skinned = false;
+  }
+
+  void SceneObject::skin() {
+    if (!skeleton || skinned) return;
+    TRACEZONE("SceneObject::skin");
+    const Model &bindPose = model[0];
+    skinnedVertexData.resize(bindPose.vertexData.size());
+    skinnedNormalsData.resize(bindPose.normalsData.size());
+    skinVertices(bindPose, boneMatrices.data(), skinnedVertexData.data(),
+		 skinnedNormalsData.data());
+    skinned = true;
+  }
+
+  void SceneObject::skinAll(const std::vector<SceneObject*> &objects,
+			    JobSystem &jobSystem) {
+    jobSystem.parallelFor(objects.size(), SKIN_BATCH_SIZE,
+			  [&objects](size_t begin, size_t end) {
+			    for (size_t idx = begin; idx < end; ++idx) {
+			      objects[idx]->skin();
+			    }
+			  });
+  }
+
+  const std::vector<float>& SceneObject::getSkinnedVertexData() const {
+    return skinnedVertexData;
+  }
+
+  const std::vector<float>& SceneObject::getSkinnedNormalsData() const {
+    return skinnedNormalsData;
+  }
+
+  void SceneObject::generateLods(const int numLevels, const float reduction) {
+    for (auto frame = model.begin(); frame != model.end(); ++frame) {
+      frame->generateLods(numLevels, reduction);
+    }
+    lod = 0;
+  }
+
+  void SceneObject::setLodScreenSizes(const std::vector<float> &screenSizes) {
+    for (size_t idx = 1; idx < screenSizes.size(); ++idx) {
+      if (screenSizes[idx] >= screenSizes[idx - 1]) {
+        throw std::runtime_error("The screen sizes of the levels of detail "
+				 "of " + name + " must be decreasing.");
+      }
+    }
+    lodScreenSizes = screenSizes;
+  }
+
+  int SceneObject::selectLod(const float screenSize) {
+    int numLevels = static_cast<int>(model[currentFrame].lodIndexData.size());
+    auto levelScreenSize = [this](const int level) {
+      return static_cast<size_t>(level) <= lodScreenSizes.size() ?
+	lodScreenSizes[static_cast<size_t>(level - 1)] :
+	DEFAULT_LOD_SCREEN_SIZE / static_cast<float>(1 << (level - 1));
+    };
+    if (lodScreenSizes.empty()) {
+      numLevels = std::min(numLevels, 31);
+    }
+    else {
+      numLevels = std::min(numLevels,
+			   static_cast<int>(lodScreenSizes.size()));
+    }
+    lod = std::min(lod, numLevels);
+    while (lod > 0 &&
+	   screenSize > levelScreenSize(lod) * (1.0f + LOD_HYSTERESIS)) {
+      --lod;
+    }
+    while (lod < numLevels &&
+	   screenSize < levelScreenSize(lod + 1) * (1.0f - LOD_HYSTERESIS)) {
+      ++lod;
+    }
+    return lod;
+  }
+
+  int SceneObject::getLod() const {
+    return lod;
+  }
+
   const std::string SceneObject::getName() const {
     return name;
   }
@@ -59,7 +369,12 @@ namespace small3d {
   }
 
   void SceneObject::resetAnimation() {
-    currentFrame = 0;
+    currentFrame = animation.firstFrame;
+    nextFrame = currentFrame;
+    frameBlend = 0.0f;
+    framesWaited = 0;
+    animationTime = 0.0;
+    if (skeleton) poseSkeleton();
   }
 
   void SceneObject::setFrameDelay(const int delay) {
@@ -68,17 +383,143 @@ namespace small3d {
 
   void SceneObject::animate() {
     if (animating) {
+      frameBlend = 0.0f;
       ++framesWaited;
       if (framesWaited == frameDelay) {
         framesWaited = 0;
         ++currentFrame;
-        if (currentFrame == numFrames) {
-          currentFrame = 0;
+        if (currentFrame == animation.firstFrame + animation.numFrames) {
+          if (animation.repeat) {
+            currentFrame = animation.firstFrame;
+          }
+          else {
+            --currentFrame;
+            animating = false;
+          }
         }
+        nextFrame = currentFrame;
       }
     }
   }
 
+  void SceneObject::animate(const double seconds) {
+    if (!animating || seconds <= 0.0) return;
+    animationTime += seconds;
+    if (skeleton) {
+      poseSkeleton();
+      return;
+    }
+    double framesPlayed = animationTime * animation.framesPerSecond +
+      ANIMATION_FRAME_EPSILON;
+    double wholeFrames = std::floor(framesPlayed);
+    frameBlend = static_cast<float>(std::max(0.0, framesPlayed - wholeFrames -
+					     ANIMATION_FRAME_EPSILON));
+    if (animation.repeat) {
+      int frame = static_cast<int>(std::fmod(wholeFrames,
+					     static_cast<double>
+					     (animation.numFrames)));
+      currentFrame = animation.firstFrame + frame;
+      nextFrame = animation.firstFrame + (frame + 1) % animation.numFrames;
+    }
+    else if (framesPlayed >= animation.numFrames) {
+      currentFrame = animation.firstFrame + animation.numFrames - 1;
+      nextFrame = currentFrame;
+      frameBlend = 0.0f;
+      animating = false;
+    }
+    else {
+      currentFrame = animation.firstFrame + static_cast<int>(wholeFrames);
+      nextFrame = std::min(currentFrame + 1,
+			   animation.firstFrame + animation.numFrames - 1);
+    }
+  }
+
+  void SceneObject::animateAll(SceneObject *objects, const size_t numObjects,
+			       const double seconds) {
+    for (size_t idx = 0; idx < numObjects; ++idx) {
+      objects[idx].animate(seconds);
+    }
+  }
+
+  void SceneObject::animateAll(const std::vector<SceneObject*> &objects,
+			       const double seconds) {
+    for (auto object = objects.begin(); object != objects.end(); ++object) {
+      (*object)->animate(seconds);
+    }
+  }
+
+  void SceneObject::setFramesPerSecond(const double framesPerSecond) {
+    if (framesPerSecond <= 0.0) {
+      throw std::runtime_error("The frames per second of an animation must "
+			       "be positive.");
+    }
+    if (skeletalAnimation >= 0) {
+      throw std::runtime_error("The keyframes of skeletal animation " +
+			       animationName + " of " + name + " are timed "
+			       "in seconds, not frames.");
+    }
+    // The current frame stays where it is.
+    animationTime = animationTime * animation.framesPerSecond /
+      framesPerSecond;
+    animation.framesPerSecond = framesPerSecond;
+    auto found = animations.find(animationName);
+    if (found != animations.end()) {
+      found->second.framesPerSecond = framesPerSecond;
+    }
+  }
+
+  void SceneObject::addAnimation(const std::string name, const int firstFrame,
+				 const int numFrames,
+				 const double framesPerSecond,
+				 const bool repeat) {
+    if (firstFrame < 0 || numFrames < 1 ||
+	firstFrame + numFrames > static_cast<int>(model.size())) {
+      throw std::runtime_error("Animation " + name + " of " + this->name +
+			       " is out of the range of its frames.");
+    }
+    if (framesPerSecond <= 0.0) {
+      throw std::runtime_error("The frames per second of an animation must "
+			       "be positive.");
+    }
+    Animation newAnimation;
+    newAnimation.firstFrame = firstFrame;
+    newAnimation.numFrames = numFrames;
+    newAnimation.framesPerSecond = framesPerSecond;
+    newAnimation.repeat = repeat;
+    animations[name] = newAnimation;
+  }
+
+  void SceneObject::playAnimation(const std::string name) {
+    skeletalAnimation = skeleton ? skeleton->getAnimationIndex(name) : -1;
+    if (skeletalAnimation >= 0) {
+      animationName = name;
+      animating = true;
+      resetAnimation();
+      return;
+    }
+    auto found = animations.find(name);
+    if (found == animations.end()) {
+      throw std::runtime_error(this->name + " has no animation named " +
+			       name + ".");
+    }
+    animationName = name;
+    animation = found->second;
+    resetAnimation();
+    animating = true;
+  }
+
+  const std::string& SceneObject::getAnimationName() const {
+    return animationName;
+  }
+
+  bool SceneObject::isAnimating() const {
+    return animating;
+  }
+
+  int SceneObject::getCurrentFrame() const {
+    return currentFrame;
+  }
+
   bool SceneObject::collidesWith(const glm::vec3 point) const {
     if (boundingBoxSet.vertices.size() == 0) {
       throw std::runtime_error("No bounding boxes have been provided for " +
@@ -88,7 +529,79 @@ namespace small3d {
     return boundingBoxSet.collidesWith(point, this->offset, this->rotation);
   }
 
-  bool SceneObject::collidesWith(SceneObject otherObject) const {
+  bool SceneObject::collidesWith(const glm::vec3 *points,
+				 const size_t numPoints) const {
+    if (boundingBoxSet.vertices.size() == 0) {
+      throw std::runtime_error("No bounding boxes have been provided for " +
+			       name +
+			       ", so collision detection is not enabled.");
+    }
+    return boundingBoxSet.collidesWith(points, numPoints, this->offset,
+				       this->rotation);
+  }
+
+  size_t SceneObject::findCollidingPoints(const glm::vec3 *points,
+					  const size_t numPoints,
+					  uint64_t *collisionMask) const {
+    if (boundingBoxSet.vertices.size() == 0) {
+      throw std::runtime_error("No bounding boxes have been provided for " +
+			       name +
+			       ", so collision detection is not enabled.");
+    }
+    return boundingBoxSet.findCollidingPoints(points, numPoints, this->offset,
+					      this->rotation, collisionMask);
+  }
+
+  size_t SceneObject::findCollidingPoints(const float *x, const float *y,
+					  const float *z,
+					  const size_t numPoints,
+					  uint64_t *collisionMask) const {
+    if (boundingBoxSet.vertices.size() == 0) {
+      throw std::runtime_error("No bounding boxes have been provided for " +
+			       name +
+			       ", so collision detection is not enabled.");
+    }
+    return boundingBoxSet.findCollidingPoints(x, y, z, numPoints,
+					      this->offset, this->rotation,
+					      collisionMask);
+  }
+
+  bool SceneObject::collidesWith(const SceneObject &otherObject) const {
+    if (boundingBoxSet.vertices.size() == 0) {
+      throw std::runtime_error("No bounding boxes have been provided for " +
+			       name +
+			       ", so collision detection is not enabled.");
+    }
+
+    if (otherObject.boundingBoxSet.vertices.size() == 0) {
+      throw std::runtime_error("No bounding boxes have been provided for " +
+			       otherObject.name +
+			       ", so collision detection is not enabled.");
+    }
+
+    return boundingBoxSet.intersects(otherObject.boundingBoxSet, this->offset,
+				     this->rotation, otherObject.offset,
+				     otherObject.rotation);
+  }
+
+  bool SceneObject::collidesWith(const glm::vec3 start, const glm::vec3 end,
+				 float &timeOfImpact, glm::vec3 &normal) const {
+    if (boundingBoxSet.vertices.size() == 0) {
+      throw std::runtime_error("No bounding boxes have been provided for " +
+			       name +
+			       ", so collision detection is not enabled.");
+    }
+    return boundingBoxSet.intersectsSegment(start, end, this->offset,
+					    this->rotation, timeOfImpact,
+					    normal);
+  }
+
+  bool SceneObject::collidesWith(const SceneObject &otherObject,
+				 const glm::vec3 previousOffset,
+				 const glm::vec3 previousRotation,
+				 const glm::vec3 otherPreviousOffset,
+				 const glm::vec3 otherPreviousRotation,
+				 float &timeOfImpact, glm::vec3 &normal) const {
     if (boundingBoxSet.vertices.size() == 0) {
       throw std::runtime_error("No bounding boxes have been provided for " +
 			       name +
@@ -101,18 +614,18 @@ namespace small3d {
 			       ", so collision detection is not enabled.");
     }
 
-    // Checking whether the boxes of this object are within the boxes of the
-    // other object or vice versa
-    return boundingBoxSet.collidesWith(otherObject.boundingBoxSet, this->offset,
-				       this->rotation, otherObject.offset,
-				       otherObject.rotation) ||
-      otherObject.boundingBoxSet.collidesWith(boundingBoxSet, otherObject.offset,
-					      otherObject.rotation,
-					      this->offset, this->rotation);
+    return boundingBoxSet.intersectsDuring(otherObject.boundingBoxSet,
+					   previousOffset, previousRotation,
+					   this->offset, this->rotation,
+					   otherPreviousOffset,
+					   otherPreviousRotation,
+					   otherObject.offset,
+					   otherObject.rotation,
+					   timeOfImpact, normal);
   }
 
   bool SceneObject::isAnimated() const {
-    return numFrames > 1;
+    return numFrames > 1 || skeleton;
   }
 
 }
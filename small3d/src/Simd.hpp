@@ -0,0 +1,18 @@
+/**
+ * @file  Simd.hpp
+ * @brief Detection of the SIMD instructions used internally by small3d
+ *
+ *  Created on: 2026/10/19
+ *      Author: Dimitri Kourkoulis
+ *     License: BSD 3-Clause License (see LICENSE file)
+ */
+
+#pragma once
+
+// SSE2 is always available on x86-64 and is used when the compiler targets
+// it on 32-bit x86. Code using it must also have a scalar version.
+#if defined(__SSE2__) || defined(_M_X64) || \
+  (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SMALL3D_SSE2
+#include <emmintrin.h>
+#endif
@@ -0,0 +1,369 @@
+/*
+ *  Skeleton.cpp
+ *
+ *  Created on: 2026/10/19
+ *      Author: Dimitri Kourkoulis
+ *     License: BSD 3-Clause License (see LICENSE file)
+ */
+
+#include "Skeleton.hpp"
+#include "GetTokens.hpp"
+#include "Trace.hpp"
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+#include <cstdlib>
+#include <cmath>
+
+// The bone matrices are passed to the vertex shader as a uniform array of
+// this size.
+#define MAX_BONES 48
+
+#define MAX_BONES_PER_VERTEX 4
+
+namespace small3d {
+
+  // Read a position and a rotation (qw qx qy qz) from the tokens of a line.
+  static void parseTransform(const std::vector<std::string> &tokens,
+			     const size_t first, glm::vec3 &position,
+			     glm::vec4 &rotation) {
+    position = glm::vec3(static_cast<float>(atof(tokens[first].c_str())),
+			 static_cast<float>(atof(tokens[first + 1].c_str())),
+			 static_cast<float>(atof(tokens[first + 2].c_str())));
+    rotation = glm::vec4(static_cast<float>(atof(tokens[first + 4].c_str())),
+			 static_cast<float>(atof(tokens[first + 5].c_str())),
+			 static_cast<float>(atof(tokens[first + 6].c_str())),
+			 static_cast<float>(atof(tokens[first + 3].c_str())));
+    float length = glm::length(rotation);
+    if (length == 0.0f) {
+      throw std::runtime_error("Invalid rotation (all zeros).");
+    }
+    rotation = rotation / length;
+  }
+
+  // The inverse of a matrix made up of a rotation and a translation only
+  static glm::mat4 invertRigid(const glm::mat4 &matrix) {
+    glm::mat4 inverse(1.0f);
+    glm::vec3 translation(matrix[3]);
+    for (int column = 0; column < 3; ++column) {
+      for (int row = 0; row < 3; ++row) {
+        inverse[column][row] = matrix[row][column];
+      }
+      inverse[3][column] = -glm::dot(glm::vec3(matrix[column]), translation);
+    }
+    return inverse;
+  }
+
+  Skeleton::Skeleton(const std::string fileLocation) {
+    TRACEZONE("Skeleton::Skeleton");
+    std::ifstream file(fileLocation.c_str());
+    if (!file.is_open()) {
+      throw std::runtime_error("Could not open file " + fileLocation);
+    }
+
+    std::string line;
+    int lineNumber = 0;
+    while (getline(file, line)) {
+      ++lineNumber;
+      if (!line.empty() && line[line.size() - 1] == '\r') {
+        line.erase(line.size() - 1);
+      }
+      if (line.empty() || line[0] == '#') continue;
+
+      std::vector<std::string> allTokens, tokens;
+      getTokens(line, ' ', allTokens);
+      for (auto token = allTokens.begin(); token != allTokens.end(); ++token) {
+        if (!token->empty()) tokens.push_back(*token);
+      }
+      if (tokens.empty()) continue;
+
+      const std::string where = " (" + fileLocation + ", line " +
+	std::to_string(lineNumber) + ")";
+      const std::string &type = tokens[0];
+
+      try {
+        if (type == "b") {
+          if (tokens.size() != 10) {
+            throw std::runtime_error("Bones need a name, a parent, a position "
+				     "and a rotation.");
+          }
+          int parent = atoi(tokens[2].c_str());
+          if (parent < -1 || parent >= static_cast<int>(boneNames.size())) {
+            throw std::runtime_error("The parent of a bone has to come "
+				     "before it.");
+          }
+          if (boneNames.size() == MAX_BONES) {
+            throw std::runtime_error("Too many bones.");
+          }
+          Transform transform;
+          parseTransform(tokens, 3, transform.position, transform.rotation);
+          boneNames.push_back(tokens[1]);
+          boneParents.push_back(parent);
+          restPose.push_back(transform);
+        }
+        else if (type == "w") {
+          if (tokens.size() < 4 || tokens.size() % 2 != 0 ||
+	      tokens.size() > 2 + 2 * MAX_BONES_PER_VERTEX) {
+            throw std::runtime_error("Weights need a vertex and up to 4 "
+				     "bones with their weights.");
+          }
+          int vertex = atoi(tokens[1].c_str());
+          if (vertex < 1) {
+            throw std::runtime_error("Vertices are numbered from 1.");
+          }
+          size_t first = MAX_BONES_PER_VERTEX * static_cast<size_t>
+	    (vertex - 1);
+          if (vertexBones.size() < first + MAX_BONES_PER_VERTEX) {
+            vertexBones.resize(first + MAX_BONES_PER_VERTEX, 0);
+            vertexWeights.resize(first + MAX_BONES_PER_VERTEX, 0.0f);
+          }
+          for (size_t idx = 2; idx < tokens.size(); idx += 2) {
+            int bone = atoi(tokens[idx].c_str());
+            float weight = static_cast<float>(atof(tokens[idx + 1].c_str()));
+            if (bone < 0 || bone >= static_cast<int>(boneNames.size())) {
+              throw std::runtime_error("Weight for a bone that has not been "
+				       "defined.");
+            }
+            if (weight < 0.0f) {
+              throw std::runtime_error("Weights cannot be negative.");
+            }
+            vertexBones[first + (idx - 2) / 2] =
+	      static_cast<unsigned char>(bone);
+            vertexWeights[first + (idx - 2) / 2] = weight;
+          }
+        }
+        else if (type == "a") {
+          if (tokens.size() != 4) {
+            throw std::runtime_error("Animations need a name, a duration and "
+				     "whether they repeat.");
+          }
+          Animation animation;
+          animation.name = tokens[1];
+          animation.duration = atof(tokens[2].c_str());
+          animation.repeat = atoi(tokens[3].c_str()) != 0;
+          if (animation.duration < 0.0) {
+            throw std::runtime_error("The duration of an animation cannot be "
+				     "negative.");
+          }
+          animation.keyframes.resize(MAX_BONES);
+          animations.push_back(animation);
+        }
+        else if (type == "k") {
+          if (animations.empty()) {
+            throw std::runtime_error("Keyframes have to follow an "
+				     "animation.");
+          }
+          if (tokens.size() != 10) {
+            throw std::runtime_error("Keyframes need a time, a bone, a "
+				     "position and a rotation.");
+          }
+          int bone = atoi(tokens[2].c_str());
+          if (bone < 0 || bone >= static_cast<int>(boneNames.size())) {
+            throw std::runtime_error("Keyframe for a bone that has not been "
+				     "defined.");
+          }
+          Keyframe keyframe;
+          keyframe.time = atof(tokens[1].c_str());
+          parseTransform(tokens, 3, keyframe.transform.position,
+			 keyframe.transform.rotation);
+          animations.back().keyframes[static_cast<size_t>(bone)].
+	    push_back(keyframe);
+        }
+        else {
+          throw std::runtime_error("Unknown line type " + type + ".");
+        }
+      }
+      catch (const std::runtime_error &e) {
+        throw std::runtime_error(e.what() + where);
+      }
+    }
+    file.close();
+
+    if (boneNames.empty()) {
+      throw std::runtime_error("There are no bones in " + fileLocation);
+    }
+
+    // Weights add up to 1. Vertices without weights move with the first bone.
+    for (size_t first = 0; first < vertexWeights.size();
+	 first += MAX_BONES_PER_VERTEX) {
+      float sum = 0.0f;
+      for (size_t idx = first; idx < first + MAX_BONES_PER_VERTEX; ++idx) {
+        sum += vertexWeights[idx];
+      }
+      for (size_t idx = first; idx < first + MAX_BONES_PER_VERTEX; ++idx) {
+        vertexWeights[idx] = sum > 0.0f ? vertexWeights[idx] / sum : 0.0f;
+      }
+      if (sum == 0.0f) {
+        vertexBones[first] = 0;
+        vertexWeights[first] = 1.0f;
+      }
+    }
+
+    for (auto animation = animations.begin(); animation != animations.end();
+	 ++animation) {
+      animation->keyframes.resize(boneNames.size());
+      animation->keyframes.shrink_to_fit();
+      for (auto keyframes = animation->keyframes.begin();
+	   keyframes != animation->keyframes.end(); ++keyframes) {
+        std::stable_sort(keyframes->begin(), keyframes->end(),
+			 [](const Keyframe &a, const Keyframe &b) {
+			   return a.time < b.time;
+			 });
+      }
+    }
+
+    // The matrices that move the vertices from the exported pose to the
+    // space of each bone
+    inverseRestMatrices.resize(boneNames.size());
+    std::vector<glm::mat4> restMatrices(boneNames.size());
+    for (size_t bone = 0; bone < boneNames.size(); ++bone) {
+      glm::mat4 local = getMatrix(restPose[bone]);
+      restMatrices[bone] = boneParents[bone] < 0 ? local :
+	restMatrices[static_cast<size_t>(boneParents[bone])] * local;
+      inverseRestMatrices[bone] = invertRigid(restMatrices[bone]);
+    }
+  }
+
+  glm::mat4 Skeleton::getMatrix(const Transform &transform) const {
+    const glm::vec4 &q = transform.rotation;
+    glm::mat4 matrix(1.0f);
+    matrix[0][0] = 1.0f - 2.0f * (q.y * q.y + q.z * q.z);
+    matrix[0][1] = 2.0f * (q.x * q.y + q.w * q.z);
+    matrix[0][2] = 2.0f * (q.x * q.z - q.w * q.y);
+    matrix[1][0] = 2.0f * (q.x * q.y - q.w * q.z);
+    matrix[1][1] = 1.0f - 2.0f * (q.x * q.x + q.z * q.z);
+    matrix[1][2] = 2.0f * (q.y * q.z + q.w * q.x);
+    matrix[2][0] = 2.0f * (q.x * q.z + q.w * q.y);
+    matrix[2][1] = 2.0f * (q.y * q.z - q.w * q.x);
+    matrix[2][2] = 1.0f - 2.0f * (q.x * q.x + q.y * q.y);
+    matrix[3] = glm::vec4(transform.position, 1.0f);
+    return matrix;
+  }
+
+  Skeleton::Transform Skeleton::getTransform(const std::vector<Keyframe>
+					     &keyframes,
+					     const double time) const {
+    if (time <= keyframes.front().time) return keyframes.front().transform;
+    if (time >= keyframes.back().time) return keyframes.back().transform;
+
+    auto next = std::upper_bound(keyframes.begin(), keyframes.end(), time,
+				 [](const double t, const Keyframe &keyframe) {
+				   return t < keyframe.time;
+				 });
+    auto previous = next - 1;
+    float t = static_cast<float>((time - previous->time) /
+				 (next->time - previous->time));
+
+    Transform transform;
+    transform.position = glm::mix(previous->transform.position,
+				  next->transform.position, t);
+    // Normalised linear interpolation, along the shortest path
+    glm::vec4 to = next->transform.rotation;
+    if (glm::dot(previous->transform.rotation, to) < 0.0f) to = -to;
+    transform.rotation = glm::normalize(glm::mix(previous->transform.rotation,
+						 to, t));
+    return transform;
+  }
+
+  size_t Skeleton::getNumBones() const {
+    return boneNames.size();
+  }
+
+  int Skeleton::getBoneIndex(const std::string name) const {
+    auto found = std::find(boneNames.begin(), boneNames.end(), name);
+    return found == boneNames.end() ? -1 :
+      static_cast<int>(found - boneNames.begin());
+  }
+
+  int Skeleton::getAnimationIndex(const std::string name) const {
+    for (size_t idx = 0; idx < animations.size(); ++idx) {
+      if (animations[idx].name == name) return static_cast<int>(idx);
+    }
+    return -1;
+  }
+
+  double Skeleton::getAnimationDuration(const int animation) const {
+    return animations.at(static_cast<size_t>(animation)).duration;
+  }
+
+  bool Skeleton::isAnimationRepeated(const int animation) const {
+    return animations.at(static_cast<size_t>(animation)).repeat;
+  }
+
+  void Skeleton::getPose(const int animation, const double time,
+			 std::vector<glm::mat4> &boneMatrices) const {
+    boneMatrices.resize(boneNames.size());
+    if (animation < 0) {
+      std::fill(boneMatrices.begin(), boneMatrices.end(), glm::mat4(1.0f));
+      return;
+    }
+    if (animation >= static_cast<int>(animations.size())) {
+      throw std::runtime_error("Animation " + std::to_string(animation) +
+			       " does not exist.");
+    }
+    const Animation &current = animations[static_cast<size_t>(animation)];
+
+    // Parents come before their children, so their matrices are ready.
+    for (size_t bone = 0; bone < boneNames.size(); ++bone) {
+      const std::vector<Keyframe> &keyframes = current.keyframes[bone];
+      glm::mat4 local = getMatrix(keyframes.empty() ? restPose[bone] :
+				  getTransform(keyframes, time));
+      boneMatrices[bone] = boneParents[bone] < 0 ? local :
+	boneMatrices[static_cast<size_t>(boneParents[bone])] * local;
+    }
+    for (size_t bone = 0; bone < boneNames.size(); ++bone) {
+      boneMatrices[bone] = boneMatrices[bone] * inverseRestMatrices[bone];
+    }
+  }
+
+  void Skeleton::loadWeights(Model &model) const {
+    size_t numVertices = model.vertexData.size() / 4;
+    size_t numFileVertices = numVertices - model.copiedVertexIndices.size();
+    size_t numWeighted = vertexWeights.size() / MAX_BONES_PER_VERTEX;
+    if (numWeighted > numFileVertices) {
+      throw std::runtime_error("The skeleton has weights for vertices that "
+			       "the model does not have.");
+    }
+
+    model.boneIndexData.assign(MAX_BONES_PER_VERTEX * numVertices, 0);
+    model.boneWeightData.assign(MAX_BONES_PER_VERTEX * numVertices, 0.0f);
+    for (size_t vertex = 0; vertex < numVertices; ++vertex) {
+      size_t fileVertex = vertex < numFileVertices ? vertex :
+	model.copiedVertexIndices[vertex - numFileVertices];
+      size_t target = MAX_BONES_PER_VERTEX * vertex;
+      if (fileVertex < numWeighted) {
+        size_t source = MAX_BONES_PER_VERTEX * fileVertex;
+        std::copy(vertexBones.begin() + source,
+		  vertexBones.begin() + source + MAX_BONES_PER_VERTEX,
+		  model.boneIndexData.begin() + target);
+        std::copy(vertexWeights.begin() + source,
+		  vertexWeights.begin() + source + MAX_BONES_PER_VERTEX,
+		  model.boneWeightData.begin() + target);
+      }
+      else {
+        model.boneWeightData[target] = 1.0f;
+      }
+    }
+  }
+
+  size_t Skeleton::getDataByteSize() const {
+    size_t size = boneParents.size() * sizeof(int) +
+      restPose.size() * sizeof(Transform) +
+      inverseRestMatrices.size() * sizeof(glm::mat4) +
+      vertexBones.size() * sizeof(unsigned char) +
+      vertexWeights.size() * sizeof(float);
+    for (auto name = boneNames.begin(); name != boneNames.end(); ++name) {
+      size += name->size();
+    }
+    for (auto animation = animations.begin(); animation != animations.end();
+	 ++animation) {
+      size += animation->name.size();
+      for (auto keyframes = animation->keyframes.begin();
+	   keyframes != animation->keyframes.end(); ++keyframes) {
+        size += keyframes->size() * sizeof(Keyframe);
+      }
+    }
+    return size;
+  }
+
+}
@@ -8,282 +8,182 @@
 
 
 #include "Sound.hpp"
-#include "Logger.hpp"
-#include <vector>
-#include <stdexcept>
-#include <cstring>
-#include <vorbis/vorbisfile.h>
-#include <GLFW/glfw3.h>
-
-#define WORD_SIZE 2
-#define PORTAUDIO_SAMPLE_FORMAT paInt16
-#define SAMPLE_DATATYPE short
-
-#define SOUND_ID(name, handle) name + "/" + handle
+#include "SoundBank.hpp"
+#include <utility>
 
 namespace small3d {
 
-  bool Sound::noOutputDevice;
-  PaDeviceIndex Sound::defaultOutput;
-  unsigned int Sound::numInstances = 0;
-
-  int Sound::audioCallback(const void *inputBuffer, void *outputBuffer,
-                           unsigned long framesPerBuffer,
-                           const PaStreamCallbackTimeInfo *timeInfo,
-                           PaStreamCallbackFlags statusFlags,
-                           void *userData) {
-    
-    int result = paContinue;
-    SoundData *soundData = static_cast<SoundData *>(userData);
-
-    if (soundData->startTime == 0) {
-      soundData->startTime = glfwGetTime() - 0.1;
-    } else if (glfwGetTime() - soundData->startTime > soundData->duration) {
-      if (soundData->repeat) {
-	soundData->startTime = glfwGetTime() - 0.1;
-        soundData->currentFrame = 0;
-      }
-      else {
-        return paAbort;
-      }
-    }
-    
-    SAMPLE_DATATYPE *out = static_cast<SAMPLE_DATATYPE *>(outputBuffer);
-    unsigned long startPos = soundData->currentFrame *
-      static_cast<unsigned long>(soundData->channels);
-    unsigned long endPos = startPos + framesPerBuffer *
-      static_cast<unsigned long>(soundData->channels);
-    
-    if (endPos > static_cast<unsigned long>(soundData->samples) * WORD_SIZE *
-	soundData->channels) {
-      endPos = static_cast<unsigned long>(soundData->samples) * WORD_SIZE *
-	soundData->channels;
-      result = paAbort;
-    }
-    
-    for (unsigned long i = startPos; i < endPos;
-	 i += static_cast<unsigned long>(soundData->channels)) {
-      for (int c = 0; c < soundData->channels; ++c) {
-        *out++ = (reinterpret_cast<short *>(soundData->data.data()))[i + c];
-      }
-    }
-    
-    soundData->currentFrame += framesPerBuffer;
-    
-    return result;
+  Sound::Sound() {
+    this->streamStarted = false;
+    this->mixer = &SoundMixer::getInstance();
+    this->voice = 0;
+    this->volume = 1.0f;
+    this->pan = 0.0f;
+    this->pitch = 1.0f;
+    this->positional = false;
   }
 
-  Sound::Sound() {
-    this->stream = nullptr;
-    if (numInstances == 0) {
-      LOGDEBUG("No Sound instances exist. Initialising PortAudio");
+  Sound::Sound(const std::string soundFilePath) : Sound() {
+    this->load(soundFilePath, false);
+  }
 
-      noOutputDevice = false;
-    
-      PaError initError = Pa_Initialize();
-    
-      if (initError != paNoError) {
-        throw std::runtime_error("PortAudio failed to initialise: " + 
-				 std::string(Pa_GetErrorText(initError)));
-      }
-    
-      defaultOutput = Pa_GetDefaultOutputDevice();
-    
-      if (defaultOutput == paNoDevice) {
-        LOGERROR("No default sound output device.");
-        noOutputDevice = true;
-      }
-    }
-    ++numInstances;
+  Sound::Sound(const std::string soundFilePath, const bool stream) : Sound() {
+    this->load(soundFilePath, stream);
   }
-  
-  Sound::Sound(const std::string soundFilePath) : Sound() {
-    this->load(soundFilePath);
+
+  Sound::Sound(const std::string soundFilePath, SoundMixer &mixer,
+	       const bool stream) {
+    this->streamStarted = false;
+    this->mixer = &mixer;
+    this->voice = 0;
+    this->volume = 1.0f;
+    this->pan = 0.0f;
+    this->pitch = 1.0f;
+    this->positional = false;
+    this->load(soundFilePath, stream);
   }
 
   Sound::~Sound() {
-    if (stream != nullptr) {
-      Pa_AbortStream(stream);
-      Pa_CloseStream(stream);
+    this->stop();
+  }
+
+  void Sound::load(const std::string soundFilePath, const bool stream) {
+    if (stream) {
+      this->stream = std::make_shared<SoundStream>(soundFilePath);
     }
-    
-    --numInstances;
-    if(numInstances == 0) {
-      LOGDEBUG("Last Sound instance destroyed. Terminating PortAudio.");
-      Pa_Terminate();
+    else {
+      this->clip = SoundBank::getInstance().get(soundFilePath);
     }
   }
 
-  void Sound::load(const std::string soundFilePath) {
-    
-    if (!noOutputDevice) {
-      
-      OggVorbis_File vorbisFile;
-      
-#if defined(_WIN32) && !defined(__MINGW32__)
-      FILE *fp;
-      fopen_s(&fp, (soundFilePath).c_str(), "rb");
-#else
-      FILE *fp = fopen((soundFilePath).c_str(), "rb");
-#endif
-      
-      if (!fp) {
-        throw std::runtime_error("Could not open file " + soundFilePath);
-      }
-      
-      if (ov_open_callbacks(fp, &vorbisFile, NULL, 0, OV_CALLBACKS_NOCLOSE) < 0) {
-        throw std::runtime_error("Could not load sound from file " + soundFilePath);
-      }
-      
-      vorbis_info *vi = ov_info(&vorbisFile, -1);
-      
-      this->soundData.channels = vi->channels;
-      this->soundData.rate = (int) vi->rate;
-      this->soundData.samples = static_cast<long>(ov_pcm_total(&vorbisFile, -1));
-      this->soundData.size = soundData.channels * soundData.samples * WORD_SIZE;
-      this->soundData.duration = static_cast<double>(soundData.samples) /
-	static_cast<double>(soundData.rate);
-      
-      char pcmout[4096];
-      int current_section;
-      long ret = 0;
-      long pos = 0;
-      
-      do {
-        ret = ov_read(&vorbisFile, pcmout, sizeof(pcmout), 0, WORD_SIZE, 1,
-		      &current_section);
-        if (ret < 0) {
-          
-          LOGERROR("Error in sound stream.");
-          
-        } else if (ret > 0) {
-          
-          this->soundData.data.insert(soundData.data.end(), &pcmout[0],
-				      &pcmout[ret]);
-          
-          pos += ret;
-          
-        }
-      } while (ret != 0);
-      
-      ov_clear(&vorbisFile);
-      
-      fclose(fp);
-      
-      char soundInfo[100];
-#if defined(_WIN32) && !defined(__MINGW32__)
-      sprintf_s(soundInfo, "Loaded sound - channels %d - rate %d - samples %ld "
-		"- size in bytes %ld", this->soundData.channels,
-		this->soundData.rate, this->soundData.samples,
-		this->soundData.size);
-#else
-      sprintf(soundInfo, "Loaded sound - channels %d - rate %d - samples %ld "
-	      "- size in bytes %ld", this->soundData.channels,
-	      this->soundData.rate, this->soundData.samples,
-	      this->soundData.size);
-#endif
-      LOGDEBUG(std::string(soundInfo));
+  void Sound::play(const bool repeat, const uint64_t startFrame) {
+    if (stream) {
+      this->stop();
+      stream->setRepeat(repeat);
+      // A new stream is already at the start.
+      if (streamStarted) stream->seek(0.0);
+      streamStarted = true;
+      this->voice = positional ?
+	mixer->play(stream, position, velocity, volume, pitch, startFrame) :
+	mixer->play(stream, volume, pan, pitch, startFrame);
+      return;
     }
-
-    this->openStream();
-    
+    if (!clip || clip->numFrames == 0) return;
+    this->stop();
+    this->voice = positional ?
+      mixer->play(clip, position, velocity, repeat, volume, pitch,
+		  startFrame) :
+      mixer->play(clip, repeat, volume, pan, pitch, startFrame);
   }
 
-  void Sound::openStream() {
+  void Sound::stop() {
+    if (this->voice != 0) {
+      mixer->stop(this->voice);
+      this->voice = 0;
+    }
+  }
 
-    PaStreamParameters outputParams;
-      
-    memset(&outputParams, 0, sizeof(PaStreamParameters));
-    outputParams.device = defaultOutput;
-    outputParams.channelCount = this->soundData.channels;
-    outputParams.hostApiSpecificStreamInfo = NULL;
-      
-    outputParams.sampleFormat = PORTAUDIO_SAMPLE_FORMAT;
-      
-    this->soundData.currentFrame = 0;
-    this->soundData.startTime = 0;
-      
-    PaError error;
+  bool Sound::isPlaying() const {
+    return this->voice != 0 && mixer->isPlaying(this->voice);
+  }
 
-    error = Pa_OpenStream(&stream, NULL, &outputParams, this->soundData.rate,
-			  1024, paNoFlag,
-			  Sound::audioCallback, &this->soundData);
-    if (error != paNoError) {
-      throw std::runtime_error("Failed to open PortAudio stream: " +
-			       std::string(Pa_GetErrorText(error)));
-    }
+  void Sound::setVolume(const float volume) {
+    this->volume = volume;
+    mixer->setVolume(this->voice, volume);
   }
-  
 
-  void Sound::play(const bool repeat) {
-    if (!noOutputDevice && this->soundData.size > 0) {
-      
-      PaError error;
+  void Sound::setPan(const float pan) {
+    this->pan = pan;
+    mixer->setPan(this->voice, pan);
+  }
 
-      if (Pa_IsStreamStopped(stream) == 0) {
-	error = Pa_AbortStream(stream);
-	if (error != paNoError) {
-	  throw std::runtime_error("Failed to abort stream on play: " +
-				   std::string(Pa_GetErrorText(error)));
-	}
-      }
+  void Sound::setPitch(const float pitch) {
+    this->pitch = pitch;
+    mixer->setPitch(this->voice, pitch);
+  }
 
-      this->soundData.currentFrame = 0;
-      this->soundData.startTime = 0;
-      this->soundData.repeat = repeat;
-        
-      error = Pa_StartStream(stream);
-      if (error != paNoError) {
-	throw std::runtime_error("Failed to start stream: " +
-				 std::string(Pa_GetErrorText(error)));
-      }
-        
-    }
-      
+  void Sound::setPosition(const glm::vec3 position,
+			  const glm::vec3 velocity) {
+    this->positional = true;
+    this->position = position;
+    this->velocity = velocity;
+    mixer->setPosition(this->voice, position, velocity);
   }
 
-  void Sound::stop() {
-    if (this->stream != nullptr) {
-      Pa_AbortStream(stream);
-      this->soundData.currentFrame = 0;
-      this->soundData.startTime = 0;
-    }
+  void Sound::clearPosition() {
+    this->positional = false;
+    mixer->clearPosition(this->voice);
   }
 
-  Sound::Sound(const Sound& other) : Sound() {
-    this->soundData = other.soundData;
-    this->stream = nullptr;
-    this->openStream();
-    ++numInstances;
+  Sound::Sound(const Sound& other) {
+    this->clip = other.clip;
+    if (other.stream) {
+      this->stream = std::make_shared<SoundStream>(other.stream->
+						   getFilePath());
+    }
+    this->streamStarted = false;
+    this->mixer = other.mixer;
+    this->voice = 0;
+    this->volume = other.volume;
+    this->pan = other.pan;
+    this->pitch = other.pitch;
+    this->positional = other.positional;
+    this->position = other.position;
+    this->velocity = other.velocity;
   }
 
-  Sound::Sound(const Sound&& other) : Sound() {
-    this->soundData = other.soundData;
-    this->stream = nullptr;
-    this->openStream();
-    ++numInstances;
+  Sound::Sound(Sound&& other) noexcept {
+    this->clip = std::move(other.clip);
+    this->stream = std::move(other.stream);
+    this->streamStarted = other.streamStarted;
+    this->mixer = other.mixer;
+    this->voice = other.voice;
+    this->volume = other.volume;
+    this->pan = other.pan;
+    this->pitch = other.pitch;
+    this->positional = other.positional;
+    this->position = other.position;
+    this->velocity = other.velocity;
+    other.voice = 0;
   }
 
   Sound& Sound::operator=(const Sound& other) {
-    if (this->stream != nullptr) {
-      Pa_AbortStream(this->stream);
-      Pa_CloseStream(this->stream);
+    if (this != &other) {
+      this->stop();
+      this->clip = other.clip;
+      this->stream.reset();
+      if (other.stream) {
+        this->stream = std::make_shared<SoundStream>(other.stream->
+						     getFilePath());
+      }
+      this->streamStarted = false;
+      this->mixer = other.mixer;
+      this->volume = other.volume;
+      this->pan = other.pan;
+      this->pitch = other.pitch;
+      this->positional = other.positional;
+      this->position = other.position;
+      this->velocity = other.velocity;
     }
-    this->soundData = other.soundData;
-    this->stream = nullptr;
-    this->openStream();
     return *this;
-    
   }
 
-  Sound& Sound::operator=(const Sound&& other) {
-    if (this->stream != nullptr) {
-      Pa_AbortStream(this->stream);
-      Pa_CloseStream(this->stream);
+  Sound& Sound::operator=(Sound&& other) noexcept {
+    if (this != &other) {
+      this->stop();
+      this->clip = std::move(other.clip);
+      this->stream = std::move(other.stream);
+      this->streamStarted = other.streamStarted;
+      this->mixer = other.mixer;
+      this->voice = other.voice;
+      this->volume = other.volume;
+      this->pan = other.pan;
+      this->pitch = other.pitch;
+      this->positional = other.positional;
+      this->position = other.position;
+      this->velocity = other.velocity;
+      other.voice = 0;
     }
-    this->soundData = other.soundData;
-    this->stream = nullptr;
-    this->openStream();
     return *this;
   }
 
@@ -0,0 +1,408 @@
+/*
+ *  SoundBank.cpp
+ *
+ *  Created on: 2026/10/19
+ *      Author: Dimitri Kourkoulis
+ *     License: BSD 3-Clause License (see LICENSE file)
+ */
+
+#include "SoundBank.hpp"
+#include "Trace.hpp"
+#include "Logger.hpp"
+#include <stdexcept>
+#include <algorithm>
+#include <functional>
+#include <utility>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <vorbis/vorbisfile.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define WORD_SIZE 2
+#define DECODE_CHUNK_BYTES 4096
+
+// Cache files start with this, followed by the modification time and size
+// of the ogg file, the format of the clip, the path of the ogg file and the
+// samples. The numbers are stored in the byte order of the machine.
+#define CACHE_MAGIC "S3DPCM01"
+#define CACHE_MAGIC_SIZE 8
+
+namespace small3d {
+
+  SoundBank& SoundBank::getInstance() {
+    static SoundBank instance;
+    return instance;
+  }
+
+  std::shared_ptr<const SoundClip> SoundBank::decode(const std::string
+						     soundFilePath) {
+    TRACEZONE("SoundBank::decode");
+
+    OggVorbis_File vorbisFile;
+
+#if defined(_WIN32) && !defined(__MINGW32__)
+    FILE *fp;
+    fopen_s(&fp, (soundFilePath).c_str(), "rb");
+#else
+    FILE *fp = fopen((soundFilePath).c_str(), "rb");
+#endif
+
+    if (!fp) {
+      throw std::runtime_error("Could not open file " + soundFilePath);
+    }
+
+    if (ov_open_callbacks(fp, &vorbisFile, NULL, 0, OV_CALLBACKS_NOCLOSE) < 0) {
+      fclose(fp);
+      throw std::runtime_error("Could not load sound from file " + soundFilePath);
+    }
+
+    vorbis_info *vi = ov_info(&vorbisFile, -1);
+
+    std::shared_ptr<SoundClip> clip(new SoundClip());
+    clip->channels = vi->channels;
+    clip->rate = static_cast<int>(vi->rate);
+    clip->numFrames = static_cast<unsigned long>(ov_pcm_total(&vorbisFile,
+							      -1));
+
+    // The size is known in advance, so the samples are decoded in place.
+    clip->samples.resize(clip->numFrames *
+			 static_cast<unsigned long>(clip->channels));
+    char *pcmout = reinterpret_cast<char *>(clip->samples.data());
+    long size = static_cast<long>(clip->samples.size() * WORD_SIZE);
+    int current_section;
+    long ret = 0;
+    long pos = 0;
+
+    while (pos < size) {
+      ret = ov_read(&vorbisFile, pcmout + pos,
+		    static_cast<int>(std::min(size - pos,
+					      static_cast<long>
+					      (DECODE_CHUNK_BYTES))),
+		    0, WORD_SIZE, 1, &current_section);
+      if (ret < 0) {
+        LOGERROR("Error in sound stream.");
+      } else if (ret == 0) {
+        break;
+      } else {
+        pos += ret;
+      }
+    }
+
+    // In case the stream has ended earlier than announced
+    clip->numFrames = static_cast<unsigned long>
+      (pos / (WORD_SIZE * clip->channels));
+    clip->samples.resize(clip->numFrames *
+			 static_cast<unsigned long>(clip->channels));
+    clip->samples.shrink_to_fit();
+
+    ov_clear(&vorbisFile);
+
+    fclose(fp);
+
+    LOGDEBUGF("Loaded sound - channels {} - rate {} - frames {} - size in "
+	      "bytes {}", clip->channels, clip->rate, clip->numFrames, pos);
+
+    return clip;
+  }
+
+  static bool getFileInfo(const std::string &filePath, int64_t &modified,
+			  uint64_t &size) {
+#if defined(_WIN32) && !defined(__MINGW32__)
+    struct _stat64 info;
+    if (_stat64(filePath.c_str(), &info) != 0) return false;
+#else
+    struct stat info;
+    if (stat(filePath.c_str(), &info) != 0) return false;
+#endif
+    modified = static_cast<int64_t>(info.st_mtime);
+    size = static_cast<uint64_t>(info.st_size);
+    return true;
+  }
+
+  // Header of the cache files
+  struct CacheHeader {
+    int64_t modified;
+    uint64_t size;
+    int32_t channels;
+    int32_t rate;
+    uint64_t numFrames;
+    uint32_t pathLength;
+  };
+
+  // Reads the clip from the contents of a cache file, if they are valid for
+  // the ogg file.
+  static std::shared_ptr<const SoundClip> parseCache(const char *data,
+						     const size_t dataSize,
+						     const std::string
+						     &soundFilePath,
+						     const int64_t modified,
+						     const uint64_t size) {
+    CacheHeader header;
+    size_t offset = CACHE_MAGIC_SIZE + sizeof(CacheHeader);
+    if (dataSize < offset ||
+	memcmp(data, CACHE_MAGIC, CACHE_MAGIC_SIZE) != 0) {
+      return nullptr;
+    }
+    memcpy(&header, data + CACHE_MAGIC_SIZE, sizeof(CacheHeader));
+    if (header.modified != modified || header.size != size ||
+	header.channels < 1 || header.channels > 2 ||
+	header.pathLength != soundFilePath.size() ||
+	dataSize - offset < header.pathLength ||
+	soundFilePath.compare(0, std::string::npos, data + offset,
+			      header.pathLength) != 0) {
+      return nullptr;
+    }
+    offset += header.pathLength;
+    uint64_t numSamples = header.numFrames *
+      static_cast<uint64_t>(header.channels);
+    if ((dataSize - offset) / sizeof(short) != numSamples) return nullptr;
+
+    std::shared_ptr<SoundClip> clip(new SoundClip());
+    clip->channels = header.channels;
+    clip->rate = header.rate;
+    clip->numFrames = static_cast<unsigned long>(header.numFrames);
+    clip->samples.resize(static_cast<size_t>(numSamples));
+    if (numSamples > 0) {
+      memcpy(clip->samples.data(), data + offset,
+	     static_cast<size_t>(numSamples) * sizeof(short));
+    }
+    return clip;
+  }
+
+  std::shared_ptr<const SoundClip> SoundBank::readCache(const std::string
+							soundFilePath,
+							const std::string
+							cacheFilePath) {
+    TRACEZONE("SoundBank::readCache");
+
+    int64_t modified;
+    uint64_t size;
+    if (!getFileInfo(soundFilePath, modified, size)) return nullptr;
+
+    std::shared_ptr<const SoundClip> clip;
+
+#ifdef _WIN32
+    FILE *fp;
+#ifdef __MINGW32__
+    fp = fopen(cacheFilePath.c_str(), "rb");
+#else
+    fopen_s(&fp, cacheFilePath.c_str(), "rb");
+#endif
+    if (!fp) return nullptr;
+    std::vector<char> data;
+    char chunk[DECODE_CHUNK_BYTES];
+    size_t numRead;
+    while ((numRead = fread(chunk, 1, DECODE_CHUNK_BYTES, fp)) > 0) {
+      data.insert(data.end(), chunk, chunk + numRead);
+    }
+    fclose(fp);
+    clip = parseCache(data.data(), data.size(), soundFilePath, modified,
+		      size);
+#else
+    int fd = open(cacheFilePath.c_str(), O_RDONLY);
+    if (fd < 0) return nullptr;
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+      size_t dataSize = static_cast<size_t>(info.st_size);
+      void *data = mmap(nullptr, dataSize, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data != MAP_FAILED) {
+        clip = parseCache(static_cast<const char *>(data), dataSize,
+			  soundFilePath, modified, size);
+        munmap(data, dataSize);
+      }
+    }
+    close(fd);
+#endif
+
+    if (clip) {
+      LOGDEBUGF("Loaded sound {} from cache {}", soundFilePath,
+		cacheFilePath);
+    }
+    return clip;
+  }
+
+  void SoundBank::writeCache(const std::string soundFilePath,
+			     const std::string cacheFilePath,
+			     const SoundClip &clip) {
+    TRACEZONE("SoundBank::writeCache");
+
+    CacheHeader header;
+    if (!getFileInfo(soundFilePath, header.modified, header.size)) return;
+    header.channels = clip.channels;
+    header.rate = clip.rate;
+    header.numFrames = clip.numFrames;
+    header.pathLength = static_cast<uint32_t>(soundFilePath.size());
+
+    // Written to a temporary file first, so that a cache file that is being
+    // written is never read.
+    std::string tempFilePath = cacheFilePath + ".tmp";
+#if defined(_WIN32) && !defined(__MINGW32__)
+    FILE *fp;
+    fopen_s(&fp, tempFilePath.c_str(), "wb");
+#else
+    FILE *fp = fopen(tempFilePath.c_str(), "wb");
+#endif
+    if (!fp) {
+      LOGERRORF("Could not write sound cache file {}", tempFilePath);
+      return;
+    }
+    bool written =
+      fwrite(CACHE_MAGIC, 1, CACHE_MAGIC_SIZE, fp) == CACHE_MAGIC_SIZE &&
+      fwrite(&header, sizeof(CacheHeader), 1, fp) == 1 &&
+      fwrite(soundFilePath.data(), 1, soundFilePath.size(), fp) ==
+      soundFilePath.size() &&
+      fwrite(clip.samples.data(), sizeof(short), clip.samples.size(), fp) ==
+      clip.samples.size();
+    written = fclose(fp) == 0 && written;
+
+    std::remove(cacheFilePath.c_str());
+    if (!written || std::rename(tempFilePath.c_str(),
+				cacheFilePath.c_str()) != 0) {
+      LOGERRORF("Could not write sound cache file {}", cacheFilePath);
+      std::remove(tempFilePath.c_str());
+    }
+  }
+
+  void SoundBank::removeExpired() {
+    for (auto clip = clips.begin(); clip != clips.end();) {
+      if (clip->second.expired()) {
+        clip = clips.erase(clip);
+      }
+      else {
+        ++clip;
+      }
+    }
+  }
+
+  std::shared_ptr<const SoundClip> SoundBank::get(const std::string
+						  soundFilePath) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto found = clips.find(soundFilePath);
+      if (found != clips.end()) {
+        std::shared_ptr<const SoundClip> clip = found->second.lock();
+        if (clip) return clip;
+      }
+    }
+
+    // Decoded without holding the lock, so that other files can be loaded
+    // in the meantime. If the same file has been loaded by another thread
+    // in the meantime, its clip is used instead.
+    std::string cacheFilePath = getCacheFilePath(soundFilePath);
+    std::shared_ptr<const SoundClip> clip;
+    if (!cacheFilePath.empty()) {
+      clip = readCache(soundFilePath, cacheFilePath);
+    }
+    if (!clip) {
+      clip = decode(soundFilePath);
+      if (!cacheFilePath.empty()) {
+        writeCache(soundFilePath, cacheFilePath, *clip);
+      }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::weak_ptr<const SoundClip> &entry = clips[soundFilePath];
+    std::shared_ptr<const SoundClip> existing = entry.lock();
+    if (existing) return existing;
+    entry = clip;
+    removeExpired();
+    return clip;
+  }
+
+  void SoundBank::get(const std::vector<std::string> &soundFilePaths,
+		       JobSystem &jobSystem,
+		       std::vector<std::shared_ptr<const SoundClip> > &clips) {
+    TRACEZONE("SoundBank::get (batch)");
+    clips.assign(soundFilePaths.size(), nullptr);
+
+    // Each file is only loaded once, even if it appears more than once.
+    std::unordered_map<std::string, size_t> firstIndexes;
+    std::vector<size_t> unique;
+    for (size_t idx = 0; idx < soundFilePaths.size(); ++idx) {
+      if (firstIndexes.insert(std::make_pair(soundFilePaths[idx],
+					     idx)).second) {
+        unique.push_back(idx);
+      }
+    }
+
+    // One file per job, since the files can take very different times to
+    // decode.
+    jobSystem.parallelFor(unique.size(), 1,
+			  [&](size_t begin, size_t end) {
+			    for (size_t idx = begin; idx < end; ++idx) {
+			      clips[unique[idx]] =
+				this->get(soundFilePaths[unique[idx]]);
+			    }
+			  });
+
+    for (size_t idx = 0; idx < soundFilePaths.size(); ++idx) {
+      if (!clips[idx]) clips[idx] = clips[firstIndexes[soundFilePaths[idx]]];
+    }
+  }
+
+  void SoundBank::setCacheDirectory(const std::string directory) {
+    if (!directory.empty()) {
+      // Fails harmlessly if the directory exists.
+#ifdef _WIN32
+      _mkdir(directory.c_str());
+#else
+      mkdir(directory.c_str(), 0755);
+#endif
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    cacheDirectory = directory;
+  }
+
+  std::string SoundBank::getCacheFilePath(const std::string soundFilePath) {
+    std::string directory;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      directory = cacheDirectory;
+    }
+    if (directory.empty()) return "";
+
+    // Named after the file and a hash of its path, so that files with the
+    // same name in different directories do not share a cache file. The
+    // path is also stored in the cache file and checked.
+    size_t nameStart = soundFilePath.find_last_of("/\\");
+    nameStart = nameStart == std::string::npos ? 0 : nameStart + 1;
+    std::string name = soundFilePath.substr(nameStart);
+    size_t extension = name.find_last_of('.');
+    if (extension != std::string::npos && extension > 0) {
+      name = name.substr(0, extension);
+    }
+    char hash[17];
+    snprintf(hash, sizeof(hash), "%016llx", static_cast<unsigned long long>
+	     (std::hash<std::string>()(soundFilePath)));
+    char last = directory[directory.size() - 1];
+    std::string separator = last == '/' || last == '\\' ? "" : "/";
+    return directory + separator + name + "-" + hash + ".pcm";
+  }
+
+  size_t SoundBank::getNumClips() {
+    std::lock_guard<std::mutex> lock(mutex);
+    removeExpired();
+    return clips.size();
+  }
+
+  size_t SoundBank::getMemoryUsage() {
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t usage = 0;
+    for (auto entry = clips.begin(); entry != clips.end(); ++entry) {
+      std::shared_ptr<const SoundClip> clip = entry->second.lock();
+      if (clip) usage += clip->samples.capacity() * sizeof(short);
+    }
+    return usage;
+  }
+
+}
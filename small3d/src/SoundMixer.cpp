@@ -0,0 +1,999 @@
+/*
+ *  SoundMixer.cpp
+ *
+ *  Created on: 2026/10/19
+ *      Author: Dimitri Kourkoulis
+ *     License: BSD 3-Clause License (see LICENSE file)
+ */
+
+#include "SoundMixer.hpp"
+#include "SoundStream.hpp"
+#include "Logger.hpp"
+#include <stdexcept>
+#include <fstream>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "Simd.hpp"
+
+// Commands that can be queued between two audio callbacks (a power of 2)
+#define MIXER_COMMAND_QUEUE_SIZE 1024
+#define MIXER_MAX_VOICES 64
+
+// Frames mixed at a time. Volume and pan changes are spread over a block.
+#define MIXER_BLOCK_FRAMES 256
+#define MIXER_FRAMES_PER_BUFFER 512
+#define MIXER_CHANNELS 2
+
+// Voice positions are in frames, as 32.32 fixed point numbers.
+#define POSITION_ONE 4294967296.0
+#define POSITION_ONE_INT (static_cast<uint64_t>(1) << 32)
+
+// Positioned voices closer than this to the listener are not panned.
+#define MIN_PAN_DISTANCE 0.0001f
+
+// The speeds of the listener and the voices towards each other are limited
+// to this fraction of the speed of sound, so that the Doppler effect does
+// not go out of bounds.
+#define MAX_DOPPLER_SPEED 0.5f
+
+namespace small3d {
+
+  enum CommandType {
+    commandplay, commandstop, commandvolume, commandpan, commandpitch,
+    commandposition, commandlistener
+  };
+
+  struct SoundMixer::Command {
+    CommandType type;
+    unsigned int handle;
+    const SoundClip *clip;
+    SoundStream *stream;
+    bool repeat;
+    float volume;
+    float pan;
+    float pitch;
+    uint64_t startFrame;
+    bool positional;
+    glm::vec3 position;
+    glm::vec3 velocity;
+    glm::mat3 rotation;
+  };
+
+  struct SoundMixer::QueueSlot {
+    std::atomic<size_t> sequence;
+    Command command;
+  };
+
+  struct SoundMixer::Voice {
+    unsigned int handle; // 0 if the voice is free
+    const SoundClip *clip;
+    SoundStream *stream;
+    bool repeat;
+    uint64_t startFrame;
+    uint64_t position;
+    uint64_t step;
+    float volume;
+    float pan;
+    float pitch;
+    bool positional;
+    glm::vec3 worldPosition;
+    glm::vec3 worldVelocity;
+
+    // The gains at the start of the block being mixed and at its end. The
+    // gains change linearly in between.
+    float gainLeft;
+    float gainRight;
+    float targetLeft;
+    float targetRight;
+    bool mixed;
+
+    // How loud the voice is (its volume, attenuated with distance), for
+    // choosing which voices to stop when there are too many.
+    float audibility;
+
+    // For streams, the frames between which the position is
+    short current[2];
+    short next[2];
+    bool hasNext;
+    bool draining;
+  };
+
+  SoundClip::SoundClip() {
+    channels = 0;
+    rate = 0;
+    numFrames = 0;
+  }
+
+  static uint64_t getStep(const int sourceRate, const float pitch,
+			  const int rate) {
+    double step = static_cast<double>(pitch) * sourceRate / rate *
+      POSITION_ONE;
+    return step < 1.0 ? 1 : static_cast<uint64_t>(step + 0.5);
+  }
+
+  // Balance rather than constant power panning, so that the centre leaves
+  // the clip as it is.
+  static float getLeftGain(const float volume, const float pan) {
+    return pan > 0.0f ? volume * (1.0f - std::min(pan, 1.0f)) : volume;
+  }
+
+  static float getRightGain(const float volume, const float pan) {
+    return pan < 0.0f ? volume * (1.0f + std::max(pan, -1.0f)) : volume;
+  }
+
+  // Clip frames played at their own rate: a plain multiply-add over the
+  // frames, which the compiler vectorises.
+  static void mixFrames(const short *samples, const int channels,
+			float *buffer, const unsigned long numFrames,
+			const float gainLeft, const float gainRight,
+			const float deltaLeft, const float deltaRight) {
+    if (channels == 1) {
+      for (unsigned long idx = 0; idx < numFrames; ++idx) {
+        float sample = samples[idx];
+        float j = static_cast<float>(idx);
+        buffer[2 * idx] += sample * (gainLeft + deltaLeft * j);
+        buffer[2 * idx + 1] += sample * (gainRight + deltaRight * j);
+      }
+    }
+    else {
+      for (unsigned long idx = 0; idx < numFrames; ++idx) {
+        float j = static_cast<float>(idx);
+        buffer[2 * idx] += samples[channels * idx] *
+	  (gainLeft + deltaLeft * j);
+        buffer[2 * idx + 1] += samples[channels * idx + 1] *
+	  (gainRight + deltaRight * j);
+      }
+    }
+  }
+
+  // Clip frames played at a different rate, interpolating linearly between
+  // them. The frame after the last one is the first one if the clip repeats,
+  // so that there is no gap when looping.
+  static void mixInterpolated(const SoundClip &clip, const bool repeat,
+			      uint64_t position, const uint64_t step,
+			      float *buffer, const unsigned long numFrames,
+			      const float gainLeft, const float gainRight,
+			      const float deltaLeft, const float deltaRight) {
+    const short *samples = clip.samples.data();
+    const int channels = clip.channels;
+    const int right = channels > 1 ? 1 : 0;
+    const uint64_t lastFrame = clip.numFrames - 1;
+    const uint64_t wrapFrame = repeat ? 0 : lastFrame;
+    for (unsigned long idx = 0; idx < numFrames; ++idx) {
+      uint64_t frame = position >> 32;
+      uint64_t next = frame < lastFrame ? frame + 1 : wrapFrame;
+      float fraction = static_cast<float>(position & 0xffffffff) *
+	(1.0f / 4294967296.0f);
+      const short *current = samples + frame * channels;
+      const short *following = samples + next * channels;
+      float left = current[0] + (following[0] - current[0]) * fraction;
+      float rightSample = current[right] +
+	(following[right] - current[right]) * fraction;
+      float j = static_cast<float>(idx);
+      buffer[2 * idx] += left * (gainLeft + deltaLeft * j);
+      buffer[2 * idx + 1] += rightSample * (gainRight + deltaRight * j);
+      position += step;
+    }
+  }
+
+  // Converts the mix to 16 bits, saturating the samples that are out of
+  // range.
+  static void saturate(const float *buffer, short *output,
+		       const size_t numSamples) {
+    size_t idx = 0;
+#ifdef SMALL3D_SSE2
+    const __m128 maxValue = _mm_set1_ps(32767.0f);
+    const __m128 minValue = _mm_set1_ps(-32768.0f);
+    for (; idx + 8 <= numSamples; idx += 8) {
+      __m128i low = _mm_cvtps_epi32(_mm_max_ps(_mm_min_ps(
+        _mm_loadu_ps(buffer + idx), maxValue), minValue));
+      __m128i high = _mm_cvtps_epi32(_mm_max_ps(_mm_min_ps(
+        _mm_loadu_ps(buffer + idx + 4), maxValue), minValue));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(output + idx),
+		       _mm_packs_epi32(low, high));
+    }
+#endif
+    for (; idx < numSamples; ++idx) {
+      float value = std::max(std::min(buffer[idx], 32767.0f), -32768.0f);
+      output[idx] = static_cast<short>(std::lrint(value));
+    }
+  }
+
+  int SoundMixer::audioCallback(const void *inputBuffer, void *outputBuffer,
+				unsigned long framesPerBuffer,
+				const PaStreamCallbackTimeInfo *timeInfo,
+				PaStreamCallbackFlags statusFlags,
+				void *userData) {
+    static_cast<SoundMixer *>(userData)->
+      mix(static_cast<short *>(outputBuffer), framesPerBuffer);
+    return paContinue;
+  }
+
+  SoundMixer& SoundMixer::getInstance() {
+    static SoundMixer instance(mixerdevice);
+    return instance;
+  }
+
+  SoundMixer::SoundMixer(const MixerOutput output, const int rate) {
+    if (rate <= 0) {
+      throw std::runtime_error("Invalid mixer sample rate.");
+    }
+    this->output = output;
+    this->rate = rate;
+    stream = nullptr;
+    paInitialised = false;
+
+    commands.reset(new QueueSlot[MIXER_COMMAND_QUEUE_SIZE]);
+    commandMask = MIXER_COMMAND_QUEUE_SIZE - 1;
+    for (size_t idx = 0; idx < MIXER_COMMAND_QUEUE_SIZE; ++idx) {
+      commands[idx].sequence.store(idx, std::memory_order_relaxed);
+    }
+    enqueuePos = 0;
+    dequeuePos = 0;
+
+    // Every voice that has been requested but has not finished has a place
+    // here, so the audio thread can always report it.
+    finishedSize = MIXER_COMMAND_QUEUE_SIZE + MIXER_MAX_VOICES;
+    finished.reset(new std::atomic<unsigned int>[finishedSize]);
+    finishedHead = 0;
+    finishedTail = 0;
+
+    voices.reset(new Voice[MIXER_MAX_VOICES]);
+    for (int idx = 0; idx < MIXER_MAX_VOICES; ++idx) {
+      voices[idx].handle = 0;
+      voices[idx].clip = nullptr;
+      voices[idx].stream = nullptr;
+    }
+    mixBuffer.resize(MIXER_BLOCK_FRAMES * MIXER_CHANNELS);
+    frameCount = 0;
+    numFramesMixed = 0;
+    lastHandle = 0;
+
+    listenerPosition = glm::vec3(0.0f);
+    listenerVelocity = glm::vec3(0.0f);
+    listenerRotation = glm::mat3(1.0f);
+    referenceDistance = 1.0f;
+    maxDistance = 1000.0f;
+    rolloffFactor = 1.0f;
+    speedOfSound = 343.0f;
+
+    if (output == mixerdevice) {
+      this->openStream();
+    }
+  }
+
+  SoundMixer::~SoundMixer() {
+    if (stream != nullptr) {
+      Pa_AbortStream(stream);
+      Pa_CloseStream(stream);
+    }
+    if (paInitialised) {
+      Pa_Terminate();
+    }
+  }
+
+  void SoundMixer::openStream() {
+    PaError error = Pa_Initialize();
+    if (error != paNoError) {
+      throw std::runtime_error("PortAudio failed to initialise: " +
+			       std::string(Pa_GetErrorText(error)));
+    }
+    paInitialised = true;
+
+    PaDeviceIndex device = Pa_GetDefaultOutputDevice();
+    if (device == paNoDevice) {
+      LOGERROR("No default sound output device.");
+      return;
+    }
+
+    PaStreamParameters outputParams;
+    memset(&outputParams, 0, sizeof(PaStreamParameters));
+    outputParams.device = device;
+    outputParams.channelCount = MIXER_CHANNELS;
+    outputParams.sampleFormat = paInt16;
+    const PaDeviceInfo *deviceInfo = Pa_GetDeviceInfo(device);
+    if (deviceInfo != nullptr) {
+      outputParams.suggestedLatency = deviceInfo->defaultLowOutputLatency;
+    }
+    outputParams.hostApiSpecificStreamInfo = NULL;
+
+    error = Pa_OpenStream(&stream, NULL, &outputParams, rate,
+			  MIXER_FRAMES_PER_BUFFER, paNoFlag,
+			  SoundMixer::audioCallback, this);
+    if (error != paNoError) {
+      stream = nullptr;
+      throw std::runtime_error("Failed to open PortAudio stream: " +
+			       std::string(Pa_GetErrorText(error)));
+    }
+
+    error = Pa_StartStream(stream);
+    if (error != paNoError) {
+      throw std::runtime_error("Failed to start stream: " +
+			       std::string(Pa_GetErrorText(error)));
+    }
+  }
+
+  bool SoundMixer::push(const Command &command) {
+    size_t pos = enqueuePos.load(std::memory_order_relaxed);
+    QueueSlot *slot;
+    while (true) {
+      slot = &commands[pos & commandMask];
+      size_t sequence = slot->sequence.load(std::memory_order_acquire);
+      std::ptrdiff_t difference = static_cast<std::ptrdiff_t>(sequence - pos);
+      if (difference == 0) {
+        if (enqueuePos.compare_exchange_weak(pos, pos + 1,
+					     std::memory_order_relaxed)) {
+          break;
+        }
+      }
+      else if (difference < 0) {
+        LOGERROR("The sound mixer command queue is full.");
+        return false;
+      }
+      else {
+        pos = enqueuePos.load(std::memory_order_relaxed);
+      }
+    }
+    slot->command = command;
+    slot->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  void SoundMixer::collectFinished() {
+    size_t tail = finishedTail.load(std::memory_order_relaxed);
+    size_t head = finishedHead.load(std::memory_order_acquire);
+    for (; tail != head; ++tail) {
+      voiceSources.erase(finished[tail % finishedSize].
+		       load(std::memory_order_relaxed));
+    }
+    finishedTail.store(tail, std::memory_order_release);
+  }
+
+  void SoundMixer::reportFinished(const unsigned int handle) {
+    size_t head = finishedHead.load(std::memory_order_relaxed);
+    if (head - finishedTail.load(std::memory_order_acquire) >= finishedSize) {
+      // Cannot happen, since play refuses voices that would not fit.
+      return;
+    }
+    finished[head % finishedSize].store(handle, std::memory_order_relaxed);
+    finishedHead.store(head + 1, std::memory_order_release);
+  }
+
+  void SoundMixer::finishVoice(Voice &voice) {
+    if (voice.stream != nullptr) {
+      voice.stream->endRead(voice.hasNext);
+      voice.stream->attached.store(false);
+    }
+    reportFinished(voice.handle);
+    voice.handle = 0;
+    voice.clip = nullptr;
+    voice.stream = nullptr;
+  }
+
+  void SoundMixer::processCommands() {
+    while (true) {
+      QueueSlot &slot = commands[dequeuePos & commandMask];
+      if (slot.sequence.load(std::memory_order_acquire) != dequeuePos + 1) {
+        break;
+      }
+      Command command = slot.command;
+      slot.sequence.store(dequeuePos + commandMask + 1,
+			  std::memory_order_release);
+      ++dequeuePos;
+
+      if (command.type == commandlistener) {
+        listenerPosition = command.position;
+        listenerVelocity = command.velocity;
+        listenerRotation = command.rotation;
+        continue;
+      }
+
+      if (command.type == commandplay) {
+        if ((command.clip != nullptr && command.clip->numFrames == 0) ||
+	    (command.stream != nullptr && command.stream->attached.load())) {
+          reportFinished(command.handle);
+          continue;
+        }
+        float audibility = command.volume;
+        if (command.positional) {
+          audibility *= getAttenuation(command.position);
+        }
+        Voice *voice = getFreeVoice(audibility);
+        if (voice == nullptr) {
+          reportFinished(command.handle);
+          continue;
+        }
+        voice->handle = command.handle;
+        voice->clip = command.clip;
+        voice->stream = command.stream;
+        voice->repeat = command.repeat;
+        voice->startFrame = command.startFrame;
+        if (command.stream != nullptr) {
+          // Two frames are read before the first one is played.
+          command.stream->attached.store(true);
+          voice->position = 2 * POSITION_ONE_INT;
+          voice->step = getStep(command.stream->rate, command.pitch, rate);
+          voice->current[0] = voice->current[1] = 0;
+          voice->next[0] = voice->next[1] = 0;
+          voice->hasNext = false;
+          voice->draining = false;
+        }
+        else {
+          voice->position = 0;
+          voice->step = getStep(command.clip->rate, command.pitch, rate);
+        }
+        voice->volume = command.volume;
+        voice->pan = command.pan;
+        voice->pitch = command.pitch;
+        voice->positional = command.positional;
+        voice->worldPosition = command.position;
+        voice->worldVelocity = command.velocity;
+        voice->mixed = false;
+        voice->audibility = audibility;
+        continue;
+      }
+
+      for (int idx = 0; idx < MIXER_MAX_VOICES; ++idx) {
+        Voice &voice = voices[idx];
+        if (voice.handle != command.handle) continue;
+        switch (command.type) {
+        case commandstop:
+          finishVoice(voice);
+          break;
+        case commandvolume:
+          voice.volume = command.volume;
+          break;
+        case commandpan:
+          voice.pan = command.pan;
+          break;
+        case commandpitch:
+          voice.pitch = command.pitch;
+          voice.step = getStep(voice.stream != nullptr ? voice.stream->rate :
+			       voice.clip->rate, command.pitch, rate);
+          break;
+        case commandposition:
+          voice.positional = command.positional;
+          voice.worldPosition = command.position;
+          voice.worldVelocity = command.velocity;
+          if (!voice.positional) {
+            voice.step = getStep(voice.stream != nullptr ?
+				 voice.stream->rate : voice.clip->rate,
+				 voice.pitch, rate);
+          }
+          break;
+        default:
+          break;
+        }
+        break;
+      }
+    }
+  }
+
+  float SoundMixer::getAttenuation(const glm::vec3 &position) const {
+    float reference = referenceDistance.load(std::memory_order_relaxed);
+    float maximum = maxDistance.load(std::memory_order_relaxed);
+    float distance = std::min(std::max(glm::length(position -
+						   listenerPosition),
+				       reference), maximum);
+    return reference / (reference +
+			rolloffFactor.load(std::memory_order_relaxed) *
+			(distance - reference));
+  }
+
+  SoundMixer::Voice* SoundMixer::getFreeVoice(const float audibility) {
+    Voice *quietest = nullptr;
+    for (int idx = 0; idx < MIXER_MAX_VOICES; ++idx) {
+      Voice &voice = voices[idx];
+      if (voice.handle == 0) return &voice;
+      if (quietest == nullptr || voice.audibility < quietest->audibility) {
+        quietest = &voice;
+      }
+    }
+
+    // All the voices are taken. The quietest one makes room for the new
+    // voice, if the new voice is louder.
+    if (quietest->audibility >= audibility) return nullptr;
+    finishVoice(*quietest);
+    return quietest;
+  }
+
+  void SoundMixer::updateGains(Voice &voice) {
+    if (!voice.positional) {
+      voice.targetLeft = getLeftGain(voice.volume, voice.pan);
+      voice.targetRight = getRightGain(voice.volume, voice.pan);
+      voice.audibility = voice.volume;
+    }
+    else {
+      glm::vec3 relative = voice.worldPosition - listenerPosition;
+      float distance = glm::length(relative);
+      float gain = voice.volume * getAttenuation(voice.worldPosition);
+      float pan = 0.0f;
+      float doppler = 1.0f;
+      if (distance > MIN_PAN_DISTANCE) {
+        // Seen from the listener, the right is along x.
+        pan = (listenerRotation * relative).x / distance;
+
+        float speed = speedOfSound.load(std::memory_order_relaxed);
+        if (speed > 0.0f) {
+          glm::vec3 direction = relative / distance;
+          float maxSpeed = MAX_DOPPLER_SPEED * speed;
+          float listenerSpeed = std::min(std::max(glm::dot(listenerVelocity,
+							   direction),
+						  -maxSpeed), maxSpeed);
+          float voiceSpeed = std::min(std::max(glm::dot(voice.worldVelocity,
+							direction),
+					       -maxSpeed), maxSpeed);
+          doppler = (speed + listenerSpeed) / (speed + voiceSpeed);
+        }
+      }
+      voice.targetLeft = getLeftGain(gain, pan);
+      voice.targetRight = getRightGain(gain, pan);
+      voice.audibility = gain;
+      voice.step = getStep(voice.stream != nullptr ? voice.stream->rate :
+			   voice.clip->rate, voice.pitch * doppler, rate);
+    }
+
+    // A voice starts at its gains, rather than changing to them.
+    if (!voice.mixed) {
+      voice.gainLeft = voice.targetLeft;
+      voice.gainRight = voice.targetRight;
+      voice.mixed = true;
+    }
+  }
+
+  void SoundMixer::mixVoice(Voice &voice, float *buffer,
+			    const unsigned long numFrames) {
+    if (voice.stream != nullptr) {
+      mixStream(voice, buffer, numFrames);
+      return;
+    }
+
+    const SoundClip &clip = *voice.clip;
+    const uint64_t end = static_cast<uint64_t>(clip.numFrames) << 32;
+
+    float targetLeft = voice.targetLeft;
+    float targetRight = voice.targetRight;
+    float deltaLeft = (targetLeft - voice.gainLeft) / numFrames;
+    float deltaRight = (targetRight - voice.gainRight) / numFrames;
+
+    unsigned long idx = 0;
+    while (idx < numFrames) {
+      if (voice.position >= end) {
+        if (!voice.repeat) {
+          finishVoice(voice);
+          return;
+        }
+        voice.position %= end;
+      }
+
+      // The frames that can be mixed before reaching the end of the clip
+      uint64_t count = (end - voice.position + voice.step - 1) / voice.step;
+      if (count > numFrames - idx) count = numFrames - idx;
+      unsigned long numMixed = static_cast<unsigned long>(count);
+
+      float gainLeft = voice.gainLeft + deltaLeft * idx;
+      float gainRight = voice.gainRight + deltaRight * idx;
+      if (voice.step == (static_cast<uint64_t>(1) << 32) &&
+	  (voice.position & 0xffffffff) == 0) {
+        mixFrames(clip.samples.data() + (voice.position >> 32) * clip.channels,
+		  clip.channels, buffer + MIXER_CHANNELS * idx, numMixed,
+		  gainLeft, gainRight, deltaLeft, deltaRight);
+      }
+      else {
+        mixInterpolated(clip, voice.repeat, voice.position, voice.step,
+			buffer + MIXER_CHANNELS * idx, numMixed,
+			gainLeft, gainRight, deltaLeft, deltaRight);
+      }
+      voice.position += voice.step * count;
+      idx += numMixed;
+    }
+
+    voice.gainLeft = targetLeft;
+    voice.gainRight = targetRight;
+  }
+
+  void SoundMixer::mixStream(Voice &voice, float *buffer,
+			     const unsigned long numFrames) {
+    SoundStream &stream = *voice.stream;
+    stream.beginRead();
+
+    float targetLeft = voice.targetLeft;
+    float targetRight = voice.targetRight;
+    float deltaLeft = (targetLeft - voice.gainLeft) / numFrames;
+    float deltaRight = (targetRight - voice.gainRight) / numFrames;
+    bool underrun = false;
+
+    for (unsigned long idx = 0; idx < numFrames; ++idx) {
+      // Move on to the frames between which the position now is. If the
+      // decoder has fallen behind, silence is played until it catches up.
+      bool stalled = false;
+      while (voice.position >= POSITION_ONE_INT) {
+        if (voice.draining) {
+          finishVoice(voice);
+          return;
+        }
+        short left, right;
+        if (stream.readFrame(left, right)) {
+          voice.current[0] = voice.next[0];
+          voice.current[1] = voice.next[1];
+          voice.next[0] = left;
+          voice.next[1] = right;
+          voice.hasNext = true;
+        }
+        else if (stream.hasEnded()) {
+          voice.current[0] = voice.next[0];
+          voice.current[1] = voice.next[1];
+          voice.next[0] = voice.next[1] = 0;
+          voice.hasNext = false;
+          voice.draining = true;
+        }
+        else {
+          stalled = true;
+          break;
+        }
+        voice.position -= POSITION_ONE_INT;
+      }
+      if (stalled) {
+        underrun = underrun || !stream.seekPending;
+        continue;
+      }
+
+      float fraction = static_cast<float>(voice.position) *
+	(1.0f / 4294967296.0f);
+      float left = voice.current[0] +
+	(voice.next[0] - voice.current[0]) * fraction;
+      float right = voice.current[1] +
+	(voice.next[1] - voice.current[1]) * fraction;
+      float j = static_cast<float>(idx);
+      buffer[2 * idx] += left * (voice.gainLeft + deltaLeft * j);
+      buffer[2 * idx + 1] += right * (voice.gainRight + deltaRight * j);
+      voice.position += voice.step;
+    }
+
+    if (underrun) stream.countUnderrun();
+    stream.endRead(voice.hasNext);
+    voice.gainLeft = targetLeft;
+    voice.gainRight = targetRight;
+  }
+
+  void SoundMixer::mix(short *output, const unsigned long numFrames) {
+    processCommands();
+
+    unsigned long done = 0;
+    while (done < numFrames) {
+      unsigned long blockFrames = std::min(numFrames - done,
+					   static_cast<unsigned long>
+					   (MIXER_BLOCK_FRAMES));
+      float *buffer = mixBuffer.data();
+      std::fill(buffer, buffer + blockFrames * MIXER_CHANNELS, 0.0f);
+      for (int idx = 0; idx < MIXER_MAX_VOICES; ++idx) {
+        Voice &voice = voices[idx];
+        if (voice.handle == 0) continue;
+
+        // Voices that start within the block start at their exact frame.
+        unsigned long offset = 0;
+        if (voice.startFrame > frameCount) {
+          if (voice.startFrame >= frameCount + blockFrames) continue;
+          offset = static_cast<unsigned long>(voice.startFrame - frameCount);
+        }
+        updateGains(voice);
+        mixVoice(voice, buffer + offset * MIXER_CHANNELS,
+		 blockFrames - offset);
+      }
+      saturate(buffer, output + done * MIXER_CHANNELS,
+	       blockFrames * MIXER_CHANNELS);
+      done += blockFrames;
+      frameCount += blockFrames;
+    }
+    numFramesMixed.store(frameCount, std::memory_order_release);
+  }
+
+  unsigned int SoundMixer::start(Command &command,
+				 const std::shared_ptr<const void> source) {
+    // Without a stream, nothing would ever pick up the voice.
+    if (output == mixerdevice && stream == nullptr) return 0;
+
+    std::lock_guard<std::mutex> lock(sourcesMutex);
+    collectFinished();
+    if (voiceSources.size() >= finishedSize) {
+      LOGERROR("Too many sound mixer voices requested.");
+      return 0;
+    }
+
+    ++lastHandle;
+    if (lastHandle == 0) ++lastHandle;
+    command.type = commandplay;
+    command.handle = lastHandle;
+    if (!push(command)) return 0;
+
+    // The voice cannot be reported as finished before this, since finished
+    // voices are only collected while holding the lock.
+    voiceSources[lastHandle] = source;
+    return lastHandle;
+  }
+
+  unsigned int SoundMixer::play(const std::shared_ptr<const SoundClip> clip,
+				const bool repeat, const float volume,
+				const float pan, const float pitch,
+				const uint64_t startFrame) {
+    if (!clip || clip->channels < 1 || clip->rate <= 0 ||
+	clip->samples.size() < clip->numFrames *
+	static_cast<unsigned long>(clip->channels)) {
+      throw std::runtime_error("Invalid sound clip.");
+    }
+    Command command;
+    command.clip = clip.get();
+    command.stream = nullptr;
+    command.repeat = repeat;
+    command.volume = volume;
+    command.pan = pan;
+    command.pitch = pitch;
+    command.startFrame = startFrame;
+    command.positional = false;
+    return start(command, clip);
+  }
+
+  unsigned int SoundMixer::play(const std::shared_ptr<SoundStream> stream,
+				const float volume, const float pan,
+				const float pitch, const uint64_t startFrame) {
+    if (!stream) {
+      throw std::runtime_error("Invalid sound stream.");
+    }
+    Command command;
+    command.clip = nullptr;
+    command.stream = stream.get();
+    command.repeat = false;
+    command.volume = volume;
+    command.pan = pan;
+    command.pitch = pitch;
+    command.startFrame = startFrame;
+    command.positional = false;
+    return start(command, stream);
+  }
+
+  unsigned int SoundMixer::play(const std::shared_ptr<const SoundClip> clip,
+				const glm::vec3 position,
+				const glm::vec3 velocity, const bool repeat,
+				const float volume, const float pitch,
+				const uint64_t startFrame) {
+    if (!clip || clip->channels < 1 || clip->rate <= 0 ||
+	clip->samples.size() < clip->numFrames *
+	static_cast<unsigned long>(clip->channels)) {
+      throw std::runtime_error("Invalid sound clip.");
+    }
+    Command command;
+    command.clip = clip.get();
+    command.stream = nullptr;
+    command.repeat = repeat;
+    command.volume = volume;
+    command.pan = 0.0f;
+    command.pitch = pitch;
+    command.startFrame = startFrame;
+    command.positional = true;
+    command.position = position;
+    command.velocity = velocity;
+    return start(command, clip);
+  }
+
+  unsigned int SoundMixer::play(const std::shared_ptr<SoundStream> stream,
+				const glm::vec3 position,
+				const glm::vec3 velocity, const float volume,
+				const float pitch, const uint64_t startFrame) {
+    if (!stream) {
+      throw std::runtime_error("Invalid sound stream.");
+    }
+    Command command;
+    command.clip = nullptr;
+    command.stream = stream.get();
+    command.repeat = false;
+    command.volume = volume;
+    command.pan = 0.0f;
+    command.pitch = pitch;
+    command.startFrame = startFrame;
+    command.positional = true;
+    command.position = position;
+    command.velocity = velocity;
+    return start(command, stream);
+  }
+
+  void SoundMixer::stop(const unsigned int voice) {
+    if (voice == 0) return;
+    Command command;
+    command.type = commandstop;
+    command.handle = voice;
+    command.clip = nullptr;
+    command.stream = nullptr;
+    push(command);
+  }
+
+  void SoundMixer::setVolume(const unsigned int voice, const float volume) {
+    if (voice == 0) return;
+    Command command;
+    command.type = commandvolume;
+    command.handle = voice;
+    command.clip = nullptr;
+    command.stream = nullptr;
+    command.volume = volume;
+    push(command);
+  }
+
+  void SoundMixer::setPan(const unsigned int voice, const float pan) {
+    if (voice == 0) return;
+    Command command;
+    command.type = commandpan;
+    command.handle = voice;
+    command.clip = nullptr;
+    command.stream = nullptr;
+    command.pan = pan;
+    push(command);
+  }
+
+  void SoundMixer::setPitch(const unsigned int voice, const float pitch) {
+    if (voice == 0) return;
+    Command command;
+    command.type = commandpitch;
+    command.handle = voice;
+    command.clip = nullptr;
+    command.stream = nullptr;
+    command.pitch = pitch;
+    push(command);
+  }
+
+  void SoundMixer::setPosition(const unsigned int voice,
+				const glm::vec3 position,
+				const glm::vec3 velocity) {
+    if (voice == 0) return;
+    Command command;
+    command.type = commandposition;
+    command.handle = voice;
+    command.clip = nullptr;
+    command.stream = nullptr;
+    command.positional = true;
+    command.position = position;
+    command.velocity = velocity;
+    push(command);
+  }
+
+  void SoundMixer::clearPosition(const unsigned int voice) {
+    if (voice == 0) return;
+    Command command;
+    command.type = commandposition;
+    command.handle = voice;
+    command.clip = nullptr;
+    command.stream = nullptr;
+    command.positional = false;
+    push(command);
+  }
+
+  void SoundMixer::setListener(const glm::vec3 position,
+			       const glm::vec3 rotation,
+			       const glm::vec3 velocity) {
+    Command command;
+    command.type = commandlistener;
+    command.handle = 0;
+    command.clip = nullptr;
+    command.stream = nullptr;
+    command.position = position;
+    command.velocity = velocity;
+
+    // The same rotation as the one the Renderer applies to the scene for
+    // the camera, worked out here once rather than by the audio thread.
+    command.rotation =
+      glm::mat3(glm::rotate(glm::mat4x4(1.0f), rotation.z,
+			    glm::vec3(0.0f, 0.0f, 1.0f)) *
+		glm::rotate(glm::mat4x4(1.0f), rotation.x,
+			    glm::vec3(1.0f, 0.0f, 0.0f)) *
+		glm::rotate(glm::mat4x4(1.0f), rotation.y,
+			    glm::vec3(0.0f, 1.0f, 0.0f)));
+    push(command);
+  }
+
+  void SoundMixer::setDistanceModel(const float referenceDistance,
+				    const float maxDistance,
+				    const float rolloffFactor) {
+    if (referenceDistance <= 0.0f || maxDistance < referenceDistance ||
+	rolloffFactor < 0.0f) {
+      throw std::runtime_error("Invalid sound mixer distance model.");
+    }
+    this->referenceDistance = referenceDistance;
+    this->maxDistance = maxDistance;
+    this->rolloffFactor = rolloffFactor;
+  }
+
+  void SoundMixer::setSpeedOfSound(const float speedOfSound) {
+    this->speedOfSound = std::max(0.0f, speedOfSound);
+  }
+
+  bool SoundMixer::isPlaying(const unsigned int voice) {
+    std::lock_guard<std::mutex> lock(sourcesMutex);
+    collectFinished();
+    return voiceSources.find(voice) != voiceSources.end();
+  }
+
+  size_t SoundMixer::getNumVoices() {
+    std::lock_guard<std::mutex> lock(sourcesMutex);
+    collectFinished();
+    return voiceSources.size();
+  }
+
+  uint64_t SoundMixer::getNumFramesMixed() const {
+    return numFramesMixed.load(std::memory_order_acquire);
+  }
+
+  int SoundMixer::getRate() const {
+    return rate;
+  }
+
+  MixerOutput SoundMixer::getOutput() const {
+    return output;
+  }
+
+  bool SoundMixer::hasOutputDevice() const {
+    return stream != nullptr;
+  }
+
+  void SoundMixer::render(std::vector<short> &samples,
+			  const unsigned long numFrames) {
+    if (output != mixernull) {
+      throw std::runtime_error("Only mixers with the null output can be "
+			       "rendered offline.");
+    }
+    samples.resize(numFrames * MIXER_CHANNELS);
+    mix(samples.data(), numFrames);
+  }
+
+  static void writeLittleEndian(std::ofstream &file, const uint32_t value,
+				const int numBytes) {
+    for (int idx = 0; idx < numBytes; ++idx) {
+      file.put(static_cast<char>((value >> (8 * idx)) & 0xff));
+    }
+  }
+
+  void SoundMixer::renderToFile(const std::string filePath,
+				const unsigned long numFrames) {
+    if (output != mixernull) {
+      throw std::runtime_error("Only mixers with the null output can be "
+			       "rendered offline.");
+    }
+    std::ofstream file(filePath.c_str(), std::ios::binary);
+    if (!file.is_open()) {
+      throw std::runtime_error("Could not open " + filePath +
+			       " for writing.");
+    }
+
+    uint32_t dataSize = static_cast<uint32_t>(numFrames * MIXER_CHANNELS *
+					      sizeof(short));
+    file.write("RIFF", 4);
+    writeLittleEndian(file, 36 + dataSize, 4);
+    file.write("WAVEfmt ", 8);
+    writeLittleEndian(file, 16, 4);
+    writeLittleEndian(file, 1, 2);
+    writeLittleEndian(file, MIXER_CHANNELS, 2);
+    writeLittleEndian(file, static_cast<uint32_t>(rate), 4);
+    writeLittleEndian(file, static_cast<uint32_t>(rate) * MIXER_CHANNELS *
+		      sizeof(short), 4);
+    writeLittleEndian(file, MIXER_CHANNELS * sizeof(short), 2);
+    writeLittleEndian(file, 16, 2);
+    file.write("data", 4);
+    writeLittleEndian(file, dataSize, 4);
+
+    std::vector<short> samples;
+    unsigned long done = 0;
+    while (done < numFrames) {
+      unsigned long blockFrames = std::min(numFrames - done, 4096UL);
+      this->render(samples, blockFrames);
+      for (auto sample = samples.begin(); sample != samples.end(); ++sample) {
+        writeLittleEndian(file, static_cast<uint16_t>(*sample), 2);
+      }
+      done += blockFrames;
+    }
+
+    if (!file.good()) {
+      throw std::runtime_error("Could not write to " + filePath + ".");
+    }
+  }
+
+}
@@ -0,0 +1,286 @@
+/*
+ *  SoundStream.cpp
+ *
+ *  Created on: 2026/10/19
+ *      Author: Dimitri Kourkoulis
+ *     License: BSD 3-Clause License (see LICENSE file)
+ */
+
+#include "SoundStream.hpp"
+#include "Trace.hpp"
+#include "Logger.hpp"
+#include <stdexcept>
+#include <algorithm>
+#include <vector>
+#include <chrono>
+
+#define WORD_SIZE 2
+
+// Frames decoded at a time
+#define STREAM_DECODE_FRAMES 1024
+
+namespace small3d {
+
+  SoundStream::SoundStream(const std::string soundFilePath,
+			   const double bufferSeconds) {
+    filePath = soundFilePath;
+
+#if defined(_WIN32) && !defined(__MINGW32__)
+    fopen_s(&fp, (soundFilePath).c_str(), "rb");
+#else
+    fp = fopen((soundFilePath).c_str(), "rb");
+#endif
+
+    if (!fp) {
+      throw std::runtime_error("Could not open file " + soundFilePath);
+    }
+
+    if (ov_open_callbacks(fp, &vorbisFile, NULL, 0, OV_CALLBACKS_NOCLOSE) < 0) {
+      fclose(fp);
+      throw std::runtime_error("Could not load sound from file " + soundFilePath);
+    }
+
+    vorbis_info *vi = ov_info(&vorbisFile, -1);
+    channels = vi->channels;
+    rate = static_cast<int>(vi->rate);
+    numFrames = static_cast<unsigned long>(ov_pcm_total(&vorbisFile, -1));
+
+    size_t ringFrames = 2 * STREAM_DECODE_FRAMES;
+    while (ringFrames < bufferSeconds * rate) ringFrames *= 2;
+    ring.reset(new short[ringFrames * static_cast<size_t>(channels)]);
+    ringMask = ringFrames - 1;
+    writeIndex = 0;
+    readIndex = 0;
+
+    seekFrame = 0;
+    requestedGeneration = 0;
+    handledGeneration = 0;
+    flushIndex = 0;
+    flushFrame = 0;
+    acknowledgedGeneration = 0;
+    attached = false;
+
+    repeat = false;
+    ended = false;
+    position = 0;
+    numUnderruns = 0;
+
+    localReadIndex = 0;
+    cachedWriteIndex = 0;
+    localPosition = 0;
+    seenGeneration = 0;
+    seekPending = false;
+
+    stopping = false;
+    decoder = std::thread(&SoundStream::decoderLoop, this);
+
+    LOGDEBUGF("Streaming sound - channels {} - rate {} - frames {} - buffer "
+	      "size in bytes {}", channels, rate, numFrames, getBufferSize());
+  }
+
+  SoundStream::~SoundStream() {
+    {
+      std::lock_guard<std::mutex> lock(decoderMutex);
+      stopping = true;
+    }
+    decoderWakeUp.notify_one();
+    decoder.join();
+    ov_clear(&vorbisFile);
+    fclose(fp);
+  }
+
+  void SoundStream::decoderLoop() {
+    const size_t ringFrames = ringMask + 1;
+    const size_t frameSize = static_cast<size_t>(channels);
+    std::vector<short> decoded(STREAM_DECODE_FRAMES * frameSize);
+    unsigned int generation = 0;
+    int currentSection;
+
+    // When the ring is full, the decoder checks it again after a quarter of
+    // its length has (probably) been played, or sooner after seeking.
+    std::chrono::milliseconds interval(std::max(1L, static_cast<long>
+					       (250 * ringFrames / rate)));
+    std::chrono::milliseconds seekInterval(2);
+
+    std::unique_lock<std::mutex> lock(decoderMutex);
+    while (!stopping) {
+      lock.unlock();
+
+      unsigned int requested = requestedGeneration.load(std::memory_order_acquire);
+      if (requested != generation) {
+        TRACEZONE("SoundStream::seek");
+        unsigned long frame = seekFrame.load(std::memory_order_relaxed);
+        if (ov_pcm_seek(&vorbisFile, static_cast<ogg_int64_t>(frame)) != 0) {
+          LOGERRORF("Could not seek in {}.", filePath);
+        }
+        ended.store(false, std::memory_order_relaxed);
+        flushIndex.store(writeIndex.load(std::memory_order_relaxed),
+			 std::memory_order_relaxed);
+        flushFrame.store(frame, std::memory_order_relaxed);
+        handledGeneration.store(requested, std::memory_order_release);
+        generation = requested;
+        if (!attached.load()) position.store(frame, std::memory_order_relaxed);
+      }
+
+      // After seeking, the frames decoded before are skipped by the audio
+      // thread, once it has seen the seek. If the stream is not being played
+      // they can be overwritten right away, since the next voice to play it
+      // will see the seek before reading anything.
+      size_t write = writeIndex.load(std::memory_order_relaxed);
+      size_t read = readIndex.load(std::memory_order_acquire);
+      bool acknowledged = acknowledgedGeneration.load() == generation;
+      if (!acknowledged && !attached.load()) {
+        read = std::max(read, flushIndex.load(std::memory_order_relaxed));
+      }
+      size_t space = ringFrames - (write - read);
+      bool wait = ended.load(std::memory_order_relaxed) ||
+	space < STREAM_DECODE_FRAMES;
+
+      if (!wait) {
+        TRACEZONE("SoundStream::decode");
+        long ret = ov_read(&vorbisFile, reinterpret_cast<char *>
+			   (decoded.data()),
+			   static_cast<int>(decoded.size() * WORD_SIZE), 0,
+			   WORD_SIZE, 1, &currentSection);
+        if (ret > 0) {
+          size_t framesRead = static_cast<size_t>(ret) /
+	    (WORD_SIZE * frameSize);
+          for (size_t idx = 0; idx < framesRead; ++idx) {
+            std::copy(decoded.data() + idx * frameSize,
+		      decoded.data() + (idx + 1) * frameSize,
+		      ring.get() + ((write + idx) & ringMask) * frameSize);
+          }
+          writeIndex.store(write + framesRead, std::memory_order_release);
+        }
+        else if (ret == 0) {
+          // End of the file. When repeating, decoding continues from the
+          // start, right after the last frame.
+          if (repeat.load(std::memory_order_relaxed) && numFrames > 0) {
+            ov_pcm_seek(&vorbisFile, 0);
+          }
+          else {
+            ended.store(true, std::memory_order_release);
+          }
+        }
+        else {
+          LOGERRORF("Error in sound stream {}.", filePath);
+        }
+      }
+
+      lock.lock();
+      if (wait && !stopping &&
+	  requestedGeneration.load(std::memory_order_relaxed) == generation) {
+        decoderWakeUp.wait_for(lock, acknowledged ? interval : seekInterval);
+      }
+    }
+  }
+
+  void SoundStream::beginRead() {
+    unsigned int generation =
+      handledGeneration.load(std::memory_order_acquire);
+    if (generation != seenGeneration) {
+      // Everything before the flush index was decoded before seeking.
+      localReadIndex = std::max(localReadIndex,
+				flushIndex.load(std::memory_order_relaxed));
+      localPosition = flushFrame.load(std::memory_order_relaxed);
+      seenGeneration = generation;
+      acknowledgedGeneration.store(generation);
+    }
+    seekPending = requestedGeneration.load(std::memory_order_acquire) !=
+      seenGeneration;
+    cachedWriteIndex = writeIndex.load(std::memory_order_acquire);
+  }
+
+  bool SoundStream::readFrame(short &left, short &right) {
+    if (seekPending) return false;
+    if (localReadIndex == cachedWriteIndex) {
+      cachedWriteIndex = writeIndex.load(std::memory_order_acquire);
+      if (localReadIndex == cachedWriteIndex) return false;
+    }
+    const short *frame = ring.get() + (localReadIndex & ringMask) *
+      static_cast<size_t>(channels);
+    left = frame[0];
+    right = channels > 1 ? frame[1] : frame[0];
+    ++localReadIndex;
+    if (localPosition + 1 < numFrames) {
+      ++localPosition;
+    }
+    else {
+      localPosition = repeat.load(std::memory_order_relaxed) ? 0 : numFrames;
+    }
+    return true;
+  }
+
+  bool SoundStream::hasEnded() const {
+    return !seekPending && ended.load(std::memory_order_acquire) &&
+      localReadIndex == writeIndex.load(std::memory_order_acquire);
+  }
+
+  void SoundStream::countUnderrun() {
+    numUnderruns.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void SoundStream::endRead(const bool frameAhead) {
+    readIndex.store(localReadIndex, std::memory_order_release);
+    // The frame that has been read ahead has not been played yet.
+    unsigned long playedPosition = localPosition;
+    if (frameAhead) {
+      playedPosition = playedPosition > 0 ? playedPosition - 1 : numFrames - 1;
+    }
+    position.store(playedPosition, std::memory_order_relaxed);
+  }
+
+  const std::string& SoundStream::getFilePath() const {
+    return filePath;
+  }
+
+  int SoundStream::getChannels() const {
+    return channels;
+  }
+
+  int SoundStream::getRate() const {
+    return rate;
+  }
+
+  unsigned long SoundStream::getNumFrames() const {
+    return numFrames;
+  }
+
+  void SoundStream::setRepeat(const bool repeat) {
+    this->repeat.store(repeat);
+    decoderWakeUp.notify_one();
+  }
+
+  void SoundStream::seek(const double seconds) {
+    double frame = std::max(0.0, seconds * rate);
+    seekFrame.store(std::min(numFrames, static_cast<unsigned long>(frame)));
+    {
+      std::lock_guard<std::mutex> lock(decoderMutex);
+      requestedGeneration.fetch_add(1, std::memory_order_release);
+    }
+    decoderWakeUp.notify_one();
+  }
+
+  unsigned long SoundStream::getPosition() const {
+    return position.load(std::memory_order_relaxed);
+  }
+
+  size_t SoundStream::getNumBufferedFrames() const {
+    if (requestedGeneration.load(std::memory_order_acquire) !=
+	handledGeneration.load(std::memory_order_acquire)) {
+      return 0;
+    }
+    size_t read = std::max(readIndex.load(std::memory_order_acquire),
+			   flushIndex.load(std::memory_order_relaxed));
+    return writeIndex.load(std::memory_order_acquire) - read;
+  }
+
+  size_t SoundStream::getBufferSize() const {
+    return (ringMask + 1) * static_cast<size_t>(channels) * sizeof(short);
+  }
+
+  unsigned long SoundStream::getNumUnderruns() const {
+    return numUnderruns.load(std::memory_order_relaxed);
+  }
+
+}
@@ -0,0 +1,273 @@
+/*
+ *  Trace.cpp
+ *
+ *  Created on: 2026/10/19
+ *      Author: Dimitri Kourkoulis
+ *     License: BSD 3-Clause License (see LICENSE file)
+ */
+
+#include "Trace.hpp"
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+#include <algorithm>
+
+// Events kept per thread (a power of 2)
+#define TRACE_BUFFER_SIZE 16384
+
+// Events of threads that have exited, kept until they are written
+#define TRACE_RETIRED_EVENTS 16384
+
+namespace small3d {
+
+  struct TraceEvent {
+    const char *name;
+    int64_t startTime;
+    int64_t duration;
+  };
+
+  // Written by its own thread only. The head is the number of events ever
+  // recorded, so the event at head - 1 is the latest one. Events before the
+  // tail have been cleared.
+  struct TraceBuffer {
+    TraceEvent events[TRACE_BUFFER_SIZE];
+    std::atomic<uint64_t> head;
+    std::atomic<uint64_t> tail;
+    unsigned int threadId;
+  };
+
+  struct RetiredEvent {
+    TraceEvent event;
+    unsigned int threadId;
+  };
+
+  // The buffers of all threads that have recorded events. When a thread
+  // exits, its events are moved to the retired events and its buffer is
+  // reused by the next thread that records events.
+  static std::mutex& getBuffersMutex() {
+    static std::mutex buffersMutex;
+    return buffersMutex;
+  }
+
+  static std::vector<std::unique_ptr<TraceBuffer> >& getBuffers() {
+    static std::vector<std::unique_ptr<TraceBuffer> > buffers;
+    return buffers;
+  }
+
+  static std::vector<TraceBuffer*>& getFreeBuffers() {
+    static std::vector<TraceBuffer*> freeBuffers;
+    return freeBuffers;
+  }
+
+  static std::vector<RetiredEvent>& getRetiredEvents() {
+    static std::vector<RetiredEvent> retiredEvents;
+    return retiredEvents;
+  }
+
+  static unsigned int nextThreadId = 1;
+
+  static thread_local TraceBuffer *threadBuffer = nullptr;
+
+  // Copies the events of a buffer that have not been written out or
+  // cleared, while its thread may still be recording.
+  static void copyEvents(const TraceBuffer &buffer,
+			 std::vector<TraceEvent> &events) {
+    uint64_t head = buffer.head.load(std::memory_order_acquire);
+    uint64_t begin = buffer.tail.load(std::memory_order_relaxed);
+    if (head - begin > TRACE_BUFFER_SIZE) begin = head - TRACE_BUFFER_SIZE;
+    events.clear();
+    for (uint64_t pos = begin; pos < head; ++pos) {
+      events.push_back(buffer.events[pos & (TRACE_BUFFER_SIZE - 1)]);
+    }
+
+    // Events that have been overwritten while being copied (or may be
+    // getting overwritten by the event being recorded) are dropped.
+    uint64_t newHead = buffer.head.load(std::memory_order_acquire);
+    uint64_t firstValid = newHead + 1 > TRACE_BUFFER_SIZE ?
+      newHead + 1 - TRACE_BUFFER_SIZE : 0;
+    if (firstValid > begin) {
+      size_t numOverwritten = static_cast<size_t>
+	(std::min(firstValid - begin, head - begin));
+      events.erase(events.begin(), events.begin() +
+		   static_cast<std::ptrdiff_t>(numOverwritten));
+    }
+  }
+
+  // Retires the buffer of the thread when the thread exits
+  struct ThreadBufferRelease {
+    bool registered = false;
+
+    ~ThreadBufferRelease() {
+      if (!registered || threadBuffer == nullptr) return;
+      std::lock_guard<std::mutex> lock(getBuffersMutex());
+      std::vector<TraceEvent> events;
+      copyEvents(*threadBuffer, events);
+      std::vector<RetiredEvent> &retiredEvents = getRetiredEvents();
+      for (auto event = events.begin(); event != events.end(); ++event) {
+        RetiredEvent retiredEvent;
+        retiredEvent.event = *event;
+        retiredEvent.threadId = threadBuffer->threadId;
+        retiredEvents.push_back(retiredEvent);
+      }
+      // Only the most recent ones are kept.
+      if (retiredEvents.size() > TRACE_RETIRED_EVENTS) {
+        retiredEvents.erase(retiredEvents.begin(), retiredEvents.end() -
+			    TRACE_RETIRED_EVENTS);
+      }
+      threadBuffer->tail.store(threadBuffer->head.load(),
+			       std::memory_order_relaxed);
+      getFreeBuffers().push_back(threadBuffer);
+      threadBuffer = nullptr;
+    }
+  };
+
+  static thread_local ThreadBufferRelease threadBufferRelease;
+
+  static int64_t getTime() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>
+      (std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  static TraceBuffer* registerThread() {
+    threadBufferRelease.registered = true;
+    std::lock_guard<std::mutex> lock(getBuffersMutex());
+    TraceBuffer *buffer;
+    std::vector<TraceBuffer*> &freeBuffers = getFreeBuffers();
+    if (freeBuffers.empty()) {
+      getBuffers().push_back(std::unique_ptr<TraceBuffer>(new TraceBuffer()));
+      buffer = getBuffers().back().get();
+    }
+    else {
+      buffer = freeBuffers.back();
+      freeBuffers.pop_back();
+    }
+    buffer->head = 0;
+    buffer->tail = 0;
+    buffer->threadId = nextThreadId++;
+    return buffer;
+  }
+
+  TraceZone::TraceZone(const char *name) {
+    this->name = name;
+    startTime = getTime();
+  }
+
+  TraceZone::~TraceZone() {
+    int64_t endTime = getTime();
+    if (threadBuffer == nullptr) {
+      threadBuffer = registerThread();
+    }
+    uint64_t head = threadBuffer->head.load(std::memory_order_relaxed);
+    TraceEvent &event = threadBuffer->events[head & (TRACE_BUFFER_SIZE - 1)];
+    event.name = name;
+    event.startTime = startTime;
+    event.duration = endTime - startTime;
+    threadBuffer->head.store(head + 1, std::memory_order_release);
+  }
+
+  static void writeJsonString(std::ostream &stream, const char *text) {
+    stream << '"';
+    for (const char *c = text; *c != '\0'; ++c) {
+      if (*c == '"' || *c == '\\') {
+        stream << '\\' << *c;
+      }
+      else if (static_cast<unsigned char>(*c) < 0x20) {
+        stream << ' ';
+      }
+      else {
+        stream << *c;
+      }
+    }
+    stream << '"';
+  }
+
+  void writeTrace(std::ostream &stream) {
+    std::lock_guard<std::mutex> lock(getBuffersMutex());
+    std::vector<std::unique_ptr<TraceBuffer> > &buffers = getBuffers();
+
+    const std::vector<RetiredEvent> &retiredEvents = getRetiredEvents();
+
+    // Events are copied out first, since their threads may keep recording
+    // while they are being written. Free buffers have no events left.
+    std::vector<std::vector<TraceEvent> > threadEvents(buffers.size());
+    int64_t firstTime = INT64_MAX;
+    for (size_t idx = 0; idx < buffers.size(); ++idx) {
+      copyEvents(*buffers[idx], threadEvents[idx]);
+      for (auto event = threadEvents[idx].begin();
+	   event != threadEvents[idx].end(); ++event) {
+        if (event->startTime < firstTime) firstTime = event->startTime;
+      }
+    }
+    for (auto retired = retiredEvents.begin(); retired != retiredEvents.end();
+	 ++retired) {
+      if (retired->event.startTime < firstTime) {
+        firstTime = retired->event.startTime;
+      }
+    }
+
+    // Times are in microseconds, from the first event.
+    stream << "{\"traceEvents\":[";
+    bool first = true;
+    std::ios::fmtflags flags = stream.flags();
+    std::streamsize precision = stream.precision();
+    stream << std::fixed << std::setprecision(3);
+    auto writeEvent = [&](const TraceEvent &event,
+			  const unsigned int threadId) {
+      stream << (first ? "\n" : ",\n") << "{\"name\":";
+      writeJsonString(stream, event.name);
+      stream << ",\"cat\":\"small3d\",\"ph\":\"X\",\"ts\":"
+	     << static_cast<double>(event.startTime - firstTime) / 1000.0
+	     << ",\"dur\":"
+	     << static_cast<double>(event.duration) / 1000.0
+	     << ",\"pid\":1,\"tid\":" << threadId << "}";
+      first = false;
+    };
+    for (auto retired = retiredEvents.begin(); retired != retiredEvents.end();
+	 ++retired) {
+      writeEvent(retired->event, retired->threadId);
+    }
+    for (size_t idx = 0; idx < buffers.size(); ++idx) {
+      for (auto event = threadEvents[idx].begin();
+	   event != threadEvents[idx].end(); ++event) {
+        writeEvent(*event, buffers[idx]->threadId);
+      }
+    }
+    stream << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    stream.flags(flags);
+    stream.precision(precision);
+  }
+
+  void writeTrace(const std::string filePath) {
+    std::ofstream file(filePath.c_str());
+    if (!file.is_open()) {
+      throw std::runtime_error("Could not open " + filePath +
+			       " for writing.");
+    }
+    writeTrace(file);
+    if (!file.good()) {
+      throw std::runtime_error("Could not write to " + filePath + ".");
+    }
+  }
+
+  void clearTrace() {
+    std::lock_guard<std::mutex> lock(getBuffersMutex());
+    std::vector<std::unique_ptr<TraceBuffer> > &buffers = getBuffers();
+    for (auto buffer = buffers.begin(); buffer != buffers.end(); ++buffer) {
+      (*buffer)->tail.store((*buffer)->head.load(std::memory_order_acquire),
+			    std::memory_order_relaxed);
+    }
+    getRetiredEvents().clear();
+  }
+
+  size_t getTraceByteSize() {
+    std::lock_guard<std::mutex> lock(getBuffersMutex());
+    return getBuffers().size() * sizeof(TraceBuffer) +
+      getRetiredEvents().capacity() * sizeof(RetiredEvent);
+  }
+
+}
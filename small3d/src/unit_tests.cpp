@@ -13,9 +13,28 @@
 #include <small3d/Image.hpp>
 #include <small3d/Model.hpp>
 #include <small3d/SceneObject.hpp>
+#include <small3d/Skeleton.hpp>
 #include <small3d/GetTokens.hpp>
 #include <small3d/Sound.hpp>
+#include <small3d/SoundBank.hpp>
+#include <small3d/SoundStream.hpp>
 #include <small3d/BoundingBoxSet.hpp>
+#include <small3d/CollisionWorld.hpp>
+#include <small3d/JobSystem.hpp>
+#include <small3d/OcclusionBuffer.hpp>
+#include <small3d/Trace.hpp>
+#include <random>
+#include <chrono>
+#include <glm/gtc/matrix_transform.hpp>
+#include <atomic>
+#include <cstdlib>
+#include <cstdio>
+#include <new>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <climits>
+#include <cfloat>
 
 
 
@@ -23,6 +42,51 @@
 using namespace small3d;
 using namespace std;
 
+// Count heap allocations, so that tests can verify that some functions do
+// not allocate memory (or how much they allocate).
+static std::atomic<size_t> numAllocations(0);
+static std::atomic<size_t> numAllocatedBytes(0);
+
+// GCC pairs the malloc and free calls below with the new and delete
+// expressions they are inlined into and takes them for mismatched.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpragmas"
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(size_t size) {
+  ++numAllocations;
+  numAllocatedBytes += size;
+  void *memory = std::malloc(size == 0 ? 1 : size);
+  if (memory == nullptr) throw std::bad_alloc();
+  return memory;
+}
+
+void* operator new[](size_t size) {
+  return operator new(size);
+}
+
+void operator delete(void *memory) noexcept {
+  std::free(memory);
+}
+
+void operator delete[](void *memory) noexcept {
+  std::free(memory);
+}
+
+void operator delete(void *memory, size_t) noexcept {
+  std::free(memory);
+}
+
+void operator delete[](void *memory, size_t) noexcept {
+  std::free(memory);
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
 TEST(LoggerTest, LogSomething) {
   deleteLogger();
   ostringstream oss;
@@ -37,6 +101,174 @@ TEST(LoggerTest, LogSomething) {
   
 }
 
+TEST(LoggerTest, AsynchronousLogger) {
+  ostringstream oss;
+  {
+    Logger asyncLogger(oss, 64, logblock);
+    for (int idx = 0; idx < 1000; ++idx) {
+      asyncLogger.append(loggerinfo, "Message " + intToStr(idx));
+    }
+
+    // Errors are written before append returns, along with everything
+    // that was logged before them.
+    asyncLogger.append(loggererror, "Error test");
+    string written = oss.str();
+    EXPECT_NE(string::npos, written.find("Message 999\n"));
+    EXPECT_NE(string::npos, written.find("ERROR: Error test\n"));
+  }
+
+  // All messages are written, in order.
+  istringstream lines(oss.str());
+  string line;
+  int expected = 0;
+  while (getline(lines, line) && expected < 1000) {
+    EXPECT_NE(string::npos, line.find("INFO: Message " +
+				      intToStr(expected)));
+    ++expected;
+  }
+  EXPECT_EQ(1000, expected);
+}
+
+TEST(LoggerTest, AsynchronousLoggerDrop) {
+  ostringstream oss;
+  const int numMessages = 10000;
+  {
+    Logger asyncLogger(oss, 16, logdrop);
+    for (int idx = 0; idx < numMessages; ++idx) {
+      asyncLogger.append(loggerdebug, "Message");
+    }
+  }
+
+  // Every message (including the one logged by the destructor) is either
+  // written or counted as dropped.
+  istringstream lines(oss.str());
+  string line;
+  int numWritten = 0, numDropped = 0;
+  while (getline(lines, line)) {
+    if (line.find("DEBUG: Message") != string::npos ||
+	line.find("INFO: Logger getting destroyed") != string::npos) {
+      ++numWritten;
+    }
+    size_t droppedPos = line.find(" log messages dropped");
+    if (droppedPos != string::npos) {
+      size_t numberPos = line.rfind(' ', droppedPos - 1) + 1;
+      numDropped += atoi(line.substr(numberPos, droppedPos - numberPos).
+			 c_str());
+    }
+  }
+  EXPECT_EQ(numMessages + 1, numWritten + numDropped);
+}
+
+TEST(LoggerTest, Benchmark) {
+  const int numMessages = 20000;
+  vector<double> latencies(numMessages);
+
+  for (int asynchronous = 0; asynchronous < 2; ++asynchronous) {
+    // The synchronous logger only writes while the global one exists.
+    initLogger();
+    {
+      ofstream file("loggerbenchmark.log");
+      std::unique_ptr<Logger> benchmarkLogger(asynchronous ?
+					      new Logger(file, 1024, logblock) :
+					      new Logger(file));
+      for (int idx = 0; idx < numMessages; ++idx) {
+        auto start = chrono::high_resolution_clock::now();
+        benchmarkLogger->append(loggerinfo, "Benchmark message");
+        latencies[idx] = chrono::duration<double, std::micro>
+          (chrono::high_resolution_clock::now() - start).count();
+      }
+    }
+    remove("loggerbenchmark.log");
+
+    sort(latencies.begin(), latencies.end());
+    cout << (asynchronous ? "Asynchronous" : "Synchronous")
+	 << " logger latency: median " << latencies[numMessages / 2]
+	 << " us, p99 " << latencies[numMessages * 99 / 100] << " us" << endl;
+  }
+}
+
+TEST(LoggerTest, Formatting) {
+  EXPECT_EQ("0", intToStr(0));
+  EXPECT_EQ("-2147483648", intToStr(INT_MIN));
+  EXPECT_EQ("2147483647", intToStr(INT_MAX));
+
+  EXPECT_EQ("Loaded 3 boxes, 2.5 m, -7 (true) x",
+	    formatLogMessage("Loaded {} boxes, {} m, {} ({}) {}", 3, 2.5f,
+			     -7L, true, string("x")));
+  EXPECT_EQ("18446744073709551615",
+	    formatLogMessage("{}", ULLONG_MAX));
+  EXPECT_EQ("No arguments {}", formatLogMessage("No arguments {}"));
+  EXPECT_EQ("Extra ", formatLogMessage("Extra {}", "", 1));
+
+  deleteLogger();
+  ostringstream oss;
+  initLogger(oss);
+  LOGINFOF("Loaded {} bounding boxes.", 12);
+  EXPECT_NE(string::npos, oss.str().find("INFO: Loaded 12 bounding boxes."));
+
+  // Filtered messages are not even built.
+  setMinLogLevel(loggererror);
+  int numEvaluations = 0;
+  LOGINFO("Filtered " + intToStr(++numEvaluations));
+  LOGINFOF("Filtered {}", ++numEvaluations);
+  LOGERRORF("Not filtered {}", ++numEvaluations);
+  EXPECT_EQ(1, numEvaluations);
+  EXPECT_EQ(string::npos, oss.str().find("Filtered"));
+  EXPECT_NE(string::npos, oss.str().find("ERROR: Not filtered 1"));
+
+  setMinLogLevel(loggerdebug);
+  deleteLogger();
+}
+
+TEST(LoggerTest, DisabledStatementsBenchmark) {
+  ostringstream oss;
+  initLogger(oss);
+  setMinLogLevel(loggerinfo);
+
+  const int numStatements = 10000000;
+  size_t allocationsBefore = numAllocations;
+  auto start = chrono::high_resolution_clock::now();
+  for (int idx = 0; idx < numStatements; ++idx) {
+    LOGDEBUGF("Frame {} took {} ms", idx, 16.7f);
+    // Keep the compiler from checking the level once for the whole loop
+    atomic_signal_fence(memory_order_seq_cst);
+  }
+  double disabledSeconds = chrono::duration<double>
+    (chrono::high_resolution_clock::now() - start).count();
+  EXPECT_EQ(0u, numAllocations - allocationsBefore);
+
+  start = chrono::high_resolution_clock::now();
+  for (int idx = 0; idx < numStatements; ++idx) {
+    LOGDEBUG("Frame " + intToStr(idx) + " took " + intToStr(16) + " ms");
+    // Keep the compiler from checking the level once for the whole loop
+    atomic_signal_fence(memory_order_seq_cst);
+  }
+  double disabledConcatenationSeconds = chrono::duration<double>
+    (chrono::high_resolution_clock::now() - start).count();
+  EXPECT_EQ(0u, numAllocations - allocationsBefore);
+
+  // For comparison, building the message without logging it
+  const int numBuilt = numStatements / 100;
+  start = chrono::high_resolution_clock::now();
+  size_t totalLength = 0;
+  for (int idx = 0; idx < numBuilt; ++idx) {
+    totalLength += ("Frame " + intToStr(idx) + " took " + intToStr(16) +
+		    " ms").size();
+  }
+  double builtSeconds = chrono::duration<double>
+    (chrono::high_resolution_clock::now() - start).count();
+  EXPECT_GT(totalLength, 0u);
+
+  setMinLogLevel(loggerdebug);
+  deleteLogger();
+
+  cout << "Disabled log statement: "
+       << 1.0e9 * disabledSeconds / numStatements << " ns (formatted), "
+       << 1.0e9 * disabledConcatenationSeconds / numStatements
+       << " ns (concatenated). Building the message: "
+       << 1.0e9 * builtSeconds / numBuilt << " ns" << endl;
+}
+
 TEST(ImageTest, LoadImage) {
   
   Image image("resources/images/testImage.png");
@@ -102,6 +334,212 @@ TEST(ModelTest, LoadModel) {
   
 }
 
+// Write a bumpy sphere with 2 * numRings * numSegments triangles to a
+// Wavefront file. The bumps reach bumpiness away from the sphere of radius 1.
+static void writeSphere(const string &fileLocation, const int numRings,
+			const int numSegments, const double bumpiness = 0.1) {
+  ofstream file(fileLocation.c_str());
+  for (int ring = 0; ring <= numRings; ++ring) {
+    double theta = 3.14159265 * ring / numRings;
+    for (int segment = 0; segment < numSegments; ++segment) {
+      double phi = 2.0 * 3.14159265 * segment / numSegments;
+      double radius = 1.0 + bumpiness * sin(5.0 * theta) * cos(7.0 * phi);
+      file << "v " << radius * sin(theta) * cos(phi) << " "
+	   << radius * cos(theta) << " " << radius * sin(theta) * sin(phi)
+	   << endl;
+      file << "vn " << sin(theta) * cos(phi) << " " << cos(theta) << " "
+	   << sin(theta) * sin(phi) << endl;
+    }
+  }
+  for (int ring = 0; ring < numRings; ++ring) {
+    for (int segment = 0; segment < numSegments; ++segment) {
+      int a = ring * numSegments + segment + 1;
+      int b = ring * numSegments + (segment + 1) % numSegments + 1;
+      int c = a + numSegments, d = b + numSegments;
+      file << "f " << a << "//" << a << " " << b << "//" << b << " " << d
+	   << "//" << d << endl;
+      file << "f " << a << "//" << a << " " << d << "//" << d << " " << c
+	   << "//" << c << endl;
+    }
+  }
+}
+
+// Ray casting against all the triangles of a model (placed at the origin,
+// without rotation), for comparison.
+static bool bruteForceIntersectsRay(const Model &model,
+				    const glm::vec3 origin,
+				    const glm::vec3 direction,
+				    float &distance) {
+  bool found = false;
+  double closest = 1e30;
+  for (size_t idx = 0; idx + 2 < model.indexData.size(); idx += 3) {
+    double v[3][3];
+    for (int vertex = 0; vertex < 3; ++vertex) {
+      for (int axis = 0; axis < 3; ++axis) {
+        v[vertex][axis] = model.vertexData[4 * model.indexData[idx + vertex] +
+					   axis];
+      }
+    }
+    double e1[3], e2[3], t[3], p[3], q[3];
+    for (int axis = 0; axis < 3; ++axis) {
+      e1[axis] = v[1][axis] - v[0][axis];
+      e2[axis] = v[2][axis] - v[0][axis];
+      t[axis] = origin[axis] - v[0][axis];
+    }
+    p[0] = direction.y * e2[2] - direction.z * e2[1];
+    p[1] = direction.z * e2[0] - direction.x * e2[2];
+    p[2] = direction.x * e2[1] - direction.y * e2[0];
+    double det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+    if (std::abs(det) < 1e-15) continue;
+    double u = (t[0] * p[0] + t[1] * p[1] + t[2] * p[2]) / det;
+    q[0] = t[1] * e1[2] - t[2] * e1[1];
+    q[1] = t[2] * e1[0] - t[0] * e1[2];
+    q[2] = t[0] * e1[1] - t[1] * e1[0];
+    double w = (direction.x * q[0] + direction.y * q[1] +
+		direction.z * q[2]) / det;
+    double hitDistance = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) / det;
+    if (u >= 0.0 && w >= 0.0 && u + w <= 1.0 && hitDistance >= 0.0 &&
+	hitDistance < closest) {
+      closest = hitDistance;
+      found = true;
+    }
+  }
+  if (found) distance = static_cast<float>(closest);
+  return found;
+}
+
+TEST(ModelTest, RayCasting) {
+  Model cube("resources/models/Cube/CubeNoTexture.obj");
+
+  float distance = 0.0f;
+  unsigned int triangle = 0;
+  glm::vec2 barycentric(0.0f, 0.0f);
+
+  glm::vec3 origin(0.3f, 0.2f, 5.0f), direction(0.0f, 0.0f, -1.0f);
+  glm::vec3 noRotation(0.0f, 0.0f, 0.0f);
+
+  EXPECT_TRUE(cube.intersectsRay(origin, direction,
+				 glm::vec3(0.0f, 0.0f, 0.0f), noRotation,
+				 distance, triangle, barycentric));
+  EXPECT_NEAR(4.0f, distance, 1e-5f);
+
+  // The barycentric coordinates must give back the point that was hit.
+  glm::vec3 v[3];
+  for (int vertex = 0; vertex < 3; ++vertex) {
+    const float *coords =
+      &cube.vertexData[4 * cube.indexData[3 * triangle + vertex]];
+    v[vertex] = glm::vec3(coords[0], coords[1], coords[2]);
+  }
+  glm::vec3 hitPoint = (1.0f - barycentric.x - barycentric.y) * v[0] +
+    barycentric.x * v[1] + barycentric.y * v[2];
+  EXPECT_NEAR(0.3f, hitPoint.x, 1e-5f);
+  EXPECT_NEAR(0.2f, hitPoint.y, 1e-5f);
+  EXPECT_NEAR(1.0f, hitPoint.z, 1e-5f);
+
+  EXPECT_TRUE(cube.intersectsRay(origin, direction,
+				 glm::vec3(0.0f, 0.0f, -2.0f), noRotation,
+				 distance, triangle, barycentric));
+  EXPECT_NEAR(6.0f, distance, 1e-5f);
+
+  // Rotated by 45 degrees around the y axis, the nearest edge of the cube is
+  // at a distance of sqrt(2) from its centre.
+  EXPECT_TRUE(cube.intersectsRay(glm::vec3(0.0f, 0.0f, 5.0f), direction,
+				 glm::vec3(0.0f, 0.0f, 0.0f),
+				 glm::vec3(0.0f, 0.78539816f, 0.0f),
+				 distance, triangle, barycentric));
+  EXPECT_NEAR(5.0f - sqrt(2.0f), distance, 1e-4f);
+
+  EXPECT_FALSE(cube.intersectsRay(origin, -direction,
+				  glm::vec3(0.0f, 0.0f, 0.0f), noRotation,
+				  distance, triangle, barycentric));
+  EXPECT_FALSE(cube.intersectsRay(glm::vec3(1.5f, 0.0f, 5.0f), direction,
+				  glm::vec3(0.0f, 0.0f, 0.0f), noRotation,
+				  distance, triangle, barycentric));
+
+  writeSphere("rayCastingSphere.obj", 40, 50);
+  Model sphere("rayCastingSphere.obj");
+  remove("rayCastingSphere.obj");
+
+  std::mt19937 generator(31);
+  std::uniform_real_distribution<float> coordinate(-1.2f, 1.2f);
+
+  int numHits = 0;
+  for (int idx = 0; idx < 500; ++idx) {
+    glm::vec3 rayOrigin(coordinate(generator), coordinate(generator),
+			coordinate(generator) + 3.0f);
+    glm::vec3 target(coordinate(generator), coordinate(generator),
+		     coordinate(generator));
+    glm::vec3 rayDirection = target - rayOrigin;
+
+    float expectedDistance = 0.0f;
+    bool expectedHit = bruteForceIntersectsRay(sphere, rayOrigin,
+					       rayDirection,
+					       expectedDistance);
+    bool hit = sphere.intersectsRay(rayOrigin, rayDirection,
+				    glm::vec3(0.0f, 0.0f, 0.0f), noRotation,
+				    distance, triangle, barycentric);
+    EXPECT_EQ(expectedHit, hit);
+    if (hit && expectedHit) {
+      ++numHits;
+      EXPECT_NEAR(expectedDistance, distance, 1e-4f);
+    }
+  }
+  EXPECT_GT(numHits, 0);
+}
+
+TEST(ModelTest, RayCastingBenchmark) {
+  writeSphere("rayCastingSphere.obj", 200, 250);
+  Model sphere("rayCastingSphere.obj");
+  remove("rayCastingSphere.obj");
+  ASSERT_EQ(300000u, sphere.indexData.size());
+
+  std::mt19937 generator(31);
+  std::uniform_real_distribution<float> coordinate(-1.2f, 1.2f);
+
+  const int numRays = 100000;
+  vector<glm::vec3> origins, directions;
+  for (int idx = 0; idx < numRays; ++idx) {
+    glm::vec3 origin(coordinate(generator), coordinate(generator),
+		     coordinate(generator) + 3.0f);
+    glm::vec3 target(coordinate(generator), coordinate(generator),
+		     coordinate(generator));
+    origins.push_back(origin);
+    directions.push_back(target - origin);
+  }
+
+  float distance;
+  unsigned int triangle;
+  glm::vec2 barycentric;
+
+  // The first call builds the bounding volume hierarchy.
+  auto start = std::chrono::high_resolution_clock::now();
+  sphere.intersectsRay(origins[0], directions[0], glm::vec3(0.0f, 0.0f, 0.0f),
+		       glm::vec3(0.0f, 0.0f, 0.0f), distance, triangle,
+		       barycentric);
+  double buildSeconds = std::chrono::duration<double>
+    (std::chrono::high_resolution_clock::now() - start).count();
+
+  int numHits = 0;
+  start = std::chrono::high_resolution_clock::now();
+  for (int idx = 0; idx < numRays; ++idx) {
+    if (sphere.intersectsRay(origins[idx], directions[idx],
+			     glm::vec3(0.0f, 0.0f, 0.0f),
+			     glm::vec3(0.0f, 0.0f, 0.0f), distance, triangle,
+			     barycentric)) {
+      ++numHits;
+    }
+  }
+  double seconds = std::chrono::duration<double>
+    (std::chrono::high_resolution_clock::now() - start).count();
+
+  EXPECT_GT(numHits, 0);
+
+  cout << "Ray casting against " << sphere.indexData.size() / 3
+       << " triangles - build: " << 1000.0 * buildSeconds << " ms, "
+       << numRays / seconds << " rays per second (" << numHits << " hits)."
+       << endl;
+}
+
 TEST(BoundingBoxesTest, LoadBoundingBoxes) {
   
   BoundingBoxSet bboxes("resources/models/GoatBB/GoatBB.obj");
@@ -131,72 +569,3403 @@ TEST(BoundingBoxesTest, LoadBoundingBoxes) {
   
 }
 
+// The point collision check, as it was before box extents were
+// precalculated, for comparison.
+static bool referenceCollidesWith(const BoundingBoxSet &boxSet,
+				  const glm::vec3 point,
+				  const glm::vec3 thisOffset,
+				  const glm::vec3 thisRotation) {
+  glm::mat4 rotationMatrix =
+    glm::rotate(glm::rotate(glm::rotate(glm::mat4x4(1.0f), -thisRotation.y,
+					glm::vec3(0.0f, -1.0f, 0.0f)),
+			    -thisRotation.x, glm::vec3(-1.0f, 0.0f, 0.0f)),
+		-thisRotation.z, glm::vec3(0.0f, 0.0f, -1.0f));
+  glm::vec4 pointInBoxSpace = rotationMatrix *
+    (glm::vec4(point, 1.0f) - glm::vec4(thisOffset, 0.0f));
 
-TEST(RendererTest, StartAndUse) {
+  for (int idx = 0; idx < boxSet.getNumBoxes(); ++idx) {
+    glm::vec3 minCoords(boxSet.vertices[idx * 8][0],
+			boxSet.vertices[idx * 8][1],
+			boxSet.vertices[idx * 8][2]);
+    glm::vec3 maxCoords = minCoords;
+    for (int checkIdx = idx * 8; checkIdx < (idx + 1) * 8; ++checkIdx) {
+      glm::vec3 coords(boxSet.vertices[checkIdx][0],
+		       boxSet.vertices[checkIdx][1],
+		       boxSet.vertices[checkIdx][2]);
+      minCoords = glm::min(minCoords, coords);
+      maxCoords = glm::max(maxCoords, coords);
+    }
+    if (pointInBoxSpace.x > minCoords.x && pointInBoxSpace.x < maxCoords.x &&
+	pointInBoxSpace.y > minCoords.y && pointInBoxSpace.y < maxCoords.y &&
+	pointInBoxSpace.z > minCoords.z && pointInBoxSpace.z < maxCoords.z) {
+      return true;
+    }
+  }
+  return false;
+}
 
-  Renderer *renderer = &Renderer::getInstance("test", 640, 480);
-  renderer->clearScreen();
-  
-  SceneObject object("cube", "resources/models/Cube/CubeNoTexture.obj");
-  object.offset = glm::vec3(0.0f, -1.0f, -8.0f);
-  renderer->render(object, glm::vec4(1.0f, 1.0f, 1.0f, 1.0f));
-  renderer->renderRectangle(glm::vec4(0.0f, 0.0f, 1.0f, 1.0f),
-			    glm::vec3(-1.0f, 0.0f, 1.0f),
-			    glm::vec3(-0.5f, -0.5f, 1.0f), false);
+static bool referenceCollidesWith(const BoundingBoxSet &boxSet,
+				  const BoundingBoxSet &otherBoxSet,
+				  const glm::vec3 thisOffset,
+				  const glm::vec3 thisRotation,
+				  const glm::vec3 otherOffset,
+				  const glm::vec3 otherRotation) {
+  glm::mat4 rotationMatrix =
+    glm::rotate(glm::rotate(glm::rotate(glm::mat4x4(1.0f), otherRotation.z,
+					glm::vec3(0.0f, 0.0f, -1.0f)),
+			    otherRotation.x, glm::vec3(-1.0f, 0.0f, 0.0f)),
+		otherRotation.y, glm::vec3(0.0f, -1.0f, 0.0f));
+  for (auto &vertex : otherBoxSet.vertices) {
+    glm::vec4 rotatedOtherCoords = rotationMatrix *
+      glm::vec4(vertex[0], vertex[1], vertex[2], 1.0f);
+    rotatedOtherCoords.x += otherOffset.x;
+    rotatedOtherCoords.y += otherOffset.y;
+    rotatedOtherCoords.z += otherOffset.z;
+    if (referenceCollidesWith(boxSet, glm::vec3(rotatedOtherCoords.x,
+						rotatedOtherCoords.y,
+						rotatedOtherCoords.z),
+			      thisOffset, thisRotation)) {
+      return true;
+    }
+  }
+  return false;
+}
 
-  SceneObject object2("texutredCube", "resources/models/Cube/Cube.obj");
-  object2.offset = glm::vec3(-2.0f, -1.0f, -7.0f);
-  object2.rotation = glm::vec3(0.3f, 1.3f, 0.0f);
-  
-  Image cubeTexture("resources/models/Cube/cubeTexture.png");
-  renderer->generateTexture("cubeTexture", cubeTexture);
+TEST(BoundingBoxesTest, SameResultsAsReference) {
 
-  renderer->render(object2, "cubeTexture");
+  BoundingBoxSet bboxes("resources/models/GoatBB/GoatBB.obj");
 
-  renderer->write("small3d :)", glm::vec3(0.0f, 1.0f, 0.0f),
-		  glm::vec2(-1.0f, 0.0f), glm::vec2(0.5f, -0.5f));
-  
-  renderer->swapBuffers();
-  
-  renderer->deleteTexture("cubeTexture");
-  
+  std::mt19937 generator(27);
+  std::uniform_real_distribution<float> position(-1.2f, 1.2f);
+  std::uniform_real_distribution<float> angle(-3.14f, 3.14f);
+
+  int numPointCollisions = 0;
+  for (int idx = 0; idx < 20000; ++idx) {
+    glm::vec3 point(position(generator), position(generator),
+		    position(generator));
+    glm::vec3 offset(0.2f * position(generator), 0.2f * position(generator),
+		     0.2f * position(generator));
+    glm::vec3 rotation(angle(generator), angle(generator), angle(generator));
+    bool collides = bboxes.collidesWith(point, offset, rotation);
+    EXPECT_EQ(referenceCollidesWith(bboxes, point, offset, rotation),
+	      collides);
+    if (collides) ++numPointCollisions;
+  }
+  EXPECT_GT(numPointCollisions, 0);
+
+  int numSetCollisions = 0;
+  for (int idx = 0; idx < 5000; ++idx) {
+    glm::vec3 offset(position(generator), position(generator),
+		     position(generator));
+    glm::vec3 rotation(angle(generator), angle(generator), angle(generator));
+    glm::vec3 otherOffset(position(generator), position(generator),
+			  position(generator));
+    glm::vec3 otherRotation(angle(generator), angle(generator),
+			    angle(generator));
+    bool collides = bboxes.collidesWith(bboxes, offset, rotation, otherOffset,
+					otherRotation);
+    EXPECT_EQ(referenceCollidesWith(bboxes, bboxes, offset, rotation,
+				    otherOffset, otherRotation), collides);
+    if (collides) ++numSetCollisions;
+  }
+  EXPECT_GT(numSetCollisions, 0);
 }
 
-TEST(SoundTest, LoadAndPlay) {
-  Sound snd("resources/sounds/bah.ogg");
-  snd.play();
-  double startSeconds = glfwGetTime();
-  while(glfwGetTime() - startSeconds < 0.5);
-  snd.stop();
-  startSeconds = glfwGetTime();
-  while(glfwGetTime() - startSeconds < 0.5);
-  snd.play();
-  // Make sure the sound is stopped by the stop function and not the destructor.
-  startSeconds = glfwGetTime();
-  while(glfwGetTime() - startSeconds < 2.0);
+TEST(BoundingBoxesTest, Benchmark) {
+
+  BoundingBoxSet bboxes("resources/models/GoatBB/GoatBB.obj");
+
+  std::mt19937 generator(27);
+  std::uniform_real_distribution<float> position(-1.2f, 1.2f);
+  std::uniform_real_distribution<float> angle(-3.14f, 3.14f);
+
+  const int numChecks = 20000;
+  vector<glm::vec3> offsets, rotations;
+  for (int idx = 0; idx < numChecks; ++idx) {
+    offsets.push_back(glm::vec3(position(generator), position(generator),
+				position(generator)));
+    rotations.push_back(glm::vec3(angle(generator), angle(generator),
+				  angle(generator)));
+  }
+
+  int referenceCollisions = 0;
+  auto start = std::chrono::high_resolution_clock::now();
+  for (int idx = 0; idx + 1 < numChecks; ++idx) {
+    if (referenceCollidesWith(bboxes, bboxes, offsets[idx], rotations[idx],
+			      offsets[idx + 1], rotations[idx + 1])) {
+      ++referenceCollisions;
+    }
+  }
+  double referenceSeconds = std::chrono::duration<double>
+    (std::chrono::high_resolution_clock::now() - start).count();
+
+  int collisions = 0;
+  start = std::chrono::high_resolution_clock::now();
+  for (int idx = 0; idx + 1 < numChecks; ++idx) {
+    if (bboxes.collidesWith(bboxes, offsets[idx], rotations[idx],
+			    offsets[idx + 1], rotations[idx + 1])) {
+      ++collisions;
+    }
+  }
+  double seconds = std::chrono::duration<double>
+    (std::chrono::high_resolution_clock::now() - start).count();
+
+  EXPECT_EQ(referenceCollisions, collisions);
+
+  cout << "Box set collision checks - before: "
+       << 1e9 * referenceSeconds / numChecks << " ns per check, now: "
+       << 1e9 * seconds / numChecks << " ns per check" << endl;
+
+  referenceCollisions = 0;
+  start = std::chrono::high_resolution_clock::now();
+  for (int idx = 0; idx + 1 < numChecks; ++idx) {
+    if (referenceCollidesWith(bboxes, offsets[idx], offsets[idx + 1],
+			      rotations[idx])) {
+      ++referenceCollisions;
+    }
+  }
+  referenceSeconds = std::chrono::duration<double>
+    (std::chrono::high_resolution_clock::now() - start).count();
+
+  collisions = 0;
+  start = std::chrono::high_resolution_clock::now();
+  for (int idx = 0; idx + 1 < numChecks; ++idx) {
+    if (bboxes.collidesWith(offsets[idx], offsets[idx + 1], rotations[idx])) {
+      ++collisions;
+    }
+  }
+  seconds = std::chrono::duration<double>
+    (std::chrono::high_resolution_clock::now() - start).count();
+
+  EXPECT_EQ(referenceCollisions, collisions);
+
+  cout << "Point collision checks - before: "
+       << 1e9 * referenceSeconds / numChecks << " ns per check, now: "
+       << 1e9 * seconds / numChecks << " ns per check" << endl;
 }
 
-TEST(SoundTest, ThreeAtTheSameTime) {
-  Sound snd1("resources/sounds/bah.ogg");
-  Sound snd2(snd1);
-  Sound snd3 = snd2;
-  snd1.play();
-  double startSeconds = glfwGetTime();
-  while(glfwGetTime() - startSeconds < 0.3);
-  snd2.play();
-  startSeconds = glfwGetTime();
-  while(glfwGetTime() - startSeconds < 0.3);
-  snd3.play();
-  startSeconds = glfwGetTime();
-  while(glfwGetTime() - startSeconds < 1.0);
+// Minimum and maximum coordinates of each box of a set, in box set space
+static void getBoxExtents(const BoundingBoxSet &boxSet,
+			  vector<pair<glm::vec3, glm::vec3> > &extents) {
+  extents.clear();
+  for (int idx = 0; idx < boxSet.getNumBoxes(); ++idx) {
+    glm::vec3 minCoords(boxSet.vertices[idx * 8][0],
+			boxSet.vertices[idx * 8][1],
+			boxSet.vertices[idx * 8][2]);
+    glm::vec3 maxCoords = minCoords;
+    for (int checkIdx = idx * 8; checkIdx < (idx + 1) * 8; ++checkIdx) {
+      glm::vec3 coords(boxSet.vertices[checkIdx][0],
+		       boxSet.vertices[checkIdx][1],
+		       boxSet.vertices[checkIdx][2]);
+      minCoords = glm::min(minCoords, coords);
+      maxCoords = glm::max(maxCoords, coords);
+    }
+    extents.push_back(make_pair(minCoords, maxCoords));
+  }
 }
 
+// Does the segment from start to end touch the box with the given extents?
+static bool segmentTouchesBox(const glm::vec3 start, const glm::vec3 end,
+			      const glm::vec3 minCoords,
+			      const glm::vec3 maxCoords) {
+  float tMin = 0.0f, tMax = 1.0f;
+  glm::vec3 direction = end - start;
+  for (int axis = 0; axis < 3; ++axis) {
+    if (std::abs(direction[axis]) < 1e-12f) {
+      if (start[axis] < minCoords[axis] || start[axis] > maxCoords[axis]) {
+        return false;
+      }
+    }
+    else {
+      float t1 = (minCoords[axis] - start[axis]) / direction[axis];
+      float t2 = (maxCoords[axis] - start[axis]) / direction[axis];
+      tMin = std::max(tMin, std::min(t1, t2));
+      tMax = std::min(tMax, std::max(t1, t2));
+      if (tMin > tMax) return false;
+    }
+  }
+  return true;
+}
 
-TEST(SoundTest, RepeatSound) {
-  Sound snd("resources/sounds/bah.ogg");
-  snd.play(true);
-  double startSeconds = glfwGetTime();
-  while(glfwGetTime() - startSeconds < 6.0);
+// Brute-force overlap check between two box sets: two convex boxes overlap
+// if and only if an edge of one of them touches the other (the case of a box
+// being completely inside the other one included).
+static bool bruteForceIntersects(const BoundingBoxSet &boxSet,
+				 const BoundingBoxSet &otherBoxSet,
+				 const glm::vec3 thisOffset,
+				 const glm::vec3 thisRotation,
+				 const glm::vec3 otherOffset,
+				 const glm::vec3 otherRotation) {
+  const BoundingBoxSet *sets[2] = {&boxSet, &otherBoxSet};
+  glm::vec3 offsets[2] = {thisOffset, otherOffset};
+  glm::vec3 rotations[2] = {thisRotation, otherRotation};
+
+  for (int from = 0; from < 2; ++from) {
+    int to = 1 - from;
+    glm::mat4 fromRotation =
+      glm::rotate(glm::rotate(glm::rotate(glm::mat4x4(1.0f), rotations[from].z,
+					  glm::vec3(0.0f, 0.0f, -1.0f)),
+			      rotations[from].x, glm::vec3(-1.0f, 0.0f, 0.0f)),
+		  rotations[from].y, glm::vec3(0.0f, -1.0f, 0.0f));
+    glm::mat4 toInverseRotation =
+      glm::rotate(glm::rotate(glm::rotate(glm::mat4x4(1.0f), -rotations[to].y,
+					  glm::vec3(0.0f, -1.0f, 0.0f)),
+			      -rotations[to].x, glm::vec3(-1.0f, 0.0f, 0.0f)),
+		  -rotations[to].z, glm::vec3(0.0f, 0.0f, -1.0f));
+
+    vector<pair<glm::vec3, glm::vec3> > fromExtents, toExtents;
+    getBoxExtents(*sets[from], fromExtents);
+    getBoxExtents(*sets[to], toExtents);
+
+    for (auto &fromBox : fromExtents) {
+      glm::vec3 corners[8];
+      for (int corner = 0; corner < 8; ++corner) {
+        glm::vec3 local((corner & 1) ? fromBox.second.x : fromBox.first.x,
+			(corner & 2) ? fromBox.second.y : fromBox.first.y,
+			(corner & 4) ? fromBox.second.z : fromBox.first.z);
+        glm::vec4 world = fromRotation * glm::vec4(local, 1.0f) +
+	  glm::vec4(offsets[from], 0.0f);
+        glm::vec4 inToSpace = toInverseRotation *
+	  (world - glm::vec4(offsets[to], 0.0f));
+        corners[corner] = glm::vec3(inToSpace.x, inToSpace.y, inToSpace.z);
+      }
+      for (auto &toBox : toExtents) {
+        for (int corner = 0; corner < 8; ++corner) {
+          for (int bit = 1; bit < 8; bit *= 2) {
+            if ((corner & bit) == 0 &&
+		segmentTouchesBox(corners[corner], corners[corner | bit],
+				  toBox.first, toBox.second)) {
+              return true;
+            }
+          }
+        }
+      }
+    }
+  }
+  return false;
+}
+
+TEST(BoundingBoxesTest, CrossingThinBoxes) {
+  BoundingBoxSet thinBox("resources/models/ThinBoxBB/ThinBoxBB.obj");
+
+  glm::vec3 noRotation(0.0f, 0.0f, 0.0f);
+  glm::vec3 quarterTurn(0.0f, 1.5707963f, 0.0f);
+
+  // The two boxes form a cross, so no corner of one is in the other.
+  EXPECT_FALSE(thinBox.collidesWith(thinBox, glm::vec3(0.0f, 0.0f, 0.0f),
+				    noRotation, glm::vec3(0.0f, 0.0f, 0.0f),
+				    quarterTurn));
+  EXPECT_TRUE(thinBox.intersects(thinBox, glm::vec3(0.0f, 0.0f, 0.0f),
+				 noRotation, glm::vec3(0.0f, 0.0f, 0.0f),
+				 quarterTurn));
+
+  EXPECT_FALSE(thinBox.intersects(thinBox, glm::vec3(0.0f, 0.0f, 0.0f),
+				  noRotation, glm::vec3(0.0f, 0.2f, 0.0f),
+				  quarterTurn));
+
+  SceneObject bar1("bar1", "resources/models/Cube/CubeNoTexture.obj", 1,
+		   "resources/models/ThinBoxBB/ThinBoxBB.obj");
+  SceneObject bar2 = bar1;
+  bar2.rotation = quarterTurn;
+  bar2.offset = glm::vec3(0.5f, 0.0f, 0.0f);
+  EXPECT_TRUE(bar1.collidesWith(bar2));
+  EXPECT_TRUE(bar2.collidesWith(bar1));
+}
+
+TEST(BoundingBoxesTest, IntersectsMatchesBruteForce) {
+  BoundingBoxSet goat("resources/models/GoatBB/GoatBB.obj");
+  BoundingBoxSet thinBox("resources/models/ThinBoxBB/ThinBoxBB.obj");
+
+  std::mt19937 generator(28);
+  std::uniform_real_distribution<float> position(-1.5f, 1.5f);
+  std::uniform_real_distribution<float> angle(-3.14f, 3.14f);
+
+  const BoundingBoxSet *sets[2] = {&goat, &thinBox};
+
+  int numIntersections = 0, numMissedByCorners = 0;
+
+  for (int idx = 0; idx < 20000; ++idx) {
+    const BoundingBoxSet &boxSet = *sets[idx % 2];
+    const BoundingBoxSet &otherBoxSet = *sets[(idx / 2) % 2];
+    glm::vec3 offset(position(generator), position(generator),
+		     position(generator));
+    glm::vec3 rotation(angle(generator), angle(generator), angle(generator));
+    glm::vec3 otherOffset(position(generator), position(generator),
+			  position(generator));
+    glm::vec3 otherRotation(angle(generator), angle(generator),
+			    angle(generator));
+
+    bool intersects = boxSet.intersects(otherBoxSet, offset, rotation,
+					otherOffset, otherRotation);
+    EXPECT_EQ(bruteForceIntersects(boxSet, otherBoxSet, offset, rotation,
+				   otherOffset, otherRotation), intersects);
+
+    // The check must be symmetric
+    EXPECT_EQ(intersects, otherBoxSet.intersects(boxSet, otherOffset,
+						 otherRotation, offset,
+						 rotation));
+
+    bool cornersInside =
+      boxSet.collidesWith(otherBoxSet, offset, rotation, otherOffset,
+			  otherRotation) ||
+      otherBoxSet.collidesWith(boxSet, otherOffset, otherRotation, offset,
+			       rotation);
+
+    // Anything detected by checking the corners must also be detected here.
+    if (cornersInside) {
+      EXPECT_TRUE(intersects);
+    }
+
+    if (intersects) {
+      ++numIntersections;
+      if (!cornersInside) ++numMissedByCorners;
+    }
+  }
+
+  EXPECT_GT(numIntersections, 0);
+  EXPECT_GT(numMissedByCorners, 0);
+  cout << "Intersections found: " << numIntersections << ", of which "
+       << numMissedByCorners << " had no corners inside a box." << endl;
+}
+
+TEST(BoundingBoxesTest, IntersectsBenchmark) {
+  BoundingBoxSet goat("resources/models/GoatBB/GoatBB.obj");
+
+  std::mt19937 generator(28);
+  std::uniform_real_distribution<float> position(-1.5f, 1.5f);
+  std::uniform_real_distribution<float> angle(-3.14f, 3.14f);
+
+  const int numChecks = 20000;
+  vector<glm::vec3> offsets, rotations;
+  for (int idx = 0; idx < numChecks; ++idx) {
+    offsets.push_back(glm::vec3(position(generator), position(generator),
+				position(generator)));
+    rotations.push_back(glm::vec3(angle(generator), angle(generator),
+				  angle(generator)));
+  }
+
+  int cornerCollisions = 0;
+  auto start = std::chrono::high_resolution_clock::now();
+  for (int idx = 0; idx + 1 < numChecks; ++idx) {
+    if (goat.collidesWith(goat, offsets[idx], rotations[idx],
+			  offsets[idx + 1], rotations[idx + 1]) ||
+	goat.collidesWith(goat, offsets[idx + 1], rotations[idx + 1],
+			  offsets[idx], rotations[idx])) {
+      ++cornerCollisions;
+    }
+  }
+  double cornerSeconds = std::chrono::duration<double>
+    (std::chrono::high_resolution_clock::now() - start).count();
+
+  int intersections = 0;
+  start = std::chrono::high_resolution_clock::now();
+  for (int idx = 0; idx + 1 < numChecks; ++idx) {
+    if (goat.intersects(goat, offsets[idx], rotations[idx],
+			offsets[idx + 1], rotations[idx + 1])) {
+      ++intersections;
+    }
+  }
+  double seconds = std::chrono::duration<double>
+    (std::chrono::high_resolution_clock::now() - start).count();
+
+  EXPECT_GE(intersections, cornerCollisions);
+
+  cout << "Corners inside boxes (both ways): "
+       << 1e9 * cornerSeconds / numChecks << " ns per check, "
+       << cornerCollisions << " collisions. Separating axis test: "
+       << 1e9 * seconds / numChecks << " ns per check, " << intersections
+       << " collisions." << endl;
+}
+
+TEST(BoundingBoxesTest, SweptThinBoxes) {
+  BoundingBoxSet thinBox("resources/models/ThinBoxBB/ThinBoxBB.obj");
+
+  glm::vec3 origin(0.0f, 0.0f, 0.0f);
+  glm::vec3 noRotation(0.0f, 0.0f, 0.0f);
+  glm::vec3 quarterTurn(0.0f, 1.5707963f, 0.0f);
+  glm::vec3 above(0.0f, 1.0f, 0.0f), below(0.0f, -1.0f, 0.0f);
+
+  float timeOfImpact = -1.0f;
+  glm::vec3 normal(0.0f, 0.0f, 0.0f);
+
+  // A projectile passing through the box between two frames
+  EXPECT_FALSE(thinBox.collidesWith(above, origin, noRotation));
+  EXPECT_FALSE(thinBox.collidesWith(below, origin, noRotation));
+  EXPECT_TRUE(thinBox.intersectsSegment(above, below, origin, noRotation,
+					timeOfImpact, normal));
+  EXPECT_NEAR(0.475f, timeOfImpact, 1e-5f);
+  EXPECT_NEAR(1.0f, normal.y, 1e-5f);
+
+  EXPECT_TRUE(thinBox.intersectsSegment(below, above, origin, quarterTurn,
+					timeOfImpact, normal));
+  EXPECT_NEAR(0.475f, timeOfImpact, 1e-5f);
+  EXPECT_NEAR(-1.0f, normal.y, 1e-5f);
+
+  EXPECT_FALSE(thinBox.intersectsSegment(above + glm::vec3(0.0f, 0.0f, 0.2f),
+					 below + glm::vec3(0.0f, 0.0f, 0.2f),
+					 origin, noRotation, timeOfImpact,
+					 normal));
+
+  // A box passing through another one between two frames
+  EXPECT_FALSE(thinBox.intersects(thinBox, origin, noRotation, above,
+				  quarterTurn));
+  EXPECT_FALSE(thinBox.intersects(thinBox, origin, noRotation, below,
+				  quarterTurn));
+  EXPECT_TRUE(thinBox.intersectsDuring(thinBox, origin, noRotation, origin,
+				       noRotation, above, quarterTurn, below,
+				       quarterTurn, timeOfImpact, normal));
+  EXPECT_NEAR(0.45f, timeOfImpact, 1e-5f);
+  EXPECT_NEAR(1.0f, normal.y, 1e-5f);
+
+  // The same, with this box moving instead
+  EXPECT_TRUE(thinBox.intersectsDuring(thinBox, below, noRotation, above,
+				       noRotation, origin, quarterTurn, origin,
+				       quarterTurn, timeOfImpact, normal));
+  EXPECT_NEAR(0.45f, timeOfImpact, 1e-5f);
+  EXPECT_NEAR(1.0f, normal.y, 1e-5f);
+
+  // Already touching at the start
+  EXPECT_TRUE(thinBox.intersectsDuring(thinBox, origin, noRotation, origin,
+				       noRotation, origin, quarterTurn, below,
+				       quarterTurn, timeOfImpact, normal));
+  EXPECT_EQ(0.0f, timeOfImpact);
+
+  // Passing by without touching
+  glm::vec3 aside(0.0f, 0.0f, 1.5f);
+  EXPECT_FALSE(thinBox.intersectsDuring(thinBox, origin, noRotation, origin,
+					noRotation, above + aside,
+					quarterTurn, below + aside,
+					quarterTurn, timeOfImpact, normal));
+
+  SceneObject bar1("bar1", "resources/models/Cube/CubeNoTexture.obj", 1,
+		   "resources/models/ThinBoxBB/ThinBoxBB.obj");
+  SceneObject bar2 = bar1;
+  bar2.offset = below;
+  EXPECT_FALSE(bar1.collidesWith(bar2));
+  EXPECT_TRUE(bar1.collidesWith(bar2, origin, noRotation, above, noRotation,
+				timeOfImpact, normal));
+  EXPECT_NEAR(0.45f, timeOfImpact, 1e-5f);
+  EXPECT_TRUE(bar1.collidesWith(above, below, timeOfImpact, normal));
+  EXPECT_NEAR(0.475f, timeOfImpact, 1e-5f);
+}
+
+TEST(BoundingBoxesTest, SweptMatchesSampling) {
+  BoundingBoxSet goat("resources/models/GoatBB/GoatBB.obj");
+
+  std::mt19937 generator(30);
+  std::uniform_real_distribution<float> position(-3.0f, 3.0f);
+  std::uniform_real_distribution<float> angle(-3.14f, 3.14f);
+
+  const int numSamples = 1000;
+  int numHits = 0, numUnsampledHits = 0;
+
+  // Segments
+  for (int idx = 0; idx < 1000; ++idx) {
+    glm::vec3 offset(0.2f * position(generator), 0.2f * position(generator),
+		     0.2f * position(generator));
+    glm::vec3 rotation(angle(generator), angle(generator), angle(generator));
+    glm::vec3 start(position(generator), position(generator),
+		    position(generator));
+    glm::vec3 end(position(generator), position(generator),
+		  position(generator));
+
+    int firstSample = -1;
+    for (int sample = 0; sample <= numSamples && firstSample == -1;
+	 ++sample) {
+      float time = static_cast<float>(sample) / numSamples;
+      if (goat.collidesWith(start + time * (end - start), offset, rotation)) {
+        firstSample = sample;
+      }
+    }
+
+    float timeOfImpact = -1.0f;
+    glm::vec3 normal(0.0f, 0.0f, 0.0f);
+    bool hit = goat.intersectsSegment(start, end, offset, rotation,
+				      timeOfImpact, normal);
+    if (firstSample != -1) {
+      EXPECT_TRUE(hit);
+      EXPECT_LE(timeOfImpact, static_cast<float>(firstSample) / numSamples +
+		1e-5f);
+      EXPECT_GE(timeOfImpact, static_cast<float>(firstSample - 1) /
+		numSamples - 1e-5f);
+    }
+    if (hit) {
+      ++numHits;
+      if (firstSample == -1) ++numUnsampledHits;
+      EXPECT_NEAR(1.0f, glm::length(normal), 1e-4f);
+    }
+  }
+
+  // Moving box sets
+  for (int idx = 0; idx < 1000; ++idx) {
+    glm::vec3 offset(0.2f * position(generator), 0.2f * position(generator),
+		     0.2f * position(generator));
+    glm::vec3 rotation(angle(generator), angle(generator), angle(generator));
+    glm::vec3 otherStart(position(generator), position(generator),
+			 position(generator));
+    glm::vec3 otherEnd(position(generator), position(generator),
+		       position(generator));
+    glm::vec3 otherRotation(angle(generator), angle(generator),
+			    angle(generator));
+
+    int firstSample = -1;
+    for (int sample = 0; sample <= numSamples && firstSample == -1;
+	 ++sample) {
+      float time = static_cast<float>(sample) / numSamples;
+      if (goat.intersects(goat, offset, rotation,
+			  otherStart + time * (otherEnd - otherStart),
+			  otherRotation)) {
+        firstSample = sample;
+      }
+    }
+
+    float timeOfImpact = -1.0f;
+    glm::vec3 normal(0.0f, 0.0f, 0.0f);
+    bool hit = goat.intersectsDuring(goat, offset, rotation, offset,
+				     rotation, otherStart, otherRotation,
+				     otherEnd, otherRotation, timeOfImpact,
+				     normal);
+    if (firstSample != -1) {
+      EXPECT_TRUE(hit);
+      EXPECT_LE(timeOfImpact, static_cast<float>(firstSample) / numSamples +
+		1e-4f);
+      EXPECT_GE(timeOfImpact, static_cast<float>(firstSample - 1) /
+		numSamples - 1e-4f);
+    }
+    if (hit) {
+      ++numHits;
+      if (firstSample == -1) ++numUnsampledHits;
+      EXPECT_NEAR(1.0f, glm::length(normal), 1e-4f);
+    }
+  }
+
+  // Sampling can only miss very brief contacts.
+  EXPECT_GT(numHits, 0);
+  EXPECT_LT(numUnsampledHits * 50, numHits);
+
+  // Rotating box sets (rotation is handled in steps, so the time of impact
+  // is approximate)
+  for (int idx = 0; idx < 200; ++idx) {
+    glm::vec3 otherStart(position(generator), position(generator),
+			 position(generator));
+    glm::vec3 otherEnd = -otherStart;
+    glm::vec3 otherStartRotation(angle(generator), angle(generator),
+				 angle(generator));
+    glm::vec3 otherEndRotation(angle(generator), angle(generator),
+			       angle(generator));
+
+    int firstSample = -1;
+    for (int sample = 0; sample <= numSamples && firstSample == -1;
+	 ++sample) {
+      float time = static_cast<float>(sample) / numSamples;
+      if (goat.intersects(goat, glm::vec3(0.0f, 0.0f, 0.0f),
+			  glm::vec3(0.0f, 0.0f, 0.0f),
+			  otherStart + time * (otherEnd - otherStart),
+			  otherStartRotation + time *
+			  (otherEndRotation - otherStartRotation))) {
+        firstSample = sample;
+      }
+    }
+
+    float timeOfImpact = -1.0f;
+    glm::vec3 normal(0.0f, 0.0f, 0.0f);
+    bool hit = goat.intersectsDuring(goat, glm::vec3(0.0f, 0.0f, 0.0f),
+				     glm::vec3(0.0f, 0.0f, 0.0f),
+				     glm::vec3(0.0f, 0.0f, 0.0f),
+				     glm::vec3(0.0f, 0.0f, 0.0f), otherStart,
+				     otherStartRotation, otherEnd,
+				     otherEndRotation, timeOfImpact, normal);
+    if (firstSample != -1) {
+      EXPECT_TRUE(hit);
+      EXPECT_NEAR(static_cast<float>(firstSample) / numSamples, timeOfImpact,
+		  0.02f);
+    }
+  }
+}
+
+TEST(BoundingBoxesTest, SweptBenchmark) {
+  BoundingBoxSet goat("resources/models/GoatBB/GoatBB.obj");
+
+  std::mt19937 generator(30);
+  std::uniform_real_distribution<float> position(-3.0f, 3.0f);
+  std::uniform_real_distribution<float> angle(-3.14f, 3.14f);
+
+  const int numChecks = 20000;
+  vector<glm::vec3> starts, ends, rotations;
+  for (int idx = 0; idx < numChecks; ++idx) {
+    starts.push_back(glm::vec3(position(generator), position(generator),
+			       position(generator)));
+    ends.push_back(glm::vec3(position(generator), position(generator),
+			     position(generator)));
+    rotations.push_back(glm::vec3(angle(generator), angle(generator),
+				  angle(generator)));
+  }
+
+  glm::vec3 origin(0.0f, 0.0f, 0.0f);
+  float timeOfImpact;
+  glm::vec3 normal;
+
+  int segmentHits = 0;
+  auto start = std::chrono::high_resolution_clock::now();
+  for (int idx = 0; idx < numChecks; ++idx) {
+    if (goat.intersectsSegment(starts[idx], ends[idx], origin, rotations[idx],
+			       timeOfImpact, normal)) {
+      ++segmentHits;
+    }
+  }
+  double segmentSeconds = std::chrono::duration<double>
+    (std::chrono::high_resolution_clock::now() - start).count();
+
+  int staticHits = 0;
+  start = std::chrono::high_resolution_clock::now();
+  for (int idx = 0; idx < numChecks; ++idx) {
+    if (goat.intersects(goat, origin, rotations[idx], ends[idx],
+			rotations[(idx + 1) % numChecks])) {
+      ++staticHits;
+    }
+  }
+  double staticSeconds = std::chrono::duration<double>
+    (std::chrono::high_resolution_clock::now() - start).count();
+
+  int sweptHits = 0;
+  start = std::chrono::high_resolution_clock::now();
+  for (int idx = 0; idx < numChecks; ++idx) {
+    if (goat.intersectsDuring(goat, origin, rotations[idx], origin,
+			      rotations[idx], starts[idx],
+			      rotations[(idx + 1) % numChecks], ends[idx],
+			      rotations[(idx + 1) % numChecks], timeOfImpact,
+			      normal)) {
+      ++sweptHits;
+    }
+  }
+  double sweptSeconds = std::chrono::duration<double>
+    (std::chrono::high_resolution_clock::now() - start).count();
+
+  EXPECT_GE(sweptHits, staticHits);
+
+  cout << "Segment checks: " << 1e9 * segmentSeconds / numChecks
+       << " ns per check, " << segmentHits << " hits. Static box set checks: "
+       << 1e9 * staticSeconds / numChecks << " ns per check, " << staticHits
+       << " hits. Swept box set checks: " << 1e9 * sweptSeconds / numChecks
+       << " ns per check, " << sweptHits << " hits." << endl;
+}
+
+TEST(BoundingBoxesTest, RayCasting) {
+  BoundingBoxSet thinBox("resources/models/ThinBoxBB/ThinBoxBB.obj");
+
+  glm::vec3 origin(0.0f, 0.0f, 0.0f);
+  glm::vec3 noRotation(0.0f, 0.0f, 0.0f);
+  glm::vec3 quarterTurn(0.0f, 1.5707963f, 0.0f);
+
+  float distance = 0.0f;
+  glm::vec3 normal(0.0f, 0.0f, 0.0f);
+
+  EXPECT_TRUE(thinBox.intersectsRay(glm::vec3(0.0f, 1.0f, 0.0f),
+				    glm::vec3(0.0f, -1.0f, 0.0f), origin,
+				    noRotation, distance, normal));
+  EXPECT_NEAR(0.95f, distance, 1e-5f);
+  EXPECT_NEAR(1.0f, normal.y, 1e-5f);
+
+  EXPECT_FALSE(thinBox.intersectsRay(glm::vec3(0.0f, 1.0f, 0.0f),
+				     glm::vec3(0.0f, 1.0f, 0.0f), origin,
+				     noRotation, distance, normal));
+
+  // Along the z axis, the box is only hit when rotated.
+  EXPECT_FALSE(thinBox.intersectsRay(glm::vec3(0.0f, 0.0f, 5.0f),
+				     glm::vec3(0.3f, 0.0f, -1.0f), origin,
+				     noRotation, distance, normal));
+  EXPECT_TRUE(thinBox.intersectsRay(glm::vec3(0.0f, 0.0f, 5.0f),
+				    glm::vec3(0.0f, 0.0f, -1.0f), origin,
+				    quarterTurn, distance, normal));
+  EXPECT_NEAR(4.0f, distance, 1e-5f);
+  EXPECT_NEAR(1.0f, normal.z, 1e-5f);
+
+  // Rays must give the same results as long segments.
+  BoundingBoxSet goat("resources/models/GoatBB/GoatBB.obj");
+  std::mt19937 generator(31);
+  std::uniform_real_distribution<float> position(-3.0f, 3.0f);
+  std::uniform_real_distribution<float> angle(-3.14f, 3.14f);
+  for (int idx = 0; idx < 1000; ++idx) {
+    glm::vec3 rotation(angle(generator), angle(generator), angle(generator));
+    glm::vec3 rayOrigin(position(generator), position(generator),
+			position(generator));
+    glm::vec3 direction(position(generator), position(generator),
+			position(generator));
+    float timeOfImpact = 0.0f;
+    glm::vec3 segmentNormal(0.0f, 0.0f, 0.0f);
+    bool segmentHit = goat.intersectsSegment(rayOrigin,
+					     rayOrigin + 100.0f * direction,
+					     origin, rotation, timeOfImpact,
+					     segmentNormal);
+    EXPECT_EQ(segmentHit, goat.intersectsRay(rayOrigin, direction, origin,
+					     rotation, distance, normal));
+    if (segmentHit) {
+      EXPECT_NEAR(100.0f * timeOfImpact, distance, 1e-3f);
+    }
+  }
+}
+
+TEST(BoundingBoxesTest, FindCollidingPoints) {
+  SceneObject goat("goat", "resources/models/Cube/CubeNoTexture.obj", 1,
+		   "resources/models/GoatBB/GoatBB.obj");
+  goat.offset = glm::vec3(0.1f, -0.2f, 0.3f);
+  goat.rotation = glm::vec3(0.4f, 1.1f, -0.6f);
+
+  std::mt19937 generator(32);
+  std::uniform_real_distribution<float> coordinate(-1.5f, 1.5f);
+
+  // Not a multiple of 64, so that the last chunk is partial
+  const size_t numPoints = 10007;
+  vector<glm::vec3> points;
+  vector<float> x, y, z;
+  for (size_t idx = 0; idx < numPoints; ++idx) {
+    glm::vec3 point(coordinate(generator), coordinate(generator),
+		    coordinate(generator));
+    points.push_back(point);
+    x.push_back(point.x);
+    y.push_back(point.y);
+    z.push_back(point.z);
+  }
+
+  vector<uint64_t> mask((numPoints + 63) / 64, ~0ULL);
+  vector<uint64_t> soaMask((numPoints + 63) / 64, 0);
+
+  size_t numColliding = goat.findCollidingPoints(points.data(), numPoints,
+						 mask.data());
+  EXPECT_EQ(numColliding, goat.findCollidingPoints(x.data(), y.data(),
+						   z.data(), numPoints,
+						   soaMask.data()));
+  EXPECT_EQ(mask, soaMask);
+
+  size_t expectedNumColliding = 0;
+  for (size_t idx = 0; idx < numPoints; ++idx) {
+    bool collides = goat.collidesWith(points[idx]);
+    if (collides) ++expectedNumColliding;
+    EXPECT_EQ(collides, ((mask[idx / 64] >> (idx % 64)) & 1) != 0);
+  }
+  EXPECT_EQ(expectedNumColliding, numColliding);
+  EXPECT_GT(numColliding, 0u);
+
+  // Bits after the last point are cleared.
+  EXPECT_EQ(0u, mask.back() >> (numPoints % 64));
+
+  EXPECT_EQ(0u, goat.findCollidingPoints(points.data(), 0, mask.data()));
+}
+
+TEST(BoundingBoxesTest, FindCollidingPointsBenchmark) {
+  SceneObject goat("goat", "resources/models/Cube/CubeNoTexture.obj", 1,
+		   "resources/models/GoatBB/GoatBB.obj");
+  goat.rotation = glm::vec3(0.4f, 1.1f, -0.6f);
+
+  std::mt19937 generator(32);
+  std::uniform_real_distribution<float> coordinate(-1.5f, 1.5f);
+
+  const size_t numPoints = 1000000;
+  vector<glm::vec3> points;
+  vector<float> x, y, z;
+  for (size_t idx = 0; idx < numPoints; ++idx) {
+    glm::vec3 point(coordinate(generator), coordinate(generator),
+		    coordinate(generator));
+    points.push_back(point);
+    x.push_back(point.x);
+    y.push_back(point.y);
+    z.push_back(point.z);
+  }
+  vector<uint64_t> mask((numPoints + 63) / 64);
+
+  size_t oneByOneColliding = 0;
+  auto start = std::chrono::high_resolution_clock::now();
+  for (size_t idx = 0; idx < numPoints; ++idx) {
+    if (goat.collidesWith(points[idx])) ++oneByOneColliding;
+  }
+  double oneByOneSeconds = std::chrono::duration<double>
+    (std::chrono::high_resolution_clock::now() - start).count();
+
+  start = std::chrono::high_resolution_clock::now();
+  size_t aosColliding = goat.findCollidingPoints(points.data(), numPoints,
+						 mask.data());
+  double aosSeconds = std::chrono::duration<double>
+    (std::chrono::high_resolution_clock::now() - start).count();
+
+  start = std::chrono::high_resolution_clock::now();
+  size_t soaColliding = goat.findCollidingPoints(x.data(), y.data(),
+						 z.data(), numPoints,
+						 mask.data());
+  double soaSeconds = std::chrono::duration<double>
+    (std::chrono::high_resolution_clock::now() - start).count();
+
+  EXPECT_EQ(oneByOneColliding, aosColliding);
+  EXPECT_EQ(oneByOneColliding, soaColliding);
+
+  cout << "Checking " << numPoints << " points against "
+       << goat.boundingBoxSet.getNumBoxes() << " boxes - one by one: "
+       << numPoints / oneByOneSeconds / 1e6 << "M points per second, batch: "
+       << numPoints / aosSeconds / 1e6 << "M points per second, "
+       << "batch with separate coordinate arrays: "
+       << numPoints / soaSeconds / 1e6 << "M points per second." << endl;
+}
+
+TEST(BoundingBoxesTest, NoAllocations) {
+  SceneObject goat("goat", "resources/models/Cube/CubeNoTexture.obj", 1,
+		   "resources/models/GoatBB/GoatBB.obj");
+  SceneObject otherGoat = goat;
+  otherGoat.offset = glm::vec3(0.3f, 0.1f, 0.0f);
+  otherGoat.rotation = glm::vec3(0.0f, 0.7f, 0.2f);
+
+  vector<glm::vec3> points;
+  for (int idx = 0; idx < 100; ++idx) {
+    points.push_back(glm::vec3(0.03f * idx - 1.5f, 0.1f, 0.0f));
+  }
+
+  CollisionWorld world;
+  world.add(goat);
+  world.add(otherGoat);
+  world.update();
+  vector<pair<SceneObject*, SceneObject*> > collisions;
+  collisions.reserve(1);
+
+  int numCollisions = 0;
+  size_t allocationsBefore = numAllocations;
+
+  for (int idx = 0; idx < 100; ++idx) {
+    if (goat.collidesWith(otherGoat)) ++numCollisions;
+    if (goat.collidesWith(points.data(), points.size())) ++numCollisions;
+    if (goat.collidesWith(points[idx])) ++numCollisions;
+    if (goat.boundingBoxSet.collidesWith(otherGoat.boundingBoxSet,
+					 goat.offset, goat.rotation,
+					 otherGoat.offset,
+					 otherGoat.rotation)) ++numCollisions;
+    world.getCollisions(collisions);
+  }
+
+  EXPECT_EQ(0u, numAllocations - allocationsBefore);
+  EXPECT_GT(numCollisions, 0);
+  EXPECT_EQ(1u, collisions.size());
+
+  // Make sure that allocations are being counted
+  allocationsBefore = numAllocations;
+  SceneObject goatCopy = goat;
+  EXPECT_GT(numAllocations - allocationsBefore, 0u);
+}
+
+TEST(CollisionWorldTest, CandidatePairs) {
+
+  SceneObject goat("goat", "resources/models/Cube/CubeNoTexture.obj", 1,
+		   "resources/models/GoatBB/GoatBB.obj");
+
+  std::mt19937 generator(26);
+  std::uniform_real_distribution<float> position(-4.0f, 4.0f);
+  std::uniform_real_distribution<float> angle(-3.14f, 3.14f);
+
+  vector<SceneObject> objects(200, goat);
+  CollisionWorld world;
+  for (auto &object : objects) {
+    object.offset = glm::vec3(position(generator), position(generator),
+			      position(generator));
+    object.rotation = glm::vec3(angle(generator), angle(generator),
+				angle(generator));
+    world.add(object);
+  }
+
+  EXPECT_EQ(200, world.getNumObjects());
+
+  // Move the objects a few times, so that the incremental sort is exercised.
+  for (int tick = 0; tick < 3; ++tick) {
+    for (auto &object : objects) {
+      object.offset.x += 0.5f * position(generator) / 4.0f;
+      object.rotation.y += 0.1f;
+    }
+    world.update();
+
+    auto &candidates = world.getCandidatePairs();
+
+    size_t expectedPairs = 0;
+    for (size_t idx = 0; idx < objects.size(); ++idx) {
+      glm::vec3 minCoords, maxCoords;
+      objects[idx].boundingBoxSet.getWorldExtents(objects[idx].offset,
+						  objects[idx].rotation,
+						  minCoords, maxCoords);
+      for (size_t otherIdx = idx + 1; otherIdx < objects.size(); ++otherIdx) {
+        glm::vec3 otherMinCoords, otherMaxCoords;
+        objects[otherIdx].boundingBoxSet.
+	  getWorldExtents(objects[otherIdx].offset, objects[otherIdx].rotation,
+			  otherMinCoords, otherMaxCoords);
+        bool overlap = minCoords.x <= otherMaxCoords.x &&
+	  otherMinCoords.x <= maxCoords.x &&
+	  minCoords.y <= otherMaxCoords.y && otherMinCoords.y <= maxCoords.y &&
+	  minCoords.z <= otherMaxCoords.z && otherMinCoords.z <= maxCoords.z;
+
+        bool found = false;
+        for (auto &pair : candidates) {
+          if ((pair.first == &objects[idx] &&
+	       pair.second == &objects[otherIdx]) ||
+	      (pair.first == &objects[otherIdx] &&
+	       pair.second == &objects[idx])) {
+            found = true;
+            break;
+          }
+        }
+        EXPECT_EQ(overlap, found);
+        if (overlap) ++expectedPairs;
+
+        // Every collision must be among the candidates
+        if (objects[idx].collidesWith(objects[otherIdx])) {
+          EXPECT_TRUE(found);
+        }
+      }
+    }
+    EXPECT_EQ(expectedPairs, candidates.size());
+  }
+
+  vector<pair<SceneObject*, SceneObject*> > collisions;
+  world.getCollisions(collisions);
+  EXPECT_LE(collisions.size(), world.getCandidatePairs().size());
+
+  world.remove(objects[0]);
+  EXPECT_EQ(199, world.getNumObjects());
+  for (auto &pair : world.getCandidatePairs()) {
+    EXPECT_NE(&objects[0], pair.first);
+    EXPECT_NE(&objects[0], pair.second);
+  }
+  world.update();
+  for (auto &pair : world.getCandidatePairs()) {
+    EXPECT_NE(&objects[0], pair.first);
+    EXPECT_NE(&objects[0], pair.second);
+  }
+}
+
+TEST(CollisionWorldTest, Benchmark) {
+
+  SceneObject goat("goat", "resources/models/Cube/CubeNoTexture.obj", 1,
+		   "resources/models/GoatBB/GoatBB.obj");
+
+  std::mt19937 generator(26);
+  std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+  for (int numObjects : {1000, 10000, 50000}) {
+    // Keep the density constant, so that the number of pairs grows linearly
+    float side = 2.0f * std::cbrt(static_cast<float>(numObjects));
+
+    vector<SceneObject> objects(static_cast<size_t>(numObjects), goat);
+    vector<glm::vec3> velocities;
+    CollisionWorld world;
+    for (auto &object : objects) {
+      object.offset = 0.5f * side * glm::vec3(unit(generator), unit(generator),
+					      unit(generator));
+      object.rotation = glm::vec3(0.0f, 3.14f * unit(generator), 0.0f);
+      velocities.push_back(0.05f * glm::vec3(unit(generator), unit(generator),
+					     unit(generator)));
+      world.add(object);
+    }
+    world.update();
+
+    const int numTicks = 10;
+    size_t numPairs = 0;
+    double seconds = 0.0;
+    for (int tick = 0; tick < numTicks; ++tick) {
+      for (size_t idx = 0; idx < objects.size(); ++idx) {
+        objects[idx].offset += velocities[idx];
+        objects[idx].rotation.y += 0.01f;
+      }
+      auto start = std::chrono::high_resolution_clock::now();
+      world.update();
+      seconds += std::chrono::duration<double>
+	(std::chrono::high_resolution_clock::now() - start).count();
+      numPairs += world.getCandidatePairs().size();
+    }
+
+    cout << "Broad phase - objects: " << numObjects << ", candidate pairs "
+	 << "per tick: " << numPairs / numTicks << ", time per tick: "
+	 << 1000.0 * seconds / numTicks << " ms" << endl;
+  }
+}
+
+TEST(CollisionWorldTest, ParallelCollisions) {
+
+  SceneObject goat("goat", "resources/models/Cube/CubeNoTexture.obj", 1,
+		   "resources/models/GoatBB/GoatBB.obj");
+
+  std::mt19937 generator(33);
+  std::uniform_real_distribution<float> position(-6.0f, 6.0f);
+  std::uniform_real_distribution<float> angle(-3.14f, 3.14f);
+
+  vector<SceneObject> objects(1000, goat);
+  CollisionWorld world;
+  for (auto &object : objects) {
+    object.offset = glm::vec3(position(generator), position(generator),
+			      position(generator));
+    object.rotation = glm::vec3(angle(generator), angle(generator),
+				angle(generator));
+    world.add(object);
+  }
+  world.update();
+
+  vector<pair<SceneObject*, SceneObject*> > expectedCollisions, collisions;
+  world.getCollisions(expectedCollisions);
+  EXPECT_GT(expectedCollisions.size(), 0u);
+
+  for (unsigned int numThreads : {1u, 2u, 4u, 8u}) {
+    JobSystem jobSystem(numThreads);
+    EXPECT_EQ(numThreads, jobSystem.getNumThreads());
+    world.getCollisions(collisions, jobSystem);
+    EXPECT_EQ(expectedCollisions, collisions);
+  }
+}
+
+TEST(CollisionWorldTest, ParallelBenchmark) {
+
+  SceneObject goat("goat", "resources/models/Cube/CubeNoTexture.obj", 1,
+		   "resources/models/GoatBB/GoatBB.obj");
+
+  std::mt19937 generator(33);
+  std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+  const int numObjects = 20000;
+  float side = 1.5f * std::cbrt(static_cast<float>(numObjects));
+  vector<SceneObject> objects(static_cast<size_t>(numObjects), goat);
+  CollisionWorld world;
+  for (auto &object : objects) {
+    object.offset = 0.5f * side * glm::vec3(unit(generator), unit(generator),
+					    unit(generator));
+    object.rotation = glm::vec3(0.0f, 3.14f * unit(generator), 0.0f);
+    world.add(object);
+  }
+  world.update();
+
+  vector<pair<SceneObject*, SceneObject*> > collisions;
+  const int numRepetitions = 5;
+
+  auto start = std::chrono::high_resolution_clock::now();
+  for (int repetition = 0; repetition < numRepetitions; ++repetition) {
+    world.getCollisions(collisions);
+  }
+  double serialSeconds = std::chrono::duration<double>
+    (std::chrono::high_resolution_clock::now() - start).count() /
+    numRepetitions;
+
+  cout << "Narrow phase - objects: " << numObjects << ", candidate pairs: "
+       << world.getCandidatePairs().size() << ", collisions: "
+       << collisions.size() << ", single thread: " << 1000.0 * serialSeconds
+       << " ms" << endl;
+
+  for (unsigned int numThreads : {1u, 2u, 4u, 8u}) {
+    JobSystem jobSystem(numThreads);
+    start = std::chrono::high_resolution_clock::now();
+    for (int repetition = 0; repetition < numRepetitions; ++repetition) {
+      world.getCollisions(collisions, jobSystem);
+    }
+    double seconds = std::chrono::duration<double>
+      (std::chrono::high_resolution_clock::now() - start).count() /
+      numRepetitions;
+    cout << "Narrow phase - job system threads: " << numThreads << ", time: "
+	 << 1000.0 * seconds << " ms, speedup: " << serialSeconds / seconds
+	 << " (hardware threads: " << std::thread::hardware_concurrency()
+	 << ")" << endl;
+  }
+}
+
+TEST(JobSystemTest, ParallelFor) {
+  for (unsigned int numThreads : {1u, 3u, 8u}) {
+    JobSystem jobSystem(numThreads);
+
+    vector<int> visits(10001, 0);
+    jobSystem.parallelFor(visits.size(), 64, [&visits](size_t begin,
+						       size_t end) {
+			    for (size_t idx = begin; idx < end; ++idx) {
+			      ++visits[idx];
+			    }
+			  });
+    for (auto visit : visits) {
+      EXPECT_EQ(1, visit);
+    }
+
+    // Nothing to do
+    jobSystem.parallelFor(0, 64, [](size_t, size_t) {
+	FAIL();
+      });
+  }
+}
+
+TEST(JobSystemTest, RunAndWait) {
+  JobSystem jobSystem(4);
+  std::atomic<int> numRuns(0);
+
+  // Jobs queueing other jobs and running parallel loops
+  for (int idx = 0; idx < 100; ++idx) {
+    jobSystem.run([&jobSystem, &numRuns]() {
+	++numRuns;
+	jobSystem.run([&numRuns]() {
+	    ++numRuns;
+	  });
+	jobSystem.parallelFor(10, 1, [&numRuns](size_t, size_t) {
+	    ++numRuns;
+	  });
+      });
+  }
+  jobSystem.wait();
+  EXPECT_EQ(1200, numRuns);
+}
+
+TEST(JobSystemTest, Exceptions) {
+  JobSystem jobSystem(4);
+
+  EXPECT_THROW(jobSystem.parallelFor(100, 1, [](size_t begin, size_t) {
+	if (begin == 50) throw std::runtime_error("Job failed");
+      }), std::runtime_error);
+
+  jobSystem.run([]() {
+      throw std::runtime_error("Job failed");
+    });
+  EXPECT_THROW(jobSystem.wait(), std::runtime_error);
+
+  // The job system is still usable afterwards.
+  std::atomic<int> numRuns(0);
+  jobSystem.parallelFor(100, 1, [&numRuns](size_t, size_t) {
+      ++numRuns;
+    });
+  jobSystem.wait();
+  EXPECT_EQ(100, numRuns);
+}
+
+// The Renderer tests run headless (without a window) if the SMALL3D_HEADLESS
+// environment variable is set. The Renderer is a singleton, so the first
+// call decides.
+static Renderer& getTestRenderer() {
+  return Renderer::getInstance("test", 640, 480, 1.0f, 1.0f, 24.0f, -1.0f,
+			       "resources/shaders/",
+			       getenv("SMALL3D_HEADLESS") != nullptr);
+}
+
+static size_t countOccurrences(const string &text, const string &pattern) {
+  size_t count = 0;
+  for (size_t pos = text.find(pattern); pos != string::npos;
+       pos = text.find(pattern, pos + pattern.size())) {
+    ++count;
+  }
+  return count;
+}
+
+TEST(TraceTest, WriteTrace) {
+  clearTrace();
+
+  {
+    TraceZone outer("outer");
+    {
+      TraceZone inner("inner \"quoted\"");
+    }
+  }
+
+  std::thread thread([] {
+      TraceZone zone("other thread");
+    });
+  thread.join();
+
+#ifdef SMALL3D_TRACE
+  Model model("resources/models/Cube/Cube.obj");
+#endif
+
+  ostringstream trace;
+  writeTrace(trace);
+  string json = trace.str();
+
+  EXPECT_EQ(0u, json.find("{\"traceEvents\":["));
+  EXPECT_EQ(1u, countOccurrences(json, "\"name\":\"outer\""));
+  EXPECT_EQ(1u, countOccurrences(json, "\"name\":\"inner \\\"quoted\\\"\""));
+  EXPECT_EQ(1u, countOccurrences(json, "\"name\":\"other thread\""));
+#ifdef SMALL3D_TRACE
+  EXPECT_EQ(1u, countOccurrences(json, "\"name\":\"Model::Model\""));
+  EXPECT_EQ(4u, countOccurrences(json, "\"ph\":\"X\""));
+#else
+  EXPECT_EQ(3u, countOccurrences(json, "\"ph\":\"X\""));
+#endif
+
+  // The zones of the other thread are recorded with a different thread id.
+  size_t otherThread = json.find("\"name\":\"other thread\"");
+  size_t outer = json.find("\"name\":\"outer\"");
+  EXPECT_NE(json.substr(json.find("\"tid\":", otherThread), 8),
+	    json.substr(json.find("\"tid\":", outer), 8));
+
+  clearTrace();
+  ostringstream emptyTrace;
+  writeTrace(emptyTrace);
+  EXPECT_EQ(0u, countOccurrences(emptyTrace.str(), "\"ph\":\"X\""));
+}
+
+TEST(TraceTest, ThreadBuffersReused) {
+  clearTrace();
+
+  std::thread firstThread([] {
+      TraceZone zone("short thread");
+    });
+  firstThread.join();
+  size_t byteSize = getTraceByteSize();
+
+  // Each thread gets the buffer of the previous one, so the memory used
+  // does not grow by a buffer per thread.
+  const int numThreads = 50;
+  for (int idx = 1; idx < numThreads; ++idx) {
+    std::thread thread([] {
+	TraceZone zone("short thread");
+      });
+    thread.join();
+  }
+  EXPECT_LT(getTraceByteSize(), byteSize + 65536);
+
+  // The events of the threads are still written after they exit.
+  ostringstream trace;
+  writeTrace(trace);
+  EXPECT_EQ(static_cast<size_t>(numThreads),
+	    countOccurrences(trace.str(), "\"name\":\"short thread\""));
+
+  clearTrace();
+  ostringstream emptyTrace;
+  writeTrace(emptyTrace);
+  EXPECT_EQ(0u, countOccurrences(emptyTrace.str(), "\"ph\":\"X\""));
+}
+
+TEST(TraceTest, Overhead) {
+  clearTrace();
+
+  // More zones than a thread's buffer can hold, so that it wraps around.
+  const int numZones = 1000000;
+  auto start = chrono::high_resolution_clock::now();
+  for (int idx = 0; idx < numZones; ++idx) {
+    TraceZone zone("overhead");
+  }
+  double seconds = chrono::duration<double>
+    (chrono::high_resolution_clock::now() - start).count();
+
+  ostringstream trace;
+  writeTrace(trace);
+  size_t numRecorded = countOccurrences(trace.str(), "\"name\":\"overhead\"");
+  EXPECT_GT(numRecorded, 0u);
+  EXPECT_LT(numRecorded, static_cast<size_t>(numZones));
+  clearTrace();
+
+  cout << "Trace zone overhead: " << 1.0e9 * seconds / numZones << " ns"
+       << endl;
+}
+
+TEST(RendererTest, StartAndUse) {
+
+  Renderer *renderer = &getTestRenderer();
+  renderer->clearScreen();
+  
+  SceneObject object("cube", "resources/models/Cube/CubeNoTexture.obj");
+  object.offset = glm::vec3(0.0f, -1.0f, -8.0f);
+  renderer->render(object, glm::vec4(1.0f, 1.0f, 1.0f, 1.0f));
+  renderer->renderRectangle(glm::vec4(0.0f, 0.0f, 1.0f, 1.0f),
+			    glm::vec3(-1.0f, 0.0f, 1.0f),
+			    glm::vec3(-0.5f, -0.5f, 1.0f), false);
+
+  SceneObject object2("texutredCube", "resources/models/Cube/Cube.obj");
+  object2.offset = glm::vec3(-2.0f, -1.0f, -7.0f);
+  object2.rotation = glm::vec3(0.3f, 1.3f, 0.0f);
+  
+  Image cubeTexture("resources/models/Cube/cubeTexture.png");
+  renderer->generateTexture("cubeTexture", cubeTexture);
+
+  renderer->render(object2, "cubeTexture");
+
+  renderer->write("small3d :)", glm::vec3(0.0f, 1.0f, 0.0f),
+		  glm::vec2(-1.0f, 0.0f), glm::vec2(0.5f, -0.5f));
+  
+  renderer->swapBuffers();
+  
+  renderer->deleteTexture("cubeTexture");
+  
+}
+
+TEST(RendererTest, ReadPixels) {
+
+  Renderer *renderer = &getTestRenderer();
+  EXPECT_EQ(640, renderer->getScreenWidth());
+  EXPECT_EQ(480, renderer->getScreenHeight());
+  EXPECT_EQ(getenv("SMALL3D_HEADLESS") != nullptr, renderer->isHeadless());
+
+  renderer->clearScreen(glm::vec4(0.2f, 0.4f, 0.6f, 1.0f));
+
+  // Top left quarter of the screen
+  renderer->renderRectangle(glm::vec4(1.0f, 0.0f, 0.0f, 1.0f),
+			    glm::vec3(-1.0f, 1.0f, -0.5f),
+			    glm::vec3(0.0f, 0.0f, -0.5f), false);
+
+  vector<unsigned char> pixels;
+  renderer->readPixels(pixels);
+  ASSERT_EQ(4u * 640u * 480u, pixels.size());
+
+  // Top left pixel
+  EXPECT_EQ(255, pixels[0]);
+  EXPECT_EQ(0, pixels[1]);
+  EXPECT_EQ(0, pixels[2]);
+
+  // Bottom right pixel
+  size_t last = pixels.size() - 4;
+  EXPECT_NEAR(51, pixels[last], 1);
+  EXPECT_NEAR(102, pixels[last + 1], 1);
+  EXPECT_NEAR(153, pixels[last + 2], 1);
+  EXPECT_EQ(255, pixels[last + 3]);
+
+  // Bottom left pixel, with the rows in OpenGL order
+  vector<unsigned char> bottomUpPixels;
+  renderer->readPixels(bottomUpPixels, false);
+  EXPECT_NEAR(51, bottomUpPixels[0], 1);
+  EXPECT_EQ(255, bottomUpPixels[4 * 640 * 479]);
+
+  const int numReads = 20;
+  auto start = std::chrono::high_resolution_clock::now();
+  for (int idx = 0; idx < numReads; ++idx) {
+    renderer->readPixels(pixels);
+  }
+  double seconds = std::chrono::duration<double>
+    (std::chrono::high_resolution_clock::now() - start).count();
+
+  cout << "Reading back 640x480 pixels: " << 1000.0 * seconds / numReads
+       << " ms" << endl;
+
+  renderer->swapBuffers();
+}
+
+TEST(RendererTest, FrameStats) {
+
+  Renderer *renderer = &getTestRenderer();
+  SceneObject object("cube", "resources/models/Cube/CubeNoTexture.obj");
+  object.offset = glm::vec3(0.0f, -1.0f, -8.0f);
+  unsigned long numCubeTriangles = object.getModel().indexData.size() / 3;
+
+  renderer->swapBuffers();
+  unsigned long firstFrame = renderer->getFrameStats().frameNumber;
+
+  renderer->clearScreen();
+  renderer->render(object, glm::vec4(1.0f, 1.0f, 1.0f, 1.0f));
+  renderer->render(object, glm::vec4(1.0f, 0.0f, 1.0f, 1.0f));
+  renderer->renderRectangle(glm::vec4(0.0f, 0.0f, 1.0f, 1.0f),
+			    glm::vec3(-1.0f, 0.0f, 1.0f),
+			    glm::vec3(-0.5f, -0.5f, 1.0f), false);
+  renderer->write("stats", glm::vec3(0.0f, 1.0f, 0.0f),
+		  glm::vec2(-1.0f, 0.0f), glm::vec2(0.5f, -0.5f));
+  renderer->swapBuffers();
+
+  FrameStats stats = renderer->getFrameStats();
+  EXPECT_EQ(firstFrame + 1, stats.frameNumber);
+  EXPECT_EQ(4u, stats.numDrawCalls);
+  EXPECT_EQ(2 * numCubeTriangles + 4, stats.numTriangles);
+  // Two programs for the models, one for the rectangle and a program and a
+  // texture for the text
+  EXPECT_EQ(5u, stats.numStateChanges);
+  EXPECT_GT(stats.textureUploadBytes, 0u);
+  // The cube is uploaded once, plus the vertices, indexes and texture
+  // coordinates of the two rectangles
+  const Model &model = object.getModel();
+  EXPECT_EQ(static_cast<unsigned long>(model.vertexDataByteSize +
+				       model.indexDataByteSize +
+				       model.normalsDataByteSize) +
+	    2 * (16 * sizeof(float) + 6 * sizeof(unsigned int)) +
+	    8 * sizeof(float), stats.bufferUploadBytes);
+  EXPECT_GT(stats.modelMilliseconds, 0.0);
+  EXPECT_GT(stats.textMilliseconds, 0.0);
+  EXPECT_GE(stats.frameMilliseconds, stats.modelMilliseconds +
+	    stats.rectangleMilliseconds + stats.textMilliseconds);
+
+  renderer->clearScreen();
+  renderer->render(object, glm::vec4(1.0f, 1.0f, 1.0f, 1.0f));
+  renderer->renderFrameStats();
+  renderer->swapBuffers();
+
+  stats = renderer->getFrameStats();
+  EXPECT_EQ(firstFrame + 2, stats.frameNumber);
+  EXPECT_EQ(0.0, stats.rectangleMilliseconds);
+  EXPECT_EQ(5u, stats.numDrawCalls);
+  EXPECT_EQ(stats.frameNumber - 1, stats.gpuFrameNumber);
+
+  // Once the GPU has finished the previous frame, its time is available.
+  glFinish();
+  renderer->swapBuffers();
+  stats = renderer->getFrameStats();
+  if (glewIsSupported("GL_VERSION_3_3")) {
+    EXPECT_GT(stats.gpuMilliseconds, 0.0);
+  }
+  else {
+    EXPECT_EQ(-1.0, stats.gpuMilliseconds);
+  }
+  cout << "Frame with statistics overlay: GPU " << stats.gpuMilliseconds
+       << " ms" << endl;
+}
+
+TEST(RendererTest, Capture) {
+
+  Renderer *renderer = &getTestRenderer();
+  const int numFrames = 5;
+
+  renderer->startCapture("capturetest.y4m", capturey4m, 25);
+  EXPECT_TRUE(renderer->isCapturing());
+  for (int frame = 0; frame < numFrames; ++frame) {
+    renderer->clearScreen(glm::vec4(0.2f * frame, 0.0f, 0.0f, 1.0f));
+    renderer->swapBuffers();
+  }
+  renderer->stopCapture();
+  EXPECT_FALSE(renderer->isCapturing());
+
+  std::ifstream y4m("capturetest.y4m", std::ios::binary);
+  ASSERT_TRUE(y4m.good());
+  string header;
+  getline(y4m, header);
+  EXPECT_EQ("YUV4MPEG2 W640 H480 F25:1 Ip A1:1 C420jpeg", header);
+  size_t frameSize = 640 * 480 + 2 * 320 * 240;
+  vector<char> frameData(frameSize);
+  for (int frame = 0; frame < numFrames; ++frame) {
+    string frameHeader;
+    getline(y4m, frameHeader);
+    EXPECT_EQ("FRAME", frameHeader);
+    y4m.read(&frameData[0], static_cast<std::streamsize>(frameSize));
+    ASSERT_TRUE(y4m.good());
+    // Luma of the first pixel (0.299 * red)
+    EXPECT_NEAR(0.299f * 0.2f * frame * 255.0f,
+		static_cast<unsigned char>(frameData[0]), 2.0f);
+  }
+  y4m.peek();
+  EXPECT_TRUE(y4m.eof());
+  y4m.close();
+  remove("capturetest.y4m");
+
+  renderer->startCapture("capturetest", capturepng);
+  renderer->clearScreen(glm::vec4(0.2f, 0.4f, 0.6f, 1.0f));
+  renderer->renderRectangle(glm::vec4(1.0f, 0.0f, 0.0f, 1.0f),
+			    glm::vec3(-1.0f, 1.0f, -0.5f),
+			    glm::vec3(0.0f, 0.0f, -0.5f), false);
+  renderer->swapBuffers();
+  renderer->stopCapture();
+
+  Image image("capturetest000000.png");
+  ASSERT_EQ(640u, image.getWidth());
+  ASSERT_EQ(480u, image.getHeight());
+  const float *imageData = image.getData();
+  EXPECT_NEAR(1.0f, imageData[0], 0.01f);
+  EXPECT_NEAR(0.0f, imageData[1], 0.01f);
+  size_t last = 4 * 640 * 480 - 4;
+  EXPECT_NEAR(0.2f, imageData[last], 0.01f);
+  EXPECT_NEAR(0.6f, imageData[last + 2], 0.01f);
+  remove("capturetest000000.png");
+}
+
+TEST(RendererTest, CaptureBenchmark) {
+
+  Renderer *renderer = &getTestRenderer();
+  SceneObject object("cube", "resources/models/Cube/CubeNoTexture.obj");
+  object.offset = glm::vec3(0.0f, -1.0f, -8.0f);
+  const int numFrames = 60;
+  vector<unsigned char> pixels;
+
+  // 0: no capture, 1: glReadPixels on every frame, 2: asynchronous capture
+  double frameTimes[3];
+  for (int mode = 0; mode < 3; ++mode) {
+    if (mode == 2) renderer->startCapture("capturebenchmark.y4m", capturey4m);
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int frame = 0; frame < numFrames; ++frame) {
+      renderer->clearScreen();
+      object.rotation = glm::vec3(0.0f, 0.1f * frame, 0.0f);
+      renderer->render(object, glm::vec4(1.0f, 1.0f, 1.0f, 1.0f));
+      if (mode == 1) renderer->readPixels(pixels, false);
+      renderer->swapBuffers();
+      // Wait for the frame to be rendered, as with vsync, otherwise (software)
+      // drivers may defer all the work until the pixels are read.
+      glFinish();
+    }
+    if (mode == 2) renderer->stopCapture();
+    frameTimes[mode] = 1000.0 * std::chrono::duration<double>
+      (std::chrono::high_resolution_clock::now() - start).count() /
+      numFrames;
+  }
+  remove("capturebenchmark.y4m");
+
+  cout << "Frame time without capture: " << frameTimes[0] << " ms" << endl;
+  cout << "Frame time reading pixels synchronously: " << frameTimes[1]
+       << " ms" << endl;
+  cout << "Frame time with capture (Y4M, including writing the last "
+       << "frames): " << frameTimes[2] << " ms" << endl;
+}
+
+TEST(SoundTest, LoadAndPlay) {
+  Sound snd("resources/sounds/bah.ogg");
+  snd.play();
+  double startSeconds = glfwGetTime();
+  while(glfwGetTime() - startSeconds < 0.5);
+  snd.stop();
+  startSeconds = glfwGetTime();
+  while(glfwGetTime() - startSeconds < 0.5);
+  snd.play();
+  // Make sure the sound is stopped by the stop function and not the destructor.
+  startSeconds = glfwGetTime();
+  while(glfwGetTime() - startSeconds < 2.0);
+}
+
+TEST(SoundTest, ThreeAtTheSameTime) {
+  Sound snd1("resources/sounds/bah.ogg");
+  Sound snd2(snd1);
+  Sound snd3 = snd2;
+  snd1.play();
+  double startSeconds = glfwGetTime();
+  while(glfwGetTime() - startSeconds < 0.3);
+  snd2.play();
+  startSeconds = glfwGetTime();
+  while(glfwGetTime() - startSeconds < 0.3);
+  snd3.play();
+  startSeconds = glfwGetTime();
+  while(glfwGetTime() - startSeconds < 1.0);
+}
+
+
+TEST(SoundTest, RepeatSound) {
+  Sound snd("resources/sounds/bah.ogg");
+  snd.play(true);
+  double startSeconds = glfwGetTime();
+  while(glfwGetTime() - startSeconds < 6.0);
+}
+
+TEST(SoundTest, SharedClips) {
+  SoundMixer mixer(mixernull);
+  SoundBank &bank = SoundBank::getInstance();
+  size_t numClipsBefore = bank.getNumClips();
+  {
+    Sound snd("resources/sounds/bah.ogg", mixer);
+    size_t clipBytes = bank.getMemoryUsage();
+    EXPECT_GT(clipBytes, 0U);
+    EXPECT_EQ(numClipsBefore + 1, bank.getNumClips());
+
+    // 100 copies, or 100 Sounds loaded from the same file, share the clip.
+    size_t bytesBefore = numAllocatedBytes;
+    vector<Sound> copies(100, snd);
+    size_t copyBytes = numAllocatedBytes - bytesBefore;
+    cout << "Size of the clip: " << clipBytes << " bytes, memory allocated "
+         << "for 100 copies: " << copyBytes << " bytes" << endl;
+    EXPECT_LE(copyBytes, 100 * sizeof(Sound));
+    EXPECT_EQ(clipBytes, bank.getMemoryUsage());
+
+    vector<Sound> loaded;
+    for (int idx = 0; idx < 100; ++idx) {
+      loaded.push_back(Sound("resources/sounds/bah.ogg", mixer));
+    }
+    EXPECT_EQ(clipBytes, bank.getMemoryUsage());
+    EXPECT_EQ(numClipsBefore + 1, bank.getNumClips());
+
+    for (auto copy = copies.begin(); copy != copies.end(); ++copy) {
+      copy->play();
+    }
+    EXPECT_EQ(100U, mixer.getNumVoices());
+    vector<short> samples;
+    mixer.render(samples, 100);
+    EXPECT_EQ(clipBytes, bank.getMemoryUsage());
+  }
+
+  // The clip is released when nothing uses it any more.
+  vector<short> samples;
+  mixer.render(samples, 100);
+  EXPECT_EQ(0U, mixer.getNumVoices());
+  EXPECT_EQ(numClipsBefore, bank.getNumClips());
+}
+
+TEST(SoundTest, Move) {
+  SoundMixer mixer(mixernull);
+  Sound snd("resources/sounds/bah.ogg", mixer);
+  snd.play(true);
+  EXPECT_TRUE(snd.isPlaying());
+
+  // The voice moves with the Sound, without being interrupted.
+  Sound moved(std::move(snd));
+  EXPECT_TRUE(moved.isPlaying());
+  EXPECT_FALSE(snd.isPlaying());
+  snd.play();
+  EXPECT_FALSE(snd.isPlaying());
+  EXPECT_EQ(1U, mixer.getNumVoices());
+
+  Sound other("resources/sounds/bah.ogg", mixer);
+  other.play(true);
+  EXPECT_EQ(2U, mixer.getNumVoices());
+  other = std::move(moved);
+  EXPECT_TRUE(other.isPlaying());
+  EXPECT_FALSE(moved.isPlaying());
+  vector<short> samples;
+  mixer.render(samples, 10);
+  EXPECT_EQ(1U, mixer.getNumVoices());
+  other.stop();
+  mixer.render(samples, 10);
+  EXPECT_EQ(0U, mixer.getNumVoices());
+}
+
+// A clip in which sample n of channel c is n * (c + 1) (modulo 10000)
+static shared_ptr<SoundClip> createTestClip(const int channels,
+                                            const unsigned long numFrames,
+                                            const int rate = 44100) {
+  shared_ptr<SoundClip> clip(new SoundClip());
+  clip->channels = channels;
+  clip->rate = rate;
+  clip->numFrames = numFrames;
+  for (unsigned long frame = 0; frame < numFrames; ++frame) {
+    for (int c = 0; c < channels; ++c) {
+      clip->samples.push_back(static_cast<short>((frame * (c + 1)) % 10000));
+    }
+  }
+  return clip;
+}
+
+TEST(SoundMixerTest, MixOffline) {
+  SoundMixer mixer(mixernull);
+  shared_ptr<SoundClip> clip = createTestClip(2, 1000);
+  unsigned int voice = mixer.play(clip);
+  EXPECT_NE(0U, voice);
+  EXPECT_TRUE(mixer.isPlaying(voice));
+
+  // The clip is played exactly as it is and the rest is silent.
+  vector<short> samples;
+  mixer.render(samples, 1500);
+  ASSERT_EQ(3000U, samples.size());
+  for (unsigned long idx = 0; idx < 2000; ++idx) {
+    EXPECT_EQ(clip->samples[idx], samples[idx]);
+  }
+  for (unsigned long idx = 2000; idx < 3000; ++idx) {
+    EXPECT_EQ(0, samples[idx]);
+  }
+  EXPECT_FALSE(mixer.isPlaying(voice));
+  EXPECT_EQ(0U, mixer.getNumVoices());
+
+  // A mono clip is played on both channels
+  shared_ptr<SoundClip> monoClip = createTestClip(1, 100);
+  mixer.play(monoClip);
+  mixer.render(samples, 100);
+  for (unsigned long frame = 0; frame < 100; ++frame) {
+    EXPECT_EQ(monoClip->samples[frame], samples[2 * frame]);
+    EXPECT_EQ(monoClip->samples[frame], samples[2 * frame + 1]);
+  }
+
+  EXPECT_THROW(mixer.play(shared_ptr<SoundClip>()), runtime_error);
+}
+
+TEST(SoundMixerTest, VolumePanPitch) {
+  SoundMixer mixer(mixernull);
+  shared_ptr<SoundClip> clip(new SoundClip());
+  clip->channels = 1;
+  clip->rate = 44100;
+  clip->numFrames = 44100;
+  clip->samples.assign(44100, 1000);
+
+  vector<short> samples;
+  unsigned int voice = mixer.play(clip, false, 0.5f, 1.0f);
+  mixer.render(samples, 256);
+  for (unsigned long frame = 0; frame < 256; ++frame) {
+    EXPECT_EQ(0, samples[2 * frame]);
+    EXPECT_EQ(500, samples[2 * frame + 1]);
+  }
+
+  // Changes are spread over a block, so that there are no clicks.
+  mixer.setPan(voice, -0.5f);
+  mixer.setVolume(voice, 1.0f);
+  mixer.render(samples, 512);
+  EXPECT_LT(samples[0], 50);
+  EXPECT_GT(samples[1], 450);
+  for (unsigned long frame = 1; frame < 256; ++frame) {
+    EXPECT_GE(samples[2 * frame], samples[2 * (frame - 1)]);
+  }
+  for (unsigned long frame = 256; frame < 512; ++frame) {
+    EXPECT_EQ(1000, samples[2 * frame]);
+    EXPECT_EQ(500, samples[2 * frame + 1]);
+  }
+  mixer.stop(voice);
+  mixer.render(samples, 10);
+  EXPECT_FALSE(mixer.isPlaying(voice));
+  EXPECT_EQ(0, samples[0]);
+
+  // Twice the pitch, or a clip at half the rate of the mixer, plays every
+  // other sample and finishes twice as fast.
+  shared_ptr<SoundClip> testClip = createTestClip(2, 1000);
+  voice = mixer.play(testClip, false, 1.0f, 0.0f, 2.0f);
+  mixer.render(samples, 501);
+  for (unsigned long frame = 0; frame < 500; ++frame) {
+    EXPECT_EQ(testClip->samples[4 * frame], samples[2 * frame]);
+    EXPECT_EQ(testClip->samples[4 * frame + 1], samples[2 * frame + 1]);
+  }
+  EXPECT_EQ(0, samples[1000]);
+  EXPECT_FALSE(mixer.isPlaying(voice));
+
+  shared_ptr<SoundClip> slowClip = createTestClip(1, 100, 22050);
+  mixer.play(slowClip);
+  mixer.render(samples, 201);
+  for (unsigned long frame = 0; frame < 99; ++frame) {
+    EXPECT_EQ(slowClip->samples[frame], samples[4 * frame]);
+    // Interpolated
+    EXPECT_NEAR((slowClip->samples[frame] + slowClip->samples[frame + 1]) /
+                2.0, samples[4 * frame + 2], 0.5);
+  }
+  EXPECT_EQ(0, samples[400]);
+}
+
+TEST(SoundMixerTest, RepeatAndSaturate) {
+  SoundMixer mixer(mixernull);
+  shared_ptr<SoundClip> clip = createTestClip(2, 10);
+  unsigned int voice = mixer.play(clip, true);
+  vector<short> samples;
+  mixer.render(samples, 1000);
+  for (unsigned long idx = 0; idx < 2000; ++idx) {
+    EXPECT_EQ(clip->samples[idx % 20], samples[idx]);
+  }
+  EXPECT_TRUE(mixer.isPlaying(voice));
+  mixer.stop(voice);
+  mixer.render(samples, 1);
+  EXPECT_FALSE(mixer.isPlaying(voice));
+
+  shared_ptr<SoundClip> loudClip(new SoundClip());
+  loudClip->channels = 2;
+  loudClip->rate = 44100;
+  loudClip->numFrames = 100;
+  for (int idx = 0; idx < 100; ++idx) {
+    loudClip->samples.push_back(30000);
+    loudClip->samples.push_back(-30000);
+  }
+  mixer.play(loudClip);
+  mixer.play(loudClip);
+  mixer.play(loudClip, false, 0.1f);
+  mixer.render(samples, 100);
+  for (unsigned long frame = 0; frame < 100; ++frame) {
+    EXPECT_EQ(32767, samples[2 * frame]);
+    EXPECT_EQ(-32768, samples[2 * frame + 1]);
+  }
+}
+
+// Render in blocks of varying sizes, as audio callbacks might be asked for.
+static void renderInBlocks(SoundMixer &mixer, vector<short> &samples,
+                           const unsigned long numFrames) {
+  minstd_rand random(7);
+  vector<short> block;
+  samples.clear();
+  unsigned long done = 0;
+  while (done < numFrames) {
+    unsigned long blockFrames = min(numFrames - done,
+                                    static_cast<unsigned long>
+                                    (1 + random() % 700));
+    mixer.render(block, blockFrames);
+    samples.insert(samples.end(), block.begin(), block.end());
+    done += blockFrames;
+  }
+}
+
+TEST(SoundMixerTest, SampleAccurateTiming) {
+  SoundMixer mixer(mixernull);
+  shared_ptr<SoundClip> clip = createTestClip(2, 441);
+  vector<short> samples;
+  mixer.render(samples, 100);
+  EXPECT_EQ(100U, mixer.getNumFramesMixed());
+
+  // Starting at an exact frame, which is within a block and not at the
+  // start of a callback, followed by the clip looping without gaps. The
+  // reference is built sample by sample.
+  uint64_t startFrame = 1234;
+  unsigned int voice = mixer.play(clip, true, 1.0f, 0.0f, 1.0f, startFrame);
+  mixer.play(clip, false, 1.0f, 0.0f, 1.0f, startFrame + 5000);
+  renderInBlocks(mixer, samples, 10000);
+  vector<short> reference(20000, 0);
+  for (unsigned long frame = 1134; frame < 10000; ++frame) {
+    for (int c = 0; c < 2; ++c) {
+      reference[2 * frame + c] = clip->samples[2 * ((frame - 1134) % 441) + c];
+    }
+  }
+  for (unsigned long frame = 6134; frame < 6134 + 441; ++frame) {
+    for (int c = 0; c < 2; ++c) {
+      reference[2 * frame + c] = static_cast<short>
+        (reference[2 * frame + c] + clip->samples[2 * (frame - 6134) + c]);
+    }
+  }
+  EXPECT_TRUE(reference == samples);
+  EXPECT_EQ(10100U, mixer.getNumFramesMixed());
+  EXPECT_EQ(1U, mixer.getNumVoices());
+
+  // Starting in the past means as soon as possible.
+  mixer.stop(voice);
+  mixer.play(clip, false, 1.0f, 0.0f, 1.0f, 1);
+  mixer.render(samples, 500);
+  for (unsigned long idx = 0; idx < 882; ++idx) {
+    EXPECT_EQ(clip->samples[idx], samples[idx]);
+  }
+
+  // The end of the clip is followed by silence in the same block.
+  for (unsigned long idx = 882; idx < 1000; ++idx) {
+    EXPECT_EQ(0, samples[idx]);
+  }
+  EXPECT_EQ(0U, mixer.getNumVoices());
+}
+
+TEST(SoundMixerTest, NoAllocationsWhileMixing) {
+  SoundMixer mixer(mixernull);
+  shared_ptr<SoundClip> clip = createTestClip(2, 44100);
+  shared_ptr<SoundClip> monoClip = createTestClip(1, 1000, 22050);
+  vector<short> samples(2 * 512);
+  for (int idx = 0; idx < 32; ++idx) {
+    mixer.play(idx % 2 == 0 ? clip : monoClip, true, 0.5f, 0.2f,
+               idx % 3 == 0 ? 1.3f : 1.0f, idx * 100);
+  }
+  size_t allocationsBefore = numAllocations;
+  for (int idx = 0; idx < 100; ++idx) {
+    mixer.render(samples, 512);
+  }
+  EXPECT_EQ(0U, numAllocations - allocationsBefore);
+}
+
+static shared_ptr<SoundClip> createConstantClip(const short value,
+                                                const unsigned long numFrames) {
+  shared_ptr<SoundClip> clip(new SoundClip());
+  clip->channels = 1;
+  clip->rate = 44100;
+  clip->numFrames = numFrames;
+  clip->samples.assign(numFrames, value);
+  return clip;
+}
+
+TEST(SoundMixerTest, SpatialGains) {
+  SoundMixer mixer(mixernull);
+  shared_ptr<SoundClip> clip = createConstantClip(10000, 44100);
+  vector<short> samples;
+
+  // In front of the listener, attenuated with distance. A voice starts at
+  // its gains.
+  unsigned int voice = mixer.play(clip, glm::vec3(0.0f, 0.0f, -5.0f),
+                                  glm::vec3(0.0f), true);
+  mixer.render(samples, 256);
+  EXPECT_EQ(2000, samples[0]);
+  EXPECT_EQ(2000, samples[1]);
+  EXPECT_EQ(2000, samples[511]);
+
+  // To the right. The gains change over a block, without jumping.
+  mixer.setPosition(voice, glm::vec3(4.0f, 0.0f, 0.0f), glm::vec3(0.0f));
+  mixer.render(samples, 256);
+  EXPECT_NEAR(2000, samples[0], 20);
+  EXPECT_NEAR(2000, samples[1], 20);
+  for (int idx = 2; idx < 512; idx += 2) {
+    EXPECT_LE(samples[idx], samples[idx - 2]);
+    EXPECT_GE(samples[idx + 1], samples[idx - 1]);
+  }
+  mixer.render(samples, 256);
+  EXPECT_EQ(0, samples[0]);
+  EXPECT_EQ(2500, samples[1]);
+
+  // Turning the listener towards the voice centres it.
+  mixer.setListener(glm::vec3(0.0f), glm::vec3(0.0f, 1.5707963f, 0.0f));
+  mixer.render(samples, 512);
+  EXPECT_EQ(2500, samples[1022]);
+  EXPECT_EQ(2500, samples[1023]);
+
+  // The listener moves away and turns back, so the voice is on the right
+  // again, further away.
+  mixer.setListener(glm::vec3(-4.0f, 0.0f, 0.0f), glm::vec3(0.0f));
+  mixer.render(samples, 512);
+  EXPECT_EQ(0, samples[1022]);
+  EXPECT_EQ(1250, samples[1023]);
+
+  // Left, with another distance model, and beyond the maximum distance
+  mixer.setDistanceModel(2.0f, 10.0f, 2.0f);
+  mixer.setPosition(voice, glm::vec3(-10.0f, 0.0f, 0.0f), glm::vec3(0.0f));
+  mixer.render(samples, 512);
+  EXPECT_EQ(2000, samples[1022]);
+  EXPECT_EQ(0, samples[1023]);
+  mixer.setPosition(voice, glm::vec3(-100.0f, 0.0f, 0.0f), glm::vec3(0.0f));
+  mixer.render(samples, 512);
+  EXPECT_EQ(1111, samples[1022]);
+  EXPECT_EQ(0, samples[1023]);
+  EXPECT_THROW(mixer.setDistanceModel(0.0f, 10.0f, 1.0f), runtime_error);
+
+  // Not positioned any more
+  mixer.clearPosition(voice);
+  mixer.render(samples, 512);
+  EXPECT_EQ(10000, samples[1022]);
+  EXPECT_EQ(10000, samples[1023]);
+  mixer.stop(voice);
+
+  // A positioned Sound, on the left of the listener
+  Sound snd("resources/sounds/bah.ogg", mixer);
+  snd.setPosition(glm::vec3(-8.0f, 0.0f, 0.0f));
+  snd.play(true);
+  mixer.render(samples, 22050);
+  short maxLeft = 0, maxRight = 0;
+  for (size_t idx = 0; idx < samples.size(); idx += 2) {
+    maxLeft = max(maxLeft, samples[idx]);
+    maxRight = max(maxRight, samples[idx + 1]);
+  }
+  EXPECT_GT(maxLeft, 0);
+  EXPECT_EQ(0, maxRight);
+}
+
+// Renders until all the voices have finished, returning the number of frames
+static unsigned long renderUntilFinished(SoundMixer &mixer) {
+  vector<short> samples;
+  unsigned long numFrames = 0;
+  while (mixer.getNumVoices() > 0) {
+    mixer.render(samples, 256);
+    numFrames += 256;
+  }
+  return numFrames;
+}
+
+TEST(SoundMixerTest, SpatialDoppler) {
+  SoundMixer mixer(mixernull);
+  shared_ptr<SoundClip> clip = createConstantClip(10000, 44100);
+
+  mixer.play(clip, glm::vec3(0.0f, 0.0f, -10.0f), glm::vec3(0.0f));
+  EXPECT_NEAR(44100, renderUntilFinished(mixer), 256);
+
+  // Coming closer at half the speed of sound, the clip plays twice as fast.
+  mixer.play(clip, glm::vec3(0.0f, 0.0f, -10.0f),
+             glm::vec3(0.0f, 0.0f, 171.5f));
+  EXPECT_NEAR(22050, renderUntilFinished(mixer), 256);
+
+  // Going away
+  mixer.play(clip, glm::vec3(0.0f, 0.0f, -10.0f),
+             glm::vec3(0.0f, 0.0f, -171.5f));
+  EXPECT_NEAR(66150, renderUntilFinished(mixer), 256);
+
+  // The listener coming closer
+  mixer.setListener(glm::vec3(0.0f), glm::vec3(0.0f),
+                    glm::vec3(0.0f, 0.0f, -171.5f));
+  mixer.play(clip, glm::vec3(0.0f, 0.0f, -10.0f), glm::vec3(0.0f), false,
+             1.0f, 0.5f);
+  EXPECT_NEAR(58800, renderUntilFinished(mixer), 256);
+
+  mixer.setSpeedOfSound(0.0f);
+  mixer.play(clip, glm::vec3(0.0f, 0.0f, -10.0f),
+             glm::vec3(0.0f, 0.0f, 171.5f));
+  EXPECT_NEAR(44100, renderUntilFinished(mixer), 256);
+}
+
+TEST(SoundMixerTest, CullQuietestVoices) {
+  SoundMixer mixer(mixernull);
+  shared_ptr<SoundClip> clip = createConstantClip(100, 1000);
+  vector<short> samples;
+
+  vector<unsigned int> handles;
+  for (int idx = 0; idx < 64; ++idx) {
+    handles.push_back(mixer.play(clip, glm::vec3(0.0f, 0.0f,
+                                                 idx == 10 ? -20.0f : -10.0f),
+                                 glm::vec3(0.0f), true));
+  }
+  mixer.render(samples, 1);
+  EXPECT_EQ(64U, mixer.getNumVoices());
+
+  // A louder voice replaces the quietest one.
+  unsigned int loud = mixer.play(clip, true, 0.5f);
+  mixer.render(samples, 1);
+  EXPECT_EQ(64U, mixer.getNumVoices());
+  EXPECT_TRUE(mixer.isPlaying(loud));
+  EXPECT_FALSE(mixer.isPlaying(handles[10]));
+
+  // A quieter one is not played.
+  unsigned int quiet = mixer.play(clip, true, 0.01f);
+  mixer.render(samples, 1);
+  EXPECT_FALSE(mixer.isPlaying(quiet));
+  EXPECT_EQ(64U, mixer.getNumVoices());
+  for (int idx = 0; idx < 64; ++idx) {
+    if (idx != 10) {
+      EXPECT_TRUE(mixer.isPlaying(handles[idx]));
+    }
+  }
+}
+
+TEST(SoundMixerTest, CommandsFromManyThreads) {
+  SoundMixer mixer(mixernull);
+  shared_ptr<SoundClip> clip = createTestClip(2, 300);
+  atomic<bool> done(false);
+  atomic<int> numPlayed(0);
+  vector<thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.push_back(thread([&mixer, &clip, &numPlayed]() {
+          for (int idx = 0; idx < 200; ++idx) {
+            unsigned int voice = mixer.play(clip, idx % 2 == 0);
+            if (voice != 0) ++numPlayed;
+            mixer.setVolume(voice, 0.5f);
+            mixer.setPitch(voice, 1.5f);
+            mixer.stop(voice);
+            this_thread::yield();
+          }
+        }));
+  }
+  thread audio([&mixer, &done]() {
+      vector<short> samples;
+      while (!done) {
+        mixer.render(samples, 256);
+        this_thread::yield();
+      }
+    });
+  for (auto t = threads.begin(); t != threads.end(); ++t) t->join();
+  done = true;
+  audio.join();
+
+  vector<short> samples;
+  mixer.render(samples, 512);
+  EXPECT_EQ(800, numPlayed.load());
+  EXPECT_EQ(0U, mixer.getNumVoices());
+}
+
+TEST(SoundMixerTest, RenderToFile) {
+  SoundMixer mixer(mixernull);
+  Sound snd("resources/sounds/bah.ogg", mixer);
+  snd.play();
+  EXPECT_TRUE(snd.isPlaying());
+  mixer.renderToFile("mix.wav", 22050);
+  ifstream file("mix.wav", ios::binary | ios::ate);
+  ASSERT_TRUE(file.is_open());
+  EXPECT_EQ(44 + 22050 * 4, static_cast<long>(file.tellg()));
+  file.close();
+  remove("mix.wav");
+
+  vector<short> samples;
+  mixer.render(samples, 1000);
+  EXPECT_GT(count_if(samples.begin(), samples.end(),
+                      [](short sample) { return sample != 0; }), 0);
+  snd.stop();
+  mixer.render(samples, 1000);
+  EXPECT_FALSE(snd.isPlaying());
+  EXPECT_EQ(0, count_if(samples.begin(), samples.end(),
+                      [](short sample) { return sample != 0; }));
+
+  // Copies share the clip, but play on their own voices.
+  Sound snd2(snd);
+  snd.play();
+  snd2.play();
+  EXPECT_EQ(2U, mixer.getNumVoices());
+}
+
+TEST(SoundMixerTest, Benchmark) {
+  SoundMixer mixer(mixernull);
+  shared_ptr<SoundClip> clip = createTestClip(2, 44100);
+  shared_ptr<SoundClip> monoClip = createTestClip(1, 44100);
+  for (int idx = 0; idx < 64; ++idx) {
+    mixer.play(idx % 2 == 0 ? clip : monoClip, true, 0.1f,
+               idx % 3 == 0 ? 0.5f : 0.0f, idx % 4 == 0 ? 1.1f : 1.0f);
+  }
+  vector<short> samples;
+  mixer.render(samples, 512);
+  unsigned long numBuffers = 400;
+  auto start = chrono::high_resolution_clock::now();
+  for (unsigned long idx = 0; idx < numBuffers; ++idx) {
+    mixer.render(samples, 512);
+  }
+  double seconds = chrono::duration<double>
+    (chrono::high_resolution_clock::now() - start).count();
+  double audioSeconds = static_cast<double>(numBuffers * 512) / 44100.0;
+  cout << "Mixing 64 voices: " << seconds * 1000.0 / audioSeconds
+       << " ms per second of audio" << endl;
+  EXPECT_EQ(64U, mixer.getNumVoices());
+}
+
+// Render a mix including a stream offline, one block at a time, waiting for
+// the stream to be decoded far enough ahead before each block, as it would be
+// when playing in real time.
+static void renderWithStream(SoundMixer &mixer, const SoundStream &stream,
+                             vector<short> &samples,
+                             const unsigned long numFrames) {
+  samples.clear();
+  vector<short> block;
+  for (unsigned long done = 0; done < numFrames; done += 256) {
+    auto start = chrono::steady_clock::now();
+    while (stream.getNumBufferedFrames() < 260 &&
+           stream.getPosition() + stream.getNumBufferedFrames() + 2 <
+           stream.getNumFrames() &&
+           chrono::steady_clock::now() - start < chrono::milliseconds(200)) {
+      this_thread::sleep_for(chrono::milliseconds(1));
+    }
+    mixer.render(block, min(256UL, numFrames - done));
+    samples.insert(samples.end(), block.begin(), block.end());
+  }
+}
+
+TEST(SoundStreamTest, StreamMatchesDecodedClip) {
+  SoundMixer mixer(mixernull);
+  shared_ptr<const SoundClip> clip =
+    SoundBank::getInstance().get("resources/sounds/bah.ogg");
+  shared_ptr<SoundStream> stream(new SoundStream("resources/sounds/bah.ogg"));
+  EXPECT_EQ(clip->numFrames, stream->getNumFrames());
+  EXPECT_EQ(clip->rate, stream->getRate());
+
+  vector<short> expected, streamed;
+  mixer.play(clip);
+  mixer.render(expected, clip->numFrames + 1000);
+  EXPECT_EQ(0U, mixer.getNumVoices());
+
+  unsigned int voice = mixer.play(stream);
+  renderWithStream(mixer, *stream, streamed, clip->numFrames + 1000);
+  EXPECT_TRUE(expected == streamed);
+  EXPECT_EQ(0U, stream->getNumUnderruns());
+  EXPECT_FALSE(mixer.isPlaying(voice));
+  EXPECT_EQ(clip->numFrames, stream->getPosition());
+
+  // Looping, without a gap
+  stream->setRepeat(true);
+  stream->seek(0.0);
+  while (stream->getNumBufferedFrames() == 0) this_thread::yield();
+  voice = mixer.play(stream);
+  renderWithStream(mixer, *stream, streamed, 5 * clip->numFrames / 2);
+  unsigned long numSamples = clip->numFrames * 2;
+  for (unsigned long idx = 0; idx < streamed.size(); ++idx) {
+    if (streamed[idx] != expected[idx % numSamples]) {
+      FAIL() << "Sample " << idx << " differs.";
+    }
+  }
+  EXPECT_EQ(clip->numFrames / 2, stream->getPosition());
+  EXPECT_TRUE(mixer.isPlaying(voice));
+
+  // The same stream cannot be played on two voices.
+  unsigned int otherVoice = mixer.play(stream);
+  mixer.render(streamed, 1);
+  EXPECT_FALSE(mixer.isPlaying(otherVoice));
+  EXPECT_TRUE(mixer.isPlaying(voice));
+  mixer.stop(voice);
+  mixer.render(streamed, 1);
+
+  // Seeking
+  stream->setRepeat(false);
+  stream->seek(0.5);
+  unsigned long seekFrame = static_cast<unsigned long>(0.5 * clip->rate);
+  while (stream->getNumBufferedFrames() == 0) this_thread::yield();
+  EXPECT_EQ(seekFrame, stream->getPosition());
+  voice = mixer.play(stream);
+  renderWithStream(mixer, *stream, streamed, 1000);
+  for (unsigned long idx = 0; idx < streamed.size(); ++idx) {
+    if (streamed[idx] != expected[2 * seekFrame + idx]) {
+      FAIL() << "Sample " << idx << " differs after seeking.";
+    }
+  }
+  EXPECT_EQ(0U, stream->getNumUnderruns());
+}
+
+TEST(SoundStreamTest, StreamingSound) {
+  SoundMixer mixer(mixernull);
+  Sound snd("resources/sounds/bah.ogg", mixer, true);
+  Sound copy(snd);
+  vector<short> first, second;
+  snd.play();
+  EXPECT_TRUE(snd.isPlaying());
+  vector<short> samples;
+  this_thread::sleep_for(chrono::milliseconds(50));
+  mixer.render(first, 2000);
+
+  // Playing again starts from the beginning, as with decoded sounds. Until
+  // the decoder has seeked, silence is played.
+  snd.play();
+  auto start = chrono::steady_clock::now();
+  while (second.size() < first.size() &&
+         chrono::steady_clock::now() - start < chrono::seconds(2)) {
+    mixer.render(samples, 1);
+    if (!second.empty() || samples[0] != 0 || samples[1] != 0) {
+      second.insert(second.end(), samples.begin(), samples.end());
+    }
+    this_thread::sleep_for(chrono::microseconds(100));
+  }
+  auto firstSound = find_if(first.begin(), first.end(),
+                            [](short sample) { return sample != 0; });
+  firstSound -= (firstSound - first.begin()) % 2;
+  first.erase(first.begin(), firstSound);
+  second.resize(first.size());
+  EXPECT_TRUE(first == second);
+
+  // The copy has its own stream.
+  copy.play(true);
+  mixer.render(samples, 10);
+  EXPECT_TRUE(snd.isPlaying());
+  EXPECT_TRUE(copy.isPlaying());
+  snd.stop();
+  copy.stop();
+  mixer.render(samples, 10);
+  EXPECT_EQ(0U, mixer.getNumVoices());
+}
+
+TEST(SoundStreamTest, Benchmark) {
+  auto start = chrono::high_resolution_clock::now();
+  SoundBank bank;
+  shared_ptr<const SoundClip> clip = bank.get("resources/sounds/bah.ogg");
+  double decodeSeconds = chrono::duration<double>
+    (chrono::high_resolution_clock::now() - start).count();
+
+  start = chrono::high_resolution_clock::now();
+  SoundStream stream("resources/sounds/bah.ogg");
+  while (stream.getNumBufferedFrames() == 0) this_thread::yield();
+  double firstSampleSeconds = chrono::duration<double>
+    (chrono::high_resolution_clock::now() - start).count();
+
+  double clipSeconds = static_cast<double>(clip->numFrames) / clip->rate;
+  cout << "Sound of " << clipSeconds << " s" << endl;
+  cout << "Decoding all of it: " << decodeSeconds * 1000.0
+       << " ms to the first sample, "
+       << clip->samples.size() * sizeof(short) << " bytes" << endl;
+  cout << "Streaming: " << firstSampleSeconds * 1000.0
+       << " ms to the first sample, " << stream.getBufferSize()
+       << " bytes, whatever the length" << endl;
+  EXPECT_LT(stream.getBufferSize(), static_cast<size_t>(clip->channels *
+                                                        clip->rate * 2));
+}
+
+static void copyFile(const string from, const string to) {
+  ifstream source(from, ios::binary);
+  ofstream destination(to, ios::binary);
+  destination << source.rdbuf();
+}
+
+TEST(SoundBankTest, ParallelLoadAndCache) {
+  SoundBank reference;
+  shared_ptr<const SoundClip> decoded =
+    reference.get("resources/sounds/bah.ogg");
+  ASSERT_GT(decoded->samples.size(), 0U);
+
+  copyFile("resources/sounds/bah.ogg", "cachedsound.ogg");
+  SoundBank bank;
+  EXPECT_EQ("", bank.getCacheFilePath("cachedsound.ogg"));
+  bank.setCacheDirectory(".");
+  string cacheFilePath = bank.getCacheFilePath("cachedsound.ogg");
+  EXPECT_NE(cacheFilePath, bank.getCacheFilePath("other/cachedsound.ogg"));
+
+  JobSystem jobSystem(4);
+  vector<string> paths = {"cachedsound.ogg", "resources/sounds/bah.ogg",
+                          "cachedsound.ogg"};
+  vector<shared_ptr<const SoundClip> > clips;
+  bank.get(paths, jobSystem, clips);
+  ASSERT_EQ(3U, clips.size());
+  EXPECT_EQ(clips[0], clips[2]);
+  EXPECT_EQ(2U, bank.getNumClips());
+  for (size_t idx = 0; idx < 2; ++idx) {
+    EXPECT_EQ(decoded->channels, clips[idx]->channels);
+    EXPECT_EQ(decoded->rate, clips[idx]->rate);
+    EXPECT_EQ(decoded->numFrames, clips[idx]->numFrames);
+    EXPECT_TRUE(decoded->samples == clips[idx]->samples);
+  }
+  EXPECT_TRUE(ifstream(cacheFilePath).good());
+
+  // Once the clip has been released, it is loaded from the cache. This is
+  // checked by changing the last sample in the cache file.
+  clips.clear();
+  EXPECT_EQ(0U, bank.getNumClips());
+  {
+    fstream cache(cacheFilePath, ios::binary | ios::in | ios::out);
+    cache.seekp(-static_cast<streamoff>(sizeof(short)), ios::end);
+    short marker = 1234;
+    cache.write(reinterpret_cast<char *>(&marker), sizeof(short));
+  }
+  shared_ptr<const SoundClip> cached = bank.get("cachedsound.ogg");
+  EXPECT_EQ(decoded->samples.size(), cached->samples.size());
+  EXPECT_EQ(1234, cached->samples.back());
+  cached.reset();
+
+  // Modifying the ogg file invalidates the cache.
+  {
+    ofstream source("cachedsound.ogg", ios::binary | ios::app);
+    source.put(0);
+  }
+  cached = bank.get("cachedsound.ogg");
+  EXPECT_TRUE(decoded->samples == cached->samples);
+  cached.reset();
+  cached = bank.get("cachedsound.ogg");
+  EXPECT_TRUE(decoded->samples == cached->samples);
+
+  // Errors are rethrown.
+  paths.push_back("resources/sounds/missing.ogg");
+  EXPECT_THROW(bank.get(paths, jobSystem, clips), runtime_error);
+
+  remove(cacheFilePath.c_str());
+  remove(bank.getCacheFilePath("resources/sounds/bah.ogg").c_str());
+  remove("cachedsound.ogg");
+}
+
+TEST(SoundBankTest, Benchmark) {
+  const int numClips = 100;
+  vector<string> paths;
+  for (int idx = 0; idx < numClips; ++idx) {
+    paths.push_back("benchmarkclip" + to_string(idx) + ".ogg");
+    copyFile("resources/sounds/bah.ogg", paths.back());
+  }
+  vector<shared_ptr<const SoundClip> > clips;
+  JobSystem jobSystem;
+
+  auto start = chrono::high_resolution_clock::now();
+  {
+    SoundBank bank;
+    for (auto path = paths.begin(); path != paths.end(); ++path) {
+      clips.push_back(bank.get(*path));
+    }
+  }
+  double sequentialSeconds = chrono::duration<double>
+    (chrono::high_resolution_clock::now() - start).count();
+  clips.clear();
+
+  start = chrono::high_resolution_clock::now();
+  {
+    SoundBank bank;
+    bank.get(paths, jobSystem, clips);
+  }
+  double parallelSeconds = chrono::duration<double>
+    (chrono::high_resolution_clock::now() - start).count();
+  clips.clear();
+
+  SoundBank coldBank;
+  coldBank.setCacheDirectory(".");
+  start = chrono::high_resolution_clock::now();
+  coldBank.get(paths, jobSystem, clips);
+  double coldSeconds = chrono::duration<double>
+    (chrono::high_resolution_clock::now() - start).count();
+  vector<short> firstSamples = clips[0]->samples;
+  clips.clear();
+
+  SoundBank warmBank;
+  warmBank.setCacheDirectory(".");
+  start = chrono::high_resolution_clock::now();
+  warmBank.get(paths, jobSystem, clips);
+  double warmSeconds = chrono::duration<double>
+    (chrono::high_resolution_clock::now() - start).count();
+  EXPECT_TRUE(firstSamples == clips[0]->samples);
+  clips.clear();
+
+  cout << "Loading " << numClips << " clips on " <<
+    jobSystem.getNumThreads() << " threads - one by one: " <<
+    sequentialSeconds * 1000 << " ms, in parallel: " <<
+    parallelSeconds * 1000 << " ms, in parallel writing the cache: " <<
+    coldSeconds * 1000 << " ms, from the cache: " << warmSeconds * 1000 <<
+    " ms" << endl;
+
+  for (auto path = paths.begin(); path != paths.end(); ++path) {
+    remove(warmBank.getCacheFilePath(*path).c_str());
+    remove(path->c_str());
+  }
+}
+
+// An animated object, with copies of the cube as its frames
+static SceneObject createAnimatedObject(const int numFrames) {
+  for (int idx = 1; idx <= numFrames; ++idx) {
+    stringstream ss;
+    ss << "animatedcube_" << setfill('0') << setw(6) << idx << ".obj";
+    copyFile("resources/models/Cube/CubeNoTexture.obj", ss.str());
+  }
+  SceneObject object("animatedcube", "animatedcube", numFrames);
+  for (int idx = 1; idx <= numFrames; ++idx) {
+    stringstream ss;
+    ss << "animatedcube_" << setfill('0') << setw(6) << idx << ".obj";
+    remove(ss.str().c_str());
+  }
+  return object;
+}
+
+TEST(AnimationTest, TimeBased) {
+  SceneObject object = createAnimatedObject(10);
+  EXPECT_TRUE(object.isAnimated());
+  EXPECT_EQ(0, object.getCurrentFrame());
+
+  // The whole sequence, at 24 frames per second by default
+  object.startAnimating();
+  object.animate(0.5);
+  EXPECT_EQ(2, object.getCurrentFrame());
+  object.setFramesPerSecond(10.0);
+  EXPECT_EQ(2, object.getCurrentFrame());
+  object.animate(0.75);
+  EXPECT_EQ(9, object.getCurrentFrame());
+  object.animate(0.1);
+  EXPECT_EQ(0, object.getCurrentFrame());
+
+  object.addAnimation("walk", 0, 6, 10.0);
+  object.addAnimation("jump", 6, 4, 8.0, false);
+  EXPECT_THROW(object.addAnimation("fly", 8, 3, 10.0), runtime_error);
+  EXPECT_THROW(object.playAnimation("fly"), runtime_error);
+
+  object.playAnimation("walk");
+  EXPECT_EQ("walk", object.getAnimationName());
+  object.animate(0.25);
+  EXPECT_EQ(2, object.getCurrentFrame());
+  object.animate(0.75);
+  EXPECT_EQ(4, object.getCurrentFrame());
+
+  // Animations that do not repeat stop on their last frame.
+  object.playAnimation("jump");
+  EXPECT_EQ(6, object.getCurrentFrame());
+  object.animate(0.3);
+  EXPECT_EQ(8, object.getCurrentFrame());
+  EXPECT_TRUE(object.isAnimating());
+  object.animate(0.3);
+  EXPECT_EQ(9, object.getCurrentFrame());
+  EXPECT_FALSE(object.isAnimating());
+  object.animate(1.0);
+  EXPECT_EQ(9, object.getCurrentFrame());
+
+  // Counting calls still works, within the animation being played.
+  object.playAnimation("walk");
+  object.setFrameDelay(2);
+  for (int idx = 0; idx < 13; ++idx) object.animate();
+  EXPECT_EQ(0, object.getCurrentFrame());
+}
+
+TEST(AnimationTest, SameAtAnyFrameRate) {
+  SceneObject object = createAnimatedObject(10);
+  object.addAnimation("walk", 0, 6, 10.0);
+  object.addAnimation("jump", 6, 4, 7.0, false);
+
+  // The same objects, animated at 30, 60, 120 and 240 frames per second
+  // and at an irregular frame rate, all switch between animations at the
+  // same times and are compared every 1/30th of a second.
+  const int rates[] = {30, 60, 120, 240};
+  vector<SceneObject> objects(5, object);
+  minstd_rand random(3);
+  for (int step = 0; step < 300; ++step) {
+    if (step % 90 == 0) {
+      for (auto animated = objects.begin(); animated != objects.end();
+           ++animated) {
+        animated->playAnimation(step % 180 == 0 ? "walk" : "jump");
+      }
+    }
+    for (int idx = 0; idx < 4; ++idx) {
+      int subSteps = rates[idx] / 30;
+      for (int subStep = 0; subStep < subSteps; ++subStep) {
+        objects[idx].animate(1.0 / rates[idx]);
+      }
+    }
+    double remaining = 1.0 / 30;
+    while (remaining > 0.0) {
+      double seconds = min(remaining, 0.001 * (1 + random() % 20));
+      objects[4].animate(seconds);
+      remaining -= seconds;
+    }
+
+    for (int idx = 1; idx < 5; ++idx) {
+      EXPECT_EQ(objects[0].getCurrentFrame(),
+                objects[idx].getCurrentFrame());
+    }
+  }
+
+  // Animating many objects at once
+  vector<SceneObject> many(100, object);
+  vector<SceneObject*> pointers;
+  for (auto animated = many.begin(); animated != many.end(); ++animated) {
+    animated->playAnimation("walk");
+    pointers.push_back(&*animated);
+  }
+  SceneObject::animateAll(many.data(), 50, 0.35);
+  SceneObject::animateAll(pointers, 0.1);
+  for (size_t idx = 0; idx < many.size(); ++idx) {
+    EXPECT_EQ(idx < 50 ? 4 : 1, many[idx].getCurrentFrame());
+  }
+}
+
+TEST(AnimationTest, FrameBlending) {
+  // Two frames: the cube and the cube scaled by 2, with its normals
+  // reversed.
+  copyFile("resources/models/Cube/CubeNoTexture.obj",
+           "blendedcube_000001.obj");
+  {
+    ifstream source("resources/models/Cube/CubeNoTexture.obj");
+    ofstream scaled("blendedcube_000002.obj");
+    string line;
+    while (getline(source, line)) {
+      istringstream tokens(line);
+      string type;
+      tokens >> type;
+      float x, y, z;
+      if (type == "v" && tokens >> x >> y >> z) {
+        scaled << "v " << 2 * x << " " << 2 * y << " " << 2 * z << endl;
+      }
+      else if (type == "vn" && tokens >> x >> y >> z) {
+        scaled << "vn " << -x << " " << -y << " " << -z << endl;
+      }
+      else {
+        scaled << line << endl;
+      }
+    }
+  }
+  SceneObject object("blendedcube", "blendedcube", 2);
+  remove("blendedcube_000001.obj");
+  remove("blendedcube_000002.obj");
+
+  const vector<float> first = object.getModel().vertexData;
+  const vector<float> firstNormals = object.getModel().normalsData;
+  ASSERT_GT(first.size(), 0U);
+  vector<float> vertexData, normalsData;
+
+  object.setFramesPerSecond(4.0);
+  object.startAnimating();
+  object.animate(0.0625);
+  EXPECT_EQ(0, object.getCurrentFrame());
+  EXPECT_NEAR(0.25f, object.getFrameBlend(), 1e-5f);
+
+  // While blending, the box covers both frames.
+  glm::vec3 minCoords, maxCoords;
+  object.getBoundingCoords(minCoords, maxCoords);
+  EXPECT_NEAR(-2.0f, minCoords.x, 1e-5f);
+  EXPECT_NEAR(2.0f, maxCoords.y, 1e-5f);
+
+  object.getBlendedFrame(vertexData, normalsData);
+  ASSERT_EQ(first.size(), vertexData.size());
+  ASSERT_EQ(firstNormals.size(), normalsData.size());
+  for (size_t idx = 0; idx < first.size(); ++idx) {
+    // The w coordinate is 1 in both frames.
+    float expected = idx % 4 == 3 ? 1.0f : 1.25f * first[idx];
+    EXPECT_NEAR(expected, vertexData[idx], 1e-5f);
+  }
+  for (size_t idx = 0; idx < firstNormals.size(); ++idx) {
+    EXPECT_NEAR(0.5f * firstNormals[idx], normalsData[idx], 1e-5f);
+  }
+
+  // From the last frame, the animation blends towards the first one.
+  object.animate(0.25);
+  EXPECT_EQ(1, object.getCurrentFrame());
+  EXPECT_TRUE(object.getNextModel().vertexData == first);
+  object.getBlendedFrame(vertexData, normalsData);
+  for (size_t idx = 0; idx < first.size(); ++idx) {
+    float expected = idx % 4 == 3 ? 1.0f : 1.75f * first[idx];
+    EXPECT_NEAR(expected, vertexData[idx], 1e-5f);
+  }
+
+  // Without blending, the frame is displayed as it is.
+  object.setFrameBlending(false);
+  EXPECT_EQ(0.0f, object.getFrameBlend());
+  object.getBlendedFrame(vertexData, normalsData);
+  EXPECT_TRUE(vertexData == object.getModel().vertexData);
+  EXPECT_TRUE(normalsData == object.getModel().normalsData);
+  object.setFrameBlending(true);
+  object.animate();
+  EXPECT_EQ(0.0f, object.getFrameBlend());
+}
+
+TEST(SkeletonTest, Load) {
+  Skeleton skeleton("resources/models/Cube/Cube.skeleton");
+  EXPECT_EQ(2U, skeleton.getNumBones());
+  EXPECT_EQ(1, skeleton.getBoneIndex("top"));
+  EXPECT_EQ(-1, skeleton.getBoneIndex("arm"));
+  EXPECT_EQ(0, skeleton.getAnimationIndex("twist"));
+  EXPECT_EQ(1, skeleton.getAnimationIndex("stretch"));
+  EXPECT_EQ(-1, skeleton.getAnimationIndex("fly"));
+  EXPECT_EQ(1.0, skeleton.getAnimationDuration(1));
+  EXPECT_TRUE(skeleton.isAnimationRepeated(0));
+  EXPECT_FALSE(skeleton.isAnimationRepeated(1));
+  EXPECT_GT(skeleton.getDataByteSize(), 0U);
+
+  vector<glm::mat4> boneMatrices;
+  skeleton.getPose(-1, 0.0, boneMatrices);
+  ASSERT_EQ(2U, boneMatrices.size());
+  EXPECT_TRUE(boneMatrices[0] == glm::mat4(1.0f));
+  EXPECT_TRUE(boneMatrices[1] == glm::mat4(1.0f));
+
+  // Half way through stretching, the top has moved up by 1.
+  skeleton.getPose(1, 0.5, boneMatrices);
+  glm::vec4 moved = boneMatrices[1] * glm::vec4(1.0f, 1.0f, -1.0f, 1.0f);
+  EXPECT_NEAR(1.0f, moved.x, 1e-5f);
+  EXPECT_NEAR(2.0f, moved.y, 1e-5f);
+  EXPECT_NEAR(-1.0f, moved.z, 1e-5f);
+  glm::vec4 unmoved = boneMatrices[0] * glm::vec4(1.0f, -1.0f, -1.0f, 1.0f);
+  EXPECT_NEAR(-1.0f, unmoved.y, 1e-5f);
+
+  // After the last keyframe, the bones stay where it left them.
+  skeleton.getPose(1, 5.0, boneMatrices);
+  moved = boneMatrices[1] * glm::vec4(1.0f, 1.0f, -1.0f, 1.0f);
+  EXPECT_NEAR(3.0f, moved.y, 1e-5f);
+
+  EXPECT_THROW(Skeleton("nonexistent.skeleton"), runtime_error);
+  {
+    ofstream invalid("invalid.skeleton");
+    invalid << "b root -1 0 0 0 1 0 0 0" << endl;
+    invalid << "b child 2 0 1 0 1 0 0 0" << endl;
+  }
+  EXPECT_THROW(Skeleton("invalid.skeleton"), runtime_error);
+  {
+    ofstream invalid("invalid.skeleton");
+    invalid << "b root -1 0 0 0 1 0 0 0" << endl;
+    invalid << "w 1 1 1" << endl;
+  }
+  EXPECT_THROW(Skeleton("invalid.skeleton"), runtime_error);
+  remove("invalid.skeleton");
+
+  // Vertices copied for their texture coordinates get the weights of the
+  // original vertices.
+  Model model("resources/models/Cube/Cube.obj");
+  ASSERT_GT(model.copiedVertexIndices.size(), 0U);
+  skeleton.loadWeights(model);
+  size_t numVertices = model.vertexData.size() / 4;
+  ASSERT_EQ(4 * numVertices, model.boneIndexData.size());
+  ASSERT_EQ(4 * numVertices, model.boneWeightData.size());
+  for (size_t vertex = 0; vertex < numVertices; ++vertex) {
+    unsigned char expectedBone = model.vertexData[4 * vertex + 1] > 0.0f ?
+      1 : 0;
+    EXPECT_EQ(expectedBone, model.boneIndexData[4 * vertex]);
+    EXPECT_EQ(1.0f, model.boneWeightData[4 * vertex]);
+    EXPECT_EQ(0.0f, model.boneWeightData[4 * vertex + 1]);
+  }
+}
+
+TEST(AnimationTest, Skeletal) {
+  shared_ptr<const Skeleton> skeleton =
+    make_shared<Skeleton>("resources/models/Cube/Cube.skeleton");
+  SceneObject object("cube", "resources/models/Cube/Cube.obj");
+  const vector<float> vertexData = object.getModel().vertexData;
+  const vector<float> normalsData = object.getModel().normalsData;
+  EXPECT_FALSE(object.isAnimated());
+  object.setSkeleton(skeleton);
+  EXPECT_TRUE(object.isAnimated());
+  EXPECT_TRUE(object.getSkeleton() == skeleton);
+
+  object.playAnimation("stretch");
+  EXPECT_EQ("stretch", object.getAnimationName());
+  object.animate(0.5);
+  object.skin();
+  const vector<float> &skinnedVertexData = object.getSkinnedVertexData();
+  const vector<float> &skinnedNormalsData = object.getSkinnedNormalsData();
+  ASSERT_EQ(vertexData.size(), skinnedVertexData.size());
+  ASSERT_EQ(normalsData.size(), skinnedNormalsData.size());
+  for (size_t idx = 0; idx < vertexData.size(); ++idx) {
+    bool top = vertexData[idx - idx % 4 + 1] > 0.0f;
+    float expected = idx % 4 == 1 && top ? vertexData[idx] + 1.0f :
+      vertexData[idx];
+    EXPECT_NEAR(expected, skinnedVertexData[idx], 1e-5f);
+  }
+  for (size_t idx = 0; idx < normalsData.size(); ++idx) {
+    EXPECT_NEAR(normalsData[idx], skinnedNormalsData[idx], 1e-5f);
+  }
+
+  // Stretching does not repeat.
+  object.animate(0.75);
+  EXPECT_FALSE(object.isAnimating());
+  object.skin();
+  for (size_t idx = 1; idx < vertexData.size(); idx += 4) {
+    float expected = vertexData[idx] > 0.0f ? vertexData[idx] + 2.0f :
+      vertexData[idx];
+    EXPECT_NEAR(expected, skinnedVertexData[idx], 1e-5f);
+  }
+
+  // Twisting turns the top, with its normals, around the y axis. Half way
+  // through, it has turned by 45 degrees.
+  object.playAnimation("twist");
+  object.animate(1.5);
+  EXPECT_TRUE(object.isAnimating());
+  object.skin();
+  glm::mat4 turn = glm::rotate(glm::mat4(1.0f), glm::radians(45.0f),
+			       glm::vec3(0.0f, 1.0f, 0.0f));
+  size_t numVertices = vertexData.size() / 4;
+  for (size_t vertex = 0; vertex < numVertices; ++vertex) {
+    bool top = vertexData[4 * vertex + 1] > 0.0f;
+    glm::vec4 position(vertexData[4 * vertex], vertexData[4 * vertex + 1],
+		       vertexData[4 * vertex + 2], 1.0f);
+    glm::vec4 normal(normalsData[3 * vertex], normalsData[3 * vertex + 1],
+		     normalsData[3 * vertex + 2], 0.0f);
+    if (top) {
+      position = turn * position;
+      normal = turn * normal;
+    }
+    for (size_t idx = 0; idx < 4; ++idx) {
+      EXPECT_NEAR(position[static_cast<int>(idx)],
+		  skinnedVertexData[4 * vertex + idx], 1e-5f);
+    }
+    for (size_t idx = 0; idx < 3; ++idx) {
+      EXPECT_NEAR(normal[static_cast<int>(idx)],
+		  skinnedNormalsData[3 * vertex + idx], 1e-5f);
+    }
+  }
+
+  // Skeletal keyframes are timed in seconds, so changing the frames per
+  // second does not apply and does not move the pose.
+  const vector<float> twistedVertexData = skinnedVertexData;
+  EXPECT_THROW(object.setFramesPerSecond(30.0), runtime_error);
+  object.animate(0.0);
+  object.skin();
+  for (size_t idx = 0; idx < twistedVertexData.size(); ++idx) {
+    EXPECT_NEAR(twistedVertexData[idx], skinnedVertexData[idx], 1e-5f);
+  }
+
+  // "" is the pose in which the model has been exported.
+  object.playAnimation("");
+  object.animate(0.5);
+  object.skin();
+  for (size_t idx = 0; idx < vertexData.size(); ++idx) {
+    EXPECT_NEAR(vertexData[idx], skinnedVertexData[idx], 1e-5f);
+  }
+
+  SceneObject animatedObject = createAnimatedObject(2);
+  EXPECT_THROW(animatedObject.setSkeleton(skeleton), runtime_error);
+
+  {
+    ofstream tooManyVertices("toomanyvertices.skeleton");
+    tooManyVertices << "b root -1 0 0 0 1 0 0 0" << endl;
+    tooManyVertices << "w 20 0 1" << endl;
+  }
+  SceneObject cube("cube", "resources/models/Cube/CubeNoTexture.obj");
+  EXPECT_THROW(cube.setSkeleton(make_shared<Skeleton>
+				("toomanyvertices.skeleton")),
+	       runtime_error);
+  remove("toomanyvertices.skeleton");
+}
+
+TEST(AnimationTest, SkinningBenchmark) {
+  // A grid of vertices, moved by a chain of bones along the y axis. Each
+  // vertex moves with the two nearest bones.
+  const int gridSize = 64;
+  const int numBones = 8;
+  {
+    ofstream grid("skinnedgrid.obj");
+    grid << "vn 0 0 1" << endl;
+    for (int row = 0; row < gridSize; ++row) {
+      for (int column = 0; column < gridSize; ++column) {
+        grid << "v " << column * 0.1f << " " << row * 0.1f << " 0" << endl;
+      }
+    }
+    for (int row = 0; row + 1 < gridSize; ++row) {
+      for (int column = 0; column + 1 < gridSize; ++column) {
+        int corner = row * gridSize + column + 1;
+        grid << "f " << corner << "//1 " << corner + 1 << "//1 " <<
+	  corner + gridSize << "//1" << endl;
+        grid << "f " << corner + 1 << "//1 " << corner + gridSize + 1 <<
+	  "//1 " << corner + gridSize << "//1" << endl;
+      }
+    }
+    ofstream skeletonFile("skinnedgrid.skeleton");
+    float boneLength = gridSize * 0.1f / numBones;
+    for (int bone = 0; bone < numBones; ++bone) {
+      skeletonFile << "b bone" << bone << " " << bone - 1 << " 0 " <<
+	(bone == 0 ? 0.0f : boneLength) << " 0 1 0 0 0" << endl;
+    }
+    for (int row = 0; row < gridSize; ++row) {
+      float along = row * 0.1f / boneLength;
+      int bone = min(static_cast<int>(along), numBones - 2);
+      float weight = min(1.0f, along - bone);
+      for (int column = 0; column < gridSize; ++column) {
+        skeletonFile << "w " << row * gridSize + column + 1 << " " << bone <<
+	  " " << 1.0f - weight << " " << bone + 1 << " " << weight << endl;
+      }
+    }
+    skeletonFile << "a wave 1 1" << endl;
+    for (int bone = 1; bone < numBones; ++bone) {
+      skeletonFile << "k 0 " << bone << " 0 " << boneLength <<
+	" 0 1 0 0 0" << endl;
+      skeletonFile << "k 0.5 " << bone << " 0 " << boneLength <<
+	" 0 0.9659258 0 0 0.2588190" << endl;
+      skeletonFile << "k 1 " << bone << " 0 " << boneLength <<
+	" 0 1 0 0 0" << endl;
+    }
+  }
+  shared_ptr<const Skeleton> skeleton =
+    make_shared<Skeleton>("skinnedgrid.skeleton");
+  SceneObject character("character", "skinnedgrid.obj");
+  remove("skinnedgrid.obj");
+  remove("skinnedgrid.skeleton");
+  character.setSkeleton(skeleton);
+  character.playAnimation("wave");
+
+  const size_t numCharacters = 200;
+  vector<SceneObject> characters(numCharacters, character);
+  vector<SceneObject*> pointers;
+  for (size_t idx = 0; idx < numCharacters; ++idx) {
+    characters[idx].animate(0.001 + 0.01 * idx);
+    pointers.push_back(&characters[idx]);
+  }
+
+  // The first time, the memory for the skinned vertices is allocated.
+  JobSystem jobSystem;
+  SceneObject::skinAll(pointers, jobSystem);
+
+  SceneObject::animateAll(pointers, 1.0 / 60);
+  auto start = chrono::high_resolution_clock::now();
+  for (auto object = pointers.begin(); object != pointers.end(); ++object) {
+    (*object)->skin();
+  }
+  double sequentialSeconds = chrono::duration<double>
+    (chrono::high_resolution_clock::now() - start).count();
+
+  SceneObject::animateAll(pointers, 1.0 / 60);
+  start = chrono::high_resolution_clock::now();
+  SceneObject::skinAll(pointers, jobSystem);
+  double parallelSeconds = chrono::duration<double>
+    (chrono::high_resolution_clock::now() - start).count();
+
+  // The vertices are moved by the weighted bone matrices.
+  const Model &model = characters[37].getModel();
+  const vector<glm::mat4> &boneMatrices = characters[37].getBoneMatrices();
+  const vector<float> &skinnedVertexData =
+    characters[37].getSkinnedVertexData();
+  size_t numVertices = model.vertexData.size() / 4;
+  ASSERT_EQ(model.vertexData.size(), skinnedVertexData.size());
+  for (size_t vertex = 0; vertex < numVertices; vertex += 97) {
+    glm::vec4 position(model.vertexData[4 * vertex],
+		       model.vertexData[4 * vertex + 1],
+		       model.vertexData[4 * vertex + 2], 1.0f);
+    glm::vec4 expected(0.0f);
+    for (size_t idx = 4 * vertex; idx < 4 * vertex + 4; ++idx) {
+      expected += model.boneWeightData[idx] *
+	(boneMatrices[model.boneIndexData[idx]] * position);
+    }
+    for (size_t idx = 0; idx < 4; ++idx) {
+      EXPECT_NEAR(expected[static_cast<int>(idx)],
+		  skinnedVertexData[4 * vertex + idx], 1e-4f);
+    }
+  }
+
+  // One second at 24 frames per second, one model per frame, against a
+  // single model, with its bones and the skinned vertices
+  size_t modelBytes = static_cast<size_t>(model.vertexDataByteSize +
+					  model.normalsDataByteSize +
+					  model.indexDataByteSize);
+  size_t frameBytes = numCharacters * 24 * modelBytes;
+  size_t skeletalBytes = skeleton->getDataByteSize();
+  for (auto object = characters.begin(); object != characters.end();
+       ++object) {
+    const Model &objectModel = object->getModel();
+    skeletalBytes += modelBytes + objectModel.boneIndexData.size() +
+      objectModel.boneWeightData.size() * sizeof(float) +
+      (object->getSkinnedVertexData().size() +
+       object->getSkinnedNormalsData().size()) * sizeof(float) +
+      object->getBoneMatrices().size() * sizeof(glm::mat4);
+  }
+  EXPECT_LT(skeletalBytes, frameBytes / 10);
+
+  cout << "Skinning " << numCharacters << " characters of " << numVertices <<
+    " vertices - one by one: " << sequentialSeconds * 1000 <<
+    " ms, in parallel on " << jobSystem.getNumThreads() << " threads: " <<
+    parallelSeconds * 1000 << " ms. Memory: " << skeletalBytes / 1024 <<
+    " KB, against " << frameBytes / 1024 << " KB for 24 frames each" << endl;
+}
+
+TEST(RendererTest, SkinnedObject) {
+  Renderer *renderer = &getTestRenderer();
+  SceneObject object("cube", "resources/models/Cube/CubeNoTexture.obj");
+  object.setSkeleton(make_shared<Skeleton>
+		     ("resources/models/Cube/Cube.skeleton"));
+  object.offset = glm::vec3(0.0f, -1.0f, -8.0f);
+  object.playAnimation("twist");
+  object.animate(0.25);
+
+  renderer->clearScreen();
+  renderer->render(object, glm::vec4(1.0f, 1.0f, 1.0f, 1.0f));
+  object.animate(0.25);
+  renderer->render(object, glm::vec4(1.0f, 0.0f, 1.0f, 1.0f));
+  renderer->swapBuffers();
+  EXPECT_EQ(2U, renderer->getFrameStats().numDrawCalls);
+  renderer->clearBuffers(object.getModel());
+  EXPECT_EQ(0U, object.getModel().boneIndexBufferObjectId);
+}
+
+TEST(LodTest, SimplifyFlatGrid) {
+  // A flat, square grid can be reduced to a couple of triangles without
+  // moving its surface or its borders.
+  const int gridSize = 32;
+  {
+    ofstream grid("flatgrid.obj");
+    grid << "vn 0 0 1" << endl;
+    for (int row = 0; row < gridSize; ++row) {
+      for (int column = 0; column < gridSize; ++column) {
+        grid << "v " << column * 0.1f << " " << row * 0.1f << " 0" << endl;
+      }
+    }
+    for (int row = 0; row + 1 < gridSize; ++row) {
+      for (int column = 0; column + 1 < gridSize; ++column) {
+        int corner = row * gridSize + column + 1;
+        grid << "f " << corner << "//1 " << corner + 1 << "//1 " <<
+	  corner + gridSize << "//1" << endl;
+        grid << "f " << corner + 1 << "//1 " << corner + gridSize + 1 <<
+	  "//1 " << corner + gridSize << "//1" << endl;
+      }
+    }
+  }
+  Model model("flatgrid.obj");
+  remove("flatgrid.obj");
+
+  vector<unsigned int> simplifiedIndexData;
+  float error = model.simplify(0, 1e-4f, simplifiedIndexData);
+  EXPECT_LT(error, 1e-4f);
+  size_t numTriangles = simplifiedIndexData.size() / 3;
+  EXPECT_GT(numTriangles, 0U);
+  EXPECT_LE(numTriangles, 8U);
+
+  // The remaining triangles cover the whole grid, facing the same way.
+  glm::vec3 minCoords(FLT_MAX), maxCoords(-FLT_MAX);
+  float area = 0.0f;
+  for (size_t idx = 0; idx < simplifiedIndexData.size(); idx += 3) {
+    glm::vec3 corners[3];
+    for (size_t corner = 0; corner < 3; ++corner) {
+      unsigned int vertex = simplifiedIndexData[idx + corner];
+      corners[corner] = glm::vec3(model.vertexData[4 * vertex],
+				  model.vertexData[4 * vertex + 1],
+				  model.vertexData[4 * vertex + 2]);
+      EXPECT_EQ(0.0f, corners[corner].z);
+      minCoords = glm::min(minCoords, corners[corner]);
+      maxCoords = glm::max(maxCoords, corners[corner]);
+    }
+    glm::vec3 normal = glm::cross(corners[1] - corners[0],
+				  corners[2] - corners[0]);
+    EXPECT_GT(normal.z, 0.0f);
+    area += normal.z / 2.0f;
+  }
+  EXPECT_NEAR(model.minCoords.x, minCoords.x, 1e-6f);
+  EXPECT_NEAR(model.minCoords.y, minCoords.y, 1e-6f);
+  EXPECT_NEAR(model.maxCoords.x, maxCoords.x, 1e-6f);
+  EXPECT_NEAR(model.maxCoords.y, maxCoords.y, 1e-6f);
+  float side = (gridSize - 1) * 0.1f;
+  EXPECT_NEAR(side * side, area, 1e-3f);
+}
+
+TEST(LodTest, SimplifySphereWithinError) {
+  // A sphere of radius 1, which cannot be simplified without moving its
+  // surface
+  writeSphere("lodsphere.obj", 32, 64, 0.0);
+  Model model("lodsphere.obj");
+  remove("lodsphere.obj");
+
+  // How far the points of the triangles are from the sphere
+  auto deviation = [&model](const vector<unsigned int> &indexData) {
+    float largest = 0.0f;
+    for (size_t idx = 0; idx < indexData.size(); idx += 3) {
+      glm::vec3 corners[3];
+      for (size_t corner = 0; corner < 3; ++corner) {
+        unsigned int vertex = indexData[idx + corner];
+        corners[corner] = glm::vec3(model.vertexData[4 * vertex],
+				    model.vertexData[4 * vertex + 1],
+				    model.vertexData[4 * vertex + 2]);
+      }
+      for (int u = 0; u <= 4; ++u) {
+        for (int v = 0; u + v <= 4; ++v) {
+          glm::vec3 point = corners[0] +
+	    (corners[1] - corners[0]) * (u / 4.0f) +
+	    (corners[2] - corners[0]) * (v / 4.0f);
+          largest = max(largest, abs(1.0f - glm::length(point)));
+        }
+      }
+    }
+    return largest;
+  };
+  float originalDeviation = deviation(model.indexData);
+
+  size_t numTriangles = model.indexData.size() / 3;
+  const float maxErrors[] = {0.005f, 0.02f, 0.08f};
+  size_t previousNumTriangles = numTriangles;
+  for (const float maxError : maxErrors) {
+    vector<unsigned int> simplifiedIndexData;
+    float error = model.simplify(0, maxError, simplifiedIndexData);
+    size_t numSimplified = simplifiedIndexData.size() / 3;
+    float simplifiedDeviation = deviation(simplifiedIndexData);
+
+    // The error stays within the limit and more of it means fewer
+    // triangles. The surface does not move away from the sphere by more
+    // than the error, besides the deviation of the original triangles.
+    EXPECT_LE(error, maxError);
+    EXPECT_GT(error, 0.0f);
+    EXPECT_LT(numSimplified, previousNumTriangles);
+    EXPECT_LE(simplifiedDeviation, originalDeviation + error);
+    cout << "Sphere simplified to " << numSimplified << " of " <<
+      numTriangles << " triangles, error " << error << " (limit " <<
+      maxError << "), largest deviation from the sphere " <<
+      simplifiedDeviation << endl;
+    previousNumTriangles = numSimplified;
+  }
+
+  // A fixed number of triangles
+  vector<unsigned int> simplifiedIndexData;
+  model.simplify(numTriangles / 10, FLT_MAX, simplifiedIndexData);
+  EXPECT_LE(simplifiedIndexData.size() / 3, numTriangles / 10);
+  EXPECT_GE(simplifiedIndexData.size() / 3 + 4, numTriangles / 10);
+
+  // Levels of detail
+  model.generateLods(4, 0.5f);
+  ASSERT_EQ(4U, model.lodIndexData.size());
+  ASSERT_EQ(4U, model.lodErrors.size());
+  previousNumTriangles = numTriangles;
+  float previousError = 0.0f;
+  for (size_t level = 0; level < model.lodIndexData.size(); ++level) {
+    size_t levelTriangles = model.lodIndexData[level].size() / 3;
+    EXPECT_LE(levelTriangles, previousNumTriangles / 2);
+    EXPECT_GE(levelTriangles + 4, previousNumTriangles / 2);
+    EXPECT_GE(model.lodErrors[level], previousError);
+    previousNumTriangles = levelTriangles;
+    previousError = model.lodErrors[level];
+  }
+  EXPECT_THROW(model.generateLods(2, 1.5f), runtime_error);
+}
+
+TEST(LodTest, SelectWithHysteresis) {
+  SceneObject object("cube", "resources/models/Cube/CubeNoTexture.obj");
+  EXPECT_EQ(0, object.selectLod(0.01f));
+
+  object.generateLods(1, 0.5f);
+  ASSERT_EQ(1U, object.getModel().lodIndexData.size());
+
+  // By default, level 1 is used below 0.5.
+  EXPECT_EQ(0, object.selectLod(0.8f));
+  EXPECT_EQ(0, object.selectLod(0.47f));
+  EXPECT_EQ(1, object.selectLod(0.44f));
+  EXPECT_EQ(1, object.getLod());
+  EXPECT_EQ(1, object.selectLod(0.53f));
+  EXPECT_EQ(0, object.selectLod(0.56f));
+  EXPECT_EQ(1, object.selectLod(0.01f));
+
+  // There are no more levels than the model has.
+  object.setLodScreenSizes({0.3f, 0.2f});
+  EXPECT_EQ(0, object.selectLod(0.4f));
+  EXPECT_EQ(0, object.selectLod(0.28f));
+  EXPECT_EQ(1, object.selectLod(0.1f));
+  EXPECT_THROW(object.setLodScreenSizes({0.2f, 0.3f}), runtime_error);
+}
+
+TEST(RendererTest, LodBenchmark) {
+  // A field of spheres, moving away from the camera, rendered with and
+  // without levels of detail
+  writeSphere("lodbenchmark.obj", 24, 48);
+  SceneObject detailed("detailed", "lodbenchmark.obj");
+  SceneObject simplified("simplified", "lodbenchmark.obj");
+  remove("lodbenchmark.obj");
+
+  auto start = chrono::high_resolution_clock::now();
+  simplified.generateLods(4, 0.5f);
+  double lodSeconds = chrono::duration<double>
+    (chrono::high_resolution_clock::now() - start).count();
+
+  const int numRows = 10, numColumns = 10;
+  Renderer *renderer = &getTestRenderer();
+  FrameStats stats[2];
+  SceneObject *objects[2] = {&detailed, &simplified};
+  renderer->swapBuffers();
+  for (int idx = 0; idx < 2; ++idx) {
+    renderer->clearScreen();
+    for (int row = 0; row < numRows; ++row) {
+      for (int column = 0; column < numColumns; ++column) {
+        objects[idx]->offset = glm::vec3(3.0f * (column - numColumns / 2),
+					 -2.0f, -4.0f - 6.0f * row);
+        renderer->render(*objects[idx], glm::vec4(1.0f, 1.0f, 1.0f, 1.0f));
+      }
+    }
+    renderer->swapBuffers();
+    stats[idx] = renderer->getFrameStats();
+  }
+  EXPECT_EQ(0U, stats[0].numTrianglesSavedByLod);
+  EXPECT_GT(stats[1].numTrianglesSavedByLod, stats[1].numTriangles);
+  EXPECT_EQ(stats[0].numTriangles, stats[1].numTriangles +
+	    stats[1].numTrianglesSavedByLod);
+  EXPECT_EQ(stats[0].numDrawCalls, stats[1].numDrawCalls);
+
+  // Levels generated again, with as many levels as before, are uploaded
+  // again.
+  simplified.generateLods(4, 0.25f);
+  Model &simplifiedModel = simplified.getModel();
+  EXPECT_TRUE(simplifiedModel.lodIndexBuffersStale);
+  renderer->render(simplified, glm::vec4(1.0f, 1.0f, 1.0f, 1.0f));
+  renderer->swapBuffers();
+  EXPECT_FALSE(simplifiedModel.lodIndexBuffersStale);
+  ASSERT_EQ(simplifiedModel.lodIndexData.size(),
+	    simplifiedModel.lodIndexBufferObjectIds.size());
+  for (size_t level = 0; level < simplifiedModel.lodIndexData.size();
+       ++level) {
+    GLint bufferSize = 0;
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,
+		 simplifiedModel.lodIndexBufferObjectIds[level]);
+    glGetBufferParameteriv(GL_ELEMENT_ARRAY_BUFFER, GL_BUFFER_SIZE,
+			   &bufferSize);
+    EXPECT_EQ(simplifiedModel.lodIndexData[level].size() *
+	      sizeof(unsigned int), static_cast<size_t>(bufferSize));
+  }
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+  renderer->clearBuffers(simplified.getModel());
+  EXPECT_TRUE(simplified.getModel().lodIndexBufferObjectIds.empty());
+  renderer->clearBuffers(detailed.getModel());
+
+  cout << "Levels of detail generated in " << lodSeconds * 1000 <<
+    " ms. Rendering " << numRows * numColumns << " spheres of " <<
+    detailed.getModel().indexData.size() / 3 << " triangles: " <<
+    stats[0].numTriangles << " triangles without levels of detail, " <<
+    stats[1].numTriangles << " with them (" <<
+    stats[1].numTrianglesSavedByLod << " saved per frame), " <<
+    stats[0].modelMilliseconds << " ms against " <<
+    stats[1].modelMilliseconds << " ms" << endl;
+}
+
+// Write a square wall, 10 units wide and high, on the xy plane, centred at
+// the origin, to a Wavefront file.
+static void writeWall(const string &fileLocation) {
+  ofstream file(fileLocation.c_str());
+  file << "v -5 -5 0" << endl << "v 5 -5 0" << endl << "v 5 5 0" << endl <<
+    "v -5 5 0" << endl << "vn 0 0 1" << endl;
+  file << "f 1//1 2//1 3//1" << endl << "f 1//1 3//1 4//1" << endl;
+}
+
+TEST(OcclusionBufferTest, WallHidesObjects) {
+  writeWall("occlusionwall.obj");
+  SceneObject wall("wall", "occlusionwall.obj");
+  remove("occlusionwall.obj");
+  wall.offset = glm::vec3(0.0f, 0.0f, -10.0f);
+  const Model cube("resources/models/Cube/CubeNoTexture.obj");
+
+  OcclusionBuffer buffer(254, 190, 1.0f, 4.0f / 3.0f, 1.0f, -1.0f);
+  EXPECT_EQ(256, buffer.getWidth());
+  EXPECT_EQ(190, buffer.getHeight());
+
+  // Nothing hides anything yet.
+  EXPECT_TRUE(buffer.isVisible(cube.minCoords, cube.maxCoords,
+			       glm::vec3(0.0f, 0.0f, -20.0f),
+			       glm::vec3(0.0f)));
+
+  vector<SceneObject*> occluders = {&wall};
+  buffer.draw(occluders);
+
+  EXPECT_NEAR(10.0f, buffer.getDepth(128, 95), 1e-3f);
+  EXPECT_EQ(FLT_MAX, buffer.getDepth(0, 0));
+  EXPECT_THROW(buffer.getDepth(256, 0), runtime_error);
+
+  // Behind the wall, in front of it, next to it, behind the camera, beside
+  // it and crossing the near plane
+  EXPECT_FALSE(buffer.isVisible(cube.minCoords, cube.maxCoords,
+				glm::vec3(0.0f, 0.0f, -20.0f),
+				glm::vec3(0.0f, 0.7f, 0.3f)));
+  EXPECT_FALSE(buffer.isVisible(cube.minCoords, cube.maxCoords,
+				glm::vec3(4.0f, -3.0f, -15.0f),
+				glm::vec3(0.0f)));
+  EXPECT_TRUE(buffer.isVisible(cube.minCoords, cube.maxCoords,
+			       glm::vec3(0.0f, 0.0f, -5.0f),
+			       glm::vec3(0.0f)));
+  EXPECT_TRUE(buffer.isVisible(cube.minCoords, cube.maxCoords,
+			       glm::vec3(12.0f, 0.0f, -20.0f),
+			       glm::vec3(0.0f)));
+  EXPECT_FALSE(buffer.isVisible(cube.minCoords, cube.maxCoords,
+				glm::vec3(0.0f, 0.0f, 10.0f),
+				glm::vec3(0.0f)));
+  EXPECT_FALSE(buffer.isVisible(cube.minCoords, cube.maxCoords,
+				glm::vec3(100.0f, 0.0f, -10.0f),
+				glm::vec3(0.0f)));
+  EXPECT_TRUE(buffer.isVisible(cube.minCoords, cube.maxCoords,
+			       glm::vec3(0.0f, 0.0f, -1.0f),
+			       glm::vec3(0.0f)));
+
+  // The wall seen from behind still hides what is behind it.
+  buffer.setCamera(glm::vec3(0.0f, 0.0f, -30.0f),
+		   glm::vec3(0.0f, 3.14159265f, 0.0f));
+  buffer.draw(occluders);
+  EXPECT_NEAR(20.0f, buffer.getDepth(128, 95), 1e-3f);
+  EXPECT_FALSE(buffer.isVisible(cube.minCoords, cube.maxCoords,
+				glm::vec3(0.0f, 0.0f, 0.0f),
+				glm::vec3(0.0f)));
+  EXPECT_TRUE(buffer.isVisible(cube.minCoords, cube.maxCoords,
+			       glm::vec3(0.0f, 0.0f, -20.0f),
+			       glm::vec3(0.0f)));
+}
+
+TEST(OcclusionBufferTest, ObjectPastWallEdge) {
+  // The right edge of the wall is on pixel 192, right of its centre, so the
+  // pixel is drawn as covered.
+  writeWall("occlusionwall.obj");
+  SceneObject wall("wall", "occlusionwall.obj");
+  remove("occlusionwall.obj");
+  wall.offset = glm::vec3(0.05f, 0.0f, -10.0f);
+
+  OcclusionBuffer buffer(256, 190, 1.0f, 4.0f / 3.0f);
+  vector<SceneObject*> occluders = {&wall};
+  buffer.draw(occluders);
+  EXPECT_NEAR(10.0f, buffer.getDepth(192, 95), 1e-3f);
+  EXPECT_EQ(FLT_MAX, buffer.getDepth(193, 95));
+
+  // A small object behind the wall, showing past its edge within that
+  // pixel, is visible. Further in, it is hidden.
+  const glm::vec3 minCoords(-0.005f), maxCoords(0.005f);
+  EXPECT_TRUE(buffer.isVisible(minCoords, maxCoords,
+			       glm::vec3(10.11f, 0.0f, -20.0f),
+			       glm::vec3(0.0f)));
+  EXPECT_FALSE(buffer.isVisible(minCoords, maxCoords,
+				glm::vec3(9.9f, 0.0f, -20.0f),
+				glm::vec3(0.0f)));
+}
+
+TEST(OcclusionBufferTest, SkinnedObjects) {
+  // A cube just hidden behind a wall, until its top is stretched above it
+  writeWall("occlusionwall.obj");
+  SceneObject wall("wall", "occlusionwall.obj");
+  remove("occlusionwall.obj");
+  wall.offset = glm::vec3(0.0f, 0.0f, -10.0f);
+  SceneObject cube("cube", "resources/models/Cube/CubeNoTexture.obj");
+  cube.setSkeleton(make_shared<Skeleton>
+		   ("resources/models/Cube/Cube.skeleton"));
+  cube.offset = glm::vec3(0.0f, 7.0f, -20.0f);
+
+  OcclusionBuffer buffer(256, 190, 1.0f, 4.0f / 3.0f);
+  vector<SceneObject*> occluders = {&wall};
+  buffer.draw(occluders);
+  EXPECT_FALSE(buffer.isVisible(cube));
+
+  cube.playAnimation("stretch");
+  cube.animate(1.0);
+  glm::vec3 minCoords, maxCoords;
+  cube.getBoundingCoords(minCoords, maxCoords);
+  EXPECT_NEAR(-1.0f, minCoords.y, 1e-4f);
+  EXPECT_NEAR(3.0f, maxCoords.y, 1e-4f);
+  EXPECT_TRUE(buffer.isVisible(cube));
+
+  // Skinned occluders are drawn as posed: the stretched cube, placed in
+  // front of the camera, covers the pixels above its model as loaded.
+  cube.offset = glm::vec3(0.0f, 0.0f, -10.0f);
+  occluders[0] = &cube;
+  buffer.draw(occluders);
+  EXPECT_NEAR(9.0f, buffer.getDepth(128, 95 + 25), 1e-3f);
+}
+
+TEST(OcclusionBufferTest, PerspectiveCorrectDepth) {
+  // A wall turned away from the camera. The depth at the centre of each
+  // pixel is where the ray through it meets the plane of the wall.
+  writeWall("occlusionwall.obj");
+  SceneObject wall("wall", "occlusionwall.obj");
+  remove("occlusionwall.obj");
+  wall.offset = glm::vec3(1.0f, -0.5f, -12.0f);
+  wall.rotation = glm::vec3(0.3f, 0.9f, 0.0f);
+
+  const float frustumScale = 1.5f, aspectRatio = 16.0f / 9.0f;
+  OcclusionBuffer buffer(160, 90, frustumScale, aspectRatio, 1.0f, -1.0f);
+  vector<SceneObject*> occluders = {&wall};
+  buffer.draw(occluders);
+
+  glm::mat3 rotationMatrix =
+    glm::mat3(glm::rotate(glm::mat4(1.0f), -wall.rotation.y,
+			  glm::vec3(0.0f, 1.0f, 0.0f)) *
+	      glm::rotate(glm::mat4(1.0f), -wall.rotation.x,
+			  glm::vec3(1.0f, 0.0f, 0.0f)));
+  glm::vec3 normal = rotationMatrix * glm::vec3(0.0f, 0.0f, 1.0f);
+
+  int numCovered = 0;
+  for (int y = 0; y < buffer.getHeight(); ++y) {
+    for (int x = 0; x < buffer.getWidth(); ++x) {
+      float depth = buffer.getDepth(x, y);
+      if (depth == FLT_MAX) continue;
+      ++numCovered;
+      glm::vec3 direction((2.0f * (x + 0.5f) / buffer.getWidth() - 1.0f) /
+			  frustumScale,
+			  (2.0f * (y + 0.5f) / buffer.getHeight() - 1.0f) /
+			  (frustumScale * aspectRatio), -1.0f);
+      float expected = glm::dot(normal, wall.offset) /
+	glm::dot(normal, direction);
+      ASSERT_NEAR(expected, depth, expected * 1e-4f);
+    }
+  }
+  EXPECT_GT(numCovered, 1000);
+}
+
+TEST(OcclusionBufferTest, ParallelBenchmark) {
+  // A level made of rooms: a grid of walls and many small objects among
+  // them, seen from one end
+  writeWall("occlusionwall.obj");
+  vector<SceneObject> walls;
+  for (int row = 0; row < 6; ++row) {
+    for (int column = -3; column <= 3; ++column) {
+      SceneObject wall("wall", "occlusionwall.obj");
+      wall.offset = glm::vec3(10.0f * column, 0.0f, -8.0f - 12.0f * row);
+      // Doorways between the rooms
+      if ((row + column) % 3 == 0) wall.offset.y = 9.0f;
+      walls.push_back(wall);
+      wall.offset += glm::vec3(5.0f, 0.0f, -6.0f);
+      wall.rotation = glm::vec3(0.0f, 1.5707963f, 0.0f);
+      walls.push_back(wall);
+    }
+  }
+  remove("occlusionwall.obj");
+  vector<SceneObject*> occluders;
+  for (auto wall = walls.begin(); wall != walls.end(); ++wall) {
+    occluders.push_back(&*wall);
+  }
+
+  const Model cube("resources/models/Cube/CubeNoTexture.obj");
+  const int numObjects = 2000;
+  vector<glm::vec3> offsets(numObjects);
+  mt19937 generator(77);
+  uniform_real_distribution<float> across(-30.0f, 30.0f);
+  uniform_real_distribution<float> along(-80.0f, -2.0f);
+  uniform_real_distribution<float> up(-4.0f, 4.0f);
+  for (int idx = 0; idx < numObjects; ++idx) {
+    offsets[idx] = glm::vec3(across(generator), up(generator),
+			     along(generator));
+  }
+
+  OcclusionBuffer single(256, 144, 1.0f, 16.0f / 9.0f);
+  OcclusionBuffer parallel(256, 144, 1.0f, 16.0f / 9.0f);
+  single.setCamera(glm::vec3(0.0f, 0.0f, 5.0f), glm::vec3(0.0f, 0.1f, 0.0f));
+  parallel.setCamera(glm::vec3(0.0f, 0.0f, 5.0f),
+		     glm::vec3(0.0f, 0.1f, 0.0f));
+  JobSystem jobSystem;
+
+  const int numRepetitions = 20;
+  auto start = chrono::high_resolution_clock::now();
+  for (int repetition = 0; repetition < numRepetitions; ++repetition) {
+    single.draw(occluders);
+  }
+  double singleSeconds = chrono::duration<double>
+    (chrono::high_resolution_clock::now() - start).count() / numRepetitions;
+
+  start = chrono::high_resolution_clock::now();
+  for (int repetition = 0; repetition < numRepetitions; ++repetition) {
+    parallel.draw(occluders, jobSystem);
+  }
+  double parallelSeconds = chrono::duration<double>
+    (chrono::high_resolution_clock::now() - start).count() / numRepetitions;
+
+  for (int y = 0; y < single.getHeight(); ++y) {
+    for (int x = 0; x < single.getWidth(); ++x) {
+      ASSERT_EQ(single.getDepth(x, y), parallel.getDepth(x, y));
+    }
+  }
+
+  start = chrono::high_resolution_clock::now();
+  int numCulled = 0;
+  for (int idx = 0; idx < numObjects; ++idx) {
+    if (!single.isVisible(cube.minCoords, cube.maxCoords, offsets[idx],
+			  glm::vec3(0.0f))) {
+      ++numCulled;
+    }
+  }
+  double testSeconds = chrono::duration<double>
+    (chrono::high_resolution_clock::now() - start).count();
+  EXPECT_GT(numCulled, numObjects / 2);
+  EXPECT_LT(numCulled, numObjects);
+
+  cout << "Occlusion buffer " << single.getWidth() << "x" <<
+    single.getHeight() << ", " << occluders.size() << " walls drawn in " <<
+    singleSeconds * 1000 << " ms (on " << jobSystem.getNumThreads() <<
+    " threads: " << parallelSeconds * 1000 << " ms). " << numCulled <<
+    " of " << numObjects << " objects culled, checked in " <<
+    testSeconds * 1000 << " ms" << endl;
+}
+
+TEST(RendererTest, OcclusionCulling) {
+  Renderer *renderer = &getTestRenderer();
+
+  // The camera looks along the x axis, at a wall with a cube in front of it
+  // and one behind it.
+  writeWall("occlusionwall.obj");
+  SceneObject wall("wall", "occlusionwall.obj");
+  remove("occlusionwall.obj");
+  wall.offset = glm::vec3(10.0f, 0.0f, 0.0f);
+  wall.rotation = glm::vec3(0.0f, 1.5707963f, 0.0f);
+  SceneObject front("front", "resources/models/Cube/CubeNoTexture.obj");
+  front.offset = glm::vec3(5.0f, -0.5f, 0.5f);
+  SceneObject behind("behind", "resources/models/Cube/CubeNoTexture.obj");
+  behind.offset = glm::vec3(18.0f, 0.0f, 0.0f);
+  renderer->cameraRotation = glm::vec3(0.0f, 1.5707963f, 0.0f);
+
+  vector<unsigned char> pixels[2];
+  FrameStats stats[2];
+  vector<SceneObject*> occluders = {&wall};
+  renderer->swapBuffers();
+  for (int idx = 0; idx < 2; ++idx) {
+    renderer->clearScreen();
+    if (idx == 1) renderer->renderOccluders(occluders);
+    renderer->render(wall, glm::vec4(0.5f, 0.5f, 0.5f, 1.0f));
+    renderer->render(behind, glm::vec4(1.0f, 0.0f, 0.0f, 1.0f));
+    renderer->render(front, glm::vec4(0.0f, 1.0f, 0.0f, 1.0f));
+    renderer->readPixels(pixels[idx]);
+    renderer->swapBuffers();
+    stats[idx] = renderer->getFrameStats();
+  }
+  renderer->cameraRotation = glm::vec3(0.0f);
+
+  // The cube behind the wall is not drawn, which makes no difference.
+  EXPECT_EQ(0U, stats[0].numObjectsCulled);
+  EXPECT_EQ(3U, stats[0].numDrawCalls);
+  EXPECT_EQ(1U, stats[1].numObjectsCulled);
+  EXPECT_EQ(2U, stats[1].numDrawCalls);
+  EXPECT_GT(stats[1].occlusionMilliseconds, 0.0);
+  EXPECT_TRUE(pixels[0] == pixels[1]);
+
+  // The cube in front of the wall is drawn in the middle of the screen.
+  size_t centre = 4 * (240 * 640 + 320);
+  EXPECT_EQ(0, pixels[1][centre]);
+  EXPECT_GT(pixels[1][centre + 1], 0);
+
+  // Culling stops when the buffers are swapped.
+  renderer->clearScreen();
+  renderer->render(behind, glm::vec4(1.0f, 0.0f, 0.0f, 1.0f));
+  renderer->swapBuffers();
+  EXPECT_EQ(0U, renderer->getFrameStats().numObjectsCulled);
 }
 
 TEST(TokenTest, GetFourTokens) {